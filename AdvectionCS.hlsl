@@ -1,35 +1,64 @@
-#include "FluidSimHelpers.hlsli"
+#include "BrickHelpers.hlsli"
+#include "ObstacleHelpers.hlsli"
+
+// Semi-lagrangian advection of up to MAX_ADVECTED_FIELDS fields at once,
+// every field is sampled at the same backtraced position
 
 // Defines the input to this compute shader
 // used to handle globabl variables
 cbuffer ExternalData : register(b0) {
 	float deltaTime;
-	int gridRes; 
+	int3 gridRes; 
+	int sparseBricks;
+	int3 bricksPerAxis;
+	int fieldCount;
+	float4 solidValues[MAX_ADVECTED_FIELDS]; //what cells inside obstacles hold
 };
 
-RWTexture3D<float4> UavOutputMap : register (u0);
-Texture3D<float4> InputMap : register (t0);
-Texture3D<float4> VelocityMap : register (t1);
-//Texture3D<float4> DensityMap : register (t2);
+Texture3D<float4> VelocityMap : register (t0);
+Texture3D<float4> InputMap0 : register (t1);
+Texture3D<float4> InputMap1 : register (t2);
+Texture3D<float4> InputMap2 : register (t3);
+Texture3D<float4> InputMap3 : register (t4);
+RWTexture3D<float4> UavOutputMap0 : register (u0);
+RWTexture3D<float4> UavOutputMap1 : register (u1);
+RWTexture3D<float4> UavOutputMap2 : register (u2);
+RWTexture3D<float4> UavOutputMap3 : register (u3);
 
 SamplerState LinearClampSampler : register(s0);
 
+void AdvectField(Texture3D<float4> inputMap, RWTexture3D<float4> outputMap, uint3 cell, float3 posUVW, float4 solidValue, bool solid) {
+	//sample with uvw coords, texel coords would clamp to the far corner
+	outputMap[cell] = solid ? solidValue : inputMap.SampleLevel(LinearClampSampler, posUVW, 0.0f);
+}
+
 [numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
-void main( uint3 DTid : SV_DispatchThreadID )
+void main(uint3 dispatchID : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
+	uint3 DTid = GetSimCellIndex(dispatchID, groupID, groupThreadID, sparseBricks, bricksPerAxis);
+
 	//we're using center of each cell for sampling
-	//get coord from thread id 
-	//float3 coords = (float3(DTid)+0.5f) * invFluidSimGridRes;
 	float3 pos = float3(DTid);
 
 	//move 'backwards' equal to the velocity map at this point
 	//to get prev pos of whats coming to this point
-	//float3 pos = coords - deltaTime * VelocityMap.SampleLevel(BilinearSampler, coords, 0.0f);
 	pos = pos - deltaTime * VelocityMap[DTid].xyz;
-
-	//pos = (pos + 0.5f) * invFluidSimGridRes;
 	float3 posUVW = PixelIndexToUVW(pos, gridRes);
+	bool solid = IsSolid(DTid, gridRes);
 
-	//write to output buffer which will be next frames data
-	UavOutputMap[DTid] = InputMap.SampleLevel(LinearClampSampler, pos, 0.0f);
+	//write to output buffers which will be next frames data,
+	//field count comes from the cbuffer so every thread takes the same branches
+	AdvectField(InputMap0, UavOutputMap0, DTid, posUVW, solidValues[0], solid);
+	[branch]
+	if (fieldCount > 1) {
+		AdvectField(InputMap1, UavOutputMap1, DTid, posUVW, solidValues[1], solid);
+	}
+	[branch]
+	if (fieldCount > 2) {
+		AdvectField(InputMap2, UavOutputMap2, DTid, posUVW, solidValues[2], solid);
+	}
+	[branch]
+	if (fieldCount > 3) {
+		AdvectField(InputMap3, UavOutputMap3, DTid, posUVW, solidValues[3], solid);
+	}
 }
\ No newline at end of file
@@ -0,0 +1,69 @@
+#include "BilateralUpsample.h"
+
+#include <algorithm>
+#include <cmath>
+
+// View space distance from post projection z, z = b / (d - a)
+static float LinearDepth(float depth, float depthA, float depthB)
+{
+	return depthB / (depth - depthA);
+}
+
+void DownsampleDepthMin(const float* depth, int width, int height, int scale, std::vector<float>& out)
+{
+	int lowWidth = (width + scale - 1) / scale;
+	int lowHeight = (height + scale - 1) / scale;
+	out.resize((size_t)lowWidth * lowHeight);
+
+	for (int y = 0; y < lowHeight; y++) {
+		for (int x = 0; x < lowWidth; x++) {
+			float nearest = 1.0f;
+			for (int by = y * scale; by < std::min((y + 1) * scale, height); by++) {
+				for (int bx = x * scale; bx < std::min((x + 1) * scale, width); bx++) {
+					nearest = std::min(nearest, depth[(size_t)by * width + bx]);
+				}
+			}
+			out[(size_t)y * lowWidth + x] = nearest;
+		}
+	}
+}
+
+void JointBilateralUpsample(const float* lowColor, const float* lowDepth, int scale,
+	const float* depth, int width, int height, float depthA, float depthB, float* out)
+{
+	int lowWidth = (width + scale - 1) / scale;
+	int lowHeight = (height + scale - 1) / scale;
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			//low resolution texel centers sit at scale * (i + 0.5)
+			float lowX = (x + 0.5f) / scale - 0.5f;
+			float lowY = (y + 0.5f) / scale - 0.5f;
+			int x0 = (int)std::floor(lowX);
+			int y0 = (int)std::floor(lowY);
+			float tx = lowX - x0;
+			float ty = lowY - y0;
+
+			float z = LinearDepth(depth[(size_t)y * width + x], depthA, depthB);
+			float color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			float totalWeight = 0.0f;
+			for (int tap = 0; tap < 4; tap++) {
+				int sx = std::min(std::max(x0 + (tap & 1), 0), lowWidth - 1);
+				int sy = std::min(std::max(y0 + (tap >> 1), 0), lowHeight - 1);
+				size_t low = (size_t)sy * lowWidth + sx;
+
+				float bilinear = (tap & 1 ? tx : 1.0f - tx) * (tap & 2 ? ty : 1.0f - ty);
+				float difference = std::abs(LinearDepth(lowDepth[low], depthA, depthB) - z) / z;
+				float weight = bilinear / (UPSAMPLE_DEPTH_EPSILON + difference);
+				for (int c = 0; c < 4; c++) {
+					color[c] += lowColor[low * 4 + c] * weight;
+				}
+				totalWeight += weight;
+			}
+
+			for (int c = 0; c < 4; c++) {
+				out[((size_t)y * width + x) * 4 + c] = totalWeight > 0.0f ? color[c] / totalWeight : 0.0f;
+			}
+		}
+	}
+}
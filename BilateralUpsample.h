@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+// Cpu reference of how RenderFluid's reduced resolution volume pass gets back
+// to full size, the same math as VolumeDepthDownsamplePS and VolumeUpsamplePS
+// so the quality of either can be checked without a gpu. Depths are what
+// SCENE_DEPTH holds, post projection z with 1 where nothing was drawn.
+
+//relative depth difference the upsample's weights fall off over, needs to match VolumeUpsamplePS
+#define UPSAMPLE_DEPTH_EPSILON 0.01f
+
+/// <summary>
+/// The nearest depth in every scale * scale block, so the low resolution
+/// raymarch stops at the closest surface and smoke never covers anything
+/// that's in front of it. out is ceil(width / scale) by ceil(height / scale).
+/// </summary>
+void DownsampleDepthMin(const float* depth, int width, int height, int scale, std::vector<float>& out);
+
+/// <summary>
+/// Upsamples rgba lowColor (low resolution is ceil(width / scale) across) to
+/// width by height. Each pixel blends its four nearest low resolution texels
+/// by bilinear weight times how close their depth is to its own, so smoke
+/// doesn't bleed across the edges of what's in front of it. depthA and
+/// depthB are the projection's _33 and _43 to linearize depth with.
+/// </summary>
+void JointBilateralUpsample(const float* lowColor, const float* lowDepth, int scale,
+	const float* depth, int width, int height, float depthA, float depthB, float* out);
@@ -0,0 +1,133 @@
+#include "BlueNoise.h"
+#include "CounterRandom.h"
+
+#include <algorithm>
+#include <cmath>
+
+//spread of the filter that finds clusters and voids, 1.5 as in the paper
+#define BLUE_NOISE_SIGMA 1.5f
+
+// Energy of each pixel from the gaussian around every set one, kept up to date as pixels flip
+class NoiseEnergy
+{
+public:
+	NoiseEnergy(int size) : size(size), energy((size_t)size * size, 0.0f), kernel((size_t)size * size)
+	{
+		//the gaussian by wrapped offset, so updates are one pass with no exp
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				int dx = x < size / 2 ? x : x - size;
+				int dy = y < size / 2 ? y : y - size;
+				kernel[(size_t)y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+			}
+		}
+	}
+
+	void Add(int pixel, float sign)
+	{
+		int px = pixel % size;
+		int py = pixel / size;
+		for (int y = 0; y < size; y++) {
+			int ky = (y - py + size) % size;
+			for (int x = 0; x < size; x++) {
+				int kx = (x - px + size) % size;
+				energy[(size_t)y * size + x] += sign * kernel[(size_t)ky * size + kx];
+			}
+		}
+	}
+
+	// Set pixel with the most energy, or unset pixel with the least, -1 if there are none
+	int Find(const std::vector<uint8_t>& pattern, bool set)
+	{
+		int best = -1;
+		for (int i = 0; i < (int)pattern.size(); i++) {
+			if ((pattern[i] != 0) != set) {
+				continue;
+			}
+			if (best < 0 || (set ? energy[i] > energy[best] : energy[i] < energy[best])) {
+				best = i;
+			}
+		}
+		return best;
+	}
+
+private:
+	int size;
+	std::vector<float> energy;
+	std::vector<float> kernel;
+};
+
+void GenerateBlueNoise(int size, uint64_t seed, std::vector<float>& out)
+{
+	out.clear();
+	if (size <= 0) {
+		return;
+	}
+	int count = size * size;
+	std::vector<uint8_t> pattern(count, 0);
+	std::vector<int> ranks(count, 0);
+
+	//start from a tenth of the pixels set at random
+	CounterRandom random(seed);
+	NoiseEnergy energy(size);
+	int initialCount = std::max(count / 10, 1);
+	for (int placed = 0; placed < initialCount;) {
+		int pixel = (int)(random.Next() % (uint32_t)count);
+		if (!pattern[pixel]) {
+			pattern[pixel] = 1;
+			energy.Add(pixel, 1.0f);
+			placed++;
+		}
+	}
+
+	//move the tightest cluster's pixel into the biggest void until that's where it already is
+	while (true) {
+		//there's always a set pixel, and the one just cleared is free
+		int cluster = energy.Find(pattern, true);
+		if (cluster < 0) {
+			return;
+		}
+		pattern[cluster] = 0;
+		energy.Add(cluster, -1.0f);
+		int gap = energy.Find(pattern, false);
+		if (gap < 0) {
+			return;
+		}
+		pattern[gap] = 1;
+		energy.Add(gap, 1.0f);
+		if (gap == cluster) {
+			break;
+		}
+	}
+	std::vector<uint8_t> initialPattern = pattern;
+	NoiseEnergy initialEnergy = energy;
+
+	//rank the starting pixels by taking clusters away one at a time
+	for (int rank = initialCount - 1; rank >= 0; rank--) {
+		int cluster = energy.Find(pattern, true);
+		if (cluster < 0) {
+			return;
+		}
+		pattern[cluster] = 0;
+		energy.Add(cluster, -1.0f);
+		ranks[cluster] = rank;
+	}
+
+	//then the rest by filling voids one at a time
+	pattern = initialPattern;
+	energy = initialEnergy;
+	for (int rank = initialCount; rank < count; rank++) {
+		int gap = energy.Find(pattern, false);
+		if (gap < 0) {
+			return;
+		}
+		pattern[gap] = 1;
+		energy.Add(gap, 1.0f);
+		ranks[gap] = rank;
+	}
+
+	out.resize(count);
+	for (int i = 0; i < count; i++) {
+		out[i] = (ranks[i] + 0.5f) / count;
+	}
+}
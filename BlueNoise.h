@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Tileable blue noise, thresholds with no low frequency content so
+// neighbouring pixels never get similar values. Used to jitter where rays
+// start sampling, which turns the banding from too few samples into fine
+// grain. Built with Ulichney's void and cluster method.
+
+/// <summary>
+/// Fills out with size * size values in [0, 1) (x fastest) that wrap
+/// around at the edges, every value appears once. The same seed always
+/// gives the same texture.
+/// </summary>
+void GenerateBlueNoise(int size, uint64_t seed, std::vector<float>& out);
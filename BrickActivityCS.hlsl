@@ -0,0 +1,59 @@
+#include "BrickHelpers.hlsli"
+#include "ObstacleHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	float densityThreshold;
+	float velocityThreshold;
+	float temperatureThreshold;
+	float ambientTemperature;
+
+	float3 injectPosition; //uv coords
+	float injectRadius; //uv coords
+
+	int3 gridRes;
+	int3 bricksPerAxis;
+};
+
+RWStructuredBuffer<uint> BrickFlags : register (u0);
+Texture3D<float4> DensityMap : register (t0);
+Texture3D<float4> VelocityMap : register (t1);
+Texture3D<float4> TemperatureMap : register (t2);
+
+groupshared uint brickHasContent;
+
+//one group per brick, flags any brick with smoke, motion or heat in it,
+//or a moving obstacle that has to push the air around it
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+	if (groupIndex == 0) {
+		//the emitter counts as content so bricks wake up before smoke arrives
+		//closest point of the brick's cell centers to the emitter, in texel space
+		float3 emitterCenter = injectPosition * gridRes - 0.5f;
+		float3 brickMin = float3(groupID * BRICK_SIZE);
+		float3 brickMax = min(brickMin + BRICK_SIZE, gridRes) - 1;
+		float3 offset = clamp(emitterCenter, brickMin, brickMax) - emitterCenter;
+		float emitterRadius = injectRadius * GetLargestAxis(gridRes);
+		brickHasContent = injectRadius > 0 && dot(offset, offset) < emitterRadius * emitterRadius;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	//out of range loads come back as zero, which never passes the thresholds
+	float density = DensityMap[DTid].a;
+	float3 velocity = VelocityMap[DTid].xyz;
+	float temperature = TemperatureMap[DTid].r;
+	bool inGrid = all(DTid < (uint3)gridRes);
+	bool movingSolid = IsSolid(DTid, gridRes) && any(ObstacleVelocityMap[DTid].xyz != 0);
+
+	if (inGrid && (density > densityThreshold ||
+		dot(velocity, velocity) > velocityThreshold * velocityThreshold ||
+		abs(temperature - ambientTemperature) > temperatureThreshold ||
+		movingSolid)) {
+		InterlockedOr(brickHasContent, 1);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if (groupIndex == 0) {
+		BrickFlags[GetBrickIndex(groupID, bricksPerAxis)] = brickHasContent;
+	}
+}
\ No newline at end of file
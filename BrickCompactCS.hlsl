@@ -0,0 +1,49 @@
+#include "BrickHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 bricksPerAxis;
+};
+
+//DispatchIndirect args, [0] groups for ActiveBricks, [3] groups for ClearBricks
+RWBuffer<uint> DispatchArgs : register (u0);
+RWStructuredBuffer<uint> ActiveBricksOut : register (u1);
+RWStructuredBuffer<uint> ClearBricks : register (u2);
+//whether each brick was active last step
+RWStructuredBuffer<uint> BrickState : register (u3);
+StructuredBuffer<uint> BrickFlags : register (t0);
+
+//one thread per brick, a brick runs if it or any neighbour has content
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	if (any(DTid >= (uint3)bricksPerAxis)) {
+		return;
+	}
+
+	int3 lower = max((int3)DTid - 1, 0);
+	int3 upper = min((int3)DTid + 1, bricksPerAxis - 1);
+
+	uint active = 0;
+	for (int z = lower.z; z <= upper.z; z++) {
+		for (int y = lower.y; y <= upper.y; y++) {
+			for (int x = lower.x; x <= upper.x; x++) {
+				active |= BrickFlags[GetBrickIndex(uint3(x, y, z), bricksPerAxis)];
+			}
+		}
+	}
+
+	uint brick = GetBrickIndex(DTid, bricksPerAxis);
+	uint wasActive = BrickState[brick];
+	BrickState[brick] = active;
+
+	uint slot;
+	if (active) {
+		InterlockedAdd(DispatchArgs[0], 1, slot);
+		ActiveBricksOut[slot] = brick;
+	}
+	else if (wasActive) {
+		//nothing writes to it from now on, so it has to be emptied once
+		InterlockedAdd(DispatchArgs[3], 1, slot);
+		ClearBricks[slot] = brick;
+	}
+}
\ No newline at end of file
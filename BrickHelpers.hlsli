@@ -0,0 +1,29 @@
+#ifndef BRICK_HELPER
+#define BRICK_HELPER
+
+#include "FluidSimHelpers.hlsli"
+
+//bricks are one thread group across, see BrickMask.h
+#define BRICK_SIZE GROUP_SIZE
+
+//compacted list of bricks to run, sparse dispatches use one group per entry
+StructuredBuffer<uint> ActiveBricks : register(t8);
+
+uint3 GetBrickCoords(uint brick, int3 bricksPerAxis) {
+	return uint3(brick % bricksPerAxis.x, (brick / bricksPerAxis.x) % bricksPerAxis.y, brick / (bricksPerAxis.x * bricksPerAxis.y));
+}
+
+uint GetBrickIndex(uint3 brickCoords, int3 bricksPerAxis) {
+	return (brickCoords.z * bricksPerAxis.y + brickCoords.y) * bricksPerAxis.x + brickCoords.x;
+}
+
+//cell a thread works on, either straight from the dispatch or from
+//the active brick its group was given
+uint3 GetSimCellIndex(uint3 DTid, uint3 groupID, uint3 groupThreadID, int sparseBricks, int3 bricksPerAxis) {
+	if (sparseBricks == 0) {
+		return DTid;
+	}
+	return GetBrickCoords(ActiveBricks[groupID.x], bricksPerAxis) * BRICK_SIZE + groupThreadID;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "BrickMask.h"
+
+#include <algorithm>
+
+BrickMask::BrickMask(int resX, int resY, int resZ)
+{
+	res[0] = resX;
+	res[1] = resY;
+	res[2] = resZ;
+	for (int axis = 0; axis < 3; axis++) {
+		bricks[axis] = (res[axis] + BRICK_SIZE - 1) / BRICK_SIZE;
+	}
+	brickCount = bricks[0] * bricks[1] * bricks[2];
+
+	active.assign(brickCount, 0);
+}
+
+void BrickMask::Reset()
+{
+	std::fill(active.begin(), active.end(), 1);
+}
+
+void BrickMask::Update(const std::vector<unsigned char>& hasContent)
+{
+	activeBricks.clear();
+	deactivatedBricks.clear();
+
+	for (int bz = 0; bz < bricks[2]; bz++) {
+		for (int by = 0; by < bricks[1]; by++) {
+			for (int bx = 0; bx < bricks[0]; bx++) {
+				//dilate by one brick so there's always room to flow into
+				bool nowActive = false;
+				for (int dz = -1; dz <= 1 && !nowActive; dz++) {
+					for (int dy = -1; dy <= 1 && !nowActive; dy++) {
+						for (int dx = -1; dx <= 1 && !nowActive; dx++) {
+							int nx = bx + dx;
+							int ny = by + dy;
+							int nz = bz + dz;
+							if (nx < 0 || ny < 0 || nz < 0 || nx >= bricks[0] || ny >= bricks[1] || nz >= bricks[2]) {
+								continue;
+							}
+							nowActive = hasContent[(nz * bricks[1] + ny) * bricks[0] + nx] != 0;
+						}
+					}
+				}
+
+				int brick = (bz * bricks[1] + by) * bricks[0] + bx;
+				if (nowActive) {
+					activeBricks.push_back(brick);
+				}
+				else if (active[brick]) {
+					deactivatedBricks.push_back(brick);
+				}
+				active[brick] = nowActive;
+			}
+		}
+	}
+}
+
+void BrickMask::GetBrickBounds(int brick, int begin[3], int end[3])
+{
+	int coords[3] = {
+		brick % bricks[0],
+		(brick / bricks[0]) % bricks[1],
+		brick / (bricks[0] * bricks[1])
+	};
+
+	for (int axis = 0; axis < 3; axis++) {
+		begin[axis] = coords[axis] * BRICK_SIZE;
+		end[axis] = std::min(begin[axis] + BRICK_SIZE, res[axis]);
+	}
+}
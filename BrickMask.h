@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+//edge length of a brick, matches GROUP_SIZE in the shaders
+#define BRICK_SIZE 8
+
+// Splits a grid into BRICK_SIZE^3 bricks and tracks which ones hold
+// anything worth simulating. Active bricks are grown by one brick of
+// halo so smoke can move into its neighbours, then compacted into a
+// list the sim stages iterate over.
+class BrickMask
+{
+public:
+	BrickMask(int resX, int resY, int resZ);
+
+	int GetBrickCount() { return brickCount; }
+	int GetActiveBrickCount() { return (int)activeBricks.size(); }
+
+	// Marks every brick as active, so the next Update
+	// reports every empty brick as newly deactivated
+	void Reset();
+
+	/// <summary>
+	/// Rebuilds the active list from per brick content flags. A brick is
+	/// active if it or any of its 26 neighbours has content, and bricks
+	/// that were active last time but aren't now go in the deactivated list.
+	/// </summary>
+	void Update(const std::vector<unsigned char>& hasContent);
+
+	const std::vector<int>& GetActiveBricks() { return activeBricks; }
+	const std::vector<int>& GetDeactivatedBricks() { return deactivatedBricks; }
+
+	// Cell range [begin, end) a brick covers, bricks on the far edges may be partial
+	void GetBrickBounds(int brick, int begin[3], int end[3]);
+
+private:
+	int res[3];
+	int bricks[3];
+	int brickCount;
+
+	std::vector<unsigned char> active;
+	std::vector<int> activeBricks;
+	std::vector<int> deactivatedBricks;
+};
@@ -1,10 +1,15 @@
-#include "FluidSimHelpers.hlsli"
+#include "BrickHelpers.hlsli"
+#include "ObstacleHelpers.hlsli"
 
 cbuffer ExternalData : register(b0)
 {
 	float densityWeight;
 	float temperatureBuoyancy;
 	float ambientTemperature;
+	float vorticityEpsilon;
+	int3 gridRes;
+	int sparseBricks;
+	int3 bricksPerAxis;
 }
 
 Texture3D VelocityMap : register(t0);
@@ -12,11 +17,81 @@ Texture3D DensityMap : register(t1);
 Texture3D TemperatureMap : register(t2);
 RWTexture3D<float4> VelocityOut : register(u0);
 
+//vorticity confinement is fused in here so it doesn't cost another pass over the grid,
+//the group's velocity with a 2 cell border covers the curl of the group plus a 1 cell border
+#define VELOCITY_TILE (GROUP_SIZE + 4)
+#define CURL_TILE (GROUP_SIZE + 2)
+
+groupshared float3 tileVelocity[VELOCITY_TILE * VELOCITY_TILE * VELOCITY_TILE];
+groupshared float tileCurlLength[CURL_TILE * CURL_TILE * CURL_TILE];
+
+int3 TileCoords(uint i, int tileSize) {
+	return int3(i % tileSize, (i / tileSize) % tileSize, i / (tileSize * tileSize));
+}
+
+int TileIndex(int3 local, int tileSize) {
+	return (local.z * tileSize + local.y) * tileSize + local.x;
+}
+
+//central difference curl at a cell, neighbours clamped at the walls
+float3 GetCurl(int3 cell, int3 tileOrigin) {
+	float3 left = tileVelocity[TileIndex(GetLeftIndex(cell) - tileOrigin, VELOCITY_TILE)];
+	float3 right = tileVelocity[TileIndex(GetRightIndex(cell, gridRes) - tileOrigin, VELOCITY_TILE)];
+	float3 bottom = tileVelocity[TileIndex(GetBottomIndex(cell) - tileOrigin, VELOCITY_TILE)];
+	float3 top = tileVelocity[TileIndex(GetTopIndex(cell, gridRes) - tileOrigin, VELOCITY_TILE)];
+	float3 back = tileVelocity[TileIndex(GetBackIndex(cell) - tileOrigin, VELOCITY_TILE)];
+	float3 front = tileVelocity[TileIndex(GetFrontIndex(cell, gridRes) - tileOrigin, VELOCITY_TILE)];
+
+	return 0.5f * float3(
+		(top.z - bottom.z) - (front.y - back.y),
+		(front.x - back.x) - (right.z - left.z),
+		(right.y - left.y) - (top.x - bottom.x));
+}
+
+float GetCurlLength(int3 cell, int3 curlOrigin) {
+	return tileCurlLength[TileIndex(cell - curlOrigin, CURL_TILE)];
+}
+
 [numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
-void main(uint3 DTid : SV_DispatchThreadID)
+void main(uint3 dispatchID : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
-	//check for obstacles and exit early if so
-	//TODO
+	uint3 DTid = GetSimCellIndex(dispatchID, groupID, groupThreadID, sparseBricks, bricksPerAxis);
+	int3 cell = (int3)DTid;
+
+	float3 confinementForce = float3(0, 0, 0);
+
+	//epsilon comes from the cbuffer, so the whole group takes the same branch
+	[branch]
+	if (vorticityEpsilon > 0.0f) {
+		uint groupThread = (groupThreadID.z * GROUP_SIZE + groupThreadID.y) * GROUP_SIZE + groupThreadID.x;
+		int3 groupOrigin = cell - (int3)groupThreadID;
+		int3 tileOrigin = groupOrigin - 2;
+		int3 curlOrigin = groupOrigin - 1;
+
+		//gather once, clamped to the grid like the neighbour lookups
+		for (uint i = groupThread; i < VELOCITY_TILE * VELOCITY_TILE * VELOCITY_TILE; i += GROUP_SIZE * GROUP_SIZE * GROUP_SIZE) {
+			tileVelocity[i] = VelocityMap[clamp(tileOrigin + TileCoords(i, VELOCITY_TILE), 0, gridRes - 1)].xyz;
+		}
+		GroupMemoryBarrierWithGroupSync();
+
+		for (uint j = groupThread; j < CURL_TILE * CURL_TILE * CURL_TILE; j += GROUP_SIZE * GROUP_SIZE * GROUP_SIZE) {
+			int3 curlCell = clamp(curlOrigin + TileCoords(j, CURL_TILE), 0, gridRes - 1);
+			tileCurlLength[j] = length(GetCurl(curlCell, tileOrigin));
+		}
+		GroupMemoryBarrierWithGroupSync();
+
+		//the curl length grows towards a vortex's center
+		float3 gradient = 0.5f * float3(
+			GetCurlLength(GetRightIndex(cell, gridRes), curlOrigin) - GetCurlLength(GetLeftIndex(cell), curlOrigin),
+			GetCurlLength(GetTopIndex(cell, gridRes), curlOrigin) - GetCurlLength(GetBottomIndex(cell), curlOrigin),
+			GetCurlLength(GetFrontIndex(cell, gridRes), curlOrigin) - GetCurlLength(GetBackIndex(cell), curlOrigin));
+		float gradientLength = length(gradient);
+
+		//push along n x curl, spinning the vortex back up
+		if (gradientLength > 1e-6f) {
+			confinementForce = vorticityEpsilon * cross(gradient / gradientLength, GetCurl(cell, tileOrigin));
+		}
+	}
 
 	//get temp
 	float thisTemp = TemperatureMap[DTid].r;
@@ -26,6 +101,11 @@ void main(uint3 DTid : SV_DispatchThreadID)
 	float3 buoyancyForce = float3(0, 1, 0) *
 		(-densityWeight * density + temperatureBuoyancy * (thisTemp - ambientTemperature));
 	
-	//add bouyancy force to cur velocity
-	VelocityOut[DTid] = float4(VelocityMap[DTid].xyz + buoyancyForce, 1);
+	//add bouyancy and confinement force to cur velocity, obstacles just move with
+	//their solid. checked at the end since the whole group has to reach the barriers
+	float3 velocity = VelocityMap[DTid].xyz + buoyancyForce + confinementForce;
+	if (IsSolid(cell, gridRes)) {
+		velocity = ObstacleVelocityMap[cell].xyz;
+	}
+	VelocityOut[DTid] = float4(velocity, 1);
 }
\ No newline at end of file
@@ -0,0 +1,32 @@
+#include "BrickHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	float ambientTemperature;
+	int3 bricksPerAxis;
+};
+
+StructuredBuffer<uint> ClearBricks : register (t0);
+RWTexture3D<float4> VelocityOut0 : register (u0);
+RWTexture3D<float4> VelocityOut1 : register (u1);
+RWTexture3D<float4> DensityOut0 : register (u2);
+RWTexture3D<float4> DensityOut1 : register (u3);
+RWTexture3D<float4> TemperatureOut0 : register (u4);
+RWTexture3D<float4> TemperatureOut1 : register (u5);
+RWTexture3D<float4> DivergenceOut : register (u6);
+
+//one group per newly inactive brick, both halves of each ping-pong pair are
+//cleared since sparse stages won't overwrite either of them
+//pressure is left alone, it's still solved over the whole grid
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
+{
+	uint3 cell = GetBrickCoords(ClearBricks[groupID.x], bricksPerAxis) * BRICK_SIZE + groupThreadID;
+
+	VelocityOut0[cell] = 0;
+	VelocityOut1[cell] = 0;
+	DensityOut0[cell] = 0;
+	DensityOut1[cell] = 0;
+	TemperatureOut0[cell] = ambientTemperature;
+	TemperatureOut1[cell] = ambientTemperature;
+	DivergenceOut[cell] = 0;
+}
\ No newline at end of file
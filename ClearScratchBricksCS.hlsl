@@ -0,0 +1,27 @@
+#include "BrickHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 bricksPerAxis;
+	float4 clearValues[MAX_ADVECTED_FIELDS]; //what each field holds where nothing is
+};
+
+StructuredBuffer<uint> ClearBricks : register (t0);
+RWTexture3D<float4> ScratchOut0 : register (u0);
+RWTexture3D<float4> ScratchOut1 : register (u1);
+RWTexture3D<float4> ScratchOut2 : register (u2);
+RWTexture3D<float4> ScratchOut3 : register (u3);
+
+//same as ClearBricksCS for the MacCormack forward results, which the
+//backward trace samples across brick edges. A separate pass since all of
+//them together would be more uavs than a compute shader gets
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
+{
+	uint3 cell = GetBrickCoords(ClearBricks[groupID.x], bricksPerAxis) * BRICK_SIZE + groupThreadID;
+
+	//unbound slots drop the write
+	ScratchOut0[cell] = clearValues[0];
+	ScratchOut1[cell] = clearValues[1];
+	ScratchOut2[cell] = clearValues[2];
+	ScratchOut3[cell] = clearValues[3];
+}
\ No newline at end of file
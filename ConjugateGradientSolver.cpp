@@ -0,0 +1,326 @@
+#include "ConjugateGradientSolver.h"
+#include "FluidSimHelpers.h"
+
+#include <algorithm>
+#include <cmath>
+
+ConjugateGradientSolver::ConjugateGradientSolver(int resX, int resY, int resZ, ThreadPool* pool)
+{
+	this->resX = resX;
+	this->resY = resY;
+	this->resZ = resZ;
+	this->pool = pool;
+	cellCount = resX * resY * resZ;
+
+	rhs.assign(cellCount, 0.0f);
+	residual.assign(cellCount, 0.0f);
+	preconditioned.assign(cellCount, 0.0f);
+	direction.assign(cellCount, 0.0f);
+	product.assign(cellCount, 0.0f);
+	micScratch.assign(cellCount, 0.0f);
+	micPrecon.assign(cellCount, 0.0f);
+
+	SetSolidCells(nullptr);
+}
+
+void ConjugateGradientSolver::SetSolidCells(const unsigned char* solid)
+{
+	faces.resize(cellCount);
+	std::vector<int> partials(resZ, 0);
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			for (int y = 0; y < resY; y++) {
+				for (int x = 0; x < resX; x++) {
+					unsigned char open = GetOpenFaces(solid, x, y, z, resX, resY, resZ);
+					faces[GridIndex(x, y, z, resX, resY)] = open;
+					partials[z] += open != 0;
+				}
+			}
+		}
+	});
+
+	fluidCount = 0;
+	for (int partial : partials) {
+		fluidCount += partial;
+	}
+
+	BuildMIC0();
+}
+
+int ConjugateGradientSolver::Solve(float* pressure, const float* divergence, PcgPreconditioner preconditioner, int maxIterations, float tolerance)
+{
+	const int sliceSize = resX * resY;
+
+	//with walls on every side the system only has a solution when the
+	//divergence sums to zero, so take out the mean before solving.
+	//cells with no open faces aren't part of the system
+	double divergenceSum = SumOverSlices([&](int z) {
+		double sum = 0.0;
+		for (int i = z * sliceSize; i < (z + 1) * sliceSize; i++) {
+			if (faces[i]) {
+				sum += divergence[i];
+			}
+		}
+		return sum;
+	});
+	float mean = fluidCount > 0 ? (float)(divergenceSum / fluidCount) : 0.0f;
+
+	//cg needs a positive definite matrix, so solve the negated system
+	double rhsNormSquared = SumOverSlices([&](int z) {
+		double sum = 0.0;
+		for (int i = z * sliceSize; i < (z + 1) * sliceSize; i++) {
+			rhs[i] = faces[i] ? mean - divergence[i] : 0.0f;
+			if (!faces[i]) {
+				pressure[i] = 0.0f;
+			}
+			sum += (double)rhs[i] * rhs[i];
+		}
+		return sum;
+	});
+
+	double rhsNorm = std::sqrt(rhsNormSquared);
+	if (rhsNorm <= 0.0) {
+		lastResidual = 0.0f;
+		return 0;
+	}
+
+	//r = b - A * x for the starting guess
+	ApplyOperator(pressure, product.data());
+	double residualNormSquared = SumOverSlices([&](int z) {
+		double sum = 0.0;
+		for (int i = z * sliceSize; i < (z + 1) * sliceSize; i++) {
+			residual[i] = rhs[i] - product[i];
+			sum += (double)residual[i] * residual[i];
+		}
+		return sum;
+	});
+	lastResidual = (float)(std::sqrt(residualNormSquared) / rhsNorm);
+
+	int iterations = 0;
+	if (lastResidual > tolerance) {
+		double rz = ApplyPreconditioner(preconditioner);
+		std::copy(preconditioned.begin(), preconditioned.end(), direction.begin());
+
+		while (iterations < maxIterations) {
+			double dq = ApplyOperator(direction.data(), product.data());
+			if (dq <= 0.0) {
+				break;
+			}
+			float alpha = (float)(rz / dq);
+
+			//x += alpha * d and r -= alpha * q in one pass, measuring r as it goes
+			residualNormSquared = SumOverSlices([&](int z) {
+				double sum = 0.0;
+				for (int i = z * sliceSize; i < (z + 1) * sliceSize; i++) {
+					pressure[i] += alpha * direction[i];
+					residual[i] -= alpha * product[i];
+					sum += (double)residual[i] * residual[i];
+				}
+				return sum;
+			});
+			iterations++;
+
+			lastResidual = (float)(std::sqrt(residualNormSquared) / rhsNorm);
+			if (lastResidual <= tolerance) {
+				break;
+			}
+
+			double rzNew = ApplyPreconditioner(preconditioner);
+			float beta = (float)(rzNew / rz);
+			rz = rzNew;
+
+			pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+				for (int i = zBegin * sliceSize; i < zEnd * sliceSize; i++) {
+					direction[i] = preconditioned[i] + beta * direction[i];
+				}
+			});
+		}
+	}
+
+	//pressure is only defined up to a constant, keep it centered on zero
+	double pressureSum = SumOverSlices([&](int z) {
+		double sum = 0.0;
+		for (int i = z * sliceSize; i < (z + 1) * sliceSize; i++) {
+			sum += pressure[i];
+		}
+		return sum;
+	});
+	float pressureMean = fluidCount > 0 ? (float)(pressureSum / fluidCount) : 0.0f;
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		for (int i = zBegin * sliceSize; i < zEnd * sliceSize; i++) {
+			if (faces[i]) {
+				pressure[i] -= pressureMean;
+			}
+		}
+	});
+
+	return iterations;
+}
+
+double ConjugateGradientSolver::ApplyOperator(const float* in, float* out)
+{
+	const int strideZ = resX * resY;
+
+	return SumOverSlices([&](int z) {
+		double sum = 0.0;
+		for (int y = 0; y < resY; y++) {
+			for (int x = 0; x < resX; x++) {
+				int i = GridIndex(x, y, z, resX, resY);
+				unsigned char open = faces[i];
+				float center = in[i];
+
+				//clamped and solid neighbours cancel out, so only the open ones contribute
+				float value = 0.0f;
+				if (open & FACE_NEG_X) value += center - in[i - 1];
+				if (open & FACE_POS_X) value += center - in[i + 1];
+				if (open & FACE_NEG_Y) value += center - in[i - resX];
+				if (open & FACE_POS_Y) value += center - in[i + resX];
+				if (open & FACE_NEG_Z) value += center - in[i - strideZ];
+				if (open & FACE_POS_Z) value += center - in[i + strideZ];
+
+				out[i] = value;
+				sum += (double)center * value;
+			}
+		}
+		return sum;
+	});
+}
+
+double ConjugateGradientSolver::ApplyPreconditioner(PcgPreconditioner preconditioner)
+{
+	const int sliceSize = resX * resY;
+
+	if (preconditioner == PCG_PRECONDITIONER_MIC0) {
+		ApplyMIC0(residual.data(), preconditioned.data());
+
+		return SumOverSlices([&](int z) {
+			double sum = 0.0;
+			for (int i = z * sliceSize; i < (z + 1) * sliceSize; i++) {
+				sum += (double)residual[i] * preconditioned[i];
+			}
+			return sum;
+		});
+	}
+
+	//jacobi is just a divide by the diagonal, so it fuses with the dot product
+	return SumOverSlices([&](int z) {
+		double sum = 0.0;
+		for (int y = 0; y < resY; y++) {
+			for (int x = 0; x < resX; x++) {
+				int i = GridIndex(x, y, z, resX, resY);
+				int count = CountOpenFaces(faces[i]);
+				preconditioned[i] = count > 0 ? residual[i] / count : 0.0f;
+				sum += (double)residual[i] * preconditioned[i];
+			}
+		}
+		return sum;
+	});
+}
+
+void ConjugateGradientSolver::ApplyMIC0(const float* in, float* out)
+{
+	const int strideZ = resX * resY;
+	const float* precon = micPrecon.data();
+	float* q = micScratch.data();
+
+	//a cell only depends on its -x, -y and -z neighbours (or +x, +y, +z going
+	//back), so every x row with the same y + z can be solved at the same time
+	int wavefronts = resY + resZ - 1;
+
+	//forward substitution, L * q = in
+	for (int wave = 0; wave < wavefronts; wave++) {
+		int yBegin = std::max(0, wave - (resZ - 1));
+		int yEnd = std::min(wave, resY - 1) + 1;
+		pool->ParallelFor(yBegin, yEnd, [&](int rowBegin, int rowEnd) {
+			for (int y = rowBegin; y < rowEnd; y++) {
+				int z = wave - y;
+				for (int x = 0; x < resX; x++) {
+					int i = GridIndex(x, y, z, resX, resY);
+					unsigned char open = faces[i];
+					float t = in[i];
+					if (open & FACE_NEG_X) t += precon[i - 1] * q[i - 1];
+					if (open & FACE_NEG_Y) t += precon[i - resX] * q[i - resX];
+					if (open & FACE_NEG_Z) t += precon[i - strideZ] * q[i - strideZ];
+					q[i] = t * precon[i];
+				}
+			}
+		});
+	}
+
+	//backward substitution, L^T * out = q
+	for (int wave = wavefronts - 1; wave >= 0; wave--) {
+		int yBegin = std::max(0, wave - (resZ - 1));
+		int yEnd = std::min(wave, resY - 1) + 1;
+		pool->ParallelFor(yBegin, yEnd, [&](int rowBegin, int rowEnd) {
+			for (int y = rowBegin; y < rowEnd; y++) {
+				int z = wave - y;
+				for (int x = resX - 1; x >= 0; x--) {
+					int i = GridIndex(x, y, z, resX, resY);
+					unsigned char open = faces[i];
+					float t = q[i];
+					if (open & FACE_POS_X) t += precon[i] * out[i + 1];
+					if (open & FACE_POS_Y) t += precon[i] * out[i + resX];
+					if (open & FACE_POS_Z) t += precon[i] * out[i + strideZ];
+					out[i] = t * precon[i];
+				}
+			}
+		});
+	}
+}
+
+void ConjugateGradientSolver::BuildMIC0()
+{
+	const int strideZ = resX * resY;
+	float* precon = micPrecon.data();
+
+	//every off diagonal entry is -1, so a lower neighbour j takes away
+	//precon_j^2 plus tau * precon_j^2 for each of its other upper neighbours
+	for (int z = 0; z < resZ; z++) {
+		for (int y = 0; y < resY; y++) {
+			for (int x = 0; x < resX; x++) {
+				int i = GridIndex(x, y, z, resX, resY);
+				unsigned char open = faces[i];
+				float diagonal = (float)CountOpenFaces(open);
+
+				float e = diagonal;
+				if (open & FACE_NEG_X) {
+					float p = precon[i - 1];
+					int others = ((faces[i - 1] & FACE_POS_Y) != 0) + ((faces[i - 1] & FACE_POS_Z) != 0);
+					e -= p * p * (1.0f + micTuning * others);
+				}
+				if (open & FACE_NEG_Y) {
+					float p = precon[i - resX];
+					int others = ((faces[i - resX] & FACE_POS_X) != 0) + ((faces[i - resX] & FACE_POS_Z) != 0);
+					e -= p * p * (1.0f + micTuning * others);
+				}
+				if (open & FACE_NEG_Z) {
+					float p = precon[i - strideZ];
+					int others = ((faces[i - strideZ] & FACE_POS_X) != 0) + ((faces[i - strideZ] & FACE_POS_Y) != 0);
+					e -= p * p * (1.0f + micTuning * others);
+				}
+
+				//the closed box is singular, so the last cells can cancel out entirely
+				if (e < micSafety * diagonal) {
+					e = diagonal;
+				}
+				precon[i] = e > 0.0f ? 1.0f / std::sqrt(e) : 0.0f;
+			}
+		}
+	}
+}
+
+double ConjugateGradientSolver::SumOverSlices(const std::function<double(int)>& slice)
+{
+	std::vector<double> partials(resZ, 0.0);
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			partials[z] = slice(z);
+		}
+	});
+
+	double total = 0.0;
+	for (double partial : partials) {
+		total += partial;
+	}
+	return total;
+}
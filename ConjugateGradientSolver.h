@@ -0,0 +1,85 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "ThreadPool.h"
+
+//preconditioners the conjugate gradient solver can use
+enum PcgPreconditioner {
+	PCG_PRECONDITIONER_JACOBI,
+	PCG_PRECONDITIONER_MIC0
+};
+
+// Preconditioned conjugate gradient solver for the fluid sim's
+// pressure equation. Matrix-vector products, dot products and
+// axpy updates are split over z slices on the thread pool, and
+// reductions add per slice partials in order so results don't
+// depend on the thread count.
+class ConjugateGradientSolver
+{
+public:
+	ConjugateGradientSolver(int resX, int resY, int resZ, ThreadPool* pool);
+
+	/// <summary>
+	/// Solves sum(neighbours) - 6 * pressure = divergence with neighbours
+	/// clamped at the walls, the same system MultigridSolver handles.
+	/// pressure holds the starting guess and receives the result. Iterates
+	/// until the relative residual drops below tolerance or maxIterations
+	/// is hit, returning the number of iterations used.
+	/// </summary>
+	int Solve(float* pressure, const float* divergence, PcgPreconditioner preconditioner, int maxIterations, float tolerance);
+
+	/// <summary>
+	/// Marks cells (a byte per cell, non zero for solid) that are walls inside
+	/// the grid, or clears them with null. Solid cells drop out of the system
+	/// and come back as zero, and the MIC(0) factor is rebuilt to match.
+	/// </summary>
+	void SetSolidCells(const unsigned char* solid);
+
+	// Relative residual (|r| / |divergence|) after the last Solve
+	float GetLastResidual() { return lastResidual; }
+
+	//modified incomplete cholesky tuning, from Bridson's fluid notes
+	float micTuning = 0.97f;
+	float micSafety = 0.25f;
+
+private:
+	// Writes (-laplacian) * in to out and returns dot(in, out)
+	double ApplyOperator(const float* in, float* out);
+
+	// Writes the preconditioned residual to z and returns dot(r, z)
+	double ApplyPreconditioner(PcgPreconditioner preconditioner);
+
+	// Forward then backward substitution with the MIC(0) factor,
+	// swept over diagonal wavefronts of x rows so rows run in parallel
+	void ApplyMIC0(const float* in, float* out);
+
+	// Factor diagonal for the MIC(0) preconditioner, only rebuilt
+	// when the solid cells change the matrix
+	void BuildMIC0();
+
+	// Runs slice(z) for every z slice and adds the results in order
+	double SumOverSlices(const std::function<double(int)>& slice);
+
+	int resX;
+	int resY;
+	int resZ;
+	int cellCount;
+	//cells with at least one open face, the ones actually solved for
+	int fluidCount;
+
+	//open faces of each cell, see GetOpenFaces
+	std::vector<unsigned char> faces;
+
+	std::vector<float> rhs;
+	std::vector<float> residual;
+	std::vector<float> preconditioned;
+	std::vector<float> direction;
+	std::vector<float> product;
+	std::vector<float> micScratch;
+	std::vector<float> micPrecon;
+
+	ThreadPool* pool;
+	float lastResidual = 0.0f;
+};
@@ -0,0 +1,31 @@
+#include "CounterRandom.h"
+
+//splitmix64's finalizer, every input bit affects every output bit
+static uint64_t Mix(uint64_t value)
+{
+	value ^= value >> 30;
+	value *= 0xBF58476D1CE4E5B9ULL;
+	value ^= value >> 27;
+	value *= 0x94D049BB133111EBULL;
+	value ^= value >> 31;
+	return value;
+}
+
+void CounterRandom::SetSeed(uint64_t seed)
+{
+	this->seed = seed;
+	counter = 0;
+}
+
+uint32_t CounterRandom::At(uint64_t counter) const
+{
+	//the seed is mixed on its own first so nearby seeds don't give shifted copies of one sequence
+	return (uint32_t)(Mix(Mix(seed + 0x9E3779B97F4A7C15ULL) ^ counter) >> 32);
+}
+
+float CounterRandom::RangeAt(uint64_t counter, float min, float max) const
+{
+	//the top 24 bits fill a float's mantissa exactly
+	float unit = (At(counter) >> 8) * (1.0f / 16777216.0f);
+	return min + unit * (max - min);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+// Random numbers as a pure function of a seed and a counter, instead of
+// rand()'s hidden global state. The same seed always gives the same
+// sequence, any value can be regenerated from its counter without
+// replaying the ones before it, and separate generators never disturb
+// each other however their calls interleave.
+class CounterRandom
+{
+public:
+	CounterRandom(uint64_t seed = 0) : seed(seed) {}
+
+	// Restarts the sequence from a new seed
+	void SetSeed(uint64_t seed);
+	uint64_t GetSeed() { return seed; }
+	uint64_t GetCounter() { return counter; }
+
+	// The value for a counter, without moving on
+	uint32_t At(uint64_t counter) const;
+	// Uniform in [min, max)
+	float RangeAt(uint64_t counter, float min, float max) const;
+
+	// The value for the current counter, then moves on to the next
+	uint32_t Next() { return At(counter++); }
+	float Range(float min, float max) { return RangeAt(counter++, min, max); }
+
+private:
+	uint64_t seed;
+	uint64_t counter = 0;
+};
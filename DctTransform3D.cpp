@@ -0,0 +1,243 @@
+#include "DctTransform3D.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+//x columns gathered together for y and z lines, 16 floats is one 64 byte cache line
+static const int TILE_WIDTH = 16;
+
+DctTransform3D::DctTransform3D(int resX, int resY, int resZ, ThreadPool* pool)
+{
+	this->pool = pool;
+	res[0] = resX;
+	res[1] = resY;
+	res[2] = resZ;
+
+	for (int axis = 0; axis < 3; axis++) {
+		BuildPlan(plans[axis], res[axis]);
+	}
+}
+
+void DctTransform3D::Forward(float* data)
+{
+	for (int axis = 0; axis < 3; axis++) {
+		TransformAxis(data, axis, false);
+	}
+}
+
+void DctTransform3D::Inverse(float* data)
+{
+	for (int axis = 0; axis < 3; axis++) {
+		TransformAxis(data, axis, true);
+	}
+}
+
+void DctTransform3D::BuildPlan(AxisPlan& plan, int length)
+{
+	plan.length = length;
+	plan.fast = length > 0 && (length & (length - 1)) == 0;
+
+	if (plan.fast) {
+		int bits = 0;
+		while ((1 << bits) < length) {
+			bits++;
+		}
+
+		plan.bitReverse.resize(length);
+		for (int i = 0; i < length; i++) {
+			int reversed = 0;
+			for (int b = 0; b < bits; b++) {
+				reversed |= ((i >> b) & 1) << (bits - 1 - b);
+			}
+			plan.bitReverse[i] = reversed;
+		}
+
+		plan.twiddles.resize(length / 2);
+		for (int k = 0; k < length / 2; k++) {
+			plan.twiddles[k] = std::polar(1.0, -2.0 * PI * k / length);
+		}
+
+		plan.shifts.resize(length);
+		for (int k = 0; k < length; k++) {
+			plan.shifts[k] = std::polar(1.0, -PI * k / (2.0 * length));
+		}
+	}
+	else {
+		plan.cosines.resize(length * length);
+		for (int k = 0; k < length; k++) {
+			for (int n = 0; n < length; n++) {
+				plan.cosines[k * length + n] = std::cos(PI * k * (2 * n + 1) / (2.0 * length));
+			}
+		}
+	}
+}
+
+void DctTransform3D::FFT(const AxisPlan& plan, std::complex<double>* values, bool inverse)
+{
+	const int n = plan.length;
+
+	for (int i = 0; i < n; i++) {
+		int j = plan.bitReverse[i];
+		if (i < j) {
+			std::swap(values[i], values[j]);
+		}
+	}
+
+	for (int size = 2; size <= n; size <<= 1) {
+		int half = size / 2;
+		int step = n / size;
+		for (int start = 0; start < n; start += size) {
+			for (int k = 0; k < half; k++) {
+				std::complex<double> w = plan.twiddles[k * step];
+				if (inverse) {
+					w = std::conj(w);
+				}
+
+				std::complex<double> even = values[start + k];
+				std::complex<double> odd = values[start + k + half] * w;
+				values[start + k] = even + odd;
+				values[start + k + half] = even - odd;
+			}
+		}
+	}
+}
+
+void DctTransform3D::TransformLine(const AxisPlan& plan, double* line, std::complex<double>* work, bool inverse)
+{
+	const int n = plan.length;
+
+	if (!plan.fast) {
+		//direct sums, inverse is the dct-iii scaled by 1 / N
+		for (int i = 0; i < n; i++) {
+			work[i] = line[i];
+		}
+
+		if (!inverse) {
+			for (int k = 0; k < n; k++) {
+				const double* row = &plan.cosines[k * n];
+				double sum = 0.0;
+				for (int i = 0; i < n; i++) {
+					sum += work[i].real() * row[i];
+				}
+				line[k] = sum;
+			}
+		}
+		else {
+			for (int i = 0; i < n; i++) {
+				double sum = 0.5 * work[0].real();
+				for (int k = 1; k < n; k++) {
+					sum += work[k].real() * plan.cosines[k * n + i];
+				}
+				line[i] = sum * 2.0 / n;
+			}
+		}
+		return;
+	}
+
+	if (!inverse) {
+		//evens forwards then odds backwards makes the dct a single fft
+		for (int i = 0; i < n / 2; i++) {
+			work[i] = line[2 * i];
+			work[n - 1 - i] = line[2 * i + 1];
+		}
+		if (n == 1) {
+			work[0] = line[0];
+		}
+
+		FFT(plan, work, false);
+
+		for (int k = 0; k < n; k++) {
+			line[k] = (work[k] * plan.shifts[k]).real();
+		}
+	}
+	else {
+		//rebuild the complex spectrum from the real coefficients, then undo the fft
+		for (int k = 0; k < n; k++) {
+			double mirrored = k == 0 ? 0.0 : line[n - k];
+			work[k] = std::conj(plan.shifts[k]) * std::complex<double>(line[k], -mirrored);
+		}
+
+		FFT(plan, work, true);
+
+		for (int i = 0; i < n / 2; i++) {
+			line[2 * i] = work[i].real() / n;
+			line[2 * i + 1] = work[n - 1 - i].real() / n;
+		}
+		if (n == 1) {
+			line[0] = work[0].real();
+		}
+	}
+}
+
+void DctTransform3D::TransformAxis(float* data, int axis, bool inverse)
+{
+	const AxisPlan& plan = plans[axis];
+	const int length = plan.length;
+	const int resX = res[0];
+	const int resY = res[1];
+	const int resZ = res[2];
+	const int sliceSize = resX * resY;
+
+	if (axis == 0) {
+		//x lines are already contiguous
+		pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+			std::vector<double> line(length);
+			std::vector<std::complex<double>> work(length);
+
+			for (int z = zBegin; z < zEnd; z++) {
+				for (int y = 0; y < resY; y++) {
+					float* row = data + z * sliceSize + y * resX;
+					for (int x = 0; x < resX; x++) {
+						line[x] = row[x];
+					}
+
+					TransformLine(plan, line.data(), work.data(), inverse);
+
+					for (int x = 0; x < resX; x++) {
+						row[x] = (float)line[x];
+					}
+				}
+			}
+		});
+		return;
+	}
+
+	//y lines are split over z slices, z lines over y rows
+	const int outerCount = axis == 1 ? resZ : resY;
+	const int outerStride = axis == 1 ? sliceSize : resX;
+	const int lineStride = axis == 1 ? resX : sliceSize;
+
+	pool->ParallelFor(0, outerCount, [&](int outerBegin, int outerEnd) {
+		std::vector<double> tile(TILE_WIDTH * length);
+		std::vector<std::complex<double>> work(length);
+
+		for (int outer = outerBegin; outer < outerEnd; outer++) {
+			for (int xBegin = 0; xBegin < resX; xBegin += TILE_WIDTH) {
+				int width = std::min(TILE_WIDTH, resX - xBegin);
+				float* base = data + outer * outerStride + xBegin;
+
+				//gather, each row of the tile is a contiguous read
+				for (int i = 0; i < length; i++) {
+					const float* row = base + i * lineStride;
+					for (int t = 0; t < width; t++) {
+						tile[t * length + i] = row[t];
+					}
+				}
+
+				for (int t = 0; t < width; t++) {
+					TransformLine(plan, &tile[t * length], work.data(), inverse);
+				}
+
+				//scatter back the same way
+				for (int i = 0; i < length; i++) {
+					float* row = base + i * lineStride;
+					for (int t = 0; t < width; t++) {
+						row[t] = (float)tile[t * length + i];
+					}
+				}
+			}
+		}
+	});
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Separable 3D DCT-II on a float grid, transformed in place one axis
+// at a time. Power of two axes go through a radix-2 FFT (Makhoul's
+// reordering), anything else falls back to a direct O(N^2) sum. Lines
+// along y and z are gathered in tiles of neighbouring x columns so every
+// load touches whole cache lines, and slices are split over the thread pool.
+class DctTransform3D
+{
+public:
+	DctTransform3D(int resX, int resY, int resZ, ThreadPool* pool);
+
+	// Unnormalized DCT-II along every axis,
+	// X[k] = sum(x[n] * cos(pi * k * (2n + 1) / 2N))
+	void Forward(float* data);
+
+	// Exact inverse of Forward
+	void Inverse(float* data);
+
+private:
+	struct AxisPlan {
+		int length;
+		//power of two lengths use the fft path
+		bool fast;
+		std::vector<int> bitReverse;
+		//exp(-2 pi i k / N) for k < N / 2
+		std::vector<std::complex<double>> twiddles;
+		//exp(-pi i k / 2N), turns the fft of the reordered line into the dct
+		std::vector<std::complex<double>> shifts;
+		//cos(pi * k * (2n + 1) / 2N) for the direct fallback, row k
+		std::vector<double> cosines;
+	};
+
+	void BuildPlan(AxisPlan& plan, int length);
+
+	// In place radix-2 FFT of plan.length values
+	void FFT(const AxisPlan& plan, std::complex<double>* values, bool inverse);
+
+	// Transforms one contiguous line, work needs plan.length entries
+	void TransformLine(const AxisPlan& plan, double* line, std::complex<double>* work, bool inverse);
+
+	void TransformAxis(float* data, int axis, bool inverse);
+
+	int res[3];
+	AxisPlan plans[3];
+	ThreadPool* pool;
+};
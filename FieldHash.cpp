@@ -0,0 +1,124 @@
+#include "FieldHash.h"
+#include "BrickMask.h"
+
+#include <cstring>
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t RotateLeft(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+//unaligned little endian reads, the rows of a brick start anywhere
+static uint64_t Read64(const unsigned char* p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint32_t Read32(const unsigned char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint64_t Round(uint64_t accumulator, uint64_t input)
+{
+	accumulator += input * PRIME64_2;
+	accumulator = RotateLeft(accumulator, 31);
+	return accumulator * PRIME64_1;
+}
+
+static uint64_t MergeRound(uint64_t hash, uint64_t accumulator)
+{
+	hash ^= Round(0, accumulator);
+	return hash * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	const unsigned char* end = p + size;
+	uint64_t hash;
+
+	//four lanes of 8 bytes while there's a full 32 byte stripe left
+	if (size >= 32) {
+		uint64_t lanes[4] = { seed + PRIME64_1 + PRIME64_2, seed + PRIME64_2, seed, seed - PRIME64_1 };
+		const unsigned char* lastStripe = end - 32;
+		do {
+			for (int lane = 0; lane < 4; lane++) {
+				lanes[lane] = Round(lanes[lane], Read64(p + lane * 8));
+			}
+			p += 32;
+		} while (p <= lastStripe);
+
+		hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) + RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+		for (int lane = 0; lane < 4; lane++) {
+			hash = MergeRound(hash, lanes[lane]);
+		}
+	}
+	else {
+		hash = seed + PRIME64_5;
+	}
+
+	hash += (uint64_t)size;
+
+	//whatever didn't fill a stripe
+	for (; p + 8 <= end; p += 8) {
+		hash ^= Round(0, Read64(p));
+		hash = RotateLeft(hash, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if (p + 4 <= end) {
+		hash ^= (uint64_t)Read32(p) * PRIME64_1;
+		hash = RotateLeft(hash, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		hash ^= (*p) * PRIME64_5;
+		hash = RotateLeft(hash, 11) * PRIME64_1;
+	}
+
+	//avalanche
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+uint64_t HashGridBricks(const void* cells, size_t bytesPerCell, int resX, int resY, int resZ, std::vector<uint64_t>& brickHashes)
+{
+	const unsigned char* bytes = (const unsigned char*)cells;
+	BrickMask bricks(resX, resY, resZ);
+	brickHashes.resize(bricks.GetBrickCount());
+
+	//a brick's rows aren't next to each other in the grid, so they're gathered first
+	std::vector<unsigned char> brick(BRICK_SIZE * BRICK_SIZE * BRICK_SIZE * bytesPerCell);
+	for (int b = 0; b < bricks.GetBrickCount(); b++) {
+		int begin[3];
+		int end[3];
+		bricks.GetBrickBounds(b, begin, end);
+
+		size_t rowBytes = (end[0] - begin[0]) * bytesPerCell;
+		size_t brickBytes = 0;
+		for (int z = begin[2]; z < end[2]; z++) {
+			for (int y = begin[1]; y < end[1]; y++) {
+				size_t cell = ((size_t)z * resY + y) * resX + begin[0];
+				memcpy(&brick[brickBytes], bytes + cell * bytesPerCell, rowBytes);
+				brickBytes += rowBytes;
+			}
+		}
+
+		brickHashes[b] = HashBytes(brick.data(), brickBytes);
+	}
+
+	return HashBytes(brickHashes.data(), brickHashes.size() * sizeof(uint64_t));
+}
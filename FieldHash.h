@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Fast non-cryptographic hashing of sim fields, for checking that two runs
+// (or one run on different thread counts) end up with bit for bit the same
+// state. HashBytes is XXH64, so it matches the reference xxHash.
+
+// XXH64 of size bytes
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+/// <summary>
+/// Hashes a grid of cells bytesPerCell wide (x fastest) one BRICK_SIZE^3
+/// brick at a time. brickHashes gets every brick's hash in brick order and
+/// the grid's hash is the hash of that list, so a mismatch can be narrowed
+/// down to the bricks that differ.
+/// </summary>
+uint64_t HashGridBricks(const void* cells, size_t bytesPerCell, int resX, int resY, int resZ, std::vector<uint64_t>& brickHashes);
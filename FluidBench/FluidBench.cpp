@@ -0,0 +1,606 @@
+// Headless benchmark of FluidSolverCPU. Runs a plume for a number of steps
+// at each grid size and thread count asked for and reports every stage's
+// time per step, cells per second and effective bandwidth, as a table and
+// optionally CSV and JSON. Effective bandwidth counts the least memory each
+// stage has to touch per cell (see STAGES), not what the cache actually does.
+// --layouts instead times a Jacobi sweep and a divergence on FluidGrids of
+// every layout, steps counting sweeps. --processes instead splits each grid
+// into z slabs over that many processes (SlabCluster), each with the first
+// --threads count of threads, and reports the speedup and parallel
+// efficiency over one process along with any difference from FluidSolverCPU.
+//
+// FluidBench [--sizes 32,64,128,256] [--threads 1,2,4,0] [--steps 10]
+//            [--warmup 5] [--solver multigrid|jacobi|cg|spectral]
+//            [--scheme semi|maccormack] [--half] [--layouts]
+//            [--processes 1,2,4] [--halo-depth 4]
+//            [--isa scalar|sse|avx2|avx512] [--csv path] [--json path]
+
+#include "../FluidGrid.h"
+#include "../FluidSolverCPU.h"
+#include "../SlabCluster.h"
+#include "../TrilinearSampler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct StageInfo {
+	FluidStage stage;
+	const char* name;
+	//values each cell has to read and write at least once, per pressure iteration for the solve
+	int valuesPerCell;
+};
+
+//inject checks every cell's distance to the emitter but only writes the few
+//inside it, so its time is arithmetic rather than traffic and it has no GB/s
+//of its own (only the rounding passes --half adds after it)
+static const StageInfo STAGES[] = {
+	{ FLUID_STAGE_ADVECT, "advect", 19 }, //3 velocity + 8 fields read, 8 written
+	{ FLUID_STAGE_INJECT, "inject", 0 },
+	{ FLUID_STAGE_BUOYANCY, "buoyancy", 8 }, //velocity, temperature, density read, velocity written
+	{ FLUID_STAGE_DIVERGENCE, "divergence", 4 }, //velocity read, divergence written
+	{ FLUID_STAGE_PRESSURE, "pressure", 3 }, //pressure and divergence read, pressure written
+	{ FLUID_STAGE_PROJECT, "project", 7 } //pressure and velocity read, velocity written
+};
+static const int STAGE_COUNT = sizeof(STAGES) / sizeof(STAGES[0]);
+
+//MacCormack reads the forward result, the fields and velocity again and writes the fields a second time
+#define MACCORMACK_EXTRA_VALUES 27
+
+//values per cell of the passes FluidSolverCPU::StoreAtPrecision makes at the end of
+//a stage, a read and a write of every channel there that is rounded to FP16
+static int GetRoundingValuesPerCell(FluidStage stage, const FieldPrecisionPolicy& precision)
+{
+	auto rounded = [](FieldPrecision fieldPrecision, int channels) {
+		return fieldPrecision == FIELD_PRECISION_FLOAT16 ? channels * 2 : 0;
+	};
+	switch (stage) {
+	case FLUID_STAGE_ADVECT:
+	case FLUID_STAGE_INJECT:
+		return rounded(precision.velocity, 3) + rounded(precision.density, 4) + rounded(precision.temperature, 1);
+	case FLUID_STAGE_BUOYANCY:
+	case FLUID_STAGE_PROJECT:
+		return rounded(precision.velocity, 3);
+	case FLUID_STAGE_PRESSURE:
+		return rounded(precision.pressure, 1);
+	default:
+		return 0;
+	}
+}
+
+struct BenchResult {
+	int resolution;
+	unsigned int threads;
+	std::string stage;
+	double msPerStep;
+	double cellsPerSecond;
+	//false for stages with no per cell traffic, their GB/s is left blank
+	bool hasBandwidth;
+	double gbPerSecond;
+	double pressureIterations;
+};
+
+// GB/s as a table, CSV or JSON field, blank (or null) where it isn't measured
+static std::string FormatBandwidth(const BenchResult& result, const char* format, const char* blank)
+{
+	if (!result.hasBandwidth) {
+		return blank;
+	}
+	char text[32];
+	snprintf(text, sizeof(text), format, result.gbPerSecond);
+	return text;
+}
+
+static std::vector<int> ParseList(const char* text)
+{
+	std::vector<int> values;
+	const char* start = text;
+	while (*start) {
+		char* end;
+		long value = strtol(start, &end, 10);
+		if (end == start) {
+			break;
+		}
+		values.push_back((int)value);
+		start = *end == ',' ? end + 1 : end;
+	}
+	return values;
+}
+
+static void PrintUsage()
+{
+	printf("FluidBench [--sizes 32,64,128,256] [--threads 1,2,4,0] [--steps 10] [--warmup 5]\n");
+	printf("           [--solver multigrid|jacobi|cg|spectral] [--scheme semi|maccormack]\n");
+	printf("           [--half] [--layouts] [--processes 1,2,4] [--halo-depth 4]\n");
+	printf("           [--isa scalar|sse|avx2|avx512] [--csv path] [--json path]\n");
+	printf("thread count 0 uses every hardware thread\n");
+}
+
+static const char* LAYOUT_NAMES[GRID_LAYOUT_COUNT] = { "linear", "tiled", "morton" };
+
+struct LayoutResult {
+	int resolution;
+	unsigned int threads;
+	const char* layout;
+	const char* stencil;
+	double msPerSweep;
+	double cellsPerSecond;
+	double gbPerSecond;
+	//largest difference from the linear layout's result, should always be 0
+	float maxError;
+};
+
+// Runs the pressure and divergence stencils on grids of every layout and
+// reports how fast each sweeps. Every layout computes the exact same sums
+// in the same order, so their results are checked against linear's.
+static int RunLayoutBenchmark(const std::vector<int>& sizes, const std::vector<int>& threadCounts, int steps, int warmup,
+	const std::string& csvPath, const std::string& jsonPath)
+{
+	std::vector<LayoutResult> results;
+	printf("%6s %7s %-7s %-10s %10s %12s %8s %9s\n", "size", "threads", "layout", "stencil", "ms/sweep", "Mcells/s", "GB/s", "error");
+	for (int size : sizes) {
+		size_t cells = (size_t)size * size * size;
+
+		//the same smooth-ish starting fields for every layout
+		std::vector<float> linear[4];
+		for (int field = 0; field < 4; field++) {
+			linear[field].resize(cells);
+			unsigned int state = 12345u + field;
+			for (size_t i = 0; i < cells; i++) {
+				state = state * 1664525u + 1013904223u;
+				linear[field][i] = (float)(state >> 8) / 16777216.0f - 0.5f;
+			}
+		}
+		std::vector<float> reference[2];
+		std::vector<float> check(cells);
+
+		for (int threadCount : threadCounts) {
+			ThreadPool pool((unsigned int)threadCount);
+			for (int layout = 0; layout < GRID_LAYOUT_COUNT; layout++) {
+				FluidGrid pressure(size, size, size, (GridLayout)layout);
+				FluidGrid pressureOut(size, size, size, (GridLayout)layout);
+				FluidGrid divergence(size, size, size, (GridLayout)layout);
+				FluidGrid velX(size, size, size, (GridLayout)layout);
+				FluidGrid velY(size, size, size, (GridLayout)layout);
+				FluidGrid velZ(size, size, size, (GridLayout)layout);
+				velX.CopyFrom(linear[0].data());
+				velY.CopyFrom(linear[1].data());
+				velZ.CopyFrom(linear[2].data());
+				pressure.CopyFrom(linear[3].data());
+
+				//divergence, 3 velocity values read and 1 written per cell
+				auto computeDivergence = [&]() {
+					const float* u = velX.GetData();
+					const float* v = velY.GetData();
+					const float* w = velZ.GetData();
+					float* div = divergence.GetData();
+					divergence.ForEachCell(&pool, [&](int, int, int, int i, const GridNeighbours& n) {
+						div[i] = 0.5f * ((u[n.posX] - u[n.negX]) + (v[n.posY] - v[n.negY]) + (w[n.posZ] - w[n.negZ]));
+					});
+				};
+				for (int step = 0; step < warmup; step++) {
+					computeDivergence();
+				}
+				auto start = std::chrono::high_resolution_clock::now();
+				for (int step = 0; step < steps; step++) {
+					computeDivergence();
+				}
+				auto end = std::chrono::high_resolution_clock::now();
+				double divergenceMs = std::chrono::duration<double, std::milli>(end - start).count() / steps;
+
+				//jacobi sweeps ping ponging between two grids, pressure and divergence read and pressure written
+				FluidGrid* source = &pressure;
+				FluidGrid* target = &pressureOut;
+				auto jacobiSweep = [&]() {
+					const float* p = source->GetData();
+					const float* div = divergence.GetData();
+					float* out = target->GetData();
+					target->ForEachCell(&pool, [&](int, int, int, int i, const GridNeighbours& n) {
+						out[i] = (p[n.negX] + p[n.posX] + p[n.negY] + p[n.posY] + p[n.negZ] + p[n.posZ] - div[i]) * (1.0f / 6.0f);
+					});
+					std::swap(source, target);
+				};
+				for (int step = 0; step < warmup; step++) {
+					jacobiSweep();
+				}
+				start = std::chrono::high_resolution_clock::now();
+				for (int step = 0; step < steps; step++) {
+					jacobiSweep();
+				}
+				end = std::chrono::high_resolution_clock::now();
+				double jacobiMs = std::chrono::duration<double, std::milli>(end - start).count() / steps;
+
+				float errors[2] = { 0.0f, 0.0f };
+				const FluidGrid* outputs[2] = { source, &divergence };
+				for (int output = 0; output < 2; output++) {
+					if (layout == GRID_LAYOUT_LINEAR) {
+						reference[output].resize(cells);
+						outputs[output]->CopyTo(reference[output].data());
+						continue;
+					}
+					outputs[output]->CopyTo(check.data());
+					for (size_t i = 0; i < cells; i++) {
+						errors[output] = std::max(errors[output], std::abs(check[i] - reference[output][i]));
+					}
+				}
+
+				const char* stencils[2] = { "jacobi", "divergence" };
+				double ms[2] = { jacobiMs, divergenceMs };
+				int valuesPerCell[2] = { 3, 4 };
+				for (int stencil = 0; stencil < 2; stencil++) {
+					LayoutResult result;
+					result.resolution = size;
+					result.threads = pool.GetThreadCount();
+					result.layout = LAYOUT_NAMES[layout];
+					result.stencil = stencils[stencil];
+					result.msPerSweep = ms[stencil];
+					result.cellsPerSecond = ms[stencil] > 0.0 ? cells * 1000.0 / ms[stencil] : 0.0;
+					result.gbPerSecond = ms[stencil] > 0.0 ? cells * valuesPerCell[stencil] * sizeof(float) / 1e9 * 1000.0 / ms[stencil] : 0.0;
+					result.maxError = errors[stencil];
+					results.push_back(result);
+					printf("%6d %7u %-7s %-10s %10.3f %12.2f %8.2f %9.2g\n", result.resolution, result.threads, result.layout, result.stencil,
+						result.msPerSweep, result.cellsPerSecond / 1e6, result.gbPerSecond, result.maxError);
+				}
+				fflush(stdout);
+			}
+		}
+	}
+
+	if (!csvPath.empty()) {
+		std::ofstream file(csvPath, std::ios::trunc);
+		if (!file) {
+			printf("Couldn't write %s\n", csvPath.c_str());
+			return 1;
+		}
+		file << "resolution,threads,layout,stencil,ms_per_sweep,cells_per_second,gb_per_second,max_error\n";
+		for (const LayoutResult& result : results) {
+			char line[256];
+			snprintf(line, sizeof(line), "%d,%u,%s,%s,%.4f,%.0f,%.3f,%g\n", result.resolution, result.threads, result.layout, result.stencil,
+				result.msPerSweep, result.cellsPerSecond, result.gbPerSecond, result.maxError);
+			file << line;
+		}
+	}
+
+	if (!jsonPath.empty()) {
+		std::ofstream file(jsonPath, std::ios::trunc);
+		if (!file) {
+			printf("Couldn't write %s\n", jsonPath.c_str());
+			return 1;
+		}
+		file << "{\n\t\"sweeps\": " << steps << ",\n\t\"warmup\": " << warmup << ",\n\t\"results\": [\n";
+		for (size_t r = 0; r < results.size(); r++) {
+			const LayoutResult& result = results[r];
+			char line[512];
+			snprintf(line, sizeof(line), "\t\t{ \"resolution\": %d, \"threads\": %u, \"layout\": \"%s\", \"stencil\": \"%s\", "
+				"\"ms_per_sweep\": %.4f, \"cells_per_second\": %.0f, \"gb_per_second\": %.3f, \"max_error\": %g }%s\n",
+				result.resolution, result.threads, result.layout, result.stencil, result.msPerSweep,
+				result.cellsPerSecond, result.gbPerSecond, result.maxError, r + 1 < results.size() ? "," : "");
+			file << line;
+		}
+		file << "\t]\n}\n";
+	}
+	return 0;
+}
+
+struct SlabResult {
+	int resolution;
+	int processes;
+	unsigned int threadsPerProcess;
+	double msPerStep;
+	double speedup;
+	double efficiency;
+	double pressureIterations;
+	unsigned int clampedTraces;
+	//largest difference from a single FluidSolverCPU, 0 unless a trace got clamped
+	float maxError;
+};
+
+// Steps each grid split over every process count asked for and compares the
+// time per step with one process's. Ends by gathering the velocity and
+// density and checking them against a FluidSolverCPU run with the same
+// settings.
+static int RunSlabBenchmark(const std::vector<int>& sizes, const std::vector<int>& processCounts, unsigned int threadsPerProcess,
+	int haloDepth, int steps, int warmup, const FluidSimSettings& requested, const std::string& csvPath, const std::string& jsonPath)
+{
+	FluidSimSettings settings = SlabSolver::GetSupportedSettings(requested);
+	if (settings.pressureSolver != requested.pressureSolver || settings.advectionScheme != requested.advectionScheme) {
+		printf("slabs run %s pressure with %s advection\n",
+			settings.pressureSolver == PRESSURE_SOLVER_JACOBI ? "jacobi" : "multigrid",
+			settings.advectionScheme == ADVECTION_MACCORMACK ? "maccormack" : "semi-lagrangian");
+	}
+
+	std::vector<SlabResult> results;
+	printf("%6s %9s %7s %10s %8s %10s %9s %8s %9s\n", "size", "processes", "threads", "ms/step", "speedup", "efficiency", "p iters", "clamped", "error");
+	for (int size : sizes) {
+		size_t cells = (size_t)size * size * size;
+
+		//what every split should come out as
+		FluidSolverCPU reference(size, size, size, threadsPerProcess);
+		*reference.GetSettings() = settings;
+		for (int step = 0; step < warmup + steps; step++) {
+			reference.Simulate();
+		}
+
+		//speedups are over the first count that started, usually 1
+		double baseMs = 0.0;
+		int baseCount = 0;
+		std::vector<float> gathered(cells);
+		for (int processCount : processCounts) {
+			SlabCluster cluster;
+			if (!cluster.Start(size, size, size, processCount, threadsPerProcess, haloDepth)) {
+				printf("%6d %9d couldn't start, slabs need 2 planes each\n", size, processCount);
+				continue;
+			}
+			*cluster.GetSettings() = settings;
+			bool failed = false;
+			for (int step = 0; step < warmup && !failed; step++) {
+				failed = !cluster.Simulate();
+			}
+
+			double pressureIterations = 0.0;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int step = 0; step < steps && !failed; step++) {
+				failed = !cluster.Simulate();
+				pressureIterations += cluster.GetPressureIterations();
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+
+			float maxError = 0.0f;
+			for (FluidChannel channel : { VELOCITY_X, VELOCITY_Y, VELOCITY_Z, DENSITY }) {
+				if (failed || !cluster.GatherChannel(channel, gathered.data())) {
+					failed = true;
+					break;
+				}
+				const std::vector<float>& expected = reference.GetChannel(channel);
+				for (size_t i = 0; i < cells; i++) {
+					maxError = std::max(maxError, std::abs(gathered[i] - expected[i]));
+				}
+			}
+			if (failed) {
+				printf("%6d %9d a worker exited or stopped answering partway\n", size, processCount);
+				continue;
+			}
+
+			SlabResult result;
+			result.resolution = size;
+			result.processes = processCount;
+			result.threadsPerProcess = reference.GetThreadCount();
+			result.msPerStep = std::chrono::duration<double, std::milli>(end - start).count() / steps;
+			if (baseCount == 0) {
+				baseMs = result.msPerStep;
+				baseCount = processCount;
+			}
+			result.speedup = result.msPerStep > 0.0 ? baseMs / result.msPerStep : 0.0;
+			result.efficiency = result.speedup * baseCount / processCount;
+			result.pressureIterations = pressureIterations / steps;
+			result.clampedTraces = cluster.GetClampedTraces();
+			result.maxError = maxError;
+			results.push_back(result);
+			printf("%6d %9d %7u %10.3f %8.2f %9.0f%% %9.1f %8u %9.2g\n", result.resolution, result.processes, result.threadsPerProcess,
+				result.msPerStep, result.speedup, result.efficiency * 100.0, result.pressureIterations, result.clampedTraces, result.maxError);
+			fflush(stdout);
+		}
+	}
+
+	if (!csvPath.empty()) {
+		std::ofstream file(csvPath, std::ios::trunc);
+		if (!file) {
+			printf("Couldn't write %s\n", csvPath.c_str());
+			return 1;
+		}
+		file << "resolution,processes,threads_per_process,ms_per_step,speedup,efficiency,pressure_iterations,clamped_traces,max_error\n";
+		for (const SlabResult& result : results) {
+			char line[256];
+			snprintf(line, sizeof(line), "%d,%d,%u,%.4f,%.3f,%.3f,%.2f,%u,%g\n", result.resolution, result.processes, result.threadsPerProcess,
+				result.msPerStep, result.speedup, result.efficiency, result.pressureIterations, result.clampedTraces, result.maxError);
+			file << line;
+		}
+	}
+
+	if (!jsonPath.empty()) {
+		std::ofstream file(jsonPath, std::ios::trunc);
+		if (!file) {
+			printf("Couldn't write %s\n", jsonPath.c_str());
+			return 1;
+		}
+		file << "{\n\t\"steps\": " << steps << ",\n\t\"warmup\": " << warmup << ",\n\t\"results\": [\n";
+		for (size_t r = 0; r < results.size(); r++) {
+			const SlabResult& result = results[r];
+			char line[512];
+			snprintf(line, sizeof(line), "\t\t{ \"resolution\": %d, \"processes\": %d, \"threads_per_process\": %u, \"ms_per_step\": %.4f, "
+				"\"speedup\": %.3f, \"efficiency\": %.3f, \"pressure_iterations\": %.2f, \"clamped_traces\": %u, \"max_error\": %g }%s\n",
+				result.resolution, result.processes, result.threadsPerProcess, result.msPerStep, result.speedup, result.efficiency,
+				result.pressureIterations, result.clampedTraces, result.maxError, r + 1 < results.size() ? "," : "");
+			file << line;
+		}
+		file << "\t]\n}\n";
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	//SlabCluster starts its workers as copies of this executable
+	if (argc == 4 && std::string(argv[1]) == "--slab-worker") {
+		return SlabCluster::RunWorker(argv[2], atoi(argv[3]));
+	}
+
+	std::vector<int> sizes = { 32, 64, 128, 256 };
+	std::vector<int> threadCounts = { 1, 2, 4, 0 };
+	std::vector<int> processCounts;
+	int haloDepth = SLAB_HALO_PLANES;
+	int steps = 10;
+	int warmup = 5;
+	FluidSimSettings settings;
+	std::string csvPath;
+	std::string jsonPath;
+	bool layouts = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : "";
+		if (arg == "--sizes") { sizes = ParseList(value); i++; }
+		else if (arg == "--threads") { threadCounts = ParseList(value); i++; }
+		else if (arg == "--steps") { steps = atoi(value); i++; }
+		else if (arg == "--warmup") { warmup = atoi(value); i++; }
+		else if (arg == "--csv") { csvPath = value; i++; }
+		else if (arg == "--json") { jsonPath = value; i++; }
+		else if (arg == "--layouts") { layouts = true; }
+		else if (arg == "--processes") { processCounts = ParseList(value); i++; }
+		else if (arg == "--halo-depth") { haloDepth = atoi(value); i++; }
+		else if (arg == "--isa") {
+			std::string isa = value;
+			SetSamplerIsa(
+				isa == "scalar" ? SAMPLER_ISA_SCALAR :
+				isa == "sse" ? SAMPLER_ISA_SSE :
+				isa == "avx2" ? SAMPLER_ISA_AVX2 : SAMPLER_ISA_AVX512);
+			i++;
+		}
+		else if (arg == "--half") {
+			settings.precision.velocity = FIELD_PRECISION_FLOAT16;
+			settings.precision.density = FIELD_PRECISION_FLOAT16;
+			settings.precision.temperature = FIELD_PRECISION_FLOAT16;
+			settings.precision.pressure = FIELD_PRECISION_FLOAT16;
+		}
+		else if (arg == "--solver") {
+			std::string solver = value;
+			settings.pressureSolver =
+				solver == "jacobi" ? PRESSURE_SOLVER_JACOBI :
+				solver == "cg" ? PRESSURE_SOLVER_CONJUGATE_GRADIENT :
+				solver == "spectral" ? PRESSURE_SOLVER_SPECTRAL : PRESSURE_SOLVER_MULTIGRID;
+			i++;
+		}
+		else if (arg == "--scheme") {
+			settings.advectionScheme = std::string(value) == "maccormack" ? ADVECTION_MACCORMACK : ADVECTION_SEMI_LAGRANGIAN;
+			i++;
+		}
+		else {
+			PrintUsage();
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+	if (steps < 1 || sizes.empty() || threadCounts.empty()) {
+		PrintUsage();
+		return 1;
+	}
+	if (layouts) {
+		return RunLayoutBenchmark(sizes, threadCounts, steps, warmup, csvPath, jsonPath);
+	}
+
+	//a plume rising from near the floor, so every stage has real work to do
+	settings.injectVelocity[1] = 5.0f;
+	if (!processCounts.empty()) {
+		return RunSlabBenchmark(sizes, processCounts, (unsigned int)threadCounts[0], haloDepth, steps, warmup, settings, csvPath, jsonPath);
+	}
+	//fields stay floats under --half, FP16 ones are only rounded in place
+	const int bytesPerValue = 4;
+
+	std::vector<BenchResult> results;
+	printf("sampler: %s (cpu supports %s)\n", GetSamplerIsaName(GetSamplerIsa()), GetSamplerIsaName(GetSupportedSamplerIsa()));
+	printf("%6s %7s %-11s %10s %12s %8s %9s\n", "size", "threads", "stage", "ms/step", "Mcells/s", "GB/s", "p iters");
+	for (int size : sizes) {
+		for (int threadCount : threadCounts) {
+			FluidSolverCPU solver(size, size, size, (unsigned int)threadCount);
+			*solver.GetSettings() = settings;
+			for (int step = 0; step < warmup; step++) {
+				solver.Simulate();
+			}
+
+			double stageMs[FLUID_STAGE_COUNT] = {};
+			double pressureIterations = 0.0;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int step = 0; step < steps; step++) {
+				solver.Simulate();
+				for (int stage = 0; stage < FLUID_STAGE_COUNT; stage++) {
+					stageMs[stage] += solver.GetStageMs((FluidStage)stage);
+				}
+				pressureIterations += solver.GetPressureIterations();
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			pressureIterations /= steps;
+
+			double cells = (double)size * size * size;
+			double totalBytes = 0.0;
+			for (const StageInfo& info : STAGES) {
+				int values = info.valuesPerCell;
+				if (info.stage == FLUID_STAGE_ADVECT && settings.advectionScheme == ADVECTION_MACCORMACK) {
+					values += MACCORMACK_EXTRA_VALUES;
+				}
+				double bytes = cells * values * bytesPerValue * (info.stage == FLUID_STAGE_PRESSURE ? pressureIterations : 1.0);
+				int roundingValues = GetRoundingValuesPerCell(info.stage, settings.precision);
+				bytes += cells * roundingValues * bytesPerValue;
+				totalBytes += bytes;
+
+				BenchResult result;
+				result.resolution = size;
+				result.threads = solver.GetThreadCount();
+				result.stage = info.name;
+				result.msPerStep = stageMs[info.stage] / steps;
+				result.cellsPerSecond = result.msPerStep > 0.0 ? cells * 1000.0 / result.msPerStep : 0.0;
+				result.hasBandwidth = info.valuesPerCell > 0 || roundingValues > 0;
+				result.gbPerSecond = result.msPerStep > 0.0 ? bytes / 1e9 * 1000.0 / result.msPerStep : 0.0;
+				result.pressureIterations = pressureIterations;
+				results.push_back(result);
+			}
+
+			//the whole step, including the bits between stages
+			BenchResult total;
+			total.resolution = size;
+			total.threads = solver.GetThreadCount();
+			total.stage = "total";
+			total.msPerStep = std::chrono::duration<double, std::milli>(end - start).count() / steps;
+			total.cellsPerSecond = total.msPerStep > 0.0 ? cells * 1000.0 / total.msPerStep : 0.0;
+			total.hasBandwidth = true;
+			total.gbPerSecond = total.msPerStep > 0.0 ? totalBytes / 1e9 * 1000.0 / total.msPerStep : 0.0;
+			total.pressureIterations = pressureIterations;
+			results.push_back(total);
+
+			for (size_t r = results.size() - STAGE_COUNT - 1; r < results.size(); r++) {
+				const BenchResult& result = results[r];
+				printf("%6d %7u %-11s %10.3f %12.2f %8s %9.1f\n", result.resolution, result.threads, result.stage.c_str(),
+					result.msPerStep, result.cellsPerSecond / 1e6, FormatBandwidth(result, "%.2f", "-").c_str(), result.pressureIterations);
+			}
+			fflush(stdout);
+		}
+	}
+
+	if (!csvPath.empty()) {
+		std::ofstream file(csvPath, std::ios::trunc);
+		if (!file) {
+			printf("Couldn't write %s\n", csvPath.c_str());
+			return 1;
+		}
+		file << "resolution,threads,stage,ms_per_step,cells_per_second,gb_per_second,pressure_iterations\n";
+		for (const BenchResult& result : results) {
+			char line[256];
+			snprintf(line, sizeof(line), "%d,%u,%s,%.4f,%.0f,%s,%.2f\n", result.resolution, result.threads, result.stage.c_str(),
+				result.msPerStep, result.cellsPerSecond, FormatBandwidth(result, "%.3f", "").c_str(), result.pressureIterations);
+			file << line;
+		}
+	}
+
+	if (!jsonPath.empty()) {
+		std::ofstream file(jsonPath, std::ios::trunc);
+		if (!file) {
+			printf("Couldn't write %s\n", jsonPath.c_str());
+			return 1;
+		}
+		file << "{\n\t\"steps\": " << steps << ",\n\t\"warmup\": " << warmup << ",\n\t\"bytes_per_value\": " << bytesPerValue << ",\n\t\"results\": [\n";
+		for (size_t r = 0; r < results.size(); r++) {
+			const BenchResult& result = results[r];
+			char line[512];
+			snprintf(line, sizeof(line), "\t\t{ \"resolution\": %d, \"threads\": %u, \"stage\": \"%s\", \"ms_per_step\": %.4f, "
+				"\"cells_per_second\": %.0f, \"gb_per_second\": %s, \"pressure_iterations\": %.2f }%s\n",
+				result.resolution, result.threads, result.stage.c_str(), result.msPerStep, result.cellsPerSecond,
+				FormatBandwidth(result, "%.3f", "null").c_str(), result.pressureIterations, r + 1 < results.size() ? "," : "");
+			file << line;
+		}
+		file << "\t]\n}\n";
+	}
+	return 0;
+}
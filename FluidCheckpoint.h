@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+//volumes saved in a checkpoint, in file order
+enum CheckpointVolume {
+	CHECKPOINT_VELOCITY,
+	CHECKPOINT_DENSITY,
+	CHECKPOINT_TEMPERATURE,
+	CHECKPOINT_PRESSURE,
+	CHECKPOINT_PREVIOUS_DENSITY,
+
+	CHECKPOINT_VOLUME_COUNT
+};
+
+#define CHECKPOINT_VERSION 1
+
+//volumes start on page boundaries, so a mapped one can be handed to an upload as is
+#define CHECKPOINT_ALIGNMENT 4096
+
+// Layout of a FluidField checkpoint. The header is followed by every
+// volume's texels exactly as its texture stores them (x-fastest, rows
+// tightly packed), so restoring is mapping the file and uploading from it.
+struct FluidCheckpointHeader {
+	char magic[4];
+	uint32_t version;
+	int32_t gridRes[3];
+	//FieldPrecision of velocity, density, temperature and pressure
+	uint32_t precision[4];
+	uint32_t previousDensityValid;
+	float fixedTimeStep;
+	float timeCounter;
+
+	//scene and injection settings
+	float ambientTemperature;
+	float injectTemperature;
+	float injectDensity;
+	float injectRadius;
+	float injectVelocityImpulseScale;
+	float temperatureBuoyancy;
+	float densityWeight;
+	float velocityDamper;
+	float densityDamper;
+	float temperatureDamper;
+	float vorticityEpsilon;
+	float injectPosition[3];
+	float injectVelocityImpulse[3];
+	float fluidColor[3];
+
+	uint64_t volumeOffsets[CHECKPOINT_VOLUME_COUNT];
+	uint64_t volumeSizes[CHECKPOINT_VOLUME_COUNT];
+};
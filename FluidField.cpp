@@ -1,12 +1,24 @@
 #include "FluidField.h"
+#include "FluidSimHelpers.h"
 #include "Helpers.h"
+#include "HalfPrecision.h"
+#include "FieldHash.h"
+#include "BlueNoise.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 
 using namespace DirectX;
 
-// Helper macro for getting a float between min and max
-#define RandomRange(min, max) (float)rand() / RAND_MAX * (max - min) + min
+//blue noise tile for jittering raymarches
+#define BLUE_NOISE_SIZE 64
+//fewest steps across the cube's diagonal adaptive raymarching goes down to
+#define MIN_RAYMARCH_SAMPLES 16
 
-FluidField::FluidField(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context)
+FluidField::FluidField(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, int gridResX, int gridResY, int gridResZ)
 {
 	this->device = device;
 	this->context = context;
@@ -21,88 +33,51 @@ FluidField::FluidField(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::W
 	clearCompShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"Clear3DTextureCS.cso").c_str());
 	injectSmokeShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"InjectSmokeCS.cso").c_str());
 	buoyancyShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"BuoyancyCS.cso").c_str());
-
-	//initialize random values for velocity and density map
-
-	const int textureSize = 64;
-	const int totalPixels = textureSize * textureSize *textureSize;
-	randomPixels = new XMFLOAT4[totalPixels];
-	randomPixelsPressure = new XMFLOAT4[totalPixels];
-	randomPixelsDensity = new XMFLOAT4[totalPixels];
-	for (int i = 0; i < totalPixels; i++) {
-		XMVECTOR randomVec = XMVectorSet(RandomRange(-1, 1), RandomRange(-1, 1), RandomRange(-1, 1), 0);
-		XMStoreFloat4(&randomPixels[i], XMVector3Normalize(randomVec));
-
-		randomVec = XMVectorSet(RandomRange(0, 1), RandomRange(0, 1), RandomRange(0, 1), 0);
-		XMStoreFloat4(&randomPixelsPressure[i], XMVector3Normalize(randomVec));
-
-		randomVec = XMVectorSet(RandomRange(0, 1), RandomRange(0, 1), RandomRange(0, 1), RandomRange(0,1));
-		XMStoreFloat4(&randomPixelsDensity[i], XMVector3Normalize(randomVec));
+	pressureResidualShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"PressureResidualCS.cso").c_str());
+	multigridRestrictShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"MultigridRestrictCS.cso").c_str());
+	multigridProlongShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"MultigridProlongCS.cso").c_str());
+	pcgInitShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"PcgInitCS.cso").c_str());
+	pcgStartShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"PcgStartCS.cso").c_str());
+	pcgApplyShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"PcgApplyCS.cso").c_str());
+	pcgUpdateShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"PcgUpdateCS.cso").c_str());
+	pcgDirectionShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"PcgDirectionCS.cso").c_str());
+	reduceGroupSumsShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"ReduceGroupSumsCS.cso").c_str());
+	volumeSumShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"VolumeSumCS.cso").c_str());
+	removeMeanShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"RemoveMeanCS.cso").c_str());
+	brickActivityShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"BrickActivityCS.cso").c_str());
+	brickCompactShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"BrickCompactCS.cso").c_str());
+	clearBricksShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"ClearBricksCS.cso").c_str());
+	clearScratchBricksShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"ClearScratchBricksCS.cso").c_str());
+	resampleVolumeShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"ResampleVolumeCS.cso").c_str());
+	macCormackShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"MacCormackCS.cso").c_str());
+	occupancyBuildShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"OccupancyBuildCS.cso").c_str());
+	occupancyReduceShader = std::make_shared<SimpleComputeShader>(device.Get(), context.Get(), FixPath(L"OccupancyReduceCS.cso").c_str());
+	fullscreenVS = std::make_shared<SimpleVertexShader>(device.Get(), context.Get(), FixPath(L"FullscreenVS.cso").c_str());
+	volumeDepthDownsamplePS = std::make_shared<SimplePixelShader>(device.Get(), context.Get(), FixPath(L"VolumeDepthDownsamplePS.cso").c_str());
+	volumeUpsamplePS = std::make_shared<SimplePixelShader>(device.Get(), context.Get(), FixPath(L"VolumeUpsamplePS.cso").c_str());
+
+	//pcg and the mean removal read pressure back through its uav,
+	//which 16 bit formats only allow on some hardware
+	D3D11_FEATURE_DATA_FORMAT_SUPPORT2 halfSupport = {};
+	halfSupport.InFormat = DXGI_FORMAT_R16_FLOAT;
+	if (SUCCEEDED(device->CheckFeatureSupport(D3D11_FEATURE_FORMAT_SUPPORT2, &halfSupport, sizeof(halfSupport)))) {
+		halfPressureSupported = (halfSupport.OutFormatSupport2 & D3D11_FORMAT_SUPPORT2_UAV_TYPED_LOAD) != 0;
 	}
 
-	D3D11_TEXTURE3D_DESC desc = {};
-	desc.Width = fluidSimGridRes;
-	desc.Height = fluidSimGridRes;
-	desc.Depth = fluidSimGridRes;
-	desc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
-	desc.CPUAccessFlags = 0;
-	desc.MiscFlags = 0;
-	desc.MipLevels = 1;
-	desc.Usage = D3D11_USAGE_DEFAULT;
-
-	//init data for the texture
-	D3D11_SUBRESOURCE_DATA data = {};
-	data.pSysMem = randomPixels;
-	data.SysMemPitch = sizeof(XMFLOAT4) * fluidSimGridRes;
-	data.SysMemSlicePitch = sizeof(XMFLOAT4) * fluidSimGridRes * fluidSimGridRes;
-
-	D3D11_SUBRESOURCE_DATA pressureData = {};
-	pressureData.pSysMem = randomPixelsPressure;
-	pressureData.SysMemPitch = sizeof(XMFLOAT4) * fluidSimGridRes;
-	pressureData.SysMemSlicePitch = sizeof(XMFLOAT4) * fluidSimGridRes * fluidSimGridRes;
-	
-	D3D11_SUBRESOURCE_DATA densityData = {};
-	densityData.pSysMem = randomPixelsDensity;
-	densityData.SysMemPitch = sizeof(XMFLOAT4) * fluidSimGridRes;
-	densityData.SysMemSlicePitch = sizeof(XMFLOAT4) * fluidSimGridRes * fluidSimGridRes;
-
-	//create the texture and fill with data
-	//Microsoft::WRL::ComPtr<ID3D11Texture3D> velocityTex1;
-	//device->CreateTexture3D(&desc, &data, velocityTex1.GetAddressOf());
-	//Microsoft::WRL::ComPtr<ID3D11Texture3D> velocityTex2;
-	//device->CreateTexture3D(&desc, 0, velocityTex2.GetAddressOf());
-
-	//Microsoft::WRL::ComPtr<ID3D11Texture3D> densityTex1;
-	//device->CreateTexture3D(&desc, &densityData, densityTex1.GetAddressOf());
-	//Microsoft::WRL::ComPtr<ID3D11Texture3D> densityTex2;
-	//device->CreateTexture3D(&desc, 0, densityTex2.GetAddressOf());
-
-	//Microsoft::WRL::ComPtr<ID3D11Texture3D> velocityDivergenceTex;
-	//device->CreateTexture3D(&desc, 0, velocityDivergenceTex.GetAddressOf());
-
-	//Microsoft::WRL::ComPtr<ID3D11Texture3D> pressureTex1;
-	//device->CreateTexture3D(&desc, &pressureData, pressureTex1.GetAddressOf());
-	//Microsoft::WRL::ComPtr<ID3D11Texture3D> pressureTex2;
-	//device->CreateTexture3D(&desc, 0, pressureTex2.GetAddressOf());
-
-
-	//velocityMap[0] = CreateSRVandUAVTexture(DXGI_FORMAT_R32G32B32A32_FLOAT, randomPixels);
-	velocityMap[0] = CreateSRVandUAVTexture(DXGI_FORMAT_R32G32B32A32_FLOAT, 0);
-	velocityMap[1] = CreateSRVandUAVTexture(DXGI_FORMAT_R32G32B32A32_FLOAT, 0);
-
-	//densityMap[0] = CreateSRVandUAVTexture(DXGI_FORMAT_R32G32B32A32_FLOAT, randomPixelsDensity);
-	densityMap[0] = CreateSRVandUAVTexture(DXGI_FORMAT_R32G32B32A32_FLOAT, 0);
-	densityMap[1] = CreateSRVandUAVTexture(DXGI_FORMAT_R32G32B32A32_FLOAT, 0);
-	
-	temperatureMap[0] = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0);
-	temperatureMap[1] = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0);
+	D3D11_QUERY_DESC disjointDesc = {};
+	disjointDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+	D3D11_QUERY_DESC timestampDesc = {};
+	timestampDesc.Query = D3D11_QUERY_TIMESTAMP;
+	for (SimTimer& timer : simTimers) {
+		device->CreateQuery(&disjointDesc, timer.disjoint.GetAddressOf());
+		device->CreateQuery(&timestampDesc, timer.start.GetAddressOf());
+		device->CreateQuery(&timestampDesc, timer.end.GetAddressOf());
+	}
 
-	velocityDivergenceMap = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0);
+	obstaclePool = std::make_unique<ThreadPool>();
 
-	//pressureMap[0] = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, randomPixelsPressure);
-	pressureMap[0] = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0);
-	pressureMap[1] = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0);
+	fluidSimGridRes = XMINT3(gridResX, gridResY, gridResZ);
+	CreateGridResources();
 
 	D3D11_SAMPLER_DESC sampDesc = {};
 	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
@@ -129,6 +104,24 @@ FluidField::FluidField(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::W
 	pointSampDesc.MaxLOD = D3D11_FLOAT32_MAX;
 	device->CreateSamplerState(&pointSampDesc, pointSamplerOptions.GetAddressOf());
 
+	//always the same tile, so jittered renders don't change from run to run
+	GenerateBlueNoise(BLUE_NOISE_SIZE, 0, blueNoise);
+	D3D11_TEXTURE2D_DESC noiseDesc = {};
+	noiseDesc.Width = BLUE_NOISE_SIZE;
+	noiseDesc.Height = BLUE_NOISE_SIZE;
+	noiseDesc.MipLevels = 1;
+	noiseDesc.ArraySize = 1;
+	noiseDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	noiseDesc.SampleDesc.Count = 1;
+	noiseDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	noiseDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	D3D11_SUBRESOURCE_DATA noiseData = {};
+	noiseData.pSysMem = blueNoise.data();
+	noiseData.SysMemPitch = BLUE_NOISE_SIZE * sizeof(float);
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> noiseTexture;
+	device->CreateTexture2D(&noiseDesc, &noiseData, noiseTexture.GetAddressOf());
+	device->CreateShaderResourceView(noiseTexture.Get(), 0, blueNoiseSRV.GetAddressOf());
+
 	D3D11_DEPTH_STENCIL_DESC depthDesc = {};
 	depthDesc.DepthEnable = true;
 	depthDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
@@ -157,97 +150,303 @@ FluidField::FluidField(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::W
 
 FluidField::~FluidField()
 {
-	if (randomPixels) free(randomPixels);
-	if (randomPixelsPressure) free(randomPixelsPressure);
-	if (randomPixelsDensity) free(randomPixelsDensity);
+	//frames still in the readback ring would be lost otherwise
+	StopRecording();
 }
 
-Transform* FluidField::GetTransform()
+void FluidField::CreateGridResources()
 {
-	return &transform;
-}
+	invFluidSimGridRes = XMFLOAT3(1.0f / fluidSimGridRes.x, 1.0f / fluidSimGridRes.y, 1.0f / fluidSimGridRes.z);
 
-void FluidField::UpdateFluid(float deltaTime) {
-	//update time counter so we have a consistent delta time for simulation
-	timeCounter += deltaTime;
-	if (timeCounter < fixedTimeStep) {
-		return;
+	CreateFieldVolumes();
+
+	//divergence is the solver's right hand side, it stays full precision
+	velocityDivergenceMap = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0);
+
+	//only made once MacCormack advection asks for them
+	for (VolumeResource& scratch : advectionScratch) {
+		scratch = VolumeResource();
 	}
 
-	Simulate(deltaTime);
-	timeCounter -= fixedTimeStep;
-}
+	//multigrid levels, halving every axis (rounding up) down to 4 cells across
+	multigridLevels.clear();
+	for (XMINT3 levelRes = fluidSimGridRes; ; levelRes = XMINT3(GetCoarseRes(levelRes.x), GetCoarseRes(levelRes.y), GetCoarseRes(levelRes.z))) {
+		MultigridLevel level = {};
+		level.gridRes = levelRes;
+		level.residual = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0, levelRes);
+		if (!multigridLevels.empty()) {
+			level.pressure[0] = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0, levelRes);
+			level.pressure[1] = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0, levelRes);
+			level.rhs = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0, levelRes);
+		}
+		multigridLevels.push_back(level);
+
+		if (min(levelRes.x, min(levelRes.y, levelRes.z)) <= 4) {
+			break;
+		}
+	}
 
-void FluidField::Simulate(float deltaTime)
-{
-	//velocity advection
-	{
-		advectionShader->SetShader();
-		advectionShader->SetFloat("deltaTime", fixedTimeStep);
-		advectionShader->SetInt("gridRes", fluidSimGridRes);
+	//one float4 of sums per thread group of the full res residual
+	residualSumsCount = ((fluidSimGridRes.x + 7) / 8) * ((fluidSimGridRes.y + 7) / 8) * ((fluidSimGridRes.z + 7) / 8);
+
+	D3D11_BUFFER_DESC sumsDesc = {};
+	sumsDesc.ByteWidth = sizeof(XMFLOAT4) * residualSumsCount;
+	sumsDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	sumsDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	sumsDesc.StructureByteStride = sizeof(XMFLOAT4);
+	sumsDesc.Usage = D3D11_USAGE_DEFAULT;
+	device->CreateBuffer(&sumsDesc, 0, residualSumsBuffer.GetAddressOf());
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC sumsUAVDesc = {};
+	sumsUAVDesc.Format = DXGI_FORMAT_UNKNOWN;
+	sumsUAVDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	sumsUAVDesc.Buffer.NumElements = residualSumsCount;
+	device->CreateUnorderedAccessView(residualSumsBuffer.Get(), &sumsUAVDesc, residualSumsUAV.GetAddressOf());
+
+	//same layout but readable from the cpu
+	sumsDesc.BindFlags = 0;
+	sumsDesc.Usage = D3D11_USAGE_STAGING;
+	sumsDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	device->CreateBuffer(&sumsDesc, 0, residualSumsStaging.GetAddressOf());
+
+	pcgResidual = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0);
+	pcgDirection = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0);
+	pcgProduct = CreateSRVandUAVTexture(DXGI_FORMAT_R32_FLOAT, 0);
+
+	D3D11_BUFFER_DESC scalarsDesc = sumsDesc;
+	scalarsDesc.ByteWidth = sizeof(XMFLOAT4) * 4;
+	scalarsDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	scalarsDesc.Usage = D3D11_USAGE_DEFAULT;
+	scalarsDesc.CPUAccessFlags = 0;
+	device->CreateBuffer(&scalarsDesc, 0, scalarsBuffer.GetAddressOf());
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC scalarsUAVDesc = sumsUAVDesc;
+	scalarsUAVDesc.Buffer.NumElements = 4;
+	device->CreateUnorderedAccessView(scalarsBuffer.Get(), &scalarsUAVDesc, scalarsUAV.GetAddressOf());
+
+	scalarsDesc.BindFlags = 0;
+	scalarsDesc.Usage = D3D11_USAGE_STAGING;
+	scalarsDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	device->CreateBuffer(&scalarsDesc, 0, scalarsStaging.GetAddressOf());
+
+	//sparse bricks, one uint per brick in each buffer
+	bricksPerAxis = XMINT3(
+		(fluidSimGridRes.x + BRICK_SIZE - 1) / BRICK_SIZE,
+		(fluidSimGridRes.y + BRICK_SIZE - 1) / BRICK_SIZE,
+		(fluidSimGridRes.z + BRICK_SIZE - 1) / BRICK_SIZE);
+	int brickCount = GetBrickCount();
+
+	D3D11_BUFFER_DESC brickDesc = {};
+	brickDesc.ByteWidth = sizeof(unsigned int) * brickCount;
+	brickDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE;
+	brickDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	brickDesc.StructureByteStride = sizeof(unsigned int);
+	brickDesc.Usage = D3D11_USAGE_DEFAULT;
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC brickUAVDesc = {};
+	brickUAVDesc.Format = DXGI_FORMAT_UNKNOWN;
+	brickUAVDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	brickUAVDesc.Buffer.NumElements = brickCount;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC brickSRVDesc = {};
+	brickSRVDesc.Format = DXGI_FORMAT_UNKNOWN;
+	brickSRVDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	brickSRVDesc.Buffer.NumElements = brickCount;
+
+	Microsoft::WRL::ComPtr<ID3D11Buffer> brickFlagsBuffer;
+	device->CreateBuffer(&brickDesc, 0, brickFlagsBuffer.GetAddressOf());
+	device->CreateUnorderedAccessView(brickFlagsBuffer.Get(), &brickUAVDesc, brickFlagsUAV.GetAddressOf());
+	device->CreateShaderResourceView(brickFlagsBuffer.Get(), &brickSRVDesc, brickFlagsSRV.GetAddressOf());
+
+	Microsoft::WRL::ComPtr<ID3D11Buffer> activeBricksBuffer;
+	device->CreateBuffer(&brickDesc, 0, activeBricksBuffer.GetAddressOf());
+	device->CreateUnorderedAccessView(activeBricksBuffer.Get(), &brickUAVDesc, activeBricksUAV.GetAddressOf());
+	device->CreateShaderResourceView(activeBricksBuffer.Get(), &brickSRVDesc, activeBricksSRV.GetAddressOf());
+
+	Microsoft::WRL::ComPtr<ID3D11Buffer> clearBricksBuffer;
+	device->CreateBuffer(&brickDesc, 0, clearBricksBuffer.GetAddressOf());
+	device->CreateUnorderedAccessView(clearBricksBuffer.Get(), &brickUAVDesc, clearBricksUAV.GetAddressOf());
+	device->CreateShaderResourceView(clearBricksBuffer.Get(), &brickSRVDesc, clearBricksSRV.GetAddressOf());
+
+	brickDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	device->CreateBuffer(&brickDesc, 0, brickStateBuffer.GetAddressOf());
+	device->CreateUnorderedAccessView(brickStateBuffer.Get(), &brickUAVDesc, brickStateUAV.GetAddressOf());
+
+	//indirect args have to be a raw typed buffer rather than a structured one
+	D3D11_BUFFER_DESC argsDesc = {};
+	argsDesc.ByteWidth = sizeof(unsigned int) * 6;
+	argsDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	argsDesc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS;
+	argsDesc.Usage = D3D11_USAGE_DEFAULT;
+	device->CreateBuffer(&argsDesc, 0, brickArgsBuffer.GetAddressOf());
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC argsUAVDesc = {};
+	argsUAVDesc.Format = DXGI_FORMAT_R32_UINT;
+	argsUAVDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	argsUAVDesc.Buffer.NumElements = 6;
+	device->CreateUnorderedAccessView(brickArgsBuffer.Get(), &argsUAVDesc, brickArgsUAV.GetAddressOf());
+
+	argsDesc.BindFlags = 0;
+	argsDesc.MiscFlags = 0;
+	argsDesc.Usage = D3D11_USAGE_STAGING;
+	argsDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	device->CreateBuffer(&argsDesc, 0, brickArgsStaging.GetAddressOf());
+
+	//occupancy, a texel per brick and a full mip chain above it like OccupancyPyramid
+	occupancyLevels = 1;
+	while ((max(bricksPerAxis.x, max(bricksPerAxis.y, bricksPerAxis.z)) >> occupancyLevels) > 0) {
+		occupancyLevels++;
+	}
 
-		//advectionShader->CopyBufferData("ExternalData");
-		advectionShader->CopyAllBufferData();
+	D3D11_TEXTURE3D_DESC occupancyDesc = {};
+	occupancyDesc.Width = bricksPerAxis.x;
+	occupancyDesc.Height = bricksPerAxis.y;
+	occupancyDesc.Depth = bricksPerAxis.z;
+	occupancyDesc.Format = DXGI_FORMAT_R32G32_FLOAT;
+	occupancyDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	occupancyDesc.MipLevels = occupancyLevels;
+	occupancyDesc.Usage = D3D11_USAGE_DEFAULT;
+
+	Microsoft::WRL::ComPtr<ID3D11Texture3D> occupancyTexture;
+	device->CreateTexture3D(&occupancyDesc, 0, occupancyTexture.GetAddressOf());
+	occupancySRV.Reset();
+	device->CreateShaderResourceView(occupancyTexture.Get(), 0, occupancySRV.GetAddressOf());
+
+	occupancyLevelSRVs.assign(occupancyLevels, nullptr);
+	occupancyLevelUAVs.assign(occupancyLevels, nullptr);
+	for (int level = 0; level < occupancyLevels; level++) {
+		D3D11_SHADER_RESOURCE_VIEW_DESC levelSRVDesc = {};
+		levelSRVDesc.Format = occupancyDesc.Format;
+		levelSRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE3D;
+		levelSRVDesc.Texture3D.MostDetailedMip = level;
+		levelSRVDesc.Texture3D.MipLevels = 1;
+		device->CreateShaderResourceView(occupancyTexture.Get(), &levelSRVDesc, occupancyLevelSRVs[level].GetAddressOf());
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC levelUAVDesc = {};
+		levelUAVDesc.Format = occupancyDesc.Format;
+		levelUAVDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE3D;
+		levelUAVDesc.Texture3D.MipSlice = level;
+		levelUAVDesc.Texture3D.WSize = max(bricksPerAxis.z >> level, 1);
+		device->CreateUnorderedAccessView(occupancyTexture.Get(), &levelUAVDesc, occupancyLevelUAVs[level].GetAddressOf());
+	}
 
-		advectionShader->SetShaderResourceView("InputMap", velocityMap[0].srv.Get());
-		advectionShader->SetShaderResourceView("VelocityMap", velocityMap[0].srv.Get());
-		advectionShader->SetUnorderedAccessView("UavOutputMap", velocityMap[1].uav.Get());
+	//obstacles start empty, every entity gets voxelized again on the next UpdateObstacles
+	obstacles = std::make_unique<ObstacleVoxelizer>(fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z, obstaclePool.get());
+	obstacleEntities.clear();
 
-		advectionShader->SetSamplerState("LinearClampSampler", linearClampSamplerOptions.Get());
+	std::vector<unsigned int> emptyBits(brickCount * OBSTACLE_WORDS_PER_BRICK, 0);
+	D3D11_BUFFER_DESC bitsDesc = {};
+	bitsDesc.ByteWidth = sizeof(unsigned int) * (unsigned int)emptyBits.size();
+	bitsDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	bitsDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	bitsDesc.StructureByteStride = sizeof(unsigned int);
+	bitsDesc.Usage = D3D11_USAGE_DEFAULT;
 
-		advectionShader->DispatchByThreads(fluidSimGridRes, fluidSimGridRes, fluidSimGridRes);
+	D3D11_SUBRESOURCE_DATA bitsData = {};
+	bitsData.pSysMem = emptyBits.data();
+	device->CreateBuffer(&bitsDesc, &bitsData, obstacleBitsBuffer.GetAddressOf());
 
-		//unbind textures	
-		advectionShader->SetShaderResourceView("InputMap", 0);
-		advectionShader->SetShaderResourceView("VelocityMap", 0);
-		advectionShader->SetUnorderedAccessView("UavOutputMap", 0);
-	}
+	D3D11_SHADER_RESOURCE_VIEW_DESC bitsSRVDesc = brickSRVDesc;
+	bitsSRVDesc.Buffer.NumElements = (unsigned int)emptyBits.size();
+	device->CreateShaderResourceView(obstacleBitsBuffer.Get(), &bitsSRVDesc, obstacleBitsSRV.GetAddressOf());
 
-	//density advection
-	{
-		advectionShader->SetShader();
-		advectionShader->SetFloat("deltaTime", fixedTimeStep);
-		advectionShader->SetInt("gridRes", fluidSimGridRes);
+	//half precision is plenty for how fast something moves
+	obstacleVelocityMap = CreateSRVandUAVTexture(DXGI_FORMAT_R16G16B16A16_FLOAT, 0);
 
-		//advectionShader->CopyBufferData("ExternalData");
-		advectionShader->CopyAllBufferData();
+}
 
-		advectionShader->SetShaderResourceView("InputMap", densityMap[0].srv.Get());
-		advectionShader->SetShaderResourceView("VelocityMap", velocityMap[0].srv.Get());
-		advectionShader->SetUnorderedAccessView("UavOutputMap", densityMap[1].uav.Get());
+Transform* FluidField::GetTransform()
+{
+	return &transform;
+}
 
-		advectionShader->SetSamplerState("LinearClampSampler", linearClampSamplerOptions.Get());
+void FluidField::UpdateFluid(float deltaTime) {
+	//update time counter so we have a consistent delta time for simulation,
+	//a deterministic run owes one step every frame however long it took
+	if (IsDeterministicRun()) {
+		timeCounter = fixedTimeStep;
+	}
+	else {
+		timeCounter += deltaTime;
+	}
 
-		advectionShader->DispatchByThreads(fluidSimGridRes, fluidSimGridRes, fluidSimGridRes);
+	//catch up on every step that's built up, but only so many a frame, if steps
+	//take longer than they simulate then running all of them makes the next frame worse
+	int owedSteps = (int)(timeCounter / fixedTimeStep);
+	lastSubsteps = min(owedSteps, max(maxSubsteps, 1));
+	lastDroppedSteps = owedSteps - lastSubsteps;
+
+	//the worker runs this frame's steps while the frame renders what it finished
+	//before, steps it hasn't got to yet count against this frame's max.
+	//deterministic runs hash each step, so they wait on it instead
+	if (simBackend == FLUID_BACKEND_CPU && asyncCpuSim && !player.IsOpen() && !IsDeterministicRun()) {
+		lastSubsteps = QueueCpuSteps(lastSubsteps, max(maxSubsteps, 1));
+		lastDroppedSteps = owedSteps - lastSubsteps;
+		ShowCpuSimResult();
+		BuildOccupancy();
+
+		timeCounter -= owedSteps * fixedTimeStep;
+		return;
+	}
 
-		//unbind textures	
-		advectionShader->SetShaderResourceView("InputMap", 0);
-		advectionShader->SetShaderResourceView("VelocityMap", 0);
-		advectionShader->SetUnorderedAccessView("UavOutputMap", 0);
+	for (int step = 0; step < lastSubsteps; step++) {
+		//rendering blends from the state before the last step to the one after
+		if (step == lastSubsteps - 1) {
+			Microsoft::WRL::ComPtr<ID3D11Resource> density;
+			Microsoft::WRL::ComPtr<ID3D11Resource> previousDensity;
+			densityMap[0].srv->GetResource(density.GetAddressOf());
+			previousDensityMap.srv->GetResource(previousDensity.GetAddressOf());
+			context->CopyResource(previousDensity.Get(), density.Get());
+			previousDensityValid = true;
+		}
+
+		Simulate(fixedTimeStep);
+
+		//the cpu worker adds its own steps to the recording
+		if (recorder.IsRecording() && simBackend == FLUID_BACKEND_GPU) {
+			RecordFrame();
+		}
+
+		if (IsDeterministicRun() && !player.IsOpen()) {
+			HashStep();
+		}
 	}
 
-	//temperature advection
-	{
-		advectionShader->SetShader();
-		advectionShader->SetFloat("deltaTime", fixedTimeStep);
-		advectionShader->SetInt("gridRes", fluidSimGridRes);
+	//the dropped steps are just lost time, the sim runs slower than real time for a bit
+	timeCounter -= owedSteps * fixedTimeStep;
 
-		//advectionShader->CopyBufferData("ExternalData");
-		advectionShader->CopyAllBufferData();
+	//also picks up resets and loads between steps, they all land before the frame renders
+	BuildOccupancy();
+}
 
-		advectionShader->SetShaderResourceView("InputMap", temperatureMap[0].srv.Get());
-		advectionShader->SetShaderResourceView("VelocityMap", velocityMap[0].srv.Get());
-		advectionShader->SetUnorderedAccessView("UavOutputMap", temperatureMap[1].uav.Get());
+void FluidField::Simulate(float deltaTime)
+{
+	//playback stands in for the sim, each step just moves on a frame
+	if (player.IsOpen()) {
+		playbackFrame = (playbackFrame + 1) % player.GetFrameCount();
+		ShowPlaybackFrame(playbackFrame);
+		return;
+	}
 
-		advectionShader->SetSamplerState("LinearClampSampler", linearClampSamplerOptions.Get());
+	if (simBackend == FLUID_BACKEND_CPU) {
+		SimulateCPU();
+		return;
+	}
 
-		advectionShader->DispatchByThreads(fluidSimGridRes, fluidSimGridRes, fluidSimGridRes);
+	BeginSimTimer();
 
-		//unbind textures	
-		advectionShader->SetShaderResourceView("InputMap", 0);
-		advectionShader->SetShaderResourceView("VelocityMap", 0);
-		advectionShader->SetUnorderedAccessView("UavOutputMap", 0);
+	//work out which bricks to run before any stage does
+	if (sparseBricks) {
+		UpdateBricks();
 	}
+	bricksWereSparse = sparseBricks;
+
+	//every field moves along the velocity from before advection, all in one pass
+	AdvectVolumes({
+		{ velocityMap, XMFLOAT4(0, 0, 0, 0) },
+		{ densityMap, XMFLOAT4(0, 0, 0, 0) },
+		{ temperatureMap, XMFLOAT4(ambientTemperature, 0, 0, 0) }
+	});
 
 	SwapBuffers(velocityMap);
 	SwapBuffers(densityMap);
@@ -263,7 +462,8 @@ void FluidField::Simulate(float deltaTime)
 		injectSmokeShader->SetFloat("injectDensity", injectDensity);
 		injectSmokeShader->SetFloat("injectTemperature", injectTemperature);
 		injectSmokeShader->SetFloat3("injectVelocity", injectVelocityImpulse);
-		injectSmokeShader->SetInt("gridSize", fluidSimGridRes);
+		SetInt3(injectSmokeShader, "gridSize", fluidSimGridRes);
+		SetBrickParams(injectSmokeShader);
 		injectSmokeShader->CopyAllBufferData();
 
 		injectSmokeShader->SetShaderResourceView("DensityMap", densityMap[0].srv.Get());
@@ -272,9 +472,11 @@ void FluidField::Simulate(float deltaTime)
 		injectSmokeShader->SetUnorderedAccessView("DensityOut", densityMap[1].uav.Get());
 		injectSmokeShader->SetUnorderedAccessView("TemperatureOut", temperatureMap[1].uav.Get());
 		injectSmokeShader->SetUnorderedAccessView("VelocityOut", velocityMap[1].uav.Get());
+		SetObstacleViews(injectSmokeShader, true);
 
 		//run compute shader
-		injectSmokeShader->DispatchByThreads(fluidSimGridRes, fluidSimGridRes, fluidSimGridRes);
+		DispatchSimCells(injectSmokeShader);
+		SetObstacleViews(injectSmokeShader, false);
 
 		//unbind
 		injectSmokeShader->SetShaderResourceView("DensityMap", 0);
@@ -298,18 +500,21 @@ void FluidField::Simulate(float deltaTime)
 		buoyancyShader->SetShader();
 		buoyancyShader->SetFloat("deltaTime", fixedTimeStep);
 		buoyancyShader->SetFloat("densityWeight", densityWeight);
-		buoyancyShader->SetFloat("temperatureBouyancy", temperatureBuoyancy);
+		buoyancyShader->SetFloat("temperatureBuoyancy", temperatureBuoyancy);
 		buoyancyShader->SetFloat("ambientTemperature", ambientTemperature);
+		buoyancyShader->SetFloat("vorticityEpsilon", vorticityEpsilon);
+		SetInt3(buoyancyShader, "gridRes", fluidSimGridRes);
+		SetBrickParams(buoyancyShader);
 		buoyancyShader->CopyAllBufferData();
 
 		buoyancyShader->SetShaderResourceView("VelocityMap", velocityMap[0].srv);
 		buoyancyShader->SetShaderResourceView("DensityMap", densityMap[0].srv);
 		buoyancyShader->SetShaderResourceView("TemperatureMap", temperatureMap[0].srv);
-		//for obstacles
-		//bouyancyShader->SetShaderResourceView("ObstacleMap", obstacleMap.srv);
+		SetObstacleViews(buoyancyShader, true);
 		buoyancyShader->SetUnorderedAccessView("VelocityOut", velocityMap[1].uav);
 	
-		buoyancyShader->DispatchByThreads(fluidSimGridRes, fluidSimGridRes, fluidSimGridRes);
+		DispatchSimCells(buoyancyShader);
+		SetObstacleViews(buoyancyShader, false);
 
 		buoyancyShader->SetShaderResourceView("VelocityMap", 0);
 		buoyancyShader->SetShaderResourceView("DensityMap", 0);
@@ -323,9 +528,10 @@ void FluidField::Simulate(float deltaTime)
 	{
 		velocityDivergenceShader->SetShader();
 		velocityDivergenceShader->SetFloat("deltaTime", fixedTimeStep);
-		velocityDivergenceShader->SetFloat("invFluidSimGridRes", invFluidSimGridRes);
-		velocityDivergenceShader->SetInt("gridRes", fluidSimGridRes);
+		velocityDivergenceShader->SetFloat3("invFluidSimGridRes", invFluidSimGridRes);
+		SetInt3(velocityDivergenceShader, "gridRes", fluidSimGridRes);
 
+		SetBrickParams(velocityDivergenceShader);
 		velocityDivergenceShader->CopyBufferData("ExternalData");
 
 		velocityDivergenceShader->SetShaderResourceView("VelocityMap", velocityMap[0].srv.Get());
@@ -333,63 +539,56 @@ void FluidField::Simulate(float deltaTime)
 
 		velocityDivergenceShader->SetSamplerState("PointSampler", pointSamplerOptions.Get());
 
-		velocityDivergenceShader->DispatchByThreads(fluidSimGridRes, fluidSimGridRes, fluidSimGridRes);
+		SetObstacleViews(velocityDivergenceShader, true);
+		DispatchSimCells(velocityDivergenceShader);
+		SetObstacleViews(velocityDivergenceShader, false);
 
 		//unbind textures	
 		velocityDivergenceShader->SetShaderResourceView("VelocityMap", 0);
 		velocityDivergenceShader->SetUnorderedAccessView("UavOutputMap", 0);
 	}
 
-	//clear the pressure tex first
-	clearCompShader->SetShader();
-	clearCompShader->SetFloat4("clearColor", { 0,0,0,0 });
-	clearCompShader->SetInt("channelCount", 1);
-	clearCompShader->CopyAllBufferData();
-
-	clearCompShader->SetUnorderedAccessView("ClearOut1", pressureMap[0].uav);
-	clearCompShader->DispatchByThreads(fluidSimGridRes, fluidSimGridRes, fluidSimGridRes);
-	clearCompShader->SetUnorderedAccessView("ClearOut1", 0);
-
-	//pressure solver, run like 20 times
-	pressureSolverShader->SetShader();
-
-	pressureSolverShader->SetFloat("deltaTime", fixedTimeStep);
-	pressureSolverShader->SetFloat("invFluidSimGridRes", invFluidSimGridRes);
-	pressureSolverShader->SetInt("gridRes", fluidSimGridRes);
-
-	//pressureSolverShader->CopyBufferData("ExternalData");
-	pressureSolverShader->CopyAllBufferData();
-	pressureSolverShader->SetShaderResourceView("VelocityDivergenceMap", velocityDivergenceMap.srv.Get());
-
-	for (int i = 0; i < 20; i++) {
-
-		pressureSolverShader->SetShaderResourceView("PressureMap", pressureMap[0].srv.Get());
-		pressureSolverShader->SetUnorderedAccessView("UavOutputMap", pressureMap[1].uav.Get());
-
-		pressureSolverShader->SetSamplerState("PointSampler", pointSamplerOptions.Get());
-		pressureSolverShader->SetSamplerState("BilinearSampler", bilinearSamplerOptions.Get());
-
-		//dispatch and unbind
-		pressureSolverShader->DispatchByThreads(fluidSimGridRes, fluidSimGridRes, fluidSimGridRes);
+	//last step's pressure is usually close, otherwise start from zero
+	if (!warmStartPressure) {
+		ClearVolume(pressureMap[0], fluidSimGridRes);
+	}
 
-		pressureSolverShader->SetUnorderedAccessView("UavOutputMap", 0);
+	//pressure solver
+	//the dct solve only exists on the cpu, multigrid is the closest gpu option
+	if (pressureSolver == PRESSURE_SOLVER_MULTIGRID || pressureSolver == PRESSURE_SOLVER_SPECTRAL) {
+		SolvePressureMultigrid();
+	}
+	else if (pressureSolver == PRESSURE_SOLVER_CONJUGATE_GRADIENT) {
+		SolvePressureConjugateGradient();
+	}
+	else {
+		//sweep in batches, stopping early once the residual is small enough
+		int sweeps = 0;
+		float residual = MeasurePressureResidual();
+		while (sweeps < pressureIterations && residual > pressureTolerance) {
+			int batch = min(jacobiCheckInterval, pressureIterations - sweeps);
+			RelaxPressure(pressureMap, velocityDivergenceMap, fluidSimGridRes, batch, 1.0f);
+			sweeps += batch;
+			residual = MeasurePressureResidual();
+		}
+		lastPressureIterations = sweeps;
+		lastPressureResidual = residual;
+	}
 
-		//swap pressure buffers for next solver pass
-		SwapBuffers(pressureMap);
+	if (warmStartPressure) {
+		RemovePressureMean();
 	}
-	pressureSolverShader->SetShaderResourceView("PressureMap", 0);
-	pressureSolverShader->SetUnorderedAccessView("UavOutputMap", 0);
-	pressureSolverShader->SetShaderResourceView("VelocityDivergenceMap", 0);
 
 	//pressure projection
 	{
 		pressureProjectionShader->SetShader();
 
 		pressureProjectionShader->SetFloat("deltaTime", fixedTimeStep);
-		pressureProjectionShader->SetFloat("invFluidSimGridRes", invFluidSimGridRes);
-		pressureProjectionShader->SetInt("gridRes", fluidSimGridRes);
+		pressureProjectionShader->SetFloat3("invFluidSimGridRes", invFluidSimGridRes);
+		SetInt3(pressureProjectionShader, "gridRes", fluidSimGridRes);
 
 		//pressureProjectionShader->CopyBufferData("ExternalData");
+		SetBrickParams(pressureProjectionShader);
 		pressureProjectionShader->CopyAllBufferData();
 
 		pressureProjectionShader->SetShaderResourceView("VelocityMap", velocityMap[0].srv.Get());
@@ -398,93 +597,2082 @@ void FluidField::Simulate(float deltaTime)
 
 		pressureProjectionShader->SetSamplerState("PointSampler", pointSamplerOptions.Get());
 
+		SetObstacleViews(pressureProjectionShader, true);
+
 		//dispatch and unbind
-		pressureProjectionShader->DispatchByThreads(fluidSimGridRes, fluidSimGridRes, fluidSimGridRes);
+		DispatchSimCells(pressureProjectionShader);
+		SetObstacleViews(pressureProjectionShader, false);
 
 		pressureProjectionShader->SetShaderResourceView("VelocityMap", 0);
 		pressureProjectionShader->SetShaderResourceView("PressureMap", 0);
 		pressureProjectionShader->SetUnorderedAccessView("UavOutputMap", 0);
 	}
 	SwapBuffers(velocityMap);
+
+	EndSimTimer();
 }
 
-void FluidField::RenderFluid(std::shared_ptr<Camera> camera) {
-	context->OMSetDepthStencilState(depthState.Get(), 0);
-	context->OMSetBlendState(blendState.Get(), 0, 0xFFFFFFFF);
-	context->RSSetState(rasterState.Get());
+void FluidField::AdvectVolumes(const std::vector<AdvectedField>& fields)
+{
+	bool maccormack = advectionScheme == ADVECTION_MACCORMACK;
+
+	for (size_t first = 0; first < fields.size(); first += MAX_ADVECTED_FIELDS) {
+		int fieldCount = (int)min(fields.size() - first, (size_t)MAX_ADVECTED_FIELDS);
+
+		XMFLOAT4 solidValues[MAX_ADVECTED_FIELDS] = {};
+		for (int i = 0; i < fieldCount; i++) {
+			solidValues[i] = fields[first + i].solidValue;
+			if (maccormack && !advectionScratch[i].srv) {
+				advectionScratch[i] = CreateSRVandUAVTexture(DXGI_FORMAT_R32G32B32A32_FLOAT, 0);
+				//bricks that are already inactive never get a forward result written
+				context->ClearUnorderedAccessViewFloat(advectionScratch[i].uav.Get(), &solidValues[i].x);
+			}
+			advectionScratchClear[i] = solidValues[i];
+		}
 
-	//get the smallest dimension and use for scaling
-	//which for now is the same since we have a perfect cube
-	float smallestDimension = (float)fluidSimGridRes;
-	//XMFLOAT3 scale = { (float)fluidSimGridRes, (float)fluidSimGridRes, (float)fluidSimGridRes };
-	XMFLOAT3 scale = { 1.0f, 1.0f, 1.0f };
+		advectionShader->SetShader();
+		advectionShader->SetFloat("deltaTime", fixedTimeStep);
+		SetInt3(advectionShader, "gridRes", fluidSimGridRes);
+		advectionShader->SetInt("fieldCount", fieldCount);
+		advectionShader->SetData("solidValues", solidValues, sizeof(solidValues));
 
-	//cube location
-	XMFLOAT3 translation(0, 0, 0);
+		SetBrickParams(advectionShader);
+		advectionShader->CopyAllBufferData();
 
-	volumePS->SetShader();
-	volumeVS->SetShader();
+		//maccormack keeps the semi-lagrangian step aside to correct it
+		advectionShader->SetShaderResourceView("VelocityMap", velocityMap[0].srv.Get());
+		for (int i = 0; i < fieldCount; i++) {
+			VolumeResource* volumes = fields[first + i].volumes;
+			VolumeResource& forward = maccormack ? advectionScratch[i] : volumes[1];
+			advectionShader->SetShaderResourceView("InputMap" + std::to_string(i), volumes[0].srv.Get());
+			advectionShader->SetUnorderedAccessView("UavOutputMap" + std::to_string(i), forward.uav.Get());
+		}
 
-	//world mat for vertex shader
-	XMMATRIX worldMat = XMMatrixScaling(scale.x, scale.y, scale.z) *
-		XMMatrixTranslation(translation.x, translation.y, translation.z);
+		advectionShader->SetSamplerState("LinearClampSampler", linearClampSamplerOptions.Get());
+		SetObstacleViews(advectionShader, true);
 
-	XMFLOAT4X4 world, invWorld;
-	XMStoreFloat4x4(&world, worldMat);
-	XMStoreFloat4x4(&invWorld, XMMatrixInverse(0, worldMat));
-	volumeVS->SetMatrix4x4("world", world);
-	volumeVS->SetMatrix4x4("view", camera->GetView());
-	volumeVS->SetMatrix4x4("projection", camera->GetProjection());
-	volumeVS->CopyAllBufferData();
-	//should be linear clamp
-	volumeVS->SetSamplerState("SamplerLinearClamp", linearClampSamplerOptions);
+		DispatchSimCells(advectionShader);
+		SetObstacleViews(advectionShader, false);
 
-	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv = densityMap[0].srv;
-	//this where code to switch which srv is being displayed would go
+		//unbind textures
+		advectionShader->SetShaderResourceView("VelocityMap", 0);
+		for (int i = 0; i < fieldCount; i++) {
+			advectionShader->SetShaderResourceView("InputMap" + std::to_string(i), 0);
+			advectionShader->SetUnorderedAccessView("UavOutputMap" + std::to_string(i), 0);
+		}
+
+		if (!maccormack) {
+			continue;
+		}
+
+		macCormackShader->SetShader();
+		macCormackShader->SetFloat("deltaTime", fixedTimeStep);
+		SetInt3(macCormackShader, "gridRes", fluidSimGridRes);
+		macCormackShader->SetInt("fieldCount", fieldCount);
+		macCormackShader->SetData("solidValues", solidValues, sizeof(solidValues));
+
+		SetBrickParams(macCormackShader);
+		macCormackShader->CopyAllBufferData();
+
+		macCormackShader->SetShaderResourceView("VelocityMap", velocityMap[0].srv.Get());
+		for (int i = 0; i < fieldCount; i++) {
+			VolumeResource* volumes = fields[first + i].volumes;
+			macCormackShader->SetShaderResourceView("InputMap" + std::to_string(i), volumes[0].srv.Get());
+			macCormackShader->SetShaderResourceView("ForwardMap" + std::to_string(i), advectionScratch[i].srv.Get());
+			macCormackShader->SetUnorderedAccessView("UavOutputMap" + std::to_string(i), volumes[1].uav.Get());
+		}
+
+		macCormackShader->SetSamplerState("LinearClampSampler", linearClampSamplerOptions.Get());
+		SetObstacleViews(macCormackShader, true);
+
+		DispatchSimCells(macCormackShader);
+		SetObstacleViews(macCormackShader, false);
+
+		macCormackShader->SetShaderResourceView("VelocityMap", 0);
+		for (int i = 0; i < fieldCount; i++) {
+			macCormackShader->SetShaderResourceView("InputMap" + std::to_string(i), 0);
+			macCormackShader->SetShaderResourceView("ForwardMap" + std::to_string(i), 0);
+			macCormackShader->SetUnorderedAccessView("UavOutputMap" + std::to_string(i), 0);
+		}
+	}
+}
 
-	volumePS->SetShaderResourceView("VolumeTexture", srv);
+void FluidField::SetGridResolution(int resX, int resY, int resZ)
+{
+	if (resX == fluidSimGridRes.x && resY == fluidSimGridRes.y && resZ == fluidSimGridRes.z) {
+		return;
+	}
 
-	volumePS->SetMatrix4x4("invWorld", invWorld);
-	volumePS->SetFloat3("cameraPosition", camera->GetTransform()->GetPosition());
-	volumePS->SetFloat3("fluidColor", fluidColor);
-	volumePS->SetInt("renderMode", 0);
-	volumePS->SetInt("raymarchSamples", raymarchSamples);
-	volumePS->CopyAllBufferData();
+	//the recording's frames are all one size, and playback only fits its own grid
+	StopRecording();
+	if (player.IsOpen() && (resX != player.GetResX() || resY != player.GetResY() || resZ != player.GetResZ())) {
+		StopPlayback();
+	}
 
-	//cube mesh to render fluid within
-	cube->SetBuffersAndDraw(context);
+	//the obstacle grid the cpu worker reads is about to be replaced
+	WaitForCpuSim();
+
+	//hold on to the current state so it can be resampled once everything is rebuilt
+	XMINT3 oldGridRes = fluidSimGridRes;
+	VolumeResource oldVelocity = velocityMap[0];
+	VolumeResource oldDensity = densityMap[0];
+	VolumeResource oldTemperature = temperatureMap[0];
+
+	fluidSimGridRes = XMINT3(resX, resY, resZ);
+	cpuSimGeneration++;
+	CreateGridResources();
+
+	//velocity is in cells per step, so each component stretches with its axis
+	XMFLOAT4 velocityScale(
+		(float)resX / oldGridRes.x,
+		(float)resY / oldGridRes.y,
+		(float)resZ / oldGridRes.z,
+		1.0f);
+	ResampleVolume(oldVelocity, velocityMap[0], velocityScale);
+	ResampleVolume(oldDensity, densityMap[0], XMFLOAT4(1, 1, 1, 1));
+	ResampleVolume(oldTemperature, temperatureMap[0], XMFLOAT4(1, 1, 1, 1));
+
+	//pressure starts over from zero, the next solve rebuilds it from the resampled velocity
+	if (cpuSolver) {
+		cpuSolver->Resize(resX, resY, resZ);
+		cpuSolver->SetObstacles(obstacles.get());
+	}
 
+	//the brick buffers are new, so sparse mode has to start over as well
+	bricksWereSparse = false;
+}
 
-	// Reset render states
-	context->OMSetDepthStencilState(0, 0);
-	context->OMSetBlendState(0, 0, 0xFFFFFFFF);
-	context->RSSetState(0);
+void FluidField::SetFieldPrecision(FieldPrecisionPolicy policy)
+{
+	if (!halfPressureSupported) {
+		policy.pressure = FIELD_PRECISION_FLOAT32;
+	}
+	if (policy.velocity == fieldPrecision.velocity && policy.density == fieldPrecision.density &&
+		policy.temperature == fieldPrecision.temperature && policy.pressure == fieldPrecision.pressure) {
+		return;
+	}
+
+	//the readback copies are in the old formats
+	StopRecording();
+
+	VolumeResource oldVelocity = velocityMap[0];
+	VolumeResource oldDensity = densityMap[0];
+	VolumeResource oldTemperature = temperatureMap[0];
+	VolumeResource oldPressure = pressureMap[0];
+
+	fieldPrecision = policy;
+	cpuSimGeneration++;
+	CreateFieldVolumes();
+
+	//same size, so the resample lands on texel centers and is a straight copy
+	XMFLOAT4 copyScale(1, 1, 1, 1);
+	ResampleVolume(oldVelocity, velocityMap[0], copyScale);
+	ResampleVolume(oldDensity, densityMap[0], copyScale);
+	ResampleVolume(oldTemperature, temperatureMap[0], copyScale);
+	ResampleVolume(oldPressure, pressureMap[0], copyScale);
 }
 
-void FluidField::SwapBuffers(VolumeResource vr[2]) {
-	//swap the buffers
-	VolumeResource temp = vr[0];
-	vr[0] = vr[1];
-	vr[1] = temp;
+void FluidField::CreateFieldVolumes()
+{
+	velocityMap[0] = CreateSRVandUAVTexture(GetFieldFormat(fieldPrecision.velocity, true), 0);
+	velocityMap[1] = CreateSRVandUAVTexture(GetFieldFormat(fieldPrecision.velocity, true), 0);
+
+	densityMap[0] = CreateSRVandUAVTexture(GetFieldFormat(fieldPrecision.density, true), 0);
+	densityMap[1] = CreateSRVandUAVTexture(GetFieldFormat(fieldPrecision.density, true), 0);
+
+	temperatureMap[0] = CreateSRVandUAVTexture(GetFieldFormat(fieldPrecision.temperature, false), 0);
+	temperatureMap[1] = CreateSRVandUAVTexture(GetFieldFormat(fieldPrecision.temperature, false), 0);
+
+	pressureMap[0] = CreateSRVandUAVTexture(GetFieldFormat(fieldPrecision.pressure, false), 0);
+	pressureMap[1] = CreateSRVandUAVTexture(GetFieldFormat(fieldPrecision.pressure, false), 0);
+
+	//has to match densityMap to copy into, it's filled in before the next step
+	previousDensityMap = CreateSRVandUAVTexture(GetFieldFormat(fieldPrecision.density, true), 0);
+	previousDensityValid = false;
 }
 
-void FluidField::SwapPressureBuffers() {
-	//swap the buffers
-	//Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> temp = pressureMapSRVs[0];
-	//pressureMapSRVs[0] = pressureMapSRVs[1];
-	//pressureMapSRVs[1] = temp;
-	//
-	//Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> uavTemp = pressureMapUAVs[0];
-	//pressureMapUAVs[0] = pressureMapUAVs[1];
-	//pressureMapUAVs[1] = uavTemp;
+DXGI_FORMAT FluidField::GetFieldFormat(FieldPrecision precision, bool fourChannels)
+{
+	if (precision == FIELD_PRECISION_FLOAT16) {
+		return fourChannels ? DXGI_FORMAT_R16G16B16A16_FLOAT : DXGI_FORMAT_R16_FLOAT;
+	}
+	return fourChannels ? DXGI_FORMAT_R32G32B32A32_FLOAT : DXGI_FORMAT_R32_FLOAT;
 }
 
-FluidField::VolumeResource FluidField::CreateSRVandUAVTexture(DXGI_FORMAT format, void* initialData) {
+float FluidField::GetFieldMemoryMB()
+{
+	float cellCount = (float)fluidSimGridRes.x * fluidSimGridRes.y * fluidSimGridRes.z;
+	return GetFieldBytesPerCell(fieldPrecision) * cellCount / (1024.0f * 1024.0f);
+}
+
+void FluidField::ResampleVolume(VolumeResource& source, VolumeResource& destination, XMFLOAT4 valueScale)
+{
+	resampleVolumeShader->SetShader();
+	resampleVolumeShader->SetFloat4("valueScale", valueScale);
+	SetInt3(resampleVolumeShader, "gridRes", fluidSimGridRes);
+	resampleVolumeShader->CopyAllBufferData();
+
+	resampleVolumeShader->SetShaderResourceView("InputMap", source.srv.Get());
+	resampleVolumeShader->SetUnorderedAccessView("UavOutputMap", destination.uav.Get());
+	resampleVolumeShader->SetSamplerState("LinearClampSampler", linearClampSamplerOptions.Get());
+
+	resampleVolumeShader->DispatchByThreads(fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z);
+
+	resampleVolumeShader->SetShaderResourceView("InputMap", 0);
+	resampleVolumeShader->SetUnorderedAccessView("UavOutputMap", 0);
+}
+
+bool FluidField::SetInt3(std::shared_ptr<SimpleComputeShader> shader, std::string name, XMINT3 value)
+{
+	return shader->SetData(name, &value, sizeof(XMINT3));
+}
+
+void FluidField::SetSimBackend(FluidSimBackend backend) {
+	WaitForCpuSim();
+
+	if (backend == FLUID_BACKEND_CPU) {
+		//only spin up the worker threads once someone asks for them
+		if (!cpuSolver) {
+			cpuSolver = std::make_shared<FluidSolverCPU>(fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z, cpuThreadCount);
+			cpuSolver->SetObstacles(obstacles.get());
+			cpuWorker = std::make_unique<FluidSimWorker>(cpuSolver.get());
+		}
+		cpuSolver->Reset();
+	}
+
+	simBackend = backend;
+}
+
+void FluidField::SetCpuThreadCount(unsigned int threadCount)
+{
+	cpuThreadCount = threadCount;
+	if (cpuSolver) {
+		WaitForCpuSim();
+		cpuSolver->SetThreadCount(threadCount);
+	}
+}
+
+unsigned int FluidField::GetCpuThreadCount()
+{
+	return cpuSolver ? cpuSolver->GetThreadCount() : cpuThreadCount;
+}
+
+void FluidField::SimulateCPU()
+{
+	//same worker as async mode, just waited on straight away
+	QueueCpuSteps(1, 1);
+	WaitForCpuSim();
+	ShowCpuSimResult();
+}
+
+int FluidField::QueueCpuSteps(int steps, int maxQueued)
+{
+	FluidSimSettings settings;
+	CopySimSettings(&settings);
+
+	//gpu frames still being read back go in before the worker adds any
+	FluidRecorder* stepRecorder = nullptr;
+	if (recorder.IsRecording()) {
+		FlushRecordingReadbacks();
+		stepRecorder = &recorder;
+	}
+
+	return cpuWorker->QueueSteps(steps, maxQueued, settings, fieldPrecision.density == FIELD_PRECISION_FLOAT16, cpuSimGeneration, stepRecorder);
+}
+
+void FluidField::ShowCpuSimResult()
+{
+	if (!cpuWorker->AcquireDensity()) {
+		return;
+	}
+
+	//texels finished before a resize or precision change don't fit the volume anymore,
+	//even when they happen to be the same number of bytes
+	if (cpuWorker->GetDensityGeneration() != cpuSimGeneration) {
+		return;
+	}
+	bool half = fieldPrecision.density == FIELD_PRECISION_FLOAT16;
+	const std::vector<unsigned char>& texels = cpuWorker->GetDensity();
+
+	//rendering blends from the last finished density to this one
+	Microsoft::WRL::ComPtr<ID3D11Resource> density;
+	Microsoft::WRL::ComPtr<ID3D11Resource> previousDensity;
+	densityMap[0].srv->GetResource(density.GetAddressOf());
+	previousDensityMap.srv->GetResource(previousDensity.GetAddressOf());
+	context->CopyResource(previousDensity.Get(), density.Get());
+	previousDensityValid = true;
+
+	UploadVolumeTexels(densityMap[0], texels.data(), 4, half, half);
+}
+
+void FluidField::WaitForCpuSim()
+{
+	if (cpuWorker) {
+		cpuWorker->Wait();
+	}
+}
+
+bool FluidField::StartRecording(const std::string& path)
+{
+	StopRecording();
+	StopPlayback();
+
+	if (!recorder.Start(path, fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z, fixedTimeStep)) {
+		return false;
+	}
+
+	for (RecordingReadback& readback : recordingReadbacks) {
+		readback.density = CreateStagingVolume(densityMap[0]);
+		readback.temperature = CreateStagingVolume(temperatureMap[0]);
+		readback.pending = false;
+	}
+	recordingReadbackIndex = 0;
+	return true;
+}
+
+void FluidField::StopRecording()
+{
+	if (!recorder.IsRecording()) {
+		return;
+	}
+
+	//the cpu worker may be adding a step right now
+	WaitForCpuSim();
+	FlushRecordingReadbacks();
+	recorder.Stop();
+
+	for (RecordingReadback& readback : recordingReadbacks) {
+		readback.density.Reset();
+		readback.temperature.Reset();
+	}
+}
+
+void FluidField::RecordFrame()
+{
+	int cellCount = fluidSimGridRes.x * fluidSimGridRes.y * fluidSimGridRes.z;
+	recordDensity.resize(cellCount * 4);
+	recordTemperature.resize(cellCount);
+
+	//the slot being reused was copied RECORDING_READBACK_COUNT steps ago, so it's ready by now
+	RecordingReadback& readback = recordingReadbacks[recordingReadbackIndex];
+	if (readback.pending) {
+		ReadStagingVolume(readback.density.Get(), 4, fieldPrecision.density == FIELD_PRECISION_FLOAT16, recordDensity.data());
+		ReadStagingVolume(readback.temperature.Get(), 1, fieldPrecision.temperature == FIELD_PRECISION_FLOAT16, recordTemperature.data());
+		recorder.AddFrame(recordDensity.data(), recordTemperature.data());
+	}
+
+	Microsoft::WRL::ComPtr<ID3D11Resource> density;
+	Microsoft::WRL::ComPtr<ID3D11Resource> temperature;
+	densityMap[0].srv->GetResource(density.GetAddressOf());
+	temperatureMap[0].srv->GetResource(temperature.GetAddressOf());
+	context->CopyResource(readback.density.Get(), density.Get());
+	context->CopyResource(readback.temperature.Get(), temperature.Get());
+	readback.pending = true;
+
+	recordingReadbackIndex = (recordingReadbackIndex + 1) % RECORDING_READBACK_COUNT;
+}
+
+void FluidField::FlushRecordingReadbacks()
+{
+	int cellCount = fluidSimGridRes.x * fluidSimGridRes.y * fluidSimGridRes.z;
+	recordDensity.resize(cellCount * 4);
+	recordTemperature.resize(cellCount);
+
+	//the next slot to be reused holds the oldest copy
+	for (int i = 0; i < RECORDING_READBACK_COUNT; i++) {
+		RecordingReadback& readback = recordingReadbacks[(recordingReadbackIndex + i) % RECORDING_READBACK_COUNT];
+		if (!readback.pending) {
+			continue;
+		}
+
+		ReadStagingVolume(readback.density.Get(), 4, fieldPrecision.density == FIELD_PRECISION_FLOAT16, recordDensity.data());
+		ReadStagingVolume(readback.temperature.Get(), 1, fieldPrecision.temperature == FIELD_PRECISION_FLOAT16, recordTemperature.data());
+		recorder.AddFrame(recordDensity.data(), recordTemperature.data());
+		readback.pending = false;
+	}
+}
+
+Microsoft::WRL::ComPtr<ID3D11Texture3D> FluidField::CreateStagingVolume(VolumeResource& vr)
+{
+	Microsoft::WRL::ComPtr<ID3D11Resource> resource;
+	Microsoft::WRL::ComPtr<ID3D11Texture3D> texture;
+	vr.srv->GetResource(resource.GetAddressOf());
+	resource.As(&texture);
+
+	D3D11_TEXTURE3D_DESC desc;
+	texture->GetDesc(&desc);
+	desc.BindFlags = 0;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	desc.Usage = D3D11_USAGE_STAGING;
+
+	Microsoft::WRL::ComPtr<ID3D11Texture3D> staging;
+	device->CreateTexture3D(&desc, 0, staging.GetAddressOf());
+	return staging;
+}
+
+void FluidField::ReadStagingVolume(ID3D11Texture3D* staging, int channels, bool half, uint16_t* out)
+{
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (FAILED(context->Map(staging, 0, D3D11_MAP_READ, 0, &mapped))) {
+		return;
+	}
+
+	//rows can be padded, so go a row at a time
+	int rowValues = fluidSimGridRes.x * channels;
+	for (int z = 0; z < fluidSimGridRes.z; z++) {
+		for (int y = 0; y < fluidSimGridRes.y; y++) {
+			const unsigned char* row = (const unsigned char*)mapped.pData + z * mapped.DepthPitch + y * mapped.RowPitch;
+			uint16_t* destination = out + (z * fluidSimGridRes.y + y) * rowValues;
+			if (half) {
+				memcpy(destination, row, rowValues * sizeof(uint16_t));
+			}
+			else {
+				FloatToHalf((const float*)row, destination, rowValues);
+			}
+		}
+	}
+
+	context->Unmap(staging, 0);
+}
+
+bool FluidField::StartPlayback(const std::string& path)
+{
+	StopRecording();
+	StopPlayback();
+
+	if (!player.Open(path)) {
+		return false;
+	}
+
+	//whatever the grid held is replaced by the first frame straight away
+	SetGridResolution(player.GetResX(), player.GetResY(), player.GetResZ());
+	SeekPlayback(0);
+	return true;
+}
+
+void FluidField::StopPlayback()
+{
+	player.Close();
+	playbackFrame = 0;
+}
+
+void FluidField::SeekPlayback(int frame)
+{
+	if (!player.IsOpen()) {
+		return;
+	}
+
+	playbackFrame = min(max(frame, 0), player.GetFrameCount() - 1);
+	ShowPlaybackFrame(playbackFrame);
+
+	//blending across the jump would smear two unrelated frames together
+	previousDensityValid = false;
+}
+
+void FluidField::ShowPlaybackFrame(int frame)
+{
+	const uint16_t* density;
+	const uint16_t* temperature;
+	if (!player.GetFrame(frame, &density, &temperature)) {
+		return;
+	}
+
+	//temperature isn't rendered, but it keeps the volumes consistent if the sim takes over again
+	UploadHalfVolume(densityMap[0], density, 4, fieldPrecision.density == FIELD_PRECISION_FLOAT16);
+	UploadHalfVolume(temperatureMap[0], temperature, 1, fieldPrecision.temperature == FIELD_PRECISION_FLOAT16);
+}
+
+void FluidField::UploadHalfVolume(VolumeResource& vr, const uint16_t* values, int channels, bool half)
+{
+	Microsoft::WRL::ComPtr<ID3D11Resource> texture;
+	vr.srv->GetResource(texture.GetAddressOf());
+
+	int rowValues = fluidSimGridRes.x * channels;
+	if (half) {
+		context->UpdateSubresource(texture.Get(), 0, 0, values,
+			rowValues * sizeof(uint16_t),
+			rowValues * sizeof(uint16_t) * fluidSimGridRes.y);
+		return;
+	}
+
+	playbackUpload.resize(rowValues * fluidSimGridRes.y * fluidSimGridRes.z);
+	HalfToFloat(values, playbackUpload.data(), (int)playbackUpload.size());
+	context->UpdateSubresource(texture.Get(), 0, 0, playbackUpload.data(),
+		rowValues * sizeof(float),
+		rowValues * sizeof(float) * fluidSimGridRes.y);
+}
+
+//cpu solver channels behind each checkpointed volume, velocity's w is always zero
+static const FluidChannel checkpointVelocityChannels[4] = { VELOCITY_X, VELOCITY_Y, VELOCITY_Z, CHANNEL_COUNT };
+static const FluidChannel checkpointDensityChannels[4] = { COLOR_R, COLOR_G, COLOR_B, DENSITY };
+static const FluidChannel checkpointTemperatureChannel = TEMPERATURE;
+static const FluidChannel checkpointPressureChannel = PRESSURE;
+
+bool FluidField::SaveCheckpoint(const std::string& path)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		return false;
+	}
+
+	FluidCheckpointHeader header = {};
+	memcpy(header.magic, "FLCK", 4);
+	header.version = CHECKPOINT_VERSION;
+	header.gridRes[0] = fluidSimGridRes.x;
+	header.gridRes[1] = fluidSimGridRes.y;
+	header.gridRes[2] = fluidSimGridRes.z;
+	header.precision[0] = fieldPrecision.velocity;
+	header.precision[1] = fieldPrecision.density;
+	header.precision[2] = fieldPrecision.temperature;
+	header.precision[3] = fieldPrecision.pressure;
+	header.previousDensityValid = previousDensityValid;
+	header.fixedTimeStep = fixedTimeStep;
+	header.timeCounter = timeCounter;
+
+	header.ambientTemperature = ambientTemperature;
+	header.injectTemperature = injectTemperature;
+	header.injectDensity = injectDensity;
+	header.injectRadius = injectRadius;
+	header.injectVelocityImpulseScale = injectVelocityImpulseScale;
+	header.temperatureBuoyancy = temperatureBuoyancy;
+	header.densityWeight = densityWeight;
+	header.velocityDamper = velocityDamper;
+	header.densityDamper = densityDamper;
+	header.temperatureDamper = temperatureDamper;
+	header.vorticityEpsilon = vorticityEpsilon;
+	memcpy(header.injectPosition, &injectPosition, sizeof(header.injectPosition));
+	memcpy(header.injectVelocityImpulse, &injectVelocityImpulse, sizeof(header.injectVelocityImpulse));
+	memcpy(header.fluidColor, &fluidColor, sizeof(header.fluidColor));
+
+	//on the cpu backend the solver has the live fields, the gpu volumes only get density.
+	WaitForCpuSim();
+	//the [1] halves of the ping-pong pairs are overwritten before they're read, so they're left out
+	std::vector<unsigned char> volumes[CHECKPOINT_VOLUME_COUNT];
+	if (simBackend == FLUID_BACKEND_CPU) {
+		GatherSolverTexels(checkpointVelocityChannels, 4, fieldPrecision.velocity == FIELD_PRECISION_FLOAT16, volumes[CHECKPOINT_VELOCITY]);
+		GatherSolverTexels(checkpointDensityChannels, 4, fieldPrecision.density == FIELD_PRECISION_FLOAT16, volumes[CHECKPOINT_DENSITY]);
+		GatherSolverTexels(&checkpointTemperatureChannel, 1, fieldPrecision.temperature == FIELD_PRECISION_FLOAT16, volumes[CHECKPOINT_TEMPERATURE]);
+		GatherSolverTexels(&checkpointPressureChannel, 1, fieldPrecision.pressure == FIELD_PRECISION_FLOAT16, volumes[CHECKPOINT_PRESSURE]);
+	}
+	else {
+		ReadVolumeTexels(velocityMap[0], volumes[CHECKPOINT_VELOCITY]);
+		ReadVolumeTexels(densityMap[0], volumes[CHECKPOINT_DENSITY]);
+		ReadVolumeTexels(temperatureMap[0], volumes[CHECKPOINT_TEMPERATURE]);
+		ReadVolumeTexels(pressureMap[0], volumes[CHECKPOINT_PRESSURE]);
+	}
+	ReadVolumeTexels(previousDensityMap, volumes[CHECKPOINT_PREVIOUS_DENSITY]);
+
+	uint64_t offset = sizeof(header);
+	for (int v = 0; v < CHECKPOINT_VOLUME_COUNT; v++) {
+		offset = (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+		header.volumeOffsets[v] = offset;
+		header.volumeSizes[v] = volumes[v].size();
+		offset += volumes[v].size();
+	}
+
+	file.write((const char*)&header, sizeof(header));
+	uint64_t written = sizeof(header);
+	std::vector<char> padding(CHECKPOINT_ALIGNMENT, 0);
+	for (int v = 0; v < CHECKPOINT_VOLUME_COUNT; v++) {
+		file.write(padding.data(), header.volumeOffsets[v] - written);
+		file.write((const char*)volumes[v].data(), volumes[v].size());
+		written = header.volumeOffsets[v] + volumes[v].size();
+	}
+
+	return file.good();
+}
+
+bool FluidField::LoadCheckpoint(const std::string& path)
+{
+	MappedFile file;
+	if (!file.Open(path) || file.GetSize() < sizeof(FluidCheckpointHeader)) {
+		return false;
+	}
+
+	FluidCheckpointHeader header;
+	memcpy(&header, file.GetData(), sizeof(header));
+	if (memcmp(header.magic, "FLCK", 4) != 0 || header.version != CHECKPOINT_VERSION ||
+		header.gridRes[0] <= 0 || header.gridRes[1] <= 0 || header.gridRes[2] <= 0) {
+		return false;
+	}
+	for (uint32_t precision : header.precision) {
+		if (precision != FIELD_PRECISION_FLOAT32 && precision != FIELD_PRECISION_FLOAT16) {
+			return false;
+		}
+	}
+
+	//every volume has to be the size its grid and format say, and be inside the file
+	static const int volumeChannels[CHECKPOINT_VOLUME_COUNT] = { 4, 4, 1, 1, 4 };
+	bool volumeHalf[CHECKPOINT_VOLUME_COUNT] = {
+		header.precision[0] == FIELD_PRECISION_FLOAT16,
+		header.precision[1] == FIELD_PRECISION_FLOAT16,
+		header.precision[2] == FIELD_PRECISION_FLOAT16,
+		header.precision[3] == FIELD_PRECISION_FLOAT16,
+		header.precision[1] == FIELD_PRECISION_FLOAT16
+	};
+	uint64_t cellCount = (uint64_t)header.gridRes[0] * header.gridRes[1] * header.gridRes[2];
+	for (int v = 0; v < CHECKPOINT_VOLUME_COUNT; v++) {
+		uint64_t expected = cellCount * volumeChannels[v] * (volumeHalf[v] ? 2 : 4);
+		uint64_t offset = header.volumeOffsets[v];
+		if (header.volumeSizes[v] != expected || offset % CHECKPOINT_ALIGNMENT != 0 ||
+			offset > file.GetSize() || file.GetSize() - offset < expected) {
+			return false;
+		}
+	}
+
+	StopRecording();
+	StopPlayback();
+
+	//match the saved grid and formats so the texels upload as they are
+	SetGridResolution(header.gridRes[0], header.gridRes[1], header.gridRes[2]);
+	FieldPrecisionPolicy policy;
+	policy.velocity = (FieldPrecision)header.precision[0];
+	policy.density = (FieldPrecision)header.precision[1];
+	policy.temperature = (FieldPrecision)header.precision[2];
+	policy.pressure = (FieldPrecision)header.precision[3];
+	SetFieldPrecision(policy);
+
+	const unsigned char* data = file.GetData();
+	const unsigned char* velocity = data + header.volumeOffsets[CHECKPOINT_VELOCITY];
+	const unsigned char* density = data + header.volumeOffsets[CHECKPOINT_DENSITY];
+	const unsigned char* temperature = data + header.volumeOffsets[CHECKPOINT_TEMPERATURE];
+	const unsigned char* pressure = data + header.volumeOffsets[CHECKPOINT_PRESSURE];
+	const unsigned char* previousDensity = data + header.volumeOffsets[CHECKPOINT_PREVIOUS_DENSITY];
+
+	//pressure is the only one that can differ, half pressure saved where it isn't supported
+	UploadVolumeTexels(velocityMap[0], velocity, 4, volumeHalf[CHECKPOINT_VELOCITY], fieldPrecision.velocity == FIELD_PRECISION_FLOAT16);
+	UploadVolumeTexels(densityMap[0], density, 4, volumeHalf[CHECKPOINT_DENSITY], fieldPrecision.density == FIELD_PRECISION_FLOAT16);
+	UploadVolumeTexels(temperatureMap[0], temperature, 1, volumeHalf[CHECKPOINT_TEMPERATURE], fieldPrecision.temperature == FIELD_PRECISION_FLOAT16);
+	UploadVolumeTexels(pressureMap[0], pressure, 1, volumeHalf[CHECKPOINT_PRESSURE], fieldPrecision.pressure == FIELD_PRECISION_FLOAT16);
+	UploadVolumeTexels(previousDensityMap, previousDensity, 4, volumeHalf[CHECKPOINT_PREVIOUS_DENSITY], fieldPrecision.density == FIELD_PRECISION_FLOAT16);
+	previousDensityValid = header.previousDensityValid != 0;
+
+	if (simBackend == FLUID_BACKEND_CPU) {
+		//anything the worker finished before now would paint over the loaded density
+		WaitForCpuSim();
+		cpuWorker->AcquireDensity();
+
+		ScatterSolverTexels(checkpointVelocityChannels, 4, volumeHalf[CHECKPOINT_VELOCITY], velocity);
+		ScatterSolverTexels(checkpointDensityChannels, 4, volumeHalf[CHECKPOINT_DENSITY], density);
+		ScatterSolverTexels(&checkpointTemperatureChannel, 1, volumeHalf[CHECKPOINT_TEMPERATURE], temperature);
+		ScatterSolverTexels(&checkpointPressureChannel, 1, volumeHalf[CHECKPOINT_PRESSURE], pressure);
+	}
+
+	//the brick flags describe the old contents
+	bricksWereSparse = false;
+
+	fixedTimeStep = header.fixedTimeStep;
+	timeCounter = header.timeCounter;
+	ambientTemperature = header.ambientTemperature;
+	injectTemperature = header.injectTemperature;
+	injectDensity = header.injectDensity;
+	injectRadius = header.injectRadius;
+	injectVelocityImpulseScale = header.injectVelocityImpulseScale;
+	temperatureBuoyancy = header.temperatureBuoyancy;
+	densityWeight = header.densityWeight;
+	velocityDamper = header.velocityDamper;
+	densityDamper = header.densityDamper;
+	temperatureDamper = header.temperatureDamper;
+	vorticityEpsilon = header.vorticityEpsilon;
+	memcpy(&injectPosition, header.injectPosition, sizeof(header.injectPosition));
+	memcpy(&injectVelocityImpulse, header.injectVelocityImpulse, sizeof(header.injectVelocityImpulse));
+	memcpy(&fluidColor, header.fluidColor, sizeof(header.fluidColor));
+	return true;
+}
+
+bool FluidField::StartDeterministicRun(const std::string& logPath, const std::string& referencePath)
+{
+	StopDeterministicRun();
+
+	//read before the log is opened in case they're the same file
+	referenceHashes.clear();
+	if (!referencePath.empty()) {
+		std::ifstream reference(referencePath);
+		if (!reference) {
+			return false;
+		}
+
+		std::string line;
+		while (std::getline(reference, line)) {
+			if (line.empty() || line[0] == '#') {
+				continue;
+			}
+			int step;
+			unsigned long long hashes[HASHED_VOLUME_COUNT];
+			if (sscanf_s(line.c_str(), "%d %llx %llx %llx %llx", &step, &hashes[0], &hashes[1], &hashes[2], &hashes[3]) != 1 + HASHED_VOLUME_COUNT ||
+				step != GetReferenceStepCount()) {
+				break;
+			}
+			referenceHashes.insert(referenceHashes.end(), hashes, hashes + HASHED_VOLUME_COUNT);
+		}
+	}
+
+	stepHashLog.open(logPath, std::ios::trunc);
+	if (!stepHashLog) {
+		return false;
+	}
+	stepHashLog << "# step velocity density temperature pressure, " <<
+		fluidSimGridRes.x << "x" << fluidSimGridRes.y << "x" << fluidSimGridRes.z <<
+		(simBackend == FLUID_BACKEND_CPU ? " cpu" : " gpu") << "\n";
+
+	//steps the worker was given before the run started aren't part of it
+	WaitForCpuSim();
+	hashedSteps = 0;
+	divergedStep = -1;
+	return true;
+}
+
+void FluidField::StopDeterministicRun()
+{
+	if (stepHashLog.is_open()) {
+		stepHashLog.close();
+	}
+}
+
+void FluidField::HashStep()
+{
+	VolumeResource* volumes[HASHED_VOLUME_COUNT] = { &velocityMap[0], &densityMap[0], &temperatureMap[0], &pressureMap[0] };
+	const FluidChannel* channels[HASHED_VOLUME_COUNT] = { checkpointVelocityChannels, checkpointDensityChannels, &checkpointTemperatureChannel, &checkpointPressureChannel };
+	int channelCounts[HASHED_VOLUME_COUNT] = { 4, 4, 1, 1 };
+	FieldPrecision precisions[HASHED_VOLUME_COUNT] = { fieldPrecision.velocity, fieldPrecision.density, fieldPrecision.temperature, fieldPrecision.pressure };
+
+	size_t cellCount = (size_t)fluidSimGridRes.x * fluidSimGridRes.y * fluidSimGridRes.z;
+	for (int v = 0; v < HASHED_VOLUME_COUNT; v++) {
+		//the cpu backend's live fields are in the solver, gathered the way the volume would store them
+		if (simBackend == FLUID_BACKEND_CPU) {
+			GatherSolverTexels(channels[v], channelCounts[v], precisions[v] == FIELD_PRECISION_FLOAT16, hashTexels);
+		}
+		else {
+			ReadVolumeTexels(*volumes[v], hashTexels);
+		}
+		stepHashes[v] = HashGridBricks(hashTexels.data(), hashTexels.size() / cellCount,
+			fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z, stepBrickHashes[v]);
+	}
+
+	char line[96];
+	snprintf(line, sizeof(line), "%d %016llx %016llx %016llx %016llx\n", hashedSteps,
+		(unsigned long long)stepHashes[0], (unsigned long long)stepHashes[1],
+		(unsigned long long)stepHashes[2], (unsigned long long)stepHashes[3]);
+	stepHashLog << line;
+
+	//everything after the first difference follows from it, so only that one is kept
+	if (divergedStep < 0 && hashedSteps < GetReferenceStepCount()) {
+		const uint64_t* reference = &referenceHashes[(size_t)hashedSteps * HASHED_VOLUME_COUNT];
+		for (int v = 0; v < HASHED_VOLUME_COUNT; v++) {
+			if (stepHashes[v] != reference[v]) {
+				divergedStep = hashedSteps;
+				divergedVolume = (CheckpointVolume)v;
+				break;
+			}
+		}
+	}
+	hashedSteps++;
+}
+
+void FluidField::ReadVolumeTexels(VolumeResource& vr, std::vector<unsigned char>& out)
+{
+	Microsoft::WRL::ComPtr<ID3D11Texture3D> staging = CreateStagingVolume(vr);
+	Microsoft::WRL::ComPtr<ID3D11Resource> texture;
+	vr.srv->GetResource(texture.GetAddressOf());
+	context->CopyResource(staging.Get(), texture.Get());
+
+	D3D11_TEXTURE3D_DESC desc;
+	staging->GetDesc(&desc);
+	size_t rowBytes = (size_t)DXGIFormatBytes(desc.Format) * fluidSimGridRes.x;
+	out.assign(rowBytes * fluidSimGridRes.y * fluidSimGridRes.z, 0);
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (FAILED(context->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mapped))) {
+		return;
+	}
+
+	for (int z = 0; z < fluidSimGridRes.z; z++) {
+		for (int y = 0; y < fluidSimGridRes.y; y++) {
+			const unsigned char* row = (const unsigned char*)mapped.pData + z * mapped.DepthPitch + y * mapped.RowPitch;
+			memcpy(&out[(z * fluidSimGridRes.y + y) * rowBytes], row, rowBytes);
+		}
+	}
+
+	context->Unmap(staging.Get(), 0);
+}
+
+void FluidField::UploadVolumeTexels(VolumeResource& vr, const unsigned char* texels, int channels, bool texelsHalf, bool volumeHalf)
+{
+	if (texelsHalf) {
+		UploadHalfVolume(vr, (const uint16_t*)texels, channels, volumeHalf);
+		return;
+	}
+
+	int rowValues = fluidSimGridRes.x * channels;
+	int valueCount = rowValues * fluidSimGridRes.y * fluidSimGridRes.z;
+	if (volumeHalf) {
+		std::vector<uint16_t> halfs(valueCount);
+		FloatToHalf((const float*)texels, halfs.data(), valueCount);
+		UploadHalfVolume(vr, halfs.data(), channels, true);
+		return;
+	}
+
+	Microsoft::WRL::ComPtr<ID3D11Resource> texture;
+	vr.srv->GetResource(texture.GetAddressOf());
+	context->UpdateSubresource(texture.Get(), 0, 0, texels,
+		rowValues * sizeof(float),
+		rowValues * sizeof(float) * fluidSimGridRes.y);
+}
+
+void FluidField::GatherSolverTexels(const FluidChannel* channels, int channelCount, bool half, std::vector<unsigned char>& out)
+{
+	int cellCount = fluidSimGridRes.x * fluidSimGridRes.y * fluidSimGridRes.z;
+	std::vector<float> texels((size_t)cellCount * channelCount, 0.0f);
+	for (int c = 0; c < channelCount; c++) {
+		if (channels[c] == CHANNEL_COUNT) {
+			continue;
+		}
+		const float* values = cpuSolver->GetChannel(channels[c]).data();
+		for (int i = 0; i < cellCount; i++) {
+			texels[(size_t)i * channelCount + c] = values[i];
+		}
+	}
+
+	if (!half) {
+		const unsigned char* bytes = (const unsigned char*)texels.data();
+		out.assign(bytes, bytes + texels.size() * sizeof(float));
+		return;
+	}
+	out.resize(texels.size() * sizeof(uint16_t));
+	FloatToHalf(texels.data(), (uint16_t*)out.data(), (int)texels.size());
+}
+
+void FluidField::ScatterSolverTexels(const FluidChannel* channels, int channelCount, bool half, const unsigned char* texels)
+{
+	int cellCount = fluidSimGridRes.x * fluidSimGridRes.y * fluidSimGridRes.z;
+	std::vector<float> values((size_t)cellCount * channelCount);
+	if (half) {
+		HalfToFloat((const uint16_t*)texels, values.data(), (int)values.size());
+	}
+	else {
+		memcpy(values.data(), texels, values.size() * sizeof(float));
+	}
+
+	for (int c = 0; c < channelCount; c++) {
+		if (channels[c] == CHANNEL_COUNT) {
+			continue;
+		}
+		std::vector<float>& field = cpuSolver->GetChannelForWrite(channels[c]);
+		for (int i = 0; i < cellCount; i++) {
+			field[i] = values[(size_t)i * channelCount + c];
+		}
+	}
+}
+
+void FluidField::CopySimSettings(FluidSimSettings* settings)
+{
+	settings->fixedTimeStep = fixedTimeStep;
+	settings->advectionScheme = advectionScheme;
+	settings->ambientTemperature = ambientTemperature;
+	settings->injectTemperature = injectTemperature;
+	settings->injectDensity = injectDensity;
+	settings->injectRadius = injectRadius;
+	settings->temperatureBuoyancy = temperatureBuoyancy;
+	settings->densityWeight = densityWeight;
+	settings->vorticityEpsilon = vorticityEpsilon;
+	settings->injectPosition[0] = injectPosition.x;
+	settings->injectPosition[1] = injectPosition.y;
+	settings->injectPosition[2] = injectPosition.z;
+	settings->injectVelocity[0] = injectVelocityImpulse.x;
+	settings->injectVelocity[1] = injectVelocityImpulse.y;
+	settings->injectVelocity[2] = injectVelocityImpulse.z;
+	settings->injectColor[0] = fluidColor.x;
+	settings->injectColor[1] = fluidColor.y;
+	settings->injectColor[2] = fluidColor.z;
+	settings->pressureSolver = pressureSolver;
+	settings->warmStartPressure = warmStartPressure;
+	settings->pressureIterations = pressureIterations;
+	settings->jacobiCheckInterval = jacobiCheckInterval;
+	settings->multigridCycle = multigridCycle;
+	settings->multigridMaxCycles = multigridMaxCycles;
+	settings->pcgPreconditioner = pcgPreconditioner;
+	settings->pcgMaxIterations = pcgMaxIterations;
+	settings->pressureTolerance = pressureTolerance;
+	settings->sparseBricks = sparseBricks;
+	settings->brickDensityThreshold = brickDensityThreshold;
+	settings->brickVelocityThreshold = brickVelocityThreshold;
+	settings->brickTemperatureThreshold = brickTemperatureThreshold;
+	settings->precision = fieldPrecision;
+}
+
+float FluidField::GetSimTimeMs()
+{
+	if (simBackend == FLUID_BACKEND_CPU) {
+		return cpuWorker->GetLastStepMs();
+	}
+
+	ReadSimTimers();
+	return lastGpuSimTimeMs;
+}
+
+void FluidField::BeginSimTimer()
+{
+	//if this one never got read it's just reissued, the reading is only for display
+	SimTimer& timer = simTimers[simTimerIndex];
+	context->Begin(timer.disjoint.Get());
+	context->End(timer.start.Get());
+}
+
+void FluidField::EndSimTimer()
+{
+	SimTimer& timer = simTimers[simTimerIndex];
+	context->End(timer.end.Get());
+	context->End(timer.disjoint.Get());
+	timer.pending = true;
+
+	simTimerIndex = (simTimerIndex + 1) % SIM_TIMER_COUNT;
+}
+
+void FluidField::ReadSimTimers()
+{
+	//oldest first, so the newest finished step is the one that sticks
+	for (int i = 0; i < SIM_TIMER_COUNT; i++) {
+		SimTimer& timer = simTimers[(simTimerIndex + i) % SIM_TIMER_COUNT];
+		if (!timer.pending) {
+			continue;
+		}
+
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint = {};
+		UINT64 start = 0;
+		UINT64 end = 0;
+		if (context->GetData(timer.disjoint.Get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+			context->GetData(timer.start.Get(), &start, sizeof(start), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+			context->GetData(timer.end.Get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) {
+			continue;
+		}
+		timer.pending = false;
+
+		//the clock changed speed partway through, so the timestamps don't mean anything
+		if (!disjoint.Disjoint && disjoint.Frequency > 0) {
+			lastGpuSimTimeMs = (float)((double)(end - start) * 1000.0 / disjoint.Frequency);
+		}
+	}
+}
+
+void FluidField::StartPrecisionReport(int steps)
+{
+	if (IsPrecisionReportRunning()) {
+		return;
+	}
+
+	FluidSimSettings settings;
+	CopySimSettings(&settings);
+	//run the whole grid so brick thresholds can't change which cells each preset steps
+	settings.sparseBricks = false;
+
+	XMINT3 res = fluidSimGridRes;
+	precisionReportTask = std::async(std::launch::async, [res, steps, settings]() {
+		return RunPrecisionReport(res.x, res.y, res.z, steps, settings);
+	});
+}
+
+bool FluidField::IsPrecisionReportRunning()
+{
+	return precisionReportTask.valid() &&
+		precisionReportTask.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+}
+
+const std::vector<PrecisionReportRow>& FluidField::GetPrecisionReport()
+{
+	if (precisionReportTask.valid() && !IsPrecisionReportRunning()) {
+		precisionReport = precisionReportTask.get();
+	}
+	return precisionReport;
+}
+
+int FluidField::GetPressureIterations()
+{
+	if (simBackend == FLUID_BACKEND_CPU) {
+		return cpuWorker->GetPressureIterations();
+	}
+	return lastPressureIterations;
+}
+
+float FluidField::GetPressureResidual()
+{
+	if (simBackend == FLUID_BACKEND_CPU) {
+		return cpuWorker->GetPressureResidual();
+	}
+	return lastPressureResidual;
+}
+
+int FluidField::GetActiveBrickCount()
+{
+	if (simBackend == FLUID_BACKEND_CPU) {
+		return cpuWorker->GetActiveBrickCount();
+	}
+	if (!sparseBricks) {
+		return GetBrickCount();
+	}
+
+	//the count is only for display, so keep the last one rather than stall
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (SUCCEEDED(context->Map(brickArgsStaging.Get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped))) {
+		lastActiveBrickCount = ((unsigned int*)mapped.pData)[0];
+		context->Unmap(brickArgsStaging.Get(), 0);
+	}
+	return lastActiveBrickCount;
+}
+
+void FluidField::UpdateBricks()
+{
+	//coming from dense, every brick counts as active so empty ones get cleared
+	if (!bricksWereSparse) {
+		std::vector<unsigned int> allActive(GetBrickCount(), 1);
+		Microsoft::WRL::ComPtr<ID3D11Resource> brickStateResource;
+		brickStateUAV->GetResource(brickStateResource.GetAddressOf());
+		context->UpdateSubresource(brickStateResource.Get(), 0, 0, allActive.data(), 0, 0);
+	}
+
+	//both group counts start at zero and get added to during compaction
+	const unsigned int emptyArgs[6] = { 0, 1, 1, 0, 1, 1 };
+	context->UpdateSubresource(brickArgsBuffer.Get(), 0, 0, emptyArgs, 0, 0);
+
+	brickActivityShader->SetShader();
+	brickActivityShader->SetFloat("densityThreshold", brickDensityThreshold);
+	brickActivityShader->SetFloat("velocityThreshold", brickVelocityThreshold);
+	brickActivityShader->SetFloat("temperatureThreshold", brickTemperatureThreshold);
+	brickActivityShader->SetFloat("ambientTemperature", ambientTemperature);
+	brickActivityShader->SetFloat3("injectPosition", injectPosition);
+	brickActivityShader->SetFloat("injectRadius", injectRadius);
+	SetInt3(brickActivityShader, "gridRes", fluidSimGridRes);
+	SetInt3(brickActivityShader, "bricksPerAxis", bricksPerAxis);
+	brickActivityShader->CopyAllBufferData();
+
+	brickActivityShader->SetShaderResourceView("DensityMap", densityMap[0].srv.Get());
+	brickActivityShader->SetShaderResourceView("VelocityMap", velocityMap[0].srv.Get());
+	brickActivityShader->SetShaderResourceView("TemperatureMap", temperatureMap[0].srv.Get());
+	brickActivityShader->SetUnorderedAccessView("BrickFlags", brickFlagsUAV.Get());
+	SetObstacleViews(brickActivityShader, true);
+
+	//one group per brick
+	brickActivityShader->DispatchByGroups(bricksPerAxis.x, bricksPerAxis.y, bricksPerAxis.z);
+	SetObstacleViews(brickActivityShader, false);
+
+	brickActivityShader->SetShaderResourceView("DensityMap", 0);
+	brickActivityShader->SetShaderResourceView("VelocityMap", 0);
+	brickActivityShader->SetShaderResourceView("TemperatureMap", 0);
+	brickActivityShader->SetUnorderedAccessView("BrickFlags", 0);
+
+	brickCompactShader->SetShader();
+	SetInt3(brickCompactShader, "bricksPerAxis", bricksPerAxis);
+	brickCompactShader->CopyAllBufferData();
+
+	brickCompactShader->SetShaderResourceView("BrickFlags", brickFlagsSRV.Get());
+	brickCompactShader->SetUnorderedAccessView("DispatchArgs", brickArgsUAV.Get());
+	brickCompactShader->SetUnorderedAccessView("ActiveBricksOut", activeBricksUAV.Get());
+	brickCompactShader->SetUnorderedAccessView("ClearBricks", clearBricksUAV.Get());
+	brickCompactShader->SetUnorderedAccessView("BrickState", brickStateUAV.Get());
+
+	//one thread per brick
+	brickCompactShader->DispatchByThreads(bricksPerAxis.x, bricksPerAxis.y, bricksPerAxis.z);
+
+	brickCompactShader->SetShaderResourceView("BrickFlags", 0);
+	brickCompactShader->SetUnorderedAccessView("DispatchArgs", 0);
+	brickCompactShader->SetUnorderedAccessView("ActiveBricksOut", 0);
+	brickCompactShader->SetUnorderedAccessView("ClearBricks", 0);
+	brickCompactShader->SetUnorderedAccessView("BrickState", 0);
+
+	//picked up by GetActiveBrickCount once the gpu gets to it
+	context->CopyResource(brickArgsStaging.Get(), brickArgsBuffer.Get());
+
+	clearBricksShader->SetShader();
+	clearBricksShader->SetFloat("ambientTemperature", ambientTemperature);
+	SetInt3(clearBricksShader, "bricksPerAxis", bricksPerAxis);
+	clearBricksShader->CopyAllBufferData();
+
+	clearBricksShader->SetShaderResourceView("ClearBricks", clearBricksSRV.Get());
+	clearBricksShader->SetUnorderedAccessView("VelocityOut0", velocityMap[0].uav.Get());
+	clearBricksShader->SetUnorderedAccessView("VelocityOut1", velocityMap[1].uav.Get());
+	clearBricksShader->SetUnorderedAccessView("DensityOut0", densityMap[0].uav.Get());
+	clearBricksShader->SetUnorderedAccessView("DensityOut1", densityMap[1].uav.Get());
+	clearBricksShader->SetUnorderedAccessView("TemperatureOut0", temperatureMap[0].uav.Get());
+	clearBricksShader->SetUnorderedAccessView("TemperatureOut1", temperatureMap[1].uav.Get());
+	clearBricksShader->SetUnorderedAccessView("DivergenceOut", velocityDivergenceMap.uav.Get());
+
+	//second set of args, 12 bytes in
+	context->DispatchIndirect(brickArgsBuffer.Get(), sizeof(unsigned int) * 3);
+
+	clearBricksShader->SetShaderResourceView("ClearBricks", 0);
+	clearBricksShader->SetUnorderedAccessView("VelocityOut0", 0);
+	clearBricksShader->SetUnorderedAccessView("VelocityOut1", 0);
+	clearBricksShader->SetUnorderedAccessView("DensityOut0", 0);
+	clearBricksShader->SetUnorderedAccessView("DensityOut1", 0);
+	clearBricksShader->SetUnorderedAccessView("TemperatureOut0", 0);
+	clearBricksShader->SetUnorderedAccessView("TemperatureOut1", 0);
+	clearBricksShader->SetUnorderedAccessView("DivergenceOut", 0);
+
+	//maccormack's forward results only exist once it has run
+	if (!advectionScratch[0].uav) {
+		return;
+	}
+
+	clearScratchBricksShader->SetShader();
+	SetInt3(clearScratchBricksShader, "bricksPerAxis", bricksPerAxis);
+	clearScratchBricksShader->SetData("clearValues", advectionScratchClear, sizeof(advectionScratchClear));
+	clearScratchBricksShader->CopyAllBufferData();
+
+	clearScratchBricksShader->SetShaderResourceView("ClearBricks", clearBricksSRV.Get());
+	for (int i = 0; i < MAX_ADVECTED_FIELDS; i++) {
+		clearScratchBricksShader->SetUnorderedAccessView("ScratchOut" + std::to_string(i), advectionScratch[i].uav.Get());
+	}
+
+	context->DispatchIndirect(brickArgsBuffer.Get(), sizeof(unsigned int) * 3);
+
+	clearScratchBricksShader->SetShaderResourceView("ClearBricks", 0);
+	for (int i = 0; i < MAX_ADVECTED_FIELDS; i++) {
+		clearScratchBricksShader->SetUnorderedAccessView("ScratchOut" + std::to_string(i), 0);
+	}
+}
+
+void FluidField::SetBrickParams(std::shared_ptr<SimpleComputeShader> shader)
+{
+	shader->SetInt("sparseBricks", sparseBricks);
+	SetInt3(shader, "bricksPerAxis", bricksPerAxis);
+}
+
+void FluidField::DispatchSimCells(std::shared_ptr<SimpleComputeShader> shader)
+{
+	if (!sparseBricks) {
+		shader->DispatchByThreads(fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z);
+		return;
+	}
+
+	//the group count was written by BrickCompactCS, so it never comes back to the cpu
+	shader->SetShaderResourceView("ActiveBricks", activeBricksSRV.Get());
+	context->DispatchIndirect(brickArgsBuffer.Get(), 0);
+	shader->SetShaderResourceView("ActiveBricks", 0);
+}
+
+void FluidField::SetObstacleViews(std::shared_ptr<SimpleComputeShader> shader, bool bind)
+{
+	shader->SetShaderResourceView("ObstacleBits", bind ? obstacleBitsSRV.Get() : 0);
+	shader->SetShaderResourceView("ObstacleVelocityMap", bind ? obstacleVelocityMap.srv.Get() : 0);
+}
+
+void FluidField::UpdateObstacles(const std::vector<std::shared_ptr<GameEntity>>& entities, float deltaTime)
+{
+	//turning obstacles off just empties the grid
+	size_t entityCount = obstaclesEnabled ? entities.size() : 0;
+	for (size_t id = entityCount; id < obstacleEntities.size(); id++) {
+		obstacles->RemoveObstacle((int)id);
+	}
+	obstacleEntities.resize(entityCount);
+
+	//same placement as RenderFluid, the longest axis spans the unit cube around the origin
+	float largestDimension = (float)max(fluidSimGridRes.x, max(fluidSimGridRes.y, fluidSimGridRes.z));
+	XMMATRIX toGrid = XMMatrixScaling(largestDimension, largestDimension, largestDimension) *
+		XMMatrixTranslation(fluidSimGridRes.x * 0.5f, fluidSimGridRes.y * 0.5f, fluidSimGridRes.z * 0.5f);
+	XMMATRIX fromGrid = XMMatrixInverse(0, toGrid);
+
+	for (size_t id = 0; id < obstacleEntities.size(); id++) {
+		ObstacleEntity& cached = obstacleEntities[id];
+		std::shared_ptr<Mesh> mesh = entities[id]->GetMesh();
+		XMFLOAT4X4 world = entities[id]->GetTransform()->GetWorldMatrix();
+
+		bool added = cached.mesh != mesh.get();
+		bool moved = added || memcmp(&world, &cached.world, sizeof(XMFLOAT4X4)) != 0;
+
+		//a solid that stopped gets one more pass to zero its velocity
+		if (!moved && !cached.moving) {
+			continue;
+		}
+
+		XMMATRIX worldMat = XMLoadFloat4x4(&world);
+		XMMATRIX objectToGrid = worldMat * toGrid;
+
+		//a point p on the solid was at p * (grid -> object -> last world -> grid)
+		//a frame ago, so it's moving at p * (I - that) / deltaTime
+		float velocityAffine[12] = {};
+		bool moving = moved && !added && deltaTime > 0.0f;
+		if (moving) {
+			XMMATRIX previous = fromGrid * XMMatrixInverse(0, worldMat) * XMLoadFloat4x4(&cached.world) * toGrid;
+			XMFLOAT4X4 velocity;
+			XMStoreFloat4x4(&velocity, (XMMatrixIdentity() - previous) * (1.0f / deltaTime));
+			for (int row = 0; row < 4; row++) {
+				for (int column = 0; column < 3; column++) {
+					velocityAffine[row * 3 + column] = velocity.m[row][column];
+				}
+			}
+		}
+
+		const std::vector<XMFLOAT3>& positions = mesh->GetPositions();
+		const std::vector<unsigned int>& indices = mesh->GetIndices();
+		obstaclePositions.resize(positions.size() * 3);
+		for (size_t v = 0; v < positions.size(); v++) {
+			XMStoreFloat3((XMFLOAT3*)&obstaclePositions[v * 3], XMVector3TransformCoord(XMLoadFloat3(&positions[v]), objectToGrid));
+		}
+		obstacles->SetObstacle((int)id, obstaclePositions.data(), (int)positions.size(), indices.data(), (int)indices.size(), velocityAffine);
+
+		cached.mesh = mesh.get();
+		cached.world = world;
+		cached.moving = moving;
+	}
+
+	//the cpu solver reads the solid grid while it steps, so redoing it has to wait
+	if (obstacles->HasPendingUpdate()) {
+		WaitForCpuSim();
+	}
+	if (obstacles->Update()) {
+		UploadObstacleBricks();
+	}
+}
+
+void FluidField::UploadObstacleBricks()
+{
+	const std::vector<uint32_t>& bits = obstacles->GetSolidBits();
+	const float* velocity[3] = { obstacles->GetVelocity(0), obstacles->GetVelocity(1), obstacles->GetVelocity(2) };
+
+	Microsoft::WRL::ComPtr<ID3D11Resource> velocityTexture;
+	obstacleVelocityMap.srv->GetResource(velocityTexture.GetAddressOf());
+
+	for (int brick : obstacles->GetUpdatedBricks()) {
+		//bits are kept brick by brick, so each brick is one range of the buffer
+		D3D11_BOX bitsBox = {};
+		bitsBox.left = brick * OBSTACLE_WORDS_PER_BRICK * sizeof(uint32_t);
+		bitsBox.right = bitsBox.left + OBSTACLE_WORDS_PER_BRICK * sizeof(uint32_t);
+		bitsBox.bottom = 1;
+		bitsBox.back = 1;
+		context->UpdateSubresource(obstacleBitsBuffer.Get(), 0, &bitsBox, &bits[brick * OBSTACLE_WORDS_PER_BRICK], 0, 0);
+
+		int begin[3];
+		int end[3];
+		obstacles->GetBrickBounds(brick, begin, end);
+		int width = end[0] - begin[0];
+		int height = end[1] - begin[1];
+		int depth = end[2] - begin[2];
+
+		obstacleVelocityUpload.resize(width * height * depth * 4);
+		for (int z = 0; z < depth; z++) {
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					int i = ((begin[2] + z) * fluidSimGridRes.y + begin[1] + y) * fluidSimGridRes.x + begin[0] + x;
+					float cell[4] = { velocity[0][i], velocity[1][i], velocity[2][i], 0.0f };
+					FloatToHalf(cell, &obstacleVelocityUpload[((z * height + y) * width + x) * 4], 4);
+				}
+			}
+		}
+
+		D3D11_BOX velocityBox = { (UINT)begin[0], (UINT)begin[1], (UINT)begin[2], (UINT)end[0], (UINT)end[1], (UINT)end[2] };
+		context->UpdateSubresource(velocityTexture.Get(), 0, &velocityBox, obstacleVelocityUpload.data(),
+			4 * sizeof(uint16_t) * width,
+			4 * sizeof(uint16_t) * width * height);
+	}
+}
+
+double FluidField::GetFluidCellCount()
+{
+	return (double)fluidSimGridRes.x * fluidSimGridRes.y * fluidSimGridRes.z - obstacles->GetSolidCellCount();
+}
+
+void FluidField::ClearVolume(VolumeResource& vr, XMINT3 gridRes)
+{
+	clearCompShader->SetShader();
+	clearCompShader->SetFloat4("clearColor", { 0,0,0,0 });
+	clearCompShader->SetInt("channelCount", 1);
+	clearCompShader->CopyAllBufferData();
+
+	clearCompShader->SetUnorderedAccessView("ClearOut1", vr.uav);
+	clearCompShader->DispatchByThreads(gridRes.x, gridRes.y, gridRes.z);
+	clearCompShader->SetUnorderedAccessView("ClearOut1", 0);
+}
+
+void FluidField::RelaxPressure(VolumeResource pressure[2], VolumeResource& rhs, XMINT3 gridRes, int iterations, float weight)
+{
+	pressureSolverShader->SetShader();
+
+	pressureSolverShader->SetFloat("deltaTime", fixedTimeStep);
+	pressureSolverShader->SetFloat3("invFluidSimGridRes", XMFLOAT3(1.0f / gridRes.x, 1.0f / gridRes.y, 1.0f / gridRes.z));
+	SetInt3(pressureSolverShader, "gridRes", gridRes);
+	pressureSolverShader->SetFloat("jacobiWeight", weight);
+
+	//coarse multigrid levels don't line up with the obstacle bits
+	bool fineLevel = pressure == pressureMap;
+	pressureSolverShader->SetInt("useObstacles", fineLevel);
+
+	pressureSolverShader->CopyAllBufferData();
+	pressureSolverShader->SetShaderResourceView("VelocityDivergenceMap", rhs.srv.Get());
+	SetObstacleViews(pressureSolverShader, fineLevel);
+
+	for (int i = 0; i < iterations; i++) {
+		pressureSolverShader->SetShaderResourceView("PressureMap", pressure[0].srv.Get());
+		pressureSolverShader->SetUnorderedAccessView("UavOutputMap", pressure[1].uav.Get());
+
+		//dispatch and unbind
+		pressureSolverShader->DispatchByThreads(gridRes.x, gridRes.y, gridRes.z);
+
+		pressureSolverShader->SetUnorderedAccessView("UavOutputMap", 0);
+
+		//swap pressure buffers for next solver pass
+		SwapBuffers(pressure);
+	}
+	pressureSolverShader->SetShaderResourceView("PressureMap", 0);
+	pressureSolverShader->SetUnorderedAccessView("UavOutputMap", 0);
+	pressureSolverShader->SetShaderResourceView("VelocityDivergenceMap", 0);
+	SetObstacleViews(pressureSolverShader, false);
+}
+
+void FluidField::SolvePressureMultigrid()
+{
+	//every measurement stalls until the gpu has caught up to the readback,
+	//so like the pcg solve only check every few cycles and after the last
+	float residual = -1.0f;
+	int cycles = 0;
+
+	while (cycles < multigridMaxCycles) {
+		//an f-cycle builds its first guess up from the coarsest grid,
+		//after that it's just correcting what's there like a v-cycle
+		if (multigridCycle == MULTIGRID_F_CYCLE && cycles == 0) {
+			MultigridFCycle();
+		}
+		else {
+			MultigridVCycle(0);
+		}
+		cycles++;
+
+		if (cycles % multigridCheckInterval == 0 || cycles == multigridMaxCycles) {
+			residual = MeasurePressureResidual();
+			if (residual <= pressureTolerance) {
+				break;
+			}
+		}
+	}
+
+	lastPressureIterations = cycles;
+	lastPressureResidual = residual;
+}
+
+void FluidField::MultigridVCycle(int level)
+{
+	XMINT3 gridRes = multigridLevels[level].gridRes;
+	VolumeResource* pressure = GetLevelPressure(level);
+	VolumeResource& rhs = GetLevelRhs(level);
+
+	if (level == (int)multigridLevels.size() - 1) {
+		RelaxPressure(pressure, rhs, gridRes, multigridCoarsestSteps, multigridJacobiWeight);
+		return;
+	}
+
+	RelaxPressure(pressure, rhs, gridRes, multigridPreSmoothSteps, multigridJacobiWeight);
+
+	//solve for the error on the next level down, starting from zero
+	ComputePressureResidual(level);
+	MultigridLevel& coarse = multigridLevels[level + 1];
+	RestrictVolume(multigridLevels[level].residual, coarse.rhs, coarse.gridRes);
+	ClearVolume(coarse.pressure[0], coarse.gridRes);
+	MultigridVCycle(level + 1);
+
+	ProlongPressure(level);
+	RelaxPressure(pressure, rhs, gridRes, multigridPostSmoothSteps, multigridJacobiWeight);
+}
+
+void FluidField::MultigridFCycle()
+{
+	int coarsest = (int)multigridLevels.size() - 1;
+
+	//push the full residual all the way down
+	ComputePressureResidual(0);
+	for (int level = 0; level < coarsest; level++) {
+		VolumeResource& fine = level == 0 ? multigridLevels[0].residual : multigridLevels[level].rhs;
+		RestrictVolume(fine, multigridLevels[level + 1].rhs, multigridLevels[level + 1].gridRes);
+	}
+
+	ClearVolume(multigridLevels[coarsest].pressure[0], multigridLevels[coarsest].gridRes);
+	RelaxPressure(multigridLevels[coarsest].pressure, multigridLevels[coarsest].rhs,
+		multigridLevels[coarsest].gridRes, multigridCoarsestSteps, multigridJacobiWeight);
+
+	//then work back up, each level starting from the interpolated coarse solve
+	for (int level = coarsest - 1; level > 0; level--) {
+		ClearVolume(multigridLevels[level].pressure[0], multigridLevels[level].gridRes);
+		ProlongPressure(level);
+		MultigridVCycle(level);
+	}
+
+	ProlongPressure(0);
+	MultigridVCycle(0);
+}
+
+void FluidField::ComputePressureResidual(int level)
+{
+	XMINT3 gridRes = multigridLevels[level].gridRes;
+
+	pressureResidualShader->SetShader();
+	SetInt3(pressureResidualShader, "gridRes", gridRes);
+	pressureResidualShader->SetInt("useObstacles", level == 0);
+	pressureResidualShader->CopyAllBufferData();
+	SetObstacleViews(pressureResidualShader, level == 0);
+
+	pressureResidualShader->SetShaderResourceView("VelocityDivergenceMap", GetLevelRhs(level).srv.Get());
+	pressureResidualShader->SetShaderResourceView("PressureMap", GetLevelPressure(level)[0].srv.Get());
+	pressureResidualShader->SetUnorderedAccessView("ResidualOut", multigridLevels[level].residual.uav.Get());
+	pressureResidualShader->SetUnorderedAccessView("GroupSums", residualSumsUAV.Get());
+
+	pressureResidualShader->DispatchByThreads(gridRes.x, gridRes.y, gridRes.z);
+
+	pressureResidualShader->SetShaderResourceView("VelocityDivergenceMap", 0);
+	pressureResidualShader->SetShaderResourceView("PressureMap", 0);
+	pressureResidualShader->SetUnorderedAccessView("ResidualOut", 0);
+	pressureResidualShader->SetUnorderedAccessView("GroupSums", 0);
+	SetObstacleViews(pressureResidualShader, false);
+}
+
+float FluidField::MeasurePressureResidual()
+{
+	ComputePressureResidual(0);
+	context->CopyResource(residualSumsStaging.Get(), residualSumsBuffer.Get());
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (FAILED(context->Map(residualSumsStaging.Get(), 0, D3D11_MAP_READ, 0, &mapped))) {
+		return -1.0f;
+	}
+
+	//x = sum r, y = sum r^2, z = sum divergence, w = sum divergence^2
+	double sums[4] = {};
+	const XMFLOAT4* groupSums = (const XMFLOAT4*)mapped.pData;
+	for (int i = 0; i < residualSumsCount; i++) {
+		sums[0] += groupSums[i].x;
+		sums[1] += groupSums[i].y;
+		sums[2] += groupSums[i].z;
+		sums[3] += groupSums[i].w;
+	}
+	context->Unmap(residualSumsStaging.Get(), 0);
+
+	//the walls make any constant a valid pressure, so the
+	//part of both vectors that is just an offset is ignored
+	double cellCount = GetFluidCellCount();
+	double residualNorm = sums[1] - sums[0] * sums[0] / cellCount;
+	double divergenceNorm = sums[3] - sums[2] * sums[2] / cellCount;
+	if (divergenceNorm <= 0.0) {
+		return 0.0f;
+	}
+	return (float)sqrt(max(residualNorm, 0.0) / divergenceNorm);
+}
+
+void FluidField::RestrictVolume(VolumeResource& fine, VolumeResource& coarse, XMINT3 coarseGridRes)
+{
+	multigridRestrictShader->SetShader();
+	SetInt3(multigridRestrictShader, "coarseGridRes", coarseGridRes);
+	multigridRestrictShader->CopyAllBufferData();
+
+	multigridRestrictShader->SetShaderResourceView("FineMap", fine.srv.Get());
+	multigridRestrictShader->SetUnorderedAccessView("CoarseOut", coarse.uav.Get());
+
+	multigridRestrictShader->DispatchByThreads(coarseGridRes.x, coarseGridRes.y, coarseGridRes.z);
+
+	multigridRestrictShader->SetShaderResourceView("FineMap", 0);
+	multigridRestrictShader->SetUnorderedAccessView("CoarseOut", 0);
+}
+
+void FluidField::ProlongPressure(int level)
+{
+	XMINT3 gridRes = multigridLevels[level].gridRes;
+	VolumeResource* pressure = GetLevelPressure(level);
+
+	multigridProlongShader->SetShader();
+	SetInt3(multigridProlongShader, "coarseGridRes", multigridLevels[level + 1].gridRes);
+	multigridProlongShader->CopyAllBufferData();
+
+	multigridProlongShader->SetShaderResourceView("CoarseMap", GetLevelPressure(level + 1)[0].srv.Get());
+	multigridProlongShader->SetShaderResourceView("FineMap", pressure[0].srv.Get());
+	multigridProlongShader->SetUnorderedAccessView("FineOut", pressure[1].uav.Get());
+	multigridProlongShader->SetSamplerState("LinearClampSampler", linearClampSamplerOptions.Get());
+
+	multigridProlongShader->DispatchByThreads(gridRes.x, gridRes.y, gridRes.z);
+
+	multigridProlongShader->SetShaderResourceView("CoarseMap", 0);
+	multigridProlongShader->SetShaderResourceView("FineMap", 0);
+	multigridProlongShader->SetUnorderedAccessView("FineOut", 0);
+
+	SwapBuffers(pressure);
+}
+
+void FluidField::SolvePressureConjugateGradient()
+{
+	//scalar slots: 0 = init sums (r, div, div^2), 2 = dot(d, A * d),
+	//1 and 3 trade off holding dot(r, z) and r^2 for the current and next iteration
+	int rzSlot = 1;
+	int rzNewSlot = 3;
+
+	//r = b - A * x from the current pressure
+	pcgInitShader->SetShader();
+	SetInt3(pcgInitShader, "gridRes", fluidSimGridRes);
+	pcgInitShader->CopyAllBufferData();
+
+	pcgInitShader->SetShaderResourceView("VelocityDivergenceMap", velocityDivergenceMap.srv.Get());
+	pcgInitShader->SetShaderResourceView("PressureMap", pressureMap[0].srv.Get());
+	pcgInitShader->SetUnorderedAccessView("ResidualOut", pcgResidual.uav.Get());
+	pcgInitShader->SetUnorderedAccessView("GroupSums", residualSumsUAV.Get());
+
+	SetObstacleViews(pcgInitShader, true);
+	pcgInitShader->DispatchByThreads(fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z);
+	SetObstacleViews(pcgInitShader, false);
+
+	pcgInitShader->SetShaderResourceView("VelocityDivergenceMap", 0);
+	pcgInitShader->SetShaderResourceView("PressureMap", 0);
+	pcgInitShader->SetUnorderedAccessView("ResidualOut", 0);
+	pcgInitShader->SetUnorderedAccessView("GroupSums", 0);
+
+	ReduceGroupSums(0);
+
+	//remove the residual's mean, then d = z = M^-1 * r
+	pcgStartShader->SetShader();
+	SetInt3(pcgStartShader, "gridRes", fluidSimGridRes);
+	pcgStartShader->SetFloat("fluidCellCount", (float)GetFluidCellCount());
+	pcgStartShader->CopyAllBufferData();
+
+	pcgStartShader->SetUnorderedAccessView("Residual", pcgResidual.uav.Get());
+	pcgStartShader->SetUnorderedAccessView("DirectionOut", pcgDirection.uav.Get());
+	pcgStartShader->SetUnorderedAccessView("GroupSums", residualSumsUAV.Get());
+	pcgStartShader->SetUnorderedAccessView("Scalars", scalarsUAV.Get());
+
+	SetObstacleViews(pcgStartShader, true);
+	pcgStartShader->DispatchByThreads(fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z);
+	SetObstacleViews(pcgStartShader, false);
+
+	pcgStartShader->SetUnorderedAccessView("Residual", 0);
+	pcgStartShader->SetUnorderedAccessView("DirectionOut", 0);
+	pcgStartShader->SetUnorderedAccessView("GroupSums", 0);
+	pcgStartShader->SetUnorderedAccessView("Scalars", 0);
+
+	ReduceGroupSums(rzSlot);
+
+	XMFLOAT4 scalars[4];
+	ReadScalars(scalars);
+
+	//the walls make any constant a valid pressure, so the mean of the divergence doesn't count
+	double cellCount = GetFluidCellCount();
+	double rhsNormSquared = scalars[0].z - (double)scalars[0].y * scalars[0].y / cellCount;
+	float residual = rhsNormSquared > 0.0 ? (float)sqrt(max(scalars[rzSlot].y, 0.0f) / rhsNormSquared) : 0.0f;
+
+	int iterations = 0;
+	while (iterations < pcgMaxIterations && residual > pressureTolerance) {
+		//q = A * d
+		pcgApplyShader->SetShader();
+		SetInt3(pcgApplyShader, "gridRes", fluidSimGridRes);
+		pcgApplyShader->CopyAllBufferData();
+
+		pcgApplyShader->SetShaderResourceView("DirectionMap", pcgDirection.srv.Get());
+		pcgApplyShader->SetUnorderedAccessView("ProductOut", pcgProduct.uav.Get());
+		pcgApplyShader->SetUnorderedAccessView("GroupSums", residualSumsUAV.Get());
+
+		SetObstacleViews(pcgApplyShader, true);
+		pcgApplyShader->DispatchByThreads(fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z);
+		SetObstacleViews(pcgApplyShader, false);
+
+		pcgApplyShader->SetShaderResourceView("DirectionMap", 0);
+		pcgApplyShader->SetUnorderedAccessView("ProductOut", 0);
+		pcgApplyShader->SetUnorderedAccessView("GroupSums", 0);
+
+		ReduceGroupSums(2);
+
+		//x += alpha * d, r -= alpha * q
+		pcgUpdateShader->SetShader();
+		SetInt3(pcgUpdateShader, "gridRes", fluidSimGridRes);
+		pcgUpdateShader->SetInt("rzSlot", rzSlot);
+		pcgUpdateShader->CopyAllBufferData();
+
+		pcgUpdateShader->SetShaderResourceView("DirectionMap", pcgDirection.srv.Get());
+		pcgUpdateShader->SetShaderResourceView("ProductMap", pcgProduct.srv.Get());
+		pcgUpdateShader->SetUnorderedAccessView("Pressure", pressureMap[0].uav.Get());
+		pcgUpdateShader->SetUnorderedAccessView("Residual", pcgResidual.uav.Get());
+		pcgUpdateShader->SetUnorderedAccessView("GroupSums", residualSumsUAV.Get());
+		pcgUpdateShader->SetUnorderedAccessView("Scalars", scalarsUAV.Get());
+
+		SetObstacleViews(pcgUpdateShader, true);
+		pcgUpdateShader->DispatchByThreads(fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z);
+		SetObstacleViews(pcgUpdateShader, false);
+
+		pcgUpdateShader->SetShaderResourceView("DirectionMap", 0);
+		pcgUpdateShader->SetShaderResourceView("ProductMap", 0);
+		pcgUpdateShader->SetUnorderedAccessView("Pressure", 0);
+		pcgUpdateShader->SetUnorderedAccessView("Residual", 0);
+		pcgUpdateShader->SetUnorderedAccessView("GroupSums", 0);
+		pcgUpdateShader->SetUnorderedAccessView("Scalars", 0);
+
+		ReduceGroupSums(rzNewSlot);
+
+		//d = z + beta * d
+		pcgDirectionShader->SetShader();
+		SetInt3(pcgDirectionShader, "gridRes", fluidSimGridRes);
+		pcgDirectionShader->SetInt("rzSlot", rzSlot);
+		pcgDirectionShader->SetInt("rzNewSlot", rzNewSlot);
+		pcgDirectionShader->CopyAllBufferData();
+
+		pcgDirectionShader->SetShaderResourceView("ResidualMap", pcgResidual.srv.Get());
+		pcgDirectionShader->SetUnorderedAccessView("Direction", pcgDirection.uav.Get());
+		pcgDirectionShader->SetUnorderedAccessView("Scalars", scalarsUAV.Get());
+
+		SetObstacleViews(pcgDirectionShader, true);
+		pcgDirectionShader->DispatchByThreads(fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z);
+		SetObstacleViews(pcgDirectionShader, false);
+
+		pcgDirectionShader->SetShaderResourceView("ResidualMap", 0);
+		pcgDirectionShader->SetUnorderedAccessView("Direction", 0);
+		pcgDirectionShader->SetUnorderedAccessView("Scalars", 0);
+
+		int temp = rzSlot;
+		rzSlot = rzNewSlot;
+		rzNewSlot = temp;
+		iterations++;
+
+		//reading back stalls the pipeline, so only check every few iterations
+		if (iterations % pcgCheckInterval == 0 || iterations == pcgMaxIterations) {
+			ReadScalars(scalars);
+			residual = (float)sqrt(max(scalars[rzSlot].y, 0.0f) / rhsNormSquared);
+		}
+	}
+
+	lastPressureIterations = iterations;
+	lastPressureResidual = residual;
+}
+
+void FluidField::ReduceGroupSums(int outputSlot)
+{
+	reduceGroupSumsShader->SetShader();
+	reduceGroupSumsShader->SetInt("partialCount", residualSumsCount);
+	reduceGroupSumsShader->SetInt("outputSlot", outputSlot);
+	reduceGroupSumsShader->CopyAllBufferData();
+
+	reduceGroupSumsShader->SetUnorderedAccessView("GroupSums", residualSumsUAV.Get());
+	reduceGroupSumsShader->SetUnorderedAccessView("Scalars", scalarsUAV.Get());
+
+	reduceGroupSumsShader->DispatchByGroups(1, 1, 1);
+
+	reduceGroupSumsShader->SetUnorderedAccessView("GroupSums", 0);
+	reduceGroupSumsShader->SetUnorderedAccessView("Scalars", 0);
+}
+
+void FluidField::ReadScalars(XMFLOAT4 scalars[4])
+{
+	context->CopyResource(scalarsStaging.Get(), scalarsBuffer.Get());
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (FAILED(context->Map(scalarsStaging.Get(), 0, D3D11_MAP_READ, 0, &mapped))) {
+		for (int i = 0; i < 4; i++) {
+			scalars[i] = XMFLOAT4(0, 0, 0, 0);
+		}
+		return;
+	}
+
+	memcpy(scalars, mapped.pData, sizeof(XMFLOAT4) * 4);
+	context->Unmap(scalarsStaging.Get(), 0);
+}
+
+void FluidField::RemovePressureMean()
+{
+	volumeSumShader->SetShader();
+	SetInt3(volumeSumShader, "gridRes", fluidSimGridRes);
+	volumeSumShader->CopyAllBufferData();
+
+	volumeSumShader->SetShaderResourceView("InputMap", pressureMap[0].srv.Get());
+	volumeSumShader->SetUnorderedAccessView("GroupSums", residualSumsUAV.Get());
+
+	volumeSumShader->DispatchByThreads(fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z);
+
+	volumeSumShader->SetShaderResourceView("InputMap", 0);
+	volumeSumShader->SetUnorderedAccessView("GroupSums", 0);
+
+	//the sum never leaves the gpu
+	ReduceGroupSums(0);
+
+	removeMeanShader->SetShader();
+	SetInt3(removeMeanShader, "gridRes", fluidSimGridRes);
+	removeMeanShader->SetInt("sumSlot", 0);
+	removeMeanShader->CopyAllBufferData();
+
+	removeMeanShader->SetUnorderedAccessView("Volume", pressureMap[0].uav.Get());
+	removeMeanShader->SetUnorderedAccessView("Scalars", scalarsUAV.Get());
+
+	removeMeanShader->DispatchByThreads(fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z);
+
+	removeMeanShader->SetUnorderedAccessView("Volume", 0);
+	removeMeanShader->SetUnorderedAccessView("Scalars", 0);
+}
+
+FluidField::VolumeResource* FluidField::GetLevelPressure(int level)
+{
+	return level == 0 ? pressureMap : multigridLevels[level].pressure;
+}
+
+FluidField::VolumeResource& FluidField::GetLevelRhs(int level)
+{
+	return level == 0 ? velocityDivergenceMap : multigridLevels[level].rhs;
+}
+
+void FluidField::RenderFluid(std::shared_ptr<Camera> camera, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> sceneDepth) {
+	//a smaller pass has to read scene depth, so it can't have the scene's targets bound
+	int scale = sceneDepth ? volumeResolution : VOLUME_RESOLUTION_FULL;
+
+	D3D11_VIEWPORT viewport = {};
+	UINT viewportCount = 1;
+	context->RSGetViewports(&viewportCount, &viewport);
+	D3D11_VIEWPORT volumeViewport = viewport;
+
+	ID3D11RenderTargetView* sceneTargets[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT] = {};
+	ID3D11DepthStencilView* sceneDepthStencil = 0;
+	if (scale != VOLUME_RESOLUTION_FULL) {
+		context->OMGetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, sceneTargets, &sceneDepthStencil);
+		context->OMSetRenderTargets(0, 0, 0);
+
+		volumeViewport.Width = (float)(((int)viewport.Width + scale - 1) / scale);
+		volumeViewport.Height = (float)(((int)viewport.Height + scale - 1) / scale);
+		CreateReducedVolumeTargets((int)volumeViewport.Width, (int)volumeViewport.Height);
+		context->RSSetViewports(1, &volumeViewport);
+
+		//nearest depth in each block, what the rays stop at
+		context->OMSetRenderTargets(1, reducedDepthRTV.GetAddressOf(), 0);
+		fullscreenVS->SetShader();
+		volumeDepthDownsamplePS->SetShader();
+		volumeDepthDownsamplePS->SetInt("scale", scale);
+		XMINT2 depthSize((int)viewport.Width, (int)viewport.Height);
+		volumeDepthDownsamplePS->SetData("depthSize", &depthSize, sizeof(XMINT2));
+		volumeDepthDownsamplePS->CopyAllBufferData();
+		volumeDepthDownsamplePS->SetShaderResourceView("SceneDepth", sceneDepth);
+		context->Draw(3, 0);
+		volumeDepthDownsamplePS->SetShaderResourceView("SceneDepth", 0);
+
+		//each pixel's one back face writes the ray's result as is
+		const float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		context->ClearRenderTargetView(reducedVolumeRTV.Get(), clearColor);
+		context->OMSetRenderTargets(1, reducedVolumeRTV.GetAddressOf(), 0);
+		context->OMSetDepthStencilState(0, 0);
+		context->OMSetBlendState(0, 0, 0xFFFFFFFF);
+	}
+	else {
+		context->OMSetDepthStencilState(depthState.Get(), 0);
+		context->OMSetBlendState(blendState.Get(), 0, 0xFFFFFFFF);
+	}
+	context->RSSetState(rasterState.Get());
+
+	volumePS->SetShader();
+	volumeVS->SetShader();
+
+	//world mat for vertex shader
+	XMMATRIX worldMat = GetVolumeWorldMatrix();
+
+	XMFLOAT4X4 world, invWorld;
+	XMStoreFloat4x4(&world, worldMat);
+	XMStoreFloat4x4(&invWorld, XMMatrixInverse(0, worldMat));
+	volumeVS->SetMatrix4x4("world", world);
+	volumeVS->SetMatrix4x4("view", camera->GetView());
+	volumeVS->SetMatrix4x4("projection", camera->GetProjection());
+	volumeVS->CopyAllBufferData();
+	//should be linear clamp
+	volumeVS->SetSamplerState("SamplerLinearClamp", linearClampSamplerOptions);
+
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv = densityMap[0].srv;
+	//this where code to switch which srv is being displayed would go
+
+	float interpolation = GetRenderInterpolation();
+	lastRaymarchSamples = GetAdaptiveRaymarchSamples(camera, volumeViewport.Height);
+
+	volumePS->SetShaderResourceView("VolumeTexture", srv);
+	volumePS->SetShaderResourceView("PreviousVolumeTexture", previousDensityValid ? previousDensityMap.srv : srv);
+	volumePS->SetFloat("interpolation", interpolation);
+
+	volumePS->SetMatrix4x4("invWorld", invWorld);
+	volumePS->SetFloat3("cameraPosition", camera->GetTransform()->GetPosition());
+	volumePS->SetFloat3("fluidColor", fluidColor);
+	volumePS->SetInt("renderMode", RENDER_MODE_BLEND);
+	volumePS->SetInt("raymarchSamples", lastRaymarchSamples);
+	volumePS->SetInt("referenceSamples", raymarchSamples);
+	volumePS->SetInt("jitterSamples", jitterRaymarch);
+	volumePS->SetShaderResourceView("BlueNoiseTexture", blueNoiseSRV);
+	volumePS->SetShaderResourceView("OccupancyTexture", occupancySRV);
+	volumePS->SetInt("occupancyLevels", emptySpaceSkipping ? occupancyLevels : 0);
+	volumePS->SetFloat("emptySpaceThreshold", emptySpaceThreshold);
+	volumePS->SetData("gridRes", &fluidSimGridRes, sizeof(XMINT3));
+	volumePS->SetData("bricksPerAxis", &bricksPerAxis, sizeof(XMINT3));
+
+	//the full size pass has the depth buffer, the smaller one stops rays at the downsampled depth instead
+	XMFLOAT4X4 view = camera->GetView();
+	XMFLOAT4X4 projection = camera->GetProjection();
+	XMFLOAT4X4 invViewProjection;
+	XMStoreFloat4x4(&invViewProjection, XMMatrixInverse(0, XMLoadFloat4x4(&view) * XMLoadFloat4x4(&projection)));
+	volumePS->SetMatrix4x4("invViewProjection", invViewProjection);
+	volumePS->SetFloat2("targetSize", XMFLOAT2(volumeViewport.Width, volumeViewport.Height));
+	volumePS->SetInt("limitToSceneDepth", scale != VOLUME_RESOLUTION_FULL);
+	volumePS->SetShaderResourceView("SceneDepth", scale != VOLUME_RESOLUTION_FULL ? reducedDepthSRV.Get() : 0);
+	volumePS->CopyAllBufferData();
+
+	//cube mesh to render fluid within
+	cube->SetBuffersAndDraw(context);
+
+	if (scale != VOLUME_RESOLUTION_FULL) {
+		volumePS->SetShaderResourceView("SceneDepth", 0);
+
+		//back up to full size over the scene color, weighted towards texels at this pixel's depth
+		context->RSSetViewports(1, &viewport);
+		context->OMSetRenderTargets(1, &sceneTargets[0], 0);
+		context->OMSetBlendState(blendState.Get(), 0, 0xFFFFFFFF);
+		context->RSSetState(0);
+
+		fullscreenVS->SetShader();
+		volumeUpsamplePS->SetShader();
+		volumeUpsamplePS->SetInt("scale", scale);
+		XMINT2 lowSize((int)volumeViewport.Width, (int)volumeViewport.Height);
+		volumeUpsamplePS->SetData("lowSize", &lowSize, sizeof(XMINT2));
+		volumeUpsamplePS->SetFloat("depthA", projection._33);
+		volumeUpsamplePS->SetFloat("depthB", projection._43);
+		volumeUpsamplePS->CopyAllBufferData();
+		volumeUpsamplePS->SetShaderResourceView("LowResVolume", reducedVolumeSRV);
+		volumeUpsamplePS->SetShaderResourceView("LowResDepth", reducedDepthSRV);
+		volumeUpsamplePS->SetShaderResourceView("SceneDepth", sceneDepth);
+		context->Draw(3, 0);
+		volumeUpsamplePS->SetShaderResourceView("LowResVolume", 0);
+		volumeUpsamplePS->SetShaderResourceView("LowResDepth", 0);
+		volumeUpsamplePS->SetShaderResourceView("SceneDepth", 0);
+
+		//put the scene's targets back how they were
+		context->OMSetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, sceneTargets, sceneDepthStencil);
+		for (ID3D11RenderTargetView* target : sceneTargets) {
+			if (target) {
+				target->Release();
+			}
+		}
+		if (sceneDepthStencil) {
+			sceneDepthStencil->Release();
+		}
+	}
+
+	// Reset render states
+	context->OMSetDepthStencilState(0, 0);
+	context->OMSetBlendState(0, 0, 0xFFFFFFFF);
+	context->RSSetState(0);
+}
+
+void FluidField::CreateReducedVolumeTargets(int width, int height)
+{
+	D3D11_TEXTURE2D_DESC desc = {};
+	if (reducedVolumeTexture) {
+		reducedVolumeTexture->GetDesc(&desc);
+		if (desc.Width == (UINT)width && desc.Height == (UINT)height) {
+			return;
+		}
+	}
+
+	desc = {};
+	desc.Width = width;
+	desc.Height = height;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+	desc.SampleDesc.Count = 1;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+	reducedVolumeTexture.Reset();
+	reducedVolumeRTV.Reset();
+	reducedVolumeSRV.Reset();
+	device->CreateTexture2D(&desc, 0, reducedVolumeTexture.GetAddressOf());
+	device->CreateRenderTargetView(reducedVolumeTexture.Get(), 0, reducedVolumeRTV.GetAddressOf());
+	device->CreateShaderResourceView(reducedVolumeTexture.Get(), 0, reducedVolumeSRV.GetAddressOf());
+
+	desc.Format = DXGI_FORMAT_R32_FLOAT;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> depthTexture;
+	reducedDepthRTV.Reset();
+	reducedDepthSRV.Reset();
+	device->CreateTexture2D(&desc, 0, depthTexture.GetAddressOf());
+	device->CreateRenderTargetView(depthTexture.Get(), 0, reducedDepthRTV.GetAddressOf());
+	device->CreateShaderResourceView(depthTexture.Get(), 0, reducedDepthSRV.GetAddressOf());
+}
+
+void FluidField::RenderFluidCPU(std::shared_ptr<Camera> camera, int width, int height)
+{
+	if (!cpuRaymarcher) {
+		cpuRaymarcher = std::make_unique<VolumeRaymarcherCPU>();
+	}
+
+	//the density exactly as RenderFluid would sample it, as float4 texels
+	float interpolation = GetRenderInterpolation();
+	VolumeResource* volumes[2] = { &densityMap[0], &previousDensityMap };
+	int volumeCount = interpolation < 1.0f ? 2 : 1;
+	std::vector<unsigned char> texels;
+	for (int v = 0; v < volumeCount; v++) {
+		ReadVolumeTexels(*volumes[v], texels);
+		std::vector<float>& values = cpuRenderTexels[v];
+		if (fieldPrecision.density == FIELD_PRECISION_FLOAT16) {
+			values.resize(texels.size() / sizeof(uint16_t));
+			HalfToFloat((const uint16_t*)texels.data(), values.data(), (int)values.size());
+		}
+		else {
+			values.resize(texels.size() / sizeof(float));
+			memcpy(values.data(), texels.data(), texels.size());
+		}
+	}
+	cpuRaymarcher->SetEmptySpaceSkipping(emptySpaceSkipping, emptySpaceThreshold);
+	cpuRaymarcher->SetSampling(raymarchSamples, jitterRaymarch ? blueNoise.data() : nullptr, BLUE_NOISE_SIZE);
+	cpuRaymarcher->SetVolume(cpuRenderTexels[0].data(), volumeCount > 1 ? cpuRenderTexels[1].data() : nullptr,
+		fluidSimGridRes.x, fluidSimGridRes.y, fluidSimGridRes.z);
+
+	XMMATRIX worldMat = GetVolumeWorldMatrix();
+	XMFLOAT4X4 view = camera->GetView();
+	XMFLOAT4X4 projection = camera->GetProjection();
+	XMMATRIX viewProjection = XMLoadFloat4x4(&view) * XMLoadFloat4x4(&projection);
+	XMFLOAT3 cameraPosition = camera->GetTransform()->GetPosition();
+
+	VolumeRenderView renderView = {};
+	XMStoreFloat4x4((XMFLOAT4X4*)renderView.invViewProjection, XMMatrixInverse(0, viewProjection));
+	XMStoreFloat4x4((XMFLOAT4X4*)renderView.invWorld, XMMatrixInverse(0, worldMat));
+	memcpy(renderView.cameraPosition, &cameraPosition, sizeof(renderView.cameraPosition));
+	renderView.width = width;
+	renderView.height = height;
+	cpuRaymarcher->Render(renderView, RENDER_MODE_BLEND, GetAdaptiveRaymarchSamples(camera, (float)height), interpolation);
+
+	cpuRenderPixels.resize((size_t)width * height * 4);
+	float background[3] = { 0.0f, 0.0f, 0.0f };
+	cpuRaymarcher->CompositeRGBA8(background, cpuRenderPixels.data());
+
+	D3D11_TEXTURE2D_DESC desc = {};
+	if (cpuRenderPreview) {
+		cpuRenderPreview->GetDesc(&desc);
+	}
+	if (!cpuRenderPreview || desc.Width != (UINT)width || desc.Height != (UINT)height) {
+		desc = {};
+		desc.Width = width;
+		desc.Height = height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		cpuRenderPreview.Reset();
+		cpuRenderPreviewSRV.Reset();
+		device->CreateTexture2D(&desc, 0, cpuRenderPreview.GetAddressOf());
+		device->CreateShaderResourceView(cpuRenderPreview.Get(), 0, cpuRenderPreviewSRV.GetAddressOf());
+	}
+	context->UpdateSubresource(cpuRenderPreview.Get(), 0, 0, cpuRenderPixels.data(), width * 4, 0);
+}
+
+XMMATRIX FluidField::GetVolumeWorldMatrix()
+{
+	//cells are cubes, so the longest axis spans the unit cube and the others shrink to match
+	float largestDimension = (float)max(fluidSimGridRes.x, max(fluidSimGridRes.y, fluidSimGridRes.z));
+	XMFLOAT3 scale = {
+		fluidSimGridRes.x / largestDimension,
+		fluidSimGridRes.y / largestDimension,
+		fluidSimGridRes.z / largestDimension
+	};
+
+	//cube location
+	XMFLOAT3 translation(0, 0, 0);
+
+	return XMMatrixScaling(scale.x, scale.y, scale.z) *
+		XMMatrixTranslation(translation.x, translation.y, translation.z);
+}
+
+int FluidField::GetAdaptiveRaymarchSamples(std::shared_ptr<Camera> camera, float viewportHeight)
+{
+	if (!adaptiveRaymarch) {
+		return raymarchSamples;
+	}
+
+	//distance to the volume's bounding sphere, from inside it every step can matter
+	XMMATRIX worldMat = GetVolumeWorldMatrix();
+	XMVECTOR center = XMVector3Transform(XMVectorZero(), worldMat);
+	float radius = XMVectorGetX(XMVector3Length(XMVector3Transform(XMVectorReplicate(0.5f), worldMat) - center));
+	XMFLOAT3 cameraPosition = camera->GetTransform()->GetPosition();
+	float distance = XMVectorGetX(XMVector3Length(XMLoadFloat3(&cameraPosition) - center)) - radius;
+	if (distance <= camera->GetNearClip()) {
+		return raymarchSamples;
+	}
+
+	//the cube's diagonal in pixels at its closest, but no more than one step a
+	//voxel, past that extra samples just land between the same texels
+	XMFLOAT4X4 projection = camera->GetProjection();
+	float pixelsPerUnit = viewportHeight * 0.5f * projection._22 / distance;
+	float largestDimension = (float)max(fluidSimGridRes.x, max(fluidSimGridRes.y, fluidSimGridRes.z));
+	float samples = raymarchQuality * 1.73205f * min(pixelsPerUnit, largestDimension);
+	return (int)min(max(ceil(samples), (float)MIN_RAYMARCH_SAMPLES), (float)max(raymarchSamples, MIN_RAYMARCH_SAMPLES));
+}
+
+float FluidField::GetRenderInterpolation()
+{
+	//the leftover time is how far we are towards the next step, so blend
+	//the last two steps by that instead of jumping from one to the next
+	if (!interpolateRendering || !previousDensityValid) {
+		return 1.0f;
+	}
+	return min(max(timeCounter / fixedTimeStep, 0.0f), 1.0f);
+}
+
+void FluidField::BuildOccupancy()
+{
+	if (!emptySpaceSkipping) {
+		return;
+	}
+
+	//covers both ends of the render's blend so nothing it can show gets skipped
+	bool usePrevious = interpolateRendering && previousDensityValid;
+
+	occupancyBuildShader->SetShader();
+	SetInt3(occupancyBuildShader, "gridRes", fluidSimGridRes);
+	occupancyBuildShader->SetInt("usePrevious", usePrevious);
+	occupancyBuildShader->CopyAllBufferData();
+
+	occupancyBuildShader->SetShaderResourceView("DensityMap", densityMap[0].srv.Get());
+	occupancyBuildShader->SetShaderResourceView("PreviousDensityMap", usePrevious ? previousDensityMap.srv.Get() : densityMap[0].srv.Get());
+	occupancyBuildShader->SetUnorderedAccessView("OccupancyOut", occupancyLevelUAVs[0].Get());
+
+	//one group per brick
+	occupancyBuildShader->DispatchByGroups(bricksPerAxis.x, bricksPerAxis.y, bricksPerAxis.z);
+
+	occupancyBuildShader->SetShaderResourceView("DensityMap", 0);
+	occupancyBuildShader->SetShaderResourceView("PreviousDensityMap", 0);
+	occupancyBuildShader->SetUnorderedAccessView("OccupancyOut", 0);
+
+	for (int level = 1; level < occupancyLevels; level++) {
+		XMINT3 fineSize(max(bricksPerAxis.x >> (level - 1), 1), max(bricksPerAxis.y >> (level - 1), 1), max(bricksPerAxis.z >> (level - 1), 1));
+		XMINT3 coarseSize(max(bricksPerAxis.x >> level, 1), max(bricksPerAxis.y >> level, 1), max(bricksPerAxis.z >> level, 1));
+
+		occupancyReduceShader->SetShader();
+		SetInt3(occupancyReduceShader, "fineSize", fineSize);
+		SetInt3(occupancyReduceShader, "coarseSize", coarseSize);
+		occupancyReduceShader->CopyAllBufferData();
+
+		occupancyReduceShader->SetShaderResourceView("FineOccupancy", occupancyLevelSRVs[level - 1].Get());
+		occupancyReduceShader->SetUnorderedAccessView("CoarseOut", occupancyLevelUAVs[level].Get());
+
+		occupancyReduceShader->DispatchByThreads(coarseSize.x, coarseSize.y, coarseSize.z);
+
+		occupancyReduceShader->SetShaderResourceView("FineOccupancy", 0);
+		occupancyReduceShader->SetUnorderedAccessView("CoarseOut", 0);
+	}
+}
+
+void FluidField::SwapBuffers(VolumeResource vr[2]) {
+	//swap the buffers
+	VolumeResource temp = vr[0];
+	vr[0] = vr[1];
+	vr[1] = temp;
+}
+
+void FluidField::SwapPressureBuffers() {
+	//swap the buffers
+	//Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> temp = pressureMapSRVs[0];
+	//pressureMapSRVs[0] = pressureMapSRVs[1];
+	//pressureMapSRVs[1] = temp;
+	//
+	//Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> uavTemp = pressureMapUAVs[0];
+	//pressureMapUAVs[0] = pressureMapUAVs[1];
+	//pressureMapUAVs[1] = uavTemp;
+}
+
+FluidField::VolumeResource FluidField::CreateSRVandUAVTexture(DXGI_FORMAT format, void* initialData) {
+	return CreateSRVandUAVTexture(format, initialData, fluidSimGridRes);
+}
+
+FluidField::VolumeResource FluidField::CreateSRVandUAVTexture(DXGI_FORMAT format, void* initialData, XMINT3 gridRes) {
 
 	D3D11_TEXTURE3D_DESC desc = {};
-	desc.Width = fluidSimGridRes;
-	desc.Height = fluidSimGridRes;
-	desc.Depth = fluidSimGridRes;
+	desc.Width = gridRes.x;
+	desc.Height = gridRes.y;
+	desc.Depth = gridRes.z;
 	desc.Format = format;
 	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
 	desc.CPUAccessFlags = 0;
@@ -506,8 +2694,8 @@ FluidField::VolumeResource FluidField::CreateSRVandUAVTexture(DXGI_FORMAT format
 	D3D11_SUBRESOURCE_DATA data = {};
 	if (initialData) {
 		data.pSysMem = initialData;
-		data.SysMemPitch = DXGIFormatBytes(format) * fluidSimGridRes;
-		data.SysMemSlicePitch = DXGIFormatBytes(format) * fluidSimGridRes * fluidSimGridRes;
+		data.SysMemPitch = DXGIFormatBytes(format) * gridRes.x;
+		data.SysMemSlicePitch = DXGIFormatBytes(format) * gridRes.x * gridRes.y;
 	}
 
 	//create the texture and fill with data
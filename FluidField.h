@@ -1,6 +1,9 @@
 #pragma once
 
+#include <fstream>
+#include <future>
 #include <memory>
+#include <vector>
 #include <d3d11.h>
 #include <DirectXMath.h>
 #include <wrl/client.h> // Used for ComPtr - a smart pointer for COM objects
@@ -9,22 +12,276 @@
 #include "SimpleShader.h"
 #include "Camera.h"
 #include "Mesh.h"
+#include "GameEntity.h"
+#include "FluidSolverCPU.h"
+#include "FluidSimWorker.h"
+#include "FluidRecording.h"
+#include "FluidCheckpoint.h"
+#include "ObstacleVoxelizer.h"
+#include "PrecisionReport.h"
+#include "VolumeRaymarcherCPU.h"
+
+//where FluidField::Simulate runs the sim stages
+enum FluidSimBackend {
+	FLUID_BACKEND_GPU,
+	FLUID_BACKEND_CPU
+};
+
+//size of the target RenderFluid raymarches into, as a divisor of the viewport's
+enum VolumeResolution {
+	VOLUME_RESOLUTION_FULL = 1,
+	VOLUME_RESOLUTION_HALF = 2,
+	VOLUME_RESOLUTION_QUARTER = 4
+};
 
 class FluidField
 {
 public:
-	FluidField(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
+	FluidField(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+		int gridResX = 64, int gridResY = 64, int gridResZ = 64);
 	~FluidField();
 
 	Transform* GetTransform();
 
+	/// <summary>
+	/// Runs every fixed step the elapsed time adds up to, at most maxSubsteps
+	/// of them a frame. Time owed past that is dropped so a slow frame can't
+	/// snowball into more steps the next one. Rendering blends the last two
+	/// density states by how far the leftover time is into the next step.
+	/// </summary>
 	void UpdateFluid(float deltaTime);
 	void Simulate(float deltaTime);
+
+	int* GetMaxSubsteps() { return &maxSubsteps; }
+	bool* GetInterpolateRendering() { return &interpolateRendering; }
+	// Steps the last UpdateFluid ran and the ones it had to skip
+	int GetLastSubsteps() { return lastSubsteps; }
+	int GetLastDroppedSteps() { return lastDroppedSteps; }
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>* GetDensityMap() {
 		return &densityMap[0].srv;
 	};
 
-	void RenderFluid(std::shared_ptr<Camera> camera);
+	/// <summary>
+	/// Draws the volume into the bound scene targets. Given the scene's depth
+	/// (post projection z, 1 where nothing was drawn) and a reduced volume
+	/// resolution, it raymarches into a smaller target with rays stopping at
+	/// the nearest depth in each block instead, then blends that over target 0
+	/// with a joint bilateral upsample (see BilateralUpsample.h).
+	/// </summary>
+	void RenderFluid(std::shared_ptr<Camera> camera, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> sceneDepth = 0);
+	void SetVolumeResolution(VolumeResolution resolution) { volumeResolution = resolution; }
+	VolumeResolution GetVolumeResolution() { return volumeResolution; }
+
+	/// <summary>
+	/// Leap rays over space with no smoke in it, using a pyramid of the min and
+	/// max density per 8^3 brick and per block of bricks above that (see
+	/// OccupancyPyramid). It's rebuilt after each frame's steps, and samples
+	/// still land where they would have, only ones that see nothing are skipped.
+	/// </summary>
+	bool* GetEmptySpaceSkipping() { return &emptySpaceSkipping; }
+	// Density a brick has to stay under to count as empty
+	float* GetEmptySpaceThreshold() { return &emptySpaceThreshold; }
+
+	/// <summary>
+	/// Steps a ray takes across the cube's diagonal at most, and the spacing the
+	/// density is tuned for. Adaptive raymarching takes fewer when the volume is
+	/// small on screen, quality steps per pixel or per voxel whichever is less,
+	/// and makes each longer step block as much light as the ones it replaces.
+	/// Jitter starts each ray a blue noise fraction of a step in so fewer steps
+	/// show up as fine grain instead of banding.
+	/// </summary>
+	int* GetRaymarchSamples() { return &raymarchSamples; }
+	bool* GetAdaptiveRaymarch() { return &adaptiveRaymarch; }
+	float* GetRaymarchQuality() { return &raymarchQuality; }
+	bool* GetRaymarchJitter() { return &jitterRaymarch; }
+	// Steps the last RenderFluid took across the diagonal
+	int GetLastRaymarchSamples() { return lastRaymarchSamples; }
+
+	/// <summary>
+	/// Raymarches the density on the cpu the same way RenderFluid draws it,
+	/// see VolumeRaymarcherCPU. The volumes are read back first so it works
+	/// on either backend, but it waits on the gpu. The image over black ends
+	/// up in GetCpuRenderPreview and the timings in GetCpuRaymarcher.
+	/// </summary>
+	void RenderFluidCPU(std::shared_ptr<Camera> camera, int width, int height);
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetCpuRenderPreview() { return cpuRenderPreviewSRV; }
+	VolumeRaymarcherCPU* GetCpuRaymarcher() { return cpuRaymarcher.get(); }
+
+	/// <summary>
+	/// Rebuild the sim volumes at a new size, axes don't have to match.
+	/// Velocity, density and temperature are trilinearly resampled onto the
+	/// new grid and pressure starts over. The volume renders with the longest
+	/// axis filling the unit cube.
+	/// </summary>
+	void SetGridResolution(int resX, int resY, int resZ);
+	DirectX::XMINT3 GetGridResolution() { return fluidSimGridRes; }
+
+	/// <summary>
+	/// Switch between the compute shader sim and the multithreaded cpu
+	/// solver. The cpu solver starts from an empty field when enabled.
+	/// </summary>
+	void SetSimBackend(FluidSimBackend backend);
+	FluidSimBackend GetSimBackend() { return simBackend; }
+
+	/// <summary>
+	/// Run the cpu solver's steps on its worker thread while the frame goes
+	/// on, rendering the density from the last steps it finished. Off, each
+	/// step waits for the worker so the render is never a step behind.
+	/// </summary>
+	bool* GetAsyncCpuSim() { return &asyncCpuSim; }
+
+	// Threads the cpu solver splits each step over, 0 uses every hardware
+	// thread. The result of a step doesn't depend on it.
+	void SetCpuThreadCount(unsigned int threadCount);
+	unsigned int GetCpuThreadCount();
+
+	/// <summary>
+	/// Pick semi-lagrangian or MacCormack advection for both backends.
+	/// MacCormack is second order and keeps much more detail for an extra
+	/// pass per field, with a limiter so it stays as stable as the first.
+	/// </summary>
+	void SetAdvectionScheme(AdvectionScheme scheme) { advectionScheme = scheme; }
+	AdvectionScheme GetAdvectionScheme() { return advectionScheme; }
+
+	// Vorticity confinement strength, 0 turns it off. It runs fused with
+	// buoyancy, so it doesn't add a pass over the grid on either backend.
+	float* GetVorticityEpsilon() { return &vorticityEpsilon; }
+
+	/// <summary>
+	/// Pick the pressure solver used by both backends. Multigrid runs cycles
+	/// until the relative residual is under the tolerance, jacobi runs a
+	/// fixed number of sweeps. Spectral solves the obstacle free box
+	/// directly on the cpu backend and falls back to multigrid on the gpu
+	/// or once there are obstacles.
+	/// </summary>
+	void SetPressureSolver(PressureSolverType solver) { pressureSolver = solver; }
+	PressureSolverType GetPressureSolver() { return pressureSolver; }
+	void SetMultigridCycle(MultigridCycle cycle) { multigridCycle = cycle; }
+	MultigridCycle GetMultigridCycle() { return multigridCycle; }
+	float* GetPressureTolerance() { return &pressureTolerance; }
+	int* GetMultigridMaxCycles() { return &multigridMaxCycles; }
+	int* GetPcgMaxIterations() { return &pcgMaxIterations; }
+	int* GetJacobiMaxIterations() { return &pressureIterations; }
+
+	// Start each pressure solve from the last step's pressure instead of zero
+	bool* GetWarmStartPressure() { return &warmStartPressure; }
+
+	// The gpu always uses a jacobi preconditioner, MIC(0) is cpu only
+	void SetPcgPreconditioner(PcgPreconditioner preconditioner) { pcgPreconditioner = preconditioner; }
+	PcgPreconditioner GetPcgPreconditioner() { return pcgPreconditioner; }
+
+	// Iterations (or multigrid cycles) of the last pressure solve and the
+	// relative residual it reached, negative if it wasn't measured
+	int GetPressureIterations();
+	float GetPressureResidual();
+
+	/// <summary>
+	/// Only run the sim stages on 8^3 bricks near smoke, motion, heat or the
+	/// emitter. Volumes stay full size and the pressure solve still covers the
+	/// whole grid, bricks that go quiet are emptied and then skipped.
+	/// </summary>
+	bool* GetSparseBricks() { return &sparseBricks; }
+	int GetActiveBrickCount();
+	int GetBrickCount() { return bricksPerAxis.x * bricksPerAxis.y * bricksPerAxis.z; }
+
+	/// <summary>
+	/// Store velocity, density (with its color), temperature and pressure as
+	/// 32 or 16 bit floats. The volumes are rebuilt in the new formats with
+	/// their contents copied over. Half pressure needs typed uav loads for
+	/// R16_FLOAT and stays 32 bit on hardware without them.
+	/// </summary>
+	void SetFieldPrecision(FieldPrecisionPolicy policy);
+	FieldPrecisionPolicy GetFieldPrecision() { return fieldPrecision; }
+	bool IsHalfPressureSupported() { return halfPressureSupported; }
+
+	// Size of the precision controlled volumes, for comparing policies
+	float GetFieldMemoryMB();
+
+	// Time the last measured step took, from timestamp queries on the gpu
+	// (a few frames behind) or the wall clock on the cpu
+	float GetSimTimeMs();
+
+	/// <summary>
+	/// Runs every precision preset on the cpu solver in the background with the
+	/// current grid and scene settings, see RunPrecisionReport. The results
+	/// show up in GetPrecisionReport once it's done.
+	/// </summary>
+	void StartPrecisionReport(int steps);
+	bool IsPrecisionReportRunning();
+	const std::vector<PrecisionReportRow>& GetPrecisionReport();
+
+	/// <summary>
+	/// Voxelizes the entities' meshes into solid cells the smoke flows around,
+	/// placed where RenderFluid draws the grid. Only entities that moved since
+	/// the last call are redone, and how far they moved becomes the velocity
+	/// of the solid. Call once a frame before UpdateFluid.
+	/// </summary>
+	void UpdateObstacles(const std::vector<std::shared_ptr<GameEntity>>& entities, float deltaTime);
+	bool* GetObstaclesEnabled() { return &obstaclesEnabled; }
+	int GetObstacleCellCount() { return obstacles->GetSolidCellCount(); }
+
+	/// <summary>
+	/// Streams density and temperature to a file after every step, see
+	/// FluidRecorder. The gpu volumes are read back a few steps late so
+	/// recording never waits on the gpu. Resizing the grid or changing
+	/// field precision ends the recording.
+	/// </summary>
+	bool StartRecording(const std::string& path);
+	void StopRecording();
+	bool IsRecording() { return recorder.IsRecording(); }
+	int GetRecordedFrameCount() { return recorder.GetFrameCount(); }
+	float GetRecordingCompression() { return recorder.GetCompressionRatio(); }
+
+	/// <summary>
+	/// Replays a recording instead of simulating. The grid takes the
+	/// recording's size, each step shows the next frame straight from the
+	/// memory mapped file and it loops at the end.
+	/// </summary>
+	bool StartPlayback(const std::string& path);
+	void StopPlayback();
+	bool IsPlayingBack() { return player.IsOpen(); }
+	int GetPlaybackFrameCount() { return player.GetFrameCount(); }
+	int GetPlaybackFrame() { return playbackFrame; }
+	void SeekPlayback(int frame);
+
+	/// <summary>
+	/// Writes the whole sim state to a file: velocity, density, temperature
+	/// and pressure, the density rendering blends from, the step accumulator
+	/// and the injection settings, see FluidCheckpointHeader.
+	/// </summary>
+	bool SaveCheckpoint(const std::string& path);
+
+	/// <summary>
+	/// Restores a SaveCheckpoint file, switching to its grid size and field
+	/// precision first. The file is memory mapped and every volume uploads
+	/// straight from the mapping. Returns false without touching anything if
+	/// the file isn't a checkpoint.
+	/// </summary>
+	bool LoadCheckpoint(const std::string& path);
+
+	/// <summary>
+	/// Runs exactly one fixed step per UpdateFluid whatever the frame time,
+	/// with cpu steps waited on, and after every step hashes velocity,
+	/// density, temperature and pressure brick by brick (see HashGridBricks)
+	/// into a log with a line per step. Given the log of an earlier run each
+	/// step is checked against it and the first one that differs is kept,
+	/// to bisect where runs on different thread counts or builds part ways.
+	/// The gpu volumes are read back every step, so it's slow.
+	/// </summary>
+	bool StartDeterministicRun(const std::string& logPath, const std::string& referencePath = "");
+	void StopDeterministicRun();
+	bool IsDeterministicRun() { return stepHashLog.is_open(); }
+	int GetHashedStepCount() { return hashedSteps; }
+	int GetReferenceStepCount() { return (int)(referenceHashes.size() / HASHED_VOLUME_COUNT); }
+
+	// Hashes from the last step, velocity through pressure only
+	uint64_t GetStepHash(CheckpointVolume volume) { return stepHashes[volume]; }
+	const std::vector<uint64_t>& GetStepBrickHashes(CheckpointVolume volume) { return stepBrickHashes[volume]; }
+
+	// First step that didn't match the reference and the volume that
+	// didn't, -1 while every step has
+	int GetDivergedStep() { return divergedStep; }
+	CheckpointVolume GetDivergedVolume() { return divergedVolume; }
 private:
 	struct VolumeResource {
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv;
@@ -45,23 +302,216 @@ private:
 	/// Helper fucntion to create paired SRVs and UAVs for fluid sim
 	/// </summary>
 	VolumeResource CreateSRVandUAVTexture(DXGI_FORMAT format, void* initialData);// Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv, Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> uav);
+	VolumeResource CreateSRVandUAVTexture(DXGI_FORMAT format, void* initialData, DirectX::XMINT3 gridRes);
+
+	/// <summary>
+	/// (Re)create every volume and buffer whose size depends on fluidSimGridRes
+	/// </summary>
+	void CreateGridResources();
+
+	// A volume for AdvectVolumes to move and what cells inside obstacles get set to
+	struct AdvectedField {
+		VolumeResource* volumes;
+		DirectX::XMFLOAT4 solidValue;
+	};
+
+	/// <summary>
+	/// Advect each field's volumes[0] into volumes[1] along velocityMap[0],
+	/// with a MacCormack correction pass after the semi-lagrangian one when
+	/// that's selected. Up to MAX_ADVECTED_FIELDS fields share a dispatch, so
+	/// the velocity is read and backtraced once per cell for all of them.
+	/// </summary>
+	void AdvectVolumes(const std::vector<AdvectedField>& fields);
+
+	// (Re)create the ping-ponged field volumes in the formats fieldPrecision asks for
+	void CreateFieldVolumes();
+
+	DXGI_FORMAT GetFieldFormat(FieldPrecision precision, bool fourChannels);
+
+	// Trilinear resample of source into destination at the current grid size, times valueScale
+	void ResampleVolume(VolumeResource& source, VolumeResource& destination, DirectX::XMFLOAT4 valueScale);
+
+	// SimpleShader has no int3 setter, grid sizes go through SetData
+	bool SetInt3(std::shared_ptr<SimpleComputeShader> shader, std::string name, DirectX::XMINT3 value);
+
+	// Fill a single channel volume with zeros
+	void ClearVolume(VolumeResource& vr, DirectX::XMINT3 gridRes);
+
+	/// <summary>
+	/// Run weighted jacobi sweeps of PressureSolverCS, ping-ponging pressure
+	/// </summary>
+	void RelaxPressure(VolumeResource pressure[2], VolumeResource& rhs, DirectX::XMINT3 gridRes, int iterations, float weight);
+
+	/// <summary>
+	/// Run multigrid cycles on the gpu until the residual is under tolerance,
+	/// reading it back every multigridCheckInterval cycles
+	/// </summary>
+	void SolvePressureMultigrid();
+	void MultigridVCycle(int level);
+	void MultigridFCycle();
+
+	// Writes a level's residual and leaves per group sums in residualSumsBuffer
+	void ComputePressureResidual(int level);
+
+	// Computes the level 0 residual and reads it back, returns |r| / |divergence|
+	float MeasurePressureResidual();
+
+	void RestrictVolume(VolumeResource& fine, VolumeResource& coarse, DirectX::XMINT3 coarseGridRes);
+	void ProlongPressure(int level);
+
+	/// <summary>
+	/// Jacobi preconditioned conjugate gradient on the gpu. Dot products
+	/// stay on the gpu between iterations, the residual is only read back
+	/// every pcgCheckInterval iterations to decide when to stop.
+	/// </summary>
+	void SolvePressureConjugateGradient();
+
+	// Adds up the group sums in residualSumsBuffer into one slot of scalarsBuffer
+	void ReduceGroupSums(int outputSlot);
+	void ReadScalars(DirectX::XMFLOAT4 scalars[4]);
+
+	/// <summary>
+	/// Shift pressureMap[0] so it averages to zero. Only the gradient matters,
+	/// but a warm started pressure would otherwise drift a little every step.
+	/// </summary>
+	void RemovePressureMean();
+
+	/// <summary>
+	/// Flags bricks with content, then builds the active brick list and the
+	/// indirect dispatch args for it, and clears bricks that just went inactive
+	/// </summary>
+	void UpdateBricks();
+
+	// Sets sparseBricks and bricksPerAxis, call before CopyAllBufferData
+	void SetBrickParams(std::shared_ptr<SimpleComputeShader> shader);
+
+	// Runs a sim stage over every cell, or one group per active brick when sparse
+	void DispatchSimCells(std::shared_ptr<SimpleComputeShader> shader);
+
+	// Binds (or unbinds) the solid bits and velocities ObstacleHelpers.hlsli reads
+	void SetObstacleViews(std::shared_ptr<SimpleComputeShader> shader, bool bind);
+
+	// Copies the bricks the voxelizer just redid into the obstacle buffer and volume
+	void UploadObstacleBricks();
+
+	// Cells outside obstacles, what the pressure sums are taken over
+	double GetFluidCellCount();
+
+	// Level 0 works directly on pressureMap and velocityDivergenceMap
+	VolumeResource* GetLevelPressure(int level);
+	VolumeResource& GetLevelRhs(int level);
 	
+	/// <summary>
+	/// Step the cpu solver and upload its density to densityMap[0] for rendering
+	/// </summary>
+	void SimulateCPU();
+
+	// Settings, texel format and recorder for the cpu worker's next steps
+	int QueueCpuSteps(int steps, int maxQueued);
+
+	// Uploads the newest density the cpu worker finished, if there's one
+	void ShowCpuSimResult();
+
+	// Lets the cpu worker finish its steps, anything that touches cpuSolver or
+	// what it reads (like the obstacle grid) has to call this first
+	void WaitForCpuSim();
+
+	// Copies the scene and solver settings into a cpu solver's settings
+	void CopySimSettings(FluidSimSettings* settings);
+
+	// Adds the state after a step to the recording, gpu frames go through the readback ring
+	void RecordFrame();
+
+	// Maps every pending readback, oldest first, and adds them to the recording
+	void FlushRecordingReadbacks();
+
+	// A cpu readable copy of a volume's texture, same size and format
+	Microsoft::WRL::ComPtr<ID3D11Texture3D> CreateStagingVolume(VolumeResource& vr);
+
+	// Copies a staging volume out as halfs, converting from 32 bit unless half is set
+	void ReadStagingVolume(ID3D11Texture3D* staging, int channels, bool half, uint16_t* out);
+
+	// Fills a volume from halfs, converting to 32 bit unless half is set
+	void UploadHalfVolume(VolumeResource& vr, const uint16_t* values, int channels, bool half);
+
+	// Uploads a played back frame into densityMap[0] and temperatureMap[0]
+	void ShowPlaybackFrame(int frame);
+
+	// Hashes and logs the state after a step of a deterministic run
+	void HashStep();
+
+	// Where RenderFluid puts the unit cube, the longest axis fills it
+	DirectX::XMMATRIX GetVolumeWorldMatrix();
+
+	// How far rendering blends from previousDensityMap to densityMap[0]
+	float GetRenderInterpolation();
+
+	// Makes the reduced resolution volume and depth targets if they aren't this size already
+	void CreateReducedVolumeTargets(int width, int height);
+
+	// Raymarch steps for how big the volume is on a viewport this tall
+	int GetAdaptiveRaymarchSamples(std::shared_ptr<Camera> camera, float viewportHeight);
+
+	// Min and max density per brick of whatever the next render blends, then every coarser level
+	void BuildOccupancy();
+
+	// Reads a volume back as tightly packed texels in its own format
+	void ReadVolumeTexels(VolumeResource& vr, std::vector<unsigned char>& out);
+
+	// Fills a volume from tightly packed texels, converting if their precision differs from its own
+	void UploadVolumeTexels(VolumeResource& vr, const unsigned char* texels, int channels, bool texelsHalf, bool volumeHalf);
+
+	// Interleaves cpu solver channels into texels, CHANNEL_COUNT entries come out as zero
+	void GatherSolverTexels(const FluidChannel* channels, int channelCount, bool half, std::vector<unsigned char>& out);
+	void ScatterSolverTexels(const FluidChannel* channels, int channelCount, bool half, const unsigned char* texels);
+
+	// Timestamp queries around a gpu step, read back once the gpu gets to them
+	void BeginSimTimer();
+	void EndSimTimer();
+	void ReadSimTimers();
+
 	unsigned int DXGIFormatBits(DXGI_FORMAT format);
 	unsigned int DXGIFormatBytes(DXGI_FORMAT format);
 	unsigned int DXGIFormatChannels(DXGI_FORMAT format);
 
-	int fluidSimGridRes = 64;
-	float invFluidSimGridRes = 1.0f / fluidSimGridRes;
+	DirectX::XMINT3 fluidSimGridRes = { 64, 64, 64 };
+	DirectX::XMFLOAT3 invFluidSimGridRes;
 	//int groupSize = 8;//8*8*8 =512 the grid res
 	float fixedTimeStep = 0.016f;
 	float timeCounter = 0;
+	int maxSubsteps = 4;
+	int lastSubsteps = 0;
+	int lastDroppedSteps = 0;
 
-	DirectX::XMFLOAT4* randomPixels;// = new DirectX::XMFLOAT4[fluidSimGridRes * fluidSimGridRes * fluidSimGridRes];
-	DirectX::XMFLOAT4* randomPixelsPressure;
-	DirectX::XMFLOAT4* randomPixelsDensity;
+	//density from before the last step, rendering blends it with densityMap[0]
+	bool interpolateRendering = true;
+	VolumeResource previousDensityMap;
+	bool previousDensityValid = false;
 
 	DirectX::XMFLOAT3 fluidColor = { 1.0f, 1.0f, 1.0f };
 	int raymarchSamples = 128;
+	bool adaptiveRaymarch = true;
+	float raymarchQuality = 1.0f;
+	bool jitterRaymarch = true;
+	int lastRaymarchSamples = 0;
+	std::vector<float> blueNoise;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> blueNoiseSRV;
+
+	//reduced resolution raymarch and the nearest scene depth it stops at
+	VolumeResolution volumeResolution = VOLUME_RESOLUTION_FULL;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> reducedVolumeTexture;
+	Microsoft::WRL::ComPtr<ID3D11RenderTargetView> reducedVolumeRTV;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> reducedVolumeSRV;
+	Microsoft::WRL::ComPtr<ID3D11RenderTargetView> reducedDepthRTV;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> reducedDepthSRV;
+
+	//min max density per brick with a mip per coarser block of bricks, a uav per mip to build them
+	bool emptySpaceSkipping = true;
+	float emptySpaceThreshold = 0.0001f;
+	int occupancyLevels = 0;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> occupancySRV;
+	std::vector<Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>> occupancyLevelSRVs;
+	std::vector<Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView>> occupancyLevelUAVs;
 	Transform transform;
 
 	//inject smoke data
@@ -81,6 +531,34 @@ private:
 
 	std::shared_ptr<Mesh> cube;
 
+	FluidSimBackend simBackend = FLUID_BACKEND_GPU;
+	std::shared_ptr<FluidSolverCPU> cpuSolver;
+	//declared after cpuSolver so it stops before the solver goes away
+	std::unique_ptr<FluidSimWorker> cpuWorker;
+	bool asyncCpuSim = true;
+	unsigned int cpuThreadCount = 0;
+	//bumped whenever the density volume's size or format changes, worker texels from an older one get dropped
+	unsigned int cpuSimGeneration = 0;
+
+	//storage formats of the sim fields, see SetFieldPrecision
+	FieldPrecisionPolicy fieldPrecision;
+	bool halfPressureSupported = false;
+
+	std::future<std::vector<PrecisionReportRow>> precisionReportTask;
+	std::vector<PrecisionReportRow> precisionReport;
+
+	//a few frames of timestamp queries so reading them back never stalls
+	struct SimTimer {
+		Microsoft::WRL::ComPtr<ID3D11Query> disjoint;
+		Microsoft::WRL::ComPtr<ID3D11Query> start;
+		Microsoft::WRL::ComPtr<ID3D11Query> end;
+		bool pending = false;
+	};
+	static const int SIM_TIMER_COUNT = 4;
+	SimTimer simTimers[SIM_TIMER_COUNT];
+	int simTimerIndex = 0;
+	float lastGpuSimTimeMs = 0.0f;
+
 	VolumeResource velocityMap[2];
 	VolumeResource densityMap[2];
 	VolumeResource temperatureMap[2];
@@ -89,6 +567,142 @@ private:
 
 	VolumeResource pressureMap[2];
 
+	//semi-lagrangian results that MacCormack advection corrects, one per field in a dispatch
+	static const int MAX_ADVECTED_FIELDS = 4;
+	VolumeResource advectionScratch[MAX_ADVECTED_FIELDS];
+	//what the field last advected through each scratch volume holds where nothing is
+	DirectX::XMFLOAT4 advectionScratchClear[MAX_ADVECTED_FIELDS] = {};
+	AdvectionScheme advectionScheme = ADVECTION_SEMI_LAGRANGIAN;
+
+	//pressure solver settings, shared with the cpu solver
+	PressureSolverType pressureSolver = PRESSURE_SOLVER_MULTIGRID;
+	bool warmStartPressure = true;
+	//max jacobi sweeps, the residual is checked every jacobiCheckInterval of them
+	int pressureIterations = 20;
+	int jacobiCheckInterval = 5;
+	MultigridCycle multigridCycle = MULTIGRID_V_CYCLE;
+	int multigridMaxCycles = 10;
+	//cycles between residual readbacks, each one waits for the gpu to catch up
+	int multigridCheckInterval = 2;
+	float pressureTolerance = 0.001f;
+	int multigridPreSmoothSteps = 2;
+	int multigridPostSmoothSteps = 2;
+	int multigridCoarsestSteps = 32;
+	//damped jacobi smooths high frequencies better than plain jacobi
+	float multigridJacobiWeight = 6.0f / 7.0f;
+
+	PcgPreconditioner pcgPreconditioner = PCG_PRECONDITIONER_MIC0;
+	int pcgMaxIterations = 200;
+	int pcgCheckInterval = 10;
+
+	int lastPressureIterations = 0;
+	float lastPressureResidual = -1.0f;
+
+	//sparse brick settings, shared with the cpu solver
+	bool sparseBricks = false;
+	bool bricksWereSparse = false;
+	float brickDensityThreshold = 0.001f;
+	float brickVelocityThreshold = 0.001f;
+	float brickTemperatureThreshold = 0.001f;
+	DirectX::XMINT3 bricksPerAxis = { 0, 0, 0 };
+	int lastActiveBrickCount = 0;
+
+	//solid cells from the scene's meshes, shared with the cpu solver
+	bool obstaclesEnabled = true;
+	std::unique_ptr<ThreadPool> obstaclePool;
+	std::unique_ptr<ObstacleVoxelizer> obstacles;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> obstacleBitsBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> obstacleBitsSRV;
+	VolumeResource obstacleVelocityMap;
+	std::vector<float> obstaclePositions;
+	std::vector<uint16_t> obstacleVelocityUpload;
+
+	//where each entity was when it was last voxelized, ids are entity indices
+	struct ObstacleEntity {
+		const Mesh* mesh = nullptr;
+		DirectX::XMFLOAT4X4 world;
+		bool moving = false;
+	};
+	std::vector<ObstacleEntity> obstacleEntities;
+
+	//recording keeps a few staging copies in flight so mapping one never stalls
+	FluidRecorder recorder;
+	struct RecordingReadback {
+		Microsoft::WRL::ComPtr<ID3D11Texture3D> density;
+		Microsoft::WRL::ComPtr<ID3D11Texture3D> temperature;
+		bool pending = false;
+	};
+	static const int RECORDING_READBACK_COUNT = 3;
+	RecordingReadback recordingReadbacks[RECORDING_READBACK_COUNT];
+	int recordingReadbackIndex = 0;
+	std::vector<uint16_t> recordDensity;
+	std::vector<uint16_t> recordTemperature;
+
+	FluidPlayer player;
+	int playbackFrame = 0;
+	std::vector<float> playbackUpload;
+
+	//deterministic runs hash the checkpoint volumes up to the previous density
+	static const int HASHED_VOLUME_COUNT = CHECKPOINT_PREVIOUS_DENSITY;
+	std::ofstream stepHashLog;
+	int hashedSteps = 0;
+	uint64_t stepHashes[HASHED_VOLUME_COUNT] = {};
+	std::vector<uint64_t> stepBrickHashes[HASHED_VOLUME_COUNT];
+	std::vector<unsigned char> hashTexels;
+	//every step of the reference run, HASHED_VOLUME_COUNT hashes each
+	std::vector<uint64_t> referenceHashes;
+	int divergedStep = -1;
+	CheckpointVolume divergedVolume = CHECKPOINT_VELOCITY;
+
+	//cpu raymarching, made on first use. texels are the density and previous density as float4
+	std::unique_ptr<VolumeRaymarcherCPU> cpuRaymarcher;
+	std::vector<float> cpuRenderTexels[2];
+	std::vector<unsigned char> cpuRenderPixels;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> cpuRenderPreview;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> cpuRenderPreviewSRV;
+
+	//per brick content flags, whether each brick ran last step,
+	//and the compacted lists of bricks to run and to clear
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> brickFlagsUAV;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> brickFlagsSRV;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> brickStateBuffer;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> brickStateUAV;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> activeBricksUAV;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> activeBricksSRV;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> clearBricksUAV;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> clearBricksSRV;
+
+	//two sets of DispatchIndirect args, active bricks then bricks to clear
+	Microsoft::WRL::ComPtr<ID3D11Buffer> brickArgsBuffer;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> brickArgsUAV;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> brickArgsStaging;
+
+	struct MultigridLevel {
+		DirectX::XMINT3 gridRes;
+		//level 0 leaves pressure and rhs empty, see GetLevelPressure
+		VolumeResource pressure[2];
+		VolumeResource rhs;
+		VolumeResource residual;
+	};
+	std::vector<MultigridLevel> multigridLevels;
+
+	//per group residual sums from PressureResidualCS and a staging copy to read them
+	Microsoft::WRL::ComPtr<ID3D11Buffer> residualSumsBuffer;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> residualSumsUAV;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> residualSumsStaging;
+	int residualSumsCount = 0;
+
+	//conjugate gradient vectors, the solution is pressureMap[0] itself
+	VolumeResource pcgResidual;
+	VolumeResource pcgDirection;
+	VolumeResource pcgProduct;
+
+	//sums from ReduceGroupSumsCS, pcg dot products and the pressure mean
+	//see SolvePressureConjugateGradient for how the slots are used
+	Microsoft::WRL::ComPtr<ID3D11Buffer> scalarsBuffer;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> scalarsUAV;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> scalarsStaging;
+
 	std::shared_ptr<SimpleComputeShader> advectionShader;
 	std::shared_ptr<SimpleComputeShader> velocityDivergenceShader;
 	std::shared_ptr<SimpleComputeShader> pressureSolverShader;
@@ -96,10 +710,32 @@ private:
 	std::shared_ptr<SimpleComputeShader> clearCompShader;
 	std::shared_ptr<SimpleComputeShader> injectSmokeShader;
 	std::shared_ptr<SimpleComputeShader> buoyancyShader;
+	std::shared_ptr<SimpleComputeShader> pressureResidualShader;
+	std::shared_ptr<SimpleComputeShader> multigridRestrictShader;
+	std::shared_ptr<SimpleComputeShader> multigridProlongShader;
+	std::shared_ptr<SimpleComputeShader> pcgInitShader;
+	std::shared_ptr<SimpleComputeShader> pcgStartShader;
+	std::shared_ptr<SimpleComputeShader> pcgApplyShader;
+	std::shared_ptr<SimpleComputeShader> pcgUpdateShader;
+	std::shared_ptr<SimpleComputeShader> pcgDirectionShader;
+	std::shared_ptr<SimpleComputeShader> reduceGroupSumsShader;
+	std::shared_ptr<SimpleComputeShader> volumeSumShader;
+	std::shared_ptr<SimpleComputeShader> removeMeanShader;
+	std::shared_ptr<SimpleComputeShader> brickActivityShader;
+	std::shared_ptr<SimpleComputeShader> brickCompactShader;
+	std::shared_ptr<SimpleComputeShader> clearBricksShader;
+	std::shared_ptr<SimpleComputeShader> clearScratchBricksShader;
+	std::shared_ptr<SimpleComputeShader> resampleVolumeShader;
+	std::shared_ptr<SimpleComputeShader> macCormackShader;
+	std::shared_ptr<SimpleComputeShader> occupancyBuildShader;
+	std::shared_ptr<SimpleComputeShader> occupancyReduceShader;
 
 	//shaders to render the fluid
 	std::shared_ptr<SimplePixelShader> volumePS;
 	std::shared_ptr<SimpleVertexShader> volumeVS;
+	std::shared_ptr<SimpleVertexShader> fullscreenVS;
+	std::shared_ptr<SimplePixelShader> volumeDepthDownsamplePS;
+	std::shared_ptr<SimplePixelShader> volumeUpsamplePS;
 
 	Microsoft::WRL::ComPtr<ID3D11SamplerState> linearClampSamplerOptions;
 	Microsoft::WRL::ComPtr<ID3D11SamplerState> bilinearSamplerOptions;
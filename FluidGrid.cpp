@@ -0,0 +1,111 @@
+#include "FluidGrid.h"
+#include "FluidSimHelpers.h"
+
+#include <algorithm>
+
+// Spreads the low 10 bits of v out to every third bit
+static unsigned int DilateBits(unsigned int v)
+{
+	v = (v | (v << 16)) & 0x030000FFu;
+	v = (v | (v << 8)) & 0x0300F00Fu;
+	v = (v | (v << 4)) & 0x030C30C3u;
+	v = (v | (v << 2)) & 0x09249249u;
+	return v;
+}
+
+FluidGrid::FluidGrid(int resX, int resY, int resZ, GridLayout layout)
+	: layout(layout)
+{
+	res[0] = resX;
+	res[1] = resY;
+	res[2] = resZ;
+	for (int axis = 0; axis < 3; axis++) {
+		tiles[axis] = (res[axis] + BRICK_SIZE - 1) / BRICK_SIZE;
+	}
+	offsetX.resize(resX);
+	offsetY.resize(resY);
+	offsetZ.resize(resZ);
+
+	size_t storage = 0;
+	switch (layout) {
+	case GRID_LAYOUT_LINEAR:
+		for (int x = 0; x < resX; x++) offsetX[x] = x;
+		for (int y = 0; y < resY; y++) offsetY[y] = y * resX;
+		for (int z = 0; z < resZ; z++) offsetZ[z] = z * resX * resY;
+		storage = (size_t)resX * resY * resZ;
+		blockCount = resZ;
+		break;
+
+	case GRID_LAYOUT_TILED: {
+		const int tileCells = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+		for (int x = 0; x < resX; x++) offsetX[x] = x / BRICK_SIZE * tileCells + x % BRICK_SIZE;
+		for (int y = 0; y < resY; y++) offsetY[y] = y / BRICK_SIZE * tileCells * tiles[0] + y % BRICK_SIZE * BRICK_SIZE;
+		for (int z = 0; z < resZ; z++) offsetZ[z] = z / BRICK_SIZE * tileCells * tiles[0] * tiles[1] + z % BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+		blockCount = tiles[0] * tiles[1] * tiles[2];
+		storage = (size_t)blockCount * tileCells;
+		break;
+	}
+
+	default: {
+		//a cube of the next power of two up from the longest side, at least one block
+		int side = BRICK_SIZE;
+		while (side < std::max(resX, std::max(resY, resZ))) {
+			side *= 2;
+		}
+		for (int x = 0; x < resX; x++) offsetX[x] = (int)DilateBits(x);
+		for (int y = 0; y < resY; y++) offsetY[y] = (int)(DilateBits(y) << 1);
+		for (int z = 0; z < resZ; z++) offsetZ[z] = (int)(DilateBits(z) << 2);
+		storage = (size_t)side * side * side;
+		blockCount = (int)(storage / (BRICK_SIZE * BRICK_SIZE * BRICK_SIZE));
+
+		auto local = [](int x, int y, int z) {
+			x &= BRICK_SIZE - 1;
+			y &= BRICK_SIZE - 1;
+			z &= BRICK_SIZE - 1;
+			return (short)(DilateBits(x) | (DilateBits(y) << 1) | (DilateBits(z) << 2));
+		};
+		mortonCells.resize(BRICK_SIZE * BRICK_SIZE * BRICK_SIZE);
+		for (int z = 0; z < BRICK_SIZE; z++) {
+			for (int y = 0; y < BRICK_SIZE; y++) {
+				for (int x = 0; x < BRICK_SIZE; x++) {
+					MortonCell& cell = mortonCells[local(x, y, z)];
+					cell.x = (unsigned char)x;
+					cell.y = (unsigned char)y;
+					cell.z = (unsigned char)z;
+					cell.negX = local(x - 1, y, z);
+					cell.posX = local(x + 1, y, z);
+					cell.negY = local(x, y - 1, z);
+					cell.posY = local(x, y + 1, z);
+					cell.negZ = local(x, y, z - 1);
+					cell.posZ = local(x, y, z + 1);
+				}
+			}
+		}
+		break;
+	}
+	}
+
+	data.assign(storage, 0.0f);
+}
+
+void FluidGrid::CopyFrom(const float* linear)
+{
+	for (int z = 0; z < res[2]; z++) {
+		for (int y = 0; y < res[1]; y++) {
+			for (int x = 0; x < res[0]; x++) {
+				data[Index(x, y, z)] = linear[GridIndex(x, y, z, res[0], res[1])];
+			}
+		}
+	}
+}
+
+void FluidGrid::CopyTo(float* linear) const
+{
+	for (int z = 0; z < res[2]; z++) {
+		for (int y = 0; y < res[1]; y++) {
+			for (int x = 0; x < res[0]; x++) {
+				linear[GridIndex(x, y, z, res[0], res[1])] = data[Index(x, y, z)];
+			}
+		}
+	}
+}
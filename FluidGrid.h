@@ -0,0 +1,278 @@
+#pragma once
+
+#include <vector>
+
+#include "BrickMask.h"
+#include "ThreadPool.h"
+
+// How a FluidGrid orders its cells in memory
+enum GridLayout {
+	GRID_LAYOUT_LINEAR, //x fastest then y then z, the order every other cpu field uses
+	GRID_LAYOUT_TILED, //BRICK_SIZE^3 tiles one after another, x fastest inside and between tiles
+	GRID_LAYOUT_MORTON, //bits of x, y and z interleaved, over a power of two cube
+	GRID_LAYOUT_COUNT
+};
+
+// Storage index of a cell's six neighbours, clamped to the cell itself
+// at the walls like GetLowerIndex and GetUpperIndex
+struct GridNeighbours {
+	int negX;
+	int posX;
+	int negY;
+	int posY;
+	int negZ;
+	int posZ;
+};
+
+// A scalar field over a 3D grid with a choice of memory layout. With a
+// linear layout the z neighbours of a cell are a whole slice away, tiles
+// and Morton order keep all six within a few cache lines for most cells.
+// Tiled and Morton grids are padded out to whole tiles and a power of two
+// cube (up to 1024 a side), the padding is never visited. Cells are walked
+// in blocks that are contiguous in memory, a slice for linear and 512 cells
+// for the others, with the neighbour offsets worked out the cheapest way
+// for each layout.
+class FluidGrid
+{
+public:
+	FluidGrid(int resX, int resY, int resZ, GridLayout layout);
+
+	GridLayout GetLayout() { return layout; }
+	int GetResX() { return res[0]; }
+	int GetResY() { return res[1]; }
+	int GetResZ() { return res[2]; }
+
+	// Storage index of a cell, for random access
+	int Index(int x, int y, int z) const { return offsetX[x] + offsetY[y] + offsetZ[z]; }
+
+	float* GetData() { return data.data(); }
+	const float* GetData() const { return data.data(); }
+	// Floats of storage including padding
+	size_t GetStorageSize() { return data.size(); }
+
+	// Copies to and from an x fastest array of resX * resY * resZ values
+	void CopyFrom(const float* linear);
+	void CopyTo(float* linear) const;
+
+	// Blocks ForEachCell hands out, each one contiguous in storage
+	int GetBlockCount() { return blockCount; }
+
+	/// <summary>
+	/// Calls func(x, y, z, index, neighbours) for every cell of the grid,
+	/// blocks split over the pool. The cells of a block run in storage order.
+	/// </summary>
+	template<typename Func>
+	void ForEachCell(ThreadPool* pool, Func func) const;
+
+private:
+	template<typename Func>
+	void ForEachLinearCell(int z, Func& func) const;
+	template<typename Func>
+	void ForEachTiledCell(int tile, Func& func) const;
+	template<typename Func>
+	void ForEachMortonCell(int block, Func& func) const;
+
+	int res[3];
+	GridLayout layout;
+	int blockCount;
+
+	//tiles per axis, tiled layout only
+	int tiles[3];
+
+	// Where a cell of a 512 cell morton block sits, and the block index of
+	// each neighbour with coordinates wrapping around the block's edges
+	struct MortonCell {
+		unsigned char x;
+		unsigned char y;
+		unsigned char z;
+		short negX;
+		short posX;
+		short negY;
+		short posY;
+		short negZ;
+		short posZ;
+	};
+	std::vector<MortonCell> mortonCells;
+	//storage offset of each coordinate along an axis, a cell's index is the sum of all three
+	std::vector<int> offsetX;
+	std::vector<int> offsetY;
+	std::vector<int> offsetZ;
+	std::vector<float> data;
+};
+
+//masks picking one axis' bits out of a morton index
+#define MORTON_MASK_X 0x09249249u
+#define MORTON_MASK_Y 0x12492492u
+#define MORTON_MASK_Z 0x24924924u
+
+template<typename Func>
+void FluidGrid::ForEachCell(ThreadPool* pool, Func func) const
+{
+	pool->ParallelFor(0, blockCount, [&](int blockBegin, int blockEnd) {
+		for (int block = blockBegin; block < blockEnd; block++) {
+			switch (layout) {
+			case GRID_LAYOUT_LINEAR: ForEachLinearCell(block, func); break;
+			case GRID_LAYOUT_TILED: ForEachTiledCell(block, func); break;
+			default: ForEachMortonCell(block, func); break;
+			}
+		}
+	});
+}
+
+template<typename Func>
+void FluidGrid::ForEachLinearCell(int z, Func& func) const
+{
+	const int strideZ = res[0] * res[1];
+	GridNeighbours n;
+	for (int y = 0; y < res[1]; y++) {
+		int i = z * strideZ + y * res[0];
+		n.negY = y > 0 ? i - res[0] : i;
+		n.posY = y < res[1] - 1 ? i + res[0] : i;
+		n.negZ = z > 0 ? i - strideZ : i;
+		n.posZ = z < res[2] - 1 ? i + strideZ : i;
+		for (int x = 0; x < res[0]; x++, i++) {
+			n.negX = x > 0 ? i - 1 : i;
+			n.posX = x < res[0] - 1 ? i + 1 : i;
+			func(x, y, z, i, n);
+			n.negY++;
+			n.posY++;
+			n.negZ++;
+			n.posZ++;
+		}
+	}
+}
+
+template<typename Func>
+void FluidGrid::ForEachTiledCell(int tile, Func& func) const
+{
+	const int tileCells = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+	const int strideY = BRICK_SIZE;
+	const int strideZ = BRICK_SIZE * BRICK_SIZE;
+	//stepping off a tile's face lands on the far face of the tile next to it
+	const int crossX = tileCells - (BRICK_SIZE - 1);
+	const int crossY = tileCells * tiles[0] - (BRICK_SIZE - 1) * strideY;
+	const int crossZ = tileCells * tiles[0] * tiles[1] - (BRICK_SIZE - 1) * strideZ;
+
+	int origin[3] = {
+		tile % tiles[0] * BRICK_SIZE,
+		tile / tiles[0] % tiles[1] * BRICK_SIZE,
+		tile / (tiles[0] * tiles[1]) * BRICK_SIZE
+	};
+	int end[3];
+	for (int axis = 0; axis < 3; axis++) {
+		end[axis] = origin[axis] + BRICK_SIZE < res[axis] ? BRICK_SIZE : res[axis] - origin[axis];
+	}
+
+	GridNeighbours n;
+	for (int lz = 0; lz < end[2]; lz++) {
+		int z = origin[2] + lz;
+		for (int ly = 0; ly < end[1]; ly++) {
+			int y = origin[1] + ly;
+			int i = tile * tileCells + lz * strideZ + ly * strideY;
+			n.negY = ly > 0 ? i - strideY : y > 0 ? i - crossY : i;
+			n.posY = ly < BRICK_SIZE - 1 ? (y < res[1] - 1 ? i + strideY : i) : y < res[1] - 1 ? i + crossY : i;
+			n.negZ = lz > 0 ? i - strideZ : z > 0 ? i - crossZ : i;
+			n.posZ = lz < BRICK_SIZE - 1 ? (z < res[2] - 1 ? i + strideZ : i) : z < res[2] - 1 ? i + crossZ : i;
+
+			//only the first and last cell of a row can leave the tile along x
+			int x = origin[0];
+			n.negX = x > 0 ? i - crossX : i;
+			n.posX = end[0] > 1 ? i + 1 : x < res[0] - 1 ? i + crossX : i;
+			func(x, y, z, i, n);
+			for (int lx = 1; lx < end[0] - 1; lx++) {
+				n.negX = i;
+				n.posX = i + 2;
+				i++;
+				n.negY++;
+				n.posY++;
+				n.negZ++;
+				n.posZ++;
+				func(x + lx, y, z, i, n);
+			}
+			if (end[0] > 1) {
+				x += end[0] - 1;
+				n.negX = i;
+				i++;
+				n.posX = x < res[0] - 1 ? i + crossX : i;
+				n.negY++;
+				n.posY++;
+				n.negZ++;
+				n.posZ++;
+				func(x, y, z, i, n);
+			}
+		}
+	}
+}
+
+template<typename Func>
+void FluidGrid::ForEachMortonCell(int block, Func& func) const
+{
+	//a block of 512 cells is an aligned 8^3 cube, its low bits decode to the
+	//cell's place inside and the high bits to where the cube starts
+	const int blockCells = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+	unsigned int first = (unsigned int)(block * blockCells);
+	int origin[3] = { 0, 0, 0 };
+	for (int bit = 9; bit < 30; bit++) {
+		if (first & (1u << bit)) {
+			origin[bit % 3] |= 1 << (bit / 3);
+		}
+	}
+	if (origin[0] >= res[0] || origin[1] >= res[1] || origin[2] >= res[2]) {
+		return;
+	}
+
+	//first cell of the six blocks around this one, dilated integer arithmetic
+	//steps one axis by a block and leaves the other two alone
+	const unsigned int blockStep[3] = { 1u << 9, 1u << 10, 1u << 11 };
+	const unsigned int masks[3] = { MORTON_MASK_X, MORTON_MASK_Y, MORTON_MASK_Z };
+	int negFirst[3];
+	int posFirst[3];
+	for (int axis = 0; axis < 3; axis++) {
+		unsigned int along = first & masks[axis];
+		unsigned int rest = first & ~masks[axis];
+		negFirst[axis] = (int)(((along - blockStep[axis]) & masks[axis]) | rest);
+		posFirst[axis] = (int)((((along | ~masks[axis]) + blockStep[axis]) & masks[axis]) | rest);
+	}
+
+	//inside the block each neighbour is a table lookup, stepping off a face
+	//lands at the same wrapped place in the block next door
+	GridNeighbours n;
+	const int base = (int)first;
+	bool interior = true;
+	for (int axis = 0; axis < 3; axis++) {
+		interior = interior && origin[axis] > 0 && origin[axis] + BRICK_SIZE < res[axis];
+	}
+	if (interior) {
+		//nothing around this block is a wall or padding, so no clamping
+		for (int local = 0; local < blockCells; local++) {
+			const MortonCell& cell = mortonCells[local];
+			n.negX = (cell.x > 0 ? base : negFirst[0]) + cell.negX;
+			n.posX = (cell.x < BRICK_SIZE - 1 ? base : posFirst[0]) + cell.posX;
+			n.negY = (cell.y > 0 ? base : negFirst[1]) + cell.negY;
+			n.posY = (cell.y < BRICK_SIZE - 1 ? base : posFirst[1]) + cell.posY;
+			n.negZ = (cell.z > 0 ? base : negFirst[2]) + cell.negZ;
+			n.posZ = (cell.z < BRICK_SIZE - 1 ? base : posFirst[2]) + cell.posZ;
+			func(origin[0] + cell.x, origin[1] + cell.y, origin[2] + cell.z, base + local, n);
+		}
+		return;
+	}
+
+	for (int local = 0; local < blockCells; local++) {
+		const MortonCell& cell = mortonCells[local];
+		int x = origin[0] + cell.x;
+		int y = origin[1] + cell.y;
+		int z = origin[2] + cell.z;
+		if (x >= res[0] || y >= res[1] || z >= res[2]) {
+			continue;
+		}
+
+		int i = base + local;
+		n.negX = x > 0 ? (cell.x > 0 ? base : negFirst[0]) + cell.negX : i;
+		n.posX = x < res[0] - 1 ? (cell.x < BRICK_SIZE - 1 ? base : posFirst[0]) + cell.posX : i;
+		n.negY = y > 0 ? (cell.y > 0 ? base : negFirst[1]) + cell.negY : i;
+		n.posY = y < res[1] - 1 ? (cell.y < BRICK_SIZE - 1 ? base : posFirst[1]) + cell.posY : i;
+		n.negZ = z > 0 ? (cell.z > 0 ? base : negFirst[2]) + cell.negZ : i;
+		n.posZ = z < res[2] - 1 ? (cell.z < BRICK_SIZE - 1 ? base : posFirst[2]) + cell.posZ : i;
+		func(x, y, z, i, n);
+	}
+}
@@ -0,0 +1,689 @@
+#include "FluidRecording.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+
+//frames waiting for the writer thread before AddFrame blocks
+static const size_t MAX_PENDING_FRAMES = 4;
+
+static const uint32_t RECORDING_VERSION = 1;
+
+//rans frequencies add up to 1 << RANS_SCALE_BITS, and renormalizing
+//keeps the coder state in [RANS_LOWER, RANS_LOWER << 8)
+static const int RANS_SCALE_BITS = 14;
+static const uint32_t RANS_SCALE = 1u << RANS_SCALE_BITS;
+static const uint32_t RANS_LOWER = 1u << 23;
+
+//how a stream's bytes are stored
+enum StreamMethod {
+	STREAM_STORED,
+	STREAM_RANS
+};
+
+//every frame is a brick mode byte per brick, then the low and high bytes of the deltas
+enum FrameStream {
+	STREAM_MODES,
+	STREAM_LOW,
+	STREAM_HIGH,
+	STREAM_COUNT
+};
+
+//start of the file, frameCount and indexOffset are filled in when recording stops
+struct RecordingHeader {
+	char magic[4];
+	uint32_t version;
+	int32_t res[3];
+	uint32_t channelCount;
+	uint32_t keyframeInterval;
+	float timeStep;
+	uint32_t frameCount;
+	uint32_t reserved;
+	uint64_t indexOffset;
+};
+
+static void AppendU32(std::vector<unsigned char>& out, uint32_t value)
+{
+	unsigned char bytes[4];
+	memcpy(bytes, &value, 4);
+	out.insert(out.end(), bytes, bytes + 4);
+}
+
+static bool ReadU32(const unsigned char*& data, const unsigned char* end, uint32_t* value)
+{
+	if (end - data < 4) {
+		return false;
+	}
+	memcpy(value, data, 4);
+	data += 4;
+	return true;
+}
+
+// Scales byte counts to frequencies that add up to RANS_SCALE, with every
+// byte that shows up getting at least 1. False if that can't be done.
+static bool BuildFrequencies(const std::vector<unsigned char>& raw, uint16_t freqs[256])
+{
+	uint32_t counts[256] = {};
+	for (unsigned char value : raw) {
+		counts[value]++;
+	}
+
+	uint32_t sum = 0;
+	int largest = 0;
+	for (int s = 0; s < 256; s++) {
+		freqs[s] = 0;
+		if (counts[s] == 0) {
+			continue;
+		}
+		uint32_t freq = (uint32_t)((uint64_t)counts[s] * RANS_SCALE / raw.size());
+		freqs[s] = (uint16_t)std::max(freq, 1u);
+		sum += freqs[s];
+		if (counts[s] > counts[largest]) {
+			largest = s;
+		}
+	}
+
+	//rounding leaves the total a little off, the most common byte soaks it up
+	int adjusted = (int)freqs[largest] + (int)RANS_SCALE - (int)sum;
+	if (adjusted < 1) {
+		return false;
+	}
+	freqs[largest] = (uint16_t)adjusted;
+	return true;
+}
+
+static void GetStarts(const uint16_t freqs[256], uint32_t starts[256])
+{
+	uint32_t start = 0;
+	for (int s = 0; s < 256; s++) {
+		starts[s] = start;
+		start += freqs[s];
+	}
+}
+
+static void RansEncode(const std::vector<unsigned char>& raw, const uint16_t freqs[256], std::vector<unsigned char>& out)
+{
+	uint32_t starts[256];
+	GetStarts(freqs, starts);
+
+	//a byte costs at most RANS_SCALE_BITS bits, plus the final state
+	out.resize(raw.size() * 2 + 4);
+	unsigned char* end = out.data() + out.size();
+	unsigned char* ptr = end;
+
+	//rans is last in first out, so encode backwards and the decoder reads forwards
+	uint32_t x = RANS_LOWER;
+	for (size_t i = raw.size(); i-- > 0;) {
+		unsigned char s = raw[i];
+		uint32_t freq = freqs[s];
+		uint32_t limit = ((RANS_LOWER >> RANS_SCALE_BITS) << 8) * freq;
+		while (x >= limit) {
+			*--ptr = (unsigned char)(x & 0xff);
+			x >>= 8;
+		}
+		x = ((x / freq) << RANS_SCALE_BITS) + (x % freq) + starts[s];
+	}
+
+	ptr -= 4;
+	memcpy(ptr, &x, 4);
+
+	size_t size = end - ptr;
+	memmove(out.data(), ptr, size);
+	out.resize(size);
+}
+
+static bool RansDecode(const unsigned char* data, size_t size, const uint16_t freqs[256], unsigned char* out, size_t count)
+{
+	uint32_t starts[256];
+	GetStarts(freqs, starts);
+
+	//slot -> byte lookup, one entry per unit of frequency
+	std::vector<unsigned char> symbols(RANS_SCALE);
+	for (int s = 0; s < 256; s++) {
+		std::fill(symbols.begin() + starts[s], symbols.begin() + starts[s] + freqs[s], (unsigned char)s);
+	}
+
+	const unsigned char* end = data + size;
+	uint32_t x;
+	if (!ReadU32(data, end, &x)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t slot = x & (RANS_SCALE - 1);
+		unsigned char s = symbols[slot];
+		x = freqs[s] * (x >> RANS_SCALE_BITS) + slot - starts[s];
+		while (x < RANS_LOWER) {
+			if (data == end) {
+				return false;
+			}
+			x = (x << 8) | *data++;
+		}
+		out[i] = s;
+	}
+	return true;
+}
+
+// Appends a stream as its raw size, method and payload. Streams that
+// don't get smaller (or are too small to be worth a table) are stored.
+static void WriteStream(const std::vector<unsigned char>& raw, std::vector<unsigned char>& out, std::vector<unsigned char>& scratch)
+{
+	AppendU32(out, (uint32_t)raw.size());
+
+	uint16_t freqs[256];
+	if (raw.size() > sizeof(freqs) && BuildFrequencies(raw, freqs)) {
+		RansEncode(raw, freqs, scratch);
+		if (scratch.size() + sizeof(freqs) < raw.size()) {
+			AppendU32(out, STREAM_RANS);
+			const unsigned char* table = (const unsigned char*)freqs;
+			out.insert(out.end(), table, table + sizeof(freqs));
+			AppendU32(out, (uint32_t)scratch.size());
+			out.insert(out.end(), scratch.begin(), scratch.end());
+			return;
+		}
+	}
+
+	AppendU32(out, STREAM_STORED);
+	out.insert(out.end(), raw.begin(), raw.end());
+}
+
+// Reads a stream WriteStream wrote, false if it's damaged or would decode
+// to more than maxSize bytes
+static bool ReadStream(const unsigned char*& data, const unsigned char* end, size_t maxSize, std::vector<unsigned char>& raw)
+{
+	uint32_t rawSize;
+	uint32_t method;
+	if (!ReadU32(data, end, &rawSize) || !ReadU32(data, end, &method) || rawSize > maxSize) {
+		return false;
+	}
+	raw.resize(rawSize);
+
+	if (method == STREAM_STORED) {
+		if ((size_t)(end - data) < rawSize) {
+			return false;
+		}
+		memcpy(raw.data(), data, rawSize);
+		data += rawSize;
+		return true;
+	}
+
+	uint16_t freqs[256];
+	uint32_t codedSize;
+	if (method != STREAM_RANS || (size_t)(end - data) < sizeof(freqs)) {
+		return false;
+	}
+	memcpy(freqs, data, sizeof(freqs));
+	data += sizeof(freqs);
+
+	//a bad table would index past the slot lookup
+	uint32_t total = 0;
+	for (int s = 0; s < 256; s++) {
+		total += freqs[s];
+	}
+	if (total != RANS_SCALE || !ReadU32(data, end, &codedSize) || (size_t)(end - data) < codedSize) {
+		return false;
+	}
+
+	bool decoded = RansDecode(data, codedSize, freqs, raw.data(), rawSize);
+	data += codedSize;
+	return decoded;
+}
+
+// Deltas are taken on the half bit patterns, which is exact both ways and
+// small wherever a value barely changed. Zigzag keeps small negatives small.
+static uint16_t ZigzagDelta(uint16_t value, uint16_t reference)
+{
+	uint16_t delta = (uint16_t)(value - reference);
+	return (uint16_t)((delta << 1) ^ (0 - (delta >> 15)));
+}
+
+static uint16_t UnzigzagDelta(uint16_t zigzag, uint16_t reference)
+{
+	uint16_t delta = (uint16_t)((zigzag >> 1) ^ (0 - (zigzag & 1)));
+	return (uint16_t)(reference + delta);
+}
+
+FluidRecorder::~FluidRecorder()
+{
+	Stop();
+}
+
+bool FluidRecorder::Start(const std::string& path, int resX, int resY, int resZ, float timeStep, int keyframeInterval)
+{
+	Stop();
+
+	if (resX > RECORDING_MAX_RESOLUTION || resY > RECORDING_MAX_RESOLUTION || resZ > RECORDING_MAX_RESOLUTION) {
+		return false;
+	}
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		return false;
+	}
+
+	res[0] = resX;
+	res[1] = resY;
+	res[2] = resZ;
+	cellCount = resX * resY * resZ;
+	this->keyframeInterval = std::max(keyframeInterval, 1);
+	bricks = std::make_unique<BrickMask>(resX, resY, resZ);
+
+	reference.assign((size_t)cellCount * RECORDING_CHANNELS, 0);
+	frameOffsets.clear();
+	pending.clear();
+	queuedFrames = 0;
+	rawBytes = 0;
+	stopping = false;
+
+	//the frame count and index get filled in by Stop
+	RecordingHeader header = {};
+	memcpy(header.magic, "FLRC", 4);
+	header.version = RECORDING_VERSION;
+	header.res[0] = resX;
+	header.res[1] = resY;
+	header.res[2] = resZ;
+	header.channelCount = RECORDING_CHANNELS;
+	header.keyframeInterval = this->keyframeInterval;
+	header.timeStep = timeStep;
+	file.write((const char*)&header, sizeof(header));
+	writtenBytes = sizeof(header);
+
+	writer = std::thread(&FluidRecorder::WriterLoop, this);
+	return true;
+}
+
+void FluidRecorder::AddFrame(const uint16_t* densityRGBA, const uint16_t* temperature)
+{
+	if (!IsRecording()) {
+		return;
+	}
+
+	//planar like the encoder walks it, so each brick row of a channel is contiguous
+	std::vector<uint16_t> frame((size_t)cellCount * RECORDING_CHANNELS);
+	for (int i = 0; i < cellCount; i++) {
+		for (int c = 0; c < 4; c++) {
+			frame[(size_t)c * cellCount + i] = densityRGBA[i * 4 + c];
+		}
+	}
+	memcpy(&frame[(size_t)4 * cellCount], temperature, cellCount * sizeof(uint16_t));
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		spaceCondition.wait(lock, [&] { return pending.size() < MAX_PENDING_FRAMES; });
+		pending.push_back(std::move(frame));
+	}
+	workCondition.notify_one();
+	queuedFrames++;
+}
+
+void FluidRecorder::Stop()
+{
+	if (!IsRecording()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workCondition.notify_one();
+	writer.join();
+
+	//the index goes after the last frame, then the header learns where it is
+	uint64_t indexOffset = writtenBytes;
+	uint32_t frameCount = (uint32_t)frameOffsets.size();
+	file.write((const char*)frameOffsets.data(), frameOffsets.size() * sizeof(uint64_t));
+
+	file.seekp(offsetof(RecordingHeader, frameCount));
+	file.write((const char*)&frameCount, sizeof(frameCount));
+	file.seekp(offsetof(RecordingHeader, indexOffset));
+	file.write((const char*)&indexOffset, sizeof(indexOffset));
+	file.close();
+}
+
+float FluidRecorder::GetCompressionRatio()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return writtenBytes > sizeof(RecordingHeader) ? (float)((double)rawBytes / (writtenBytes - sizeof(RecordingHeader))) : 0.0f;
+}
+
+void FluidRecorder::WriterLoop()
+{
+	std::vector<unsigned char> streams[STREAM_COUNT];
+	std::vector<unsigned char> frameData;
+	std::vector<unsigned char> scratch;
+	const int sliceSize = res[0] * res[1];
+
+	for (int frameIndex = 0;; frameIndex++) {
+		std::vector<uint16_t> frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workCondition.wait(lock, [&] { return !pending.empty() || stopping; });
+			if (pending.empty()) {
+				return;
+			}
+			frame = std::move(pending.front());
+			pending.pop_front();
+		}
+		spaceCondition.notify_one();
+
+		//keyframes are taken against an empty grid so seeking can start from them
+		bool keyframe = frameIndex % keyframeInterval == 0;
+		if (keyframe) {
+			std::fill(reference.begin(), reference.end(), 0);
+		}
+
+		for (auto& stream : streams) {
+			stream.clear();
+		}
+
+		for (int brick = 0; brick < bricks->GetBrickCount(); brick++) {
+			int begin[3];
+			int end[3];
+			bricks->GetBrickBounds(brick, begin, end);
+
+			bool changed = false;
+			for (int c = 0; c < RECORDING_CHANNELS && !changed; c++) {
+				for (int z = begin[2]; z < end[2] && !changed; z++) {
+					for (int y = begin[1]; y < end[1] && !changed; y++) {
+						size_t row = (size_t)c * cellCount + z * sliceSize + y * res[0];
+						changed = memcmp(&frame[row + begin[0]], &reference[row + begin[0]], (end[0] - begin[0]) * sizeof(uint16_t)) != 0;
+					}
+				}
+			}
+
+			//bricks that match the reference cost a byte, most of an idle grid
+			streams[STREAM_MODES].push_back(changed ? 1 : 0);
+			if (!changed) {
+				continue;
+			}
+
+			for (int c = 0; c < RECORDING_CHANNELS; c++) {
+				for (int z = begin[2]; z < end[2]; z++) {
+					for (int y = begin[1]; y < end[1]; y++) {
+						size_t row = (size_t)c * cellCount + z * sliceSize + y * res[0];
+						for (int x = begin[0]; x < end[0]; x++) {
+							uint16_t delta = ZigzagDelta(frame[row + x], reference[row + x]);
+							streams[STREAM_LOW].push_back((unsigned char)(delta & 0xff));
+							streams[STREAM_HIGH].push_back((unsigned char)(delta >> 8));
+							reference[row + x] = frame[row + x];
+						}
+					}
+				}
+			}
+		}
+
+		frameData.clear();
+		AppendU32(frameData, keyframe ? 1 : 0);
+		for (auto& stream : streams) {
+			WriteStream(stream, frameData, scratch);
+		}
+
+		file.write((const char*)frameData.data(), frameData.size());
+
+		std::lock_guard<std::mutex> lock(mutex);
+		frameOffsets.push_back(writtenBytes);
+		writtenBytes += frameData.size();
+		rawBytes += frame.size() * sizeof(uint16_t);
+	}
+}
+
+FluidPlayer::~FluidPlayer()
+{
+	Close();
+}
+
+bool FluidPlayer::Open(const std::string& path)
+{
+	Close();
+
+	if (!file.Open(path)) {
+		return false;
+	}
+	const unsigned char* mappedData = file.GetData();
+	size_t mappedSize = file.GetSize();
+
+	RecordingHeader header;
+	bool valid = mappedSize >= sizeof(header);
+	if (valid) {
+		memcpy(&header, mappedData, sizeof(header));
+		valid = memcmp(header.magic, "FLRC", 4) == 0 && header.version == RECORDING_VERSION &&
+			header.channelCount == RECORDING_CHANNELS && header.keyframeInterval > 0 && header.frameCount > 0 &&
+			header.indexOffset <= mappedSize &&
+			(mappedSize - header.indexOffset) / sizeof(uint64_t) >= header.frameCount;
+	}
+	//every buffer is sized from the resolution, so it has to be one a recorder could have written
+	uint64_t headerCells = 1;
+	for (int axis = 0; axis < 3 && valid; axis++) {
+		valid = header.res[axis] > 0 && header.res[axis] <= RECORDING_MAX_RESOLUTION;
+		headerCells *= valid ? (uint64_t)header.res[axis] : 0;
+	}
+	if (!valid || headerCells * RECORDING_CHANNELS > (uint64_t)INT_MAX) {
+		Close();
+		return false;
+	}
+
+	frameOffsets.resize(header.frameCount);
+	memcpy(frameOffsets.data(), mappedData + header.indexOffset, header.frameCount * sizeof(uint64_t));
+	//every frame ends where the next one starts, the last one where the index does
+	frameOffsets.push_back(header.indexOffset);
+	for (size_t i = 0; i + 1 < frameOffsets.size(); i++) {
+		if (frameOffsets[i] < sizeof(header) || frameOffsets[i] > frameOffsets[i + 1]) {
+			Close();
+			return false;
+		}
+	}
+
+	for (int axis = 0; axis < 3; axis++) {
+		res[axis] = header.res[axis];
+	}
+	cellCount = (int)headerCells;
+	keyframeInterval = (int)header.keyframeInterval;
+	timeStep = header.timeStep;
+	bricks = std::make_unique<BrickMask>(res[0], res[1], res[2]);
+
+	reference.assign((size_t)cellCount * RECORDING_CHANNELS, 0);
+	referenceFrame = -1;
+	for (DecodedFrame& slot : slots) {
+		slot.frame = -1;
+		slot.densityRGBA.resize((size_t)cellCount * 4);
+		slot.temperature.resize(cellCount);
+	}
+	targetFrame = 0;
+	prefetchMisses = 0;
+	stopping = false;
+
+	decoder = std::thread(&FluidPlayer::DecoderLoop, this);
+	return true;
+}
+
+void FluidPlayer::Close()
+{
+	if (decoder.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		workCondition.notify_one();
+		decoder.join();
+	}
+
+	file.Close();
+	frameOffsets.clear();
+}
+
+int FluidPlayer::GetFrameCount()
+{
+	//the last offset is the end of the frames, not a frame
+	return frameOffsets.empty() ? 0 : (int)frameOffsets.size() - 1;
+}
+
+bool FluidPlayer::GetFrame(int frame, const uint16_t** densityRGBA, const uint16_t** temperature)
+{
+	if (!IsOpen() || frame < 0 || frame >= GetFrameCount()) {
+		return false;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	targetFrame = frame;
+	workCondition.notify_one();
+
+	DecodedFrame* slot = FindSlot(frame);
+	if (!slot) {
+		prefetchMisses++;
+		readyCondition.wait(lock, [&] { return (slot = FindSlot(frame)) != nullptr; });
+	}
+
+	if (!slot->valid) {
+		return false;
+	}
+	*densityRGBA = slot->densityRGBA.data();
+	*temperature = slot->temperature.data();
+	return true;
+}
+
+FluidPlayer::DecodedFrame* FluidPlayer::FindSlot(int frame)
+{
+	for (DecodedFrame& slot : slots) {
+		if (slot.frame == frame) {
+			return &slot;
+		}
+	}
+	return nullptr;
+}
+
+void FluidPlayer::DecoderLoop()
+{
+	const int frameCount = GetFrameCount();
+	//taken by value, std::min would bind the constant to a reference and need a definition before c++17
+	const int windowSize = frameCount < PREFETCH_FRAMES ? frameCount : PREFETCH_FRAMES;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping) {
+		//the first frame coming up that isn't decoded yet, playback loops so the window wraps
+		int wanted = -1;
+		for (int i = 0; i < windowSize && wanted < 0; i++) {
+			int frame = (targetFrame + i) % frameCount;
+			if (!FindSlot(frame)) {
+				wanted = frame;
+			}
+		}
+		if (wanted < 0) {
+			workCondition.wait(lock);
+			continue;
+		}
+
+		//there's one slot per window frame and wanted isn't in any, so one is free
+		DecodedFrame* slot = nullptr;
+		for (DecodedFrame& candidate : slots) {
+			int ahead = (candidate.frame - targetFrame + frameCount) % frameCount;
+			if (candidate.frame < 0 || ahead >= windowSize) {
+				slot = &candidate;
+				break;
+			}
+		}
+		slot->frame = -1;
+		lock.unlock();
+
+		bool valid = DecodeFrame(wanted);
+		if (valid) {
+			for (int i = 0; i < cellCount; i++) {
+				for (int c = 0; c < 4; c++) {
+					slot->densityRGBA[i * 4 + c] = reference[(size_t)c * cellCount + i];
+				}
+			}
+			memcpy(slot->temperature.data(), &reference[(size_t)4 * cellCount], cellCount * sizeof(uint16_t));
+		}
+
+		lock.lock();
+		slot->frame = wanted;
+		slot->valid = valid;
+		readyCondition.notify_all();
+	}
+}
+
+bool FluidPlayer::DecodeFrame(int frame)
+{
+	if (frame == referenceFrame) {
+		return true;
+	}
+
+	//a frame only builds on the one before it, so carry on from the reference
+	//if it's between the frame and its keyframe, otherwise go back to the keyframe
+	int keyframe = frame - frame % keyframeInterval;
+	int start = referenceFrame >= keyframe && referenceFrame < frame ? referenceFrame + 1 : keyframe;
+
+	for (int f = start; f <= frame; f++) {
+		if (!ApplyFrame(f)) {
+			referenceFrame = -1;
+			return false;
+		}
+	}
+	referenceFrame = frame;
+	return true;
+}
+
+bool FluidPlayer::ApplyFrame(int frame)
+{
+	const unsigned char* data = file.GetData() + frameOffsets[frame];
+	const unsigned char* end = file.GetData() + frameOffsets[frame + 1];
+
+	uint32_t keyframe;
+	if (!ReadU32(data, end, &keyframe)) {
+		return false;
+	}
+	//a mode per brick, and at most every cell of every brick in the deltas
+	const size_t brickCount = bricks->GetBrickCount();
+	const size_t maxSizes[STREAM_COUNT] = {
+		brickCount,
+		brickCount * BRICK_SIZE * BRICK_SIZE * BRICK_SIZE * RECORDING_CHANNELS,
+		brickCount * BRICK_SIZE * BRICK_SIZE * BRICK_SIZE * RECORDING_CHANNELS
+	};
+	for (int s = 0; s < STREAM_COUNT; s++) {
+		if (!ReadStream(data, end, maxSizes[s], streams[s])) {
+			return false;
+		}
+	}
+
+	if (keyframe) {
+		std::fill(reference.begin(), reference.end(), 0);
+	}
+
+	const std::vector<unsigned char>& modes = streams[STREAM_MODES];
+	const std::vector<unsigned char>& low = streams[STREAM_LOW];
+	const std::vector<unsigned char>& high = streams[STREAM_HIGH];
+	if ((int)modes.size() != bricks->GetBrickCount() || low.size() != high.size()) {
+		return false;
+	}
+
+	const int sliceSize = res[0] * res[1];
+	size_t next = 0;
+	for (int brick = 0; brick < bricks->GetBrickCount(); brick++) {
+		if (!modes[brick]) {
+			continue;
+		}
+
+		int begin[3];
+		int end[3];
+		bricks->GetBrickBounds(brick, begin, end);
+
+		size_t brickCells = (size_t)(end[0] - begin[0]) * (end[1] - begin[1]) * (end[2] - begin[2]);
+		if (low.size() - next < brickCells * RECORDING_CHANNELS) {
+			return false;
+		}
+
+		for (int c = 0; c < RECORDING_CHANNELS; c++) {
+			for (int z = begin[2]; z < end[2]; z++) {
+				for (int y = begin[1]; y < end[1]; y++) {
+					size_t row = (size_t)c * cellCount + z * sliceSize + y * res[0];
+					for (int x = begin[0]; x < end[0]; x++) {
+						uint16_t delta = (uint16_t)(low[next] | (high[next] << 8));
+						reference[row + x] = UnzigzagDelta(delta, reference[row + x]);
+						next++;
+					}
+				}
+			}
+		}
+	}
+	return next == low.size();
+}
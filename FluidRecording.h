@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BrickMask.h"
+#include "MappedFile.h"
+
+//half channels in a recorded frame, density's rgba then temperature
+#define RECORDING_CHANNELS 5
+//largest grid axis a recording can have, so a damaged header can't ask for huge frames
+#define RECORDING_MAX_RESOLUTION 512
+
+// Streams density and temperature frames of a run to disk so it can be
+// replayed without simulating. Frames are stored as halfs brick by brick,
+// as the difference from the same brick in the frame before, and bricks
+// that didn't change are skipped outright. Every keyframeInterval frames
+// the difference is taken from an empty grid instead so a player can seek
+// without decoding from the start. The differences are split into low and
+// high byte streams and rANS coded. Encoding and writing run on a
+// background thread, AddFrame only copies the frame into a queue.
+class FluidRecorder
+{
+public:
+	FluidRecorder() : queuedFrames(0) {}
+	~FluidRecorder();
+
+	// Creates the file and starts the writer thread, false if it couldn't be created
+	// or an axis is over RECORDING_MAX_RESOLUTION
+	bool Start(const std::string& path, int resX, int resY, int resZ, float timeStep, int keyframeInterval = 30);
+
+	/// <summary>
+	/// Queues a frame. densityRGBA is half4 texels and temperature one half per
+	/// cell, both x-fastest like the sim volumes. Blocks while a few frames are
+	/// already waiting, so a slow disk can't pile up memory.
+	/// </summary>
+	void AddFrame(const uint16_t* densityRGBA, const uint16_t* temperature);
+
+	// Writes out the queued frames and the frame index, then closes the file
+	void Stop();
+
+	bool IsRecording() { return writer.joinable(); }
+	int GetFrameCount() { return queuedFrames; }
+
+	// Raw half size of the frames written so far over what they took on disk
+	float GetCompressionRatio();
+
+private:
+	void WriterLoop();
+
+	int res[3] = { 0, 0, 0 };
+	int cellCount = 0;
+	int keyframeInterval = 30;
+	std::unique_ptr<BrickMask> bricks;
+	std::ofstream file;
+
+	//last frame written, what the next one is encoded against
+	std::vector<uint16_t> reference;
+	std::vector<uint64_t> frameOffsets;
+	uint64_t writtenBytes = 0;
+	uint64_t rawBytes = 0;
+	//AddFrame can be called from a sim thread while the ui reads this
+	std::atomic<int> queuedFrames;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable workCondition;
+	std::condition_variable spaceCondition;
+	//planar frames, RECORDING_CHANNELS grids one after another
+	std::deque<std::vector<uint16_t>> pending;
+	bool stopping = false;
+};
+
+// Plays back a FluidRecorder file. The file is memory mapped, so opening
+// costs nothing however long the run is, and a background thread decodes
+// the next few frames ahead of the one being shown. Seeking decodes
+// forward from the keyframe at or before the frame asked for.
+class FluidPlayer
+{
+public:
+	FluidPlayer() {}
+	~FluidPlayer();
+
+	// Maps the file and starts prefetching from frame 0, false if it isn't a recording
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() { return file.IsOpen(); }
+	int GetFrameCount();
+	int GetResX() { return res[0]; }
+	int GetResY() { return res[1]; }
+	int GetResZ() { return res[2]; }
+	float GetTimeStep() { return timeStep; }
+
+	/// <summary>
+	/// Gets a decoded frame laid out the way FluidRecorder::AddFrame takes them.
+	/// Prefetched frames come back right away, anything else waits for it to be
+	/// decoded. Prefetching moves on to the frames after it, and the pointers
+	/// stay valid until the next call.
+	/// </summary>
+	bool GetFrame(int frame, const uint16_t** densityRGBA, const uint16_t** temperature);
+
+	// Calls to GetFrame that had to wait for a decode
+	int GetPrefetchMisses() { return prefetchMisses; }
+
+private:
+	//decoded frames, slots outside [targetFrame, targetFrame + PREFETCH_FRAMES) get reused
+	struct DecodedFrame {
+		int frame = -1;
+		//false if the frame couldn't be decoded
+		bool valid = false;
+		std::vector<uint16_t> densityRGBA;
+		std::vector<uint16_t> temperature;
+	};
+	static constexpr int PREFETCH_FRAMES = 4;
+
+	void DecoderLoop();
+	DecodedFrame* FindSlot(int frame);
+
+	// Decodes a frame into reference, going back to its keyframe if it doesn't follow the last one
+	bool DecodeFrame(int frame);
+	bool ApplyFrame(int frame);
+
+	MappedFile file;
+
+	int res[3] = { 0, 0, 0 };
+	int cellCount = 0;
+	int keyframeInterval = 30;
+	float timeStep = 0.0f;
+	std::unique_ptr<BrickMask> bricks;
+	//one past the frame count, the last entry is where the frames end
+	std::vector<uint64_t> frameOffsets;
+
+	//decoder thread state, the planar frame last decoded and scratch for its streams
+	std::vector<uint16_t> reference;
+	int referenceFrame = -1;
+	std::vector<unsigned char> streams[3];
+
+	DecodedFrame slots[PREFETCH_FRAMES];
+	int targetFrame = 0;
+	int prefetchMisses = 0;
+
+	std::thread decoder;
+	std::mutex mutex;
+	std::condition_variable workCondition;
+	std::condition_variable readyCondition;
+	bool stopping = false;
+};
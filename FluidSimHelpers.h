@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// CPU versions of the helpers in FluidSimHelpers.hlsli, shared by
+// the cpu solver and its pressure solvers
+
+// Neighbour lookups along one axis, same clamping as
+// the Get*Index functions in the shader helpers
+inline int GetLowerIndex(int i) { return i == 0 ? 0 : i - 1; }
+inline int GetUpperIndex(int i, int gridSize) { return std::min(i + 1, gridSize - 1); }
+
+// Linear index of a cell in an x-fastest grid
+inline int GridIndex(int x, int y, int z, int resX, int resY) { return (z * resY + y) * resX + x; }
+
+// Cells along an axis one multigrid level down, the last cell of an odd axis gets a coarse cell to itself
+inline int GetCoarseRes(int fineRes) { return (fineRes + 1) / 2; }
+
+// Restricted value of the coarse cell whose first child is block, at x, y, z
+// of the fine grid: the children's average times 4, since the coarse operator
+// is a quarter of the fine one per unit spacing. Children past the end of an
+// odd axis count as zero rather than being averaged out, which keeps the
+// coarse right hand side summing to the fine one so the walls' solvability
+// still holds. Same as MultigridRestrictCS, whose out of bounds loads read 0
+inline float RestrictBlock(const float* block, int x, int y, int z, int resX, int resY, int resZ)
+{
+	const int strideZ = resX * resY;
+	const bool hasX = x + 1 < resX;
+	const bool hasY = y + 1 < resY;
+	const bool hasZ = z + 1 < resZ;
+
+	//missing children add zero, so whole blocks sum in the same order as ever
+	float sum =
+		block[0] + (hasX ? block[1] : 0.0f) +
+		(hasY ? block[resX] : 0.0f) + (hasX && hasY ? block[resX + 1] : 0.0f) +
+		(hasZ ? block[strideZ] : 0.0f) + (hasX && hasZ ? block[strideZ + 1] : 0.0f) +
+		(hasY && hasZ ? block[strideZ + resX] : 0.0f) + (hasX && hasY && hasZ ? block[strideZ + resX + 1] : 0.0f);
+	return sum * 0.5f;
+}
+
+// The 8 texels and weights of a trilinear sample, worked out once so
+// every field sampled at the same position can reuse them
+struct TrilinearStencil {
+	//cell index of each corner, bit 0 is +x, bit 1 is +y and bit 2 is +z
+	int corners[8];
+	float tx;
+	float ty;
+	float tz;
+};
+
+// Stencil for a texel space position with clamp addressing,
+// matches LinearClampSampler with texel centers on whole numbers
+inline void GetTrilinearStencil(int resX, int resY, int resZ, float x, float y, float z, TrilinearStencil& stencil)
+{
+	float fx = std::floor(x);
+	float fy = std::floor(y);
+	float fz = std::floor(z);
+	stencil.tx = x - fx;
+	stencil.ty = y - fy;
+	stencil.tz = z - fz;
+
+	//clamp addressing, out of range texels repeat the edge
+	int x0 = std::min(std::max((int)fx, 0), resX - 1);
+	int y0 = std::min(std::max((int)fy, 0), resY - 1);
+	int z0 = std::min(std::max((int)fz, 0), resZ - 1);
+	int x1 = std::min(std::max((int)fx + 1, 0), resX - 1);
+	int y1 = std::min(std::max((int)fy + 1, 0), resY - 1);
+	int z1 = std::min(std::max((int)fz + 1, 0), resZ - 1);
+
+	for (int corner = 0; corner < 8; corner++) {
+		stencil.corners[corner] = GridIndex(corner & 1 ? x1 : x0, corner & 2 ? y1 : y0, corner & 4 ? z1 : z0, resX, resY);
+	}
+}
+
+inline float SampleStencil(const float* field, const TrilinearStencil& stencil)
+{
+	const int* c = stencil.corners;
+	float c00 = field[c[0]] + (field[c[1]] - field[c[0]]) * stencil.tx;
+	float c10 = field[c[2]] + (field[c[3]] - field[c[2]]) * stencil.tx;
+	float c01 = field[c[4]] + (field[c[5]] - field[c[4]]) * stencil.tx;
+	float c11 = field[c[6]] + (field[c[7]] - field[c[6]]) * stencil.tx;
+
+	float c0 = c00 + (c10 - c00) * stencil.ty;
+	float c1 = c01 + (c11 - c01) * stencil.ty;
+	return c0 + (c1 - c0) * stencil.tz;
+}
+
+// Smallest and largest of the texels a stencil blends,
+// the MacCormack limiter clamps its corrected value to this range
+inline void GetStencilRange(const float* field, const TrilinearStencil& stencil, float& minValue, float& maxValue)
+{
+	minValue = maxValue = field[stencil.corners[0]];
+	for (int corner = 1; corner < 8; corner++) {
+		float value = field[stencil.corners[corner]];
+		minValue = std::min(minValue, value);
+		maxValue = std::max(maxValue, value);
+	}
+}
+
+// Trilinear sample with clamp addressing at a texel space position
+inline float SampleTrilinear(const float* field, int resX, int resY, int resZ, float x, float y, float z)
+{
+	TrilinearStencil stencil;
+	GetTrilinearStencil(resX, resY, resZ, x, y, z, stencil);
+	return SampleStencil(field, stencil);
+}
+
+//bits of a cell's open face mask, set when the neighbour on that side is fluid
+#define FACE_NEG_X 1
+#define FACE_POS_X 2
+#define FACE_NEG_Y 4
+#define FACE_POS_Y 8
+#define FACE_NEG_Z 16
+#define FACE_POS_Z 32
+
+// Sides of a cell that open onto fluid. Walls and solid neighbours are
+// both closed, and a solid cell has no open faces. solid holds a byte per
+// cell and may be null for a grid without obstacles.
+inline unsigned char GetOpenFaces(const unsigned char* solid, int x, int y, int z, int resX, int resY, int resZ)
+{
+	int i = GridIndex(x, y, z, resX, resY);
+	const int strideZ = resX * resY;
+	if (solid && solid[i]) {
+		return 0;
+	}
+
+	unsigned char open = 0;
+	if (x > 0 && !(solid && solid[i - 1])) open |= FACE_NEG_X;
+	if (x < resX - 1 && !(solid && solid[i + 1])) open |= FACE_POS_X;
+	if (y > 0 && !(solid && solid[i - resX])) open |= FACE_NEG_Y;
+	if (y < resY - 1 && !(solid && solid[i + resX])) open |= FACE_POS_Y;
+	if (z > 0 && !(solid && solid[i - strideZ])) open |= FACE_NEG_Z;
+	if (z < resZ - 1 && !(solid && solid[i + strideZ])) open |= FACE_POS_Z;
+	return open;
+}
+
+// Number of open faces, the diagonal of the pressure operator for that cell
+inline int CountOpenFaces(unsigned char faces)
+{
+	int count = 0;
+	for (; faces; faces &= faces - 1) {
+		count++;
+	}
+	return count;
+}
+
+// Sum of a cell's 6 neighbouring pressures with closed faces reading the
+// cell's own value, the clamping PressureSolverCS does at walls and solids
+inline float NeighbourPressureSum(const float* pressure, unsigned char open, int i, int resX, int resY)
+{
+	const int strideZ = resX * resY;
+	float center = pressure[i];
+	return
+		((open & FACE_NEG_X) ? pressure[i - 1] : center) +
+		((open & FACE_POS_X) ? pressure[i + 1] : center) +
+		((open & FACE_NEG_Y) ? pressure[i - resX] : center) +
+		((open & FACE_POS_Y) ? pressure[i + resX] : center) +
+		((open & FACE_NEG_Z) ? pressure[i - strideZ] : center) +
+		((open & FACE_POS_Z) ? pressure[i + strideZ] : center);
+}
@@ -3,14 +3,17 @@
 
 #define GROUP_SIZE 8
 
+//fields AdvectionCS and MacCormackCS can move in one dispatch
+#define MAX_ADVECTED_FIELDS 4
+
 int3 GetLeftIndex(int3 index) {
 	index.x = index.x == 0 ? 0 : index.x - 1;
 	return index;
 }
 
-int3 GetRightIndex(int3 index, int gridSize) {
+int3 GetRightIndex(int3 index, int3 gridSize) {
 	//index.x = index.x >= gridSize - 1 ? gridSize -1 : index.x + 1;
-	index.x = min(index.x + 1, gridSize - 1); //clamp grid size 
+	index.x = min(index.x + 1, gridSize.x - 1); //clamp grid size 
 	return index;
 }
 
@@ -19,9 +22,9 @@ int3 GetBottomIndex(int3 index) {
 	return index;
 }
 
-int3 GetTopIndex(int3 index, int gridSize) {
+int3 GetTopIndex(int3 index, int3 gridSize) {
 	//index.y = index.y >= gridSize - 1 ? gridSize - 1 : index.y + 1;
-	index.y = min(index.y + 1, gridSize - 1);
+	index.y = min(index.y + 1, gridSize.y - 1);
 	return index;
 }
 
@@ -30,17 +33,34 @@ int3 GetBackIndex(int3 index) {
 	return index;
 }
 
-int3 GetFrontIndex(int3 index, int gridSize) {
+int3 GetFrontIndex(int3 index, int3 gridSize) {
 	//index.z = index.z == gridSize - 1 ? gridSize - 1 : index.z + 1;
-	index.z = min(index.z + 1, gridSize - 1);
+	index.z = min(index.z + 1, gridSize.z - 1);
 	return index;
 }
 
-float3 PixelIndexToUVW(float3 index, int gridSize) {
+//neighbours that aren't clamped back onto the cell itself
+int GetNeighbourCount(int3 index, int3 gridSize) {
+	int3 lower = index > 0;
+	int3 upper = index < gridSize - 1;
+	return lower.x + lower.y + lower.z + upper.x + upper.y + upper.z;
+}
+
+float3 PixelIndexToUVW(float3 index, int3 gridSize) {
 	return float3((index + 0.5f) / gridSize);
 }
 
 uint3 UVWToPixelIndex(float3 uvw, float3 sizes) {
 	return (uint3)floor(uvw * (sizes - 1));
 }
+
+//cell count of a grid
+float GetCellCount(int3 gridSize) {
+	return (float)gridSize.x * gridSize.y * gridSize.z;
+}
+
+//emitter distances are measured against the longest axis so it stays round on any grid
+float GetLargestAxis(int3 gridSize) {
+	return (float)max(gridSize.x, max(gridSize.y, gridSize.z));
+}
 #endif
\ No newline at end of file
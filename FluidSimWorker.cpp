@@ -0,0 +1,135 @@
+#include "FluidSimWorker.h"
+#include "HalfPrecision.h"
+
+#include <algorithm>
+#include <chrono>
+
+//set on the shared buffer index when it holds density the reader hasn't taken yet
+static const int FRESH_BUFFER = 4;
+static const int BUFFER_INDEX_MASK = 3;
+
+FluidSimWorker::FluidSimWorker(FluidSolverCPU* solver)
+{
+	this->solver = solver;
+
+	sharedBuffer = 2;
+	lastStepMs = 0.0f;
+	pressureIterations = 0;
+	pressureResidual = -1.0f;
+	activeBrickCount = solver->GetBrickCount();
+
+	worker = std::thread(&FluidSimWorker::WorkerLoop, this);
+}
+
+FluidSimWorker::~FluidSimWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workCondition.notify_one();
+	worker.join();
+}
+
+int FluidSimWorker::QueueSteps(int steps, int maxQueued, const FluidSimSettings& settings, bool halfDensity, unsigned int generation,
+	FluidRecorder* recorder)
+{
+	int queued;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queued = std::max(std::min(steps, maxQueued - queuedSteps), 0);
+		queuedSteps += queued;
+		this->settings = settings;
+		this->halfDensity = halfDensity;
+		this->generation = generation;
+		this->recorder = recorder;
+	}
+	if (queued > 0) {
+		workCondition.notify_one();
+	}
+	return queued;
+}
+
+void FluidSimWorker::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idleCondition.wait(lock, [&] { return queuedSteps == 0; });
+}
+
+bool FluidSimWorker::AcquireDensity()
+{
+	if (!(sharedBuffer.load(std::memory_order_acquire) & FRESH_BUFFER)) {
+		return false;
+	}
+
+	//only this thread clears the fresh flag, so the buffer is still fresh when swapped out
+	frontBuffer = sharedBuffer.exchange(frontBuffer, std::memory_order_acq_rel) & BUFFER_INDEX_MASK;
+	return true;
+}
+
+void FluidSimWorker::WorkerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		workCondition.wait(lock, [&] { return queuedSteps > 0 || stopping; });
+		if (stopping) {
+			return;
+		}
+
+		*solver->GetSettings() = settings;
+		bool half = halfDensity;
+		unsigned int stepGeneration = generation;
+		FluidRecorder* stepRecorder = recorder;
+		//the last queued step always gets shown, earlier ones only if the
+		//reader already took the last density and would otherwise go without
+		bool publish = queuedSteps == 1 || !(sharedBuffer.load(std::memory_order_acquire) & FRESH_BUFFER);
+		lock.unlock();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		solver->Simulate();
+		auto end = std::chrono::high_resolution_clock::now();
+
+		lastStepMs = std::chrono::duration<float, std::milli>(end - start).count();
+		pressureIterations = solver->GetPressureIterations();
+		pressureResidual = solver->GetPressureResidual();
+		activeBrickCount = solver->GetActiveBrickCount();
+
+		if (stepRecorder) {
+			int cellCount = solver->GetResX() * solver->GetResY() * solver->GetResZ();
+			recordDensity.resize((size_t)cellCount * 4);
+			recordTemperature.resize(cellCount);
+			solver->CopyDensityRGBAHalf(recordDensity.data());
+			FloatToHalf(solver->GetChannel(TEMPERATURE).data(), recordTemperature.data(), cellCount);
+			stepRecorder->AddFrame(recordDensity.data(), recordTemperature.data());
+		}
+
+		if (publish) {
+			PublishDensity(half, stepGeneration);
+		}
+
+		lock.lock();
+		queuedSteps--;
+		if (queuedSteps == 0) {
+			idleCondition.notify_all();
+		}
+	}
+}
+
+void FluidSimWorker::PublishDensity(bool half, unsigned int generation)
+{
+	int cellCount = solver->GetResX() * solver->GetResY() * solver->GetResZ();
+	std::vector<unsigned char>& texels = densityBuffers[backBuffer];
+
+	if (half) {
+		texels.resize((size_t)cellCount * 4 * sizeof(uint16_t));
+		solver->CopyDensityRGBAHalf((uint16_t*)texels.data());
+	}
+	else {
+		texels.resize((size_t)cellCount * 4 * sizeof(float));
+		solver->CopyDensityRGBA((float*)texels.data());
+	}
+	densityGenerations[backBuffer] = generation;
+
+	//whatever was shared before is either stale or already taken, so it becomes the next back buffer
+	backBuffer = sharedBuffer.exchange(backBuffer | FRESH_BUFFER, std::memory_order_acq_rel) & BUFFER_INDEX_MASK;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FluidSolverCPU.h"
+#include "FluidRecording.h"
+
+// Steps a FluidSolverCPU on its own thread so the caller never waits on
+// the sim. Steps are queued with the settings to run them with, and the
+// density is interleaved into texels ready to upload whenever the queue
+// runs dry or the reader has taken the last ones. Finished density goes
+// through a lock free triple buffer: the worker fills the back buffer and
+// swaps it with the shared one, and the reader swaps the shared one with
+// its front buffer when it's newer, so neither side ever blocks the other.
+class FluidSimWorker
+{
+public:
+	FluidSimWorker(FluidSolverCPU* solver);
+	~FluidSimWorker();
+
+	/// <summary>
+	/// Queues up to steps more steps, without letting more than maxQueued wait
+	/// at once, and returns how many were queued. halfDensity picks half4
+	/// texels instead of float4, and generation is handed back with them. With
+	/// a recorder every step is added to it.
+	/// </summary>
+	int QueueSteps(int steps, int maxQueued, const FluidSimSettings& settings, bool halfDensity, unsigned int generation,
+		FluidRecorder* recorder);
+
+	// Blocks until every queued step is done. The solver is safe to use from
+	// the calling thread until the next QueueSteps.
+	void Wait();
+
+	/// <summary>
+	/// Swaps in the newest finished density, false if nothing finished since
+	/// the last call. GetDensity stays valid until the next successful call.
+	/// </summary>
+	bool AcquireDensity();
+	const std::vector<unsigned char>& GetDensity() { return densityBuffers[frontBuffer]; }
+	// The generation queued with the step GetDensity came from
+	unsigned int GetDensityGeneration() { return densityGenerations[frontBuffer]; }
+
+	// Stats from the last finished step, safe to read while steps are running
+	float GetLastStepMs() { return lastStepMs.load(); }
+	int GetPressureIterations() { return pressureIterations.load(); }
+	float GetPressureResidual() { return pressureResidual.load(); }
+	int GetActiveBrickCount() { return activeBrickCount.load(); }
+
+private:
+	void WorkerLoop();
+
+	// Fills the back buffer and hands it over to the reader
+	void PublishDensity(bool half, unsigned int generation);
+
+	FluidSolverCPU* solver;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable workCondition;
+	std::condition_variable idleCondition;
+	int queuedSteps = 0;
+	bool stopping = false;
+
+	//what the next step runs with, copied in by QueueSteps
+	FluidSimSettings settings;
+	bool halfDensity = false;
+	unsigned int generation = 0;
+	FluidRecorder* recorder = nullptr;
+
+	//triple buffered density texels, the shared index has FRESH_BUFFER set when the reader hasn't seen it
+	std::vector<unsigned char> densityBuffers[3];
+	unsigned int densityGenerations[3] = {};
+	std::atomic<int> sharedBuffer;
+	int backBuffer = 0;
+	int frontBuffer = 1;
+
+	std::vector<uint16_t> recordDensity;
+	std::vector<uint16_t> recordTemperature;
+
+	std::atomic<float> lastStepMs;
+	std::atomic<int> pressureIterations;
+	std::atomic<float> pressureResidual;
+	std::atomic<int> activeBrickCount;
+};
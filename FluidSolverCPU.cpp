@@ -0,0 +1,988 @@
+#include "FluidSolverCPU.h"
+#include "FluidSimHelpers.h"
+#include "HalfPrecision.h"
+#include "TrilinearSampler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+FluidSolverCPU::FluidSolverCPU(int resX, int resY, int resZ, unsigned int threadCount)
+{
+	pool = std::make_unique<ThreadPool>(threadCount);
+
+	SetResolution(resX, resY, resZ);
+	for (int i = 0; i < CHANNEL_COUNT; i++) {
+		fields[i].assign(cellCount, 0.0f);
+		scratch[i].assign(cellCount, 0.0f);
+	}
+}
+
+void FluidSolverCPU::Resize(int resX, int resY, int resZ)
+{
+	if (resX == this->resX && resY == this->resY && resZ == this->resZ) {
+		return;
+	}
+
+	int oldRes[3] = { this->resX, this->resY, this->resZ };
+	SetResolution(resX, resY, resZ);
+
+	//where a new cell center lands in the old grid's texel space
+	float scale[3];
+	float offset[3];
+	for (int axis = 0; axis < 3; axis++) {
+		int newRes = axis == 0 ? resX : axis == 1 ? resY : resZ;
+		scale[axis] = (float)oldRes[axis] / newRes;
+		offset[axis] = 0.5f * scale[axis] - 0.5f;
+	}
+
+	for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+		std::vector<float> resampled(cellCount, 0.0f);
+
+		//velocity is in cells per step, so it stretches with its axis
+		float valueScale = 1.0f;
+		if (channel == VELOCITY_X || channel == VELOCITY_Y || channel == VELOCITY_Z) {
+			valueScale = 1.0f / scale[channel - VELOCITY_X];
+		}
+
+		//pressure and divergence get rebuilt from velocity next step
+		if (channel != PRESSURE && channel != DIVERGENCE) {
+			const float* input = fields[channel].data();
+			pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+				for (int z = zBegin; z < zEnd; z++) {
+					for (int y = 0; y < resY; y++) {
+						for (int x = 0; x < resX; x++) {
+							resampled[Index(x, y, z)] = valueScale * SampleTrilinear(input, oldRes[0], oldRes[1], oldRes[2],
+								x * scale[0] + offset[0], y * scale[1] + offset[1], z * scale[2] + offset[2]);
+						}
+					}
+				}
+			});
+		}
+
+		fields[channel] = std::move(resampled);
+		scratch[channel].assign(cellCount, 0.0f);
+	}
+
+	//bricks start from scratch, so sparse mode rebuilds its list as if just enabled
+	bricksWereSparse = false;
+}
+
+void FluidSolverCPU::SetThreadCount(unsigned int threadCount)
+{
+	pool = std::make_unique<ThreadPool>(threadCount);
+
+	//the pressure solvers hang on to the pool, so they're rebuilt around the new one
+	multigrid = std::make_unique<MultigridSolver>(resX, resY, resZ, pool.get());
+	conjugateGradient = std::make_unique<ConjugateGradientSolver>(resX, resY, resZ, pool.get());
+	spectral = std::make_unique<SpectralPoissonSolver>(resX, resY, resZ, pool.get());
+	if (!solidCells.empty()) {
+		multigrid->SetSolidCells(solidCells.data());
+		conjugateGradient->SetSolidCells(solidCells.data());
+	}
+}
+
+void FluidSolverCPU::SetResolution(int resX, int resY, int resZ)
+{
+	this->resX = resX;
+	this->resY = resY;
+	this->resZ = resZ;
+	cellCount = resX * resY * resZ;
+
+	multigrid = std::make_unique<MultigridSolver>(resX, resY, resZ, pool.get());
+	conjugateGradient = std::make_unique<ConjugateGradientSolver>(resX, resY, resZ, pool.get());
+	spectral = std::make_unique<SpectralPoissonSolver>(resX, resY, resZ, pool.get());
+
+	bricks = std::make_unique<BrickMask>(resX, resY, resZ);
+	brickContent.assign(bricks->GetBrickCount(), 0);
+
+	//the old obstacles were voxelized for the old size
+	obstacles = nullptr;
+	solidCells.clear();
+	faces.resize(cellCount);
+	for (int z = 0; z < resZ; z++) {
+		for (int y = 0; y < resY; y++) {
+			for (int x = 0; x < resX; x++) {
+				faces[Index(x, y, z)] = GetOpenFaces(nullptr, x, y, z, resX, resY, resZ);
+			}
+		}
+	}
+}
+
+void FluidSolverCPU::SetObstacles(const ObstacleVoxelizer* obstacles)
+{
+	this->obstacles = obstacles;
+	//forces a refresh on the next step
+	obstacleVersion = obstacles ? obstacles->GetVersion() - 1 : 0;
+	if (!obstacles && !solidCells.empty()) {
+		solidCells.clear();
+		multigrid->SetSolidCells(nullptr);
+		conjugateGradient->SetSolidCells(nullptr);
+		pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+			for (int z = zBegin; z < zEnd; z++) {
+				for (int y = 0; y < resY; y++) {
+					for (int x = 0; x < resX; x++) {
+						faces[Index(x, y, z)] = GetOpenFaces(nullptr, x, y, z, resX, resY, resZ);
+					}
+				}
+			}
+		});
+	}
+}
+
+void FluidSolverCPU::SyncObstacles()
+{
+	if (!obstacles || obstacles->GetVersion() == obstacleVersion) {
+		return;
+	}
+	obstacleVersion = obstacles->GetVersion();
+
+	if (obstacles->HasObstacles()) {
+		solidCells.resize(cellCount);
+		obstacles->CopySolidCells(solidCells.data());
+	}
+	else {
+		solidCells.clear();
+	}
+
+	const unsigned char* solid = solidCells.empty() ? nullptr : solidCells.data();
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			for (int y = 0; y < resY; y++) {
+				for (int x = 0; x < resX; x++) {
+					faces[Index(x, y, z)] = GetOpenFaces(solid, x, y, z, resX, resY, resZ);
+				}
+			}
+		}
+	});
+	multigrid->SetSolidCells(solid);
+	conjugateGradient->SetSolidCells(solid);
+}
+
+void FluidSolverCPU::Reset()
+{
+	for (int i = 0; i < CHANNEL_COUNT; i++) {
+		std::fill(fields[i].begin(), fields[i].end(), 0.0f);
+		std::fill(scratch[i].begin(), scratch[i].end(), 0.0f);
+	}
+}
+
+void FluidSolverCPU::Simulate()
+{
+	auto stageStart = std::chrono::high_resolution_clock::now();
+	auto endStage = [&](FluidStage stage) {
+		auto now = std::chrono::high_resolution_clock::now();
+		stageMs[stage] = std::chrono::duration<float, std::milli>(now - stageStart).count();
+		stageStart = now;
+	};
+
+	SyncObstacles();
+
+	//sparse mode needs to know which bricks to run before any stage
+	if (settings.sparseBricks) {
+		UpdateBricks();
+	}
+	bricksWereSparse = settings.sparseBricks;
+
+	//each stage's output goes through the storage precision, as it would on the gpu
+	Advect();
+	StoreAtPrecision({ VELOCITY_X, VELOCITY_Y, VELOCITY_Z, COLOR_R, COLOR_G, COLOR_B, DENSITY, TEMPERATURE });
+	endStage(FLUID_STAGE_ADVECT);
+	InjectSmoke();
+	StoreAtPrecision({ VELOCITY_X, VELOCITY_Y, VELOCITY_Z, COLOR_R, COLOR_G, COLOR_B, DENSITY, TEMPERATURE });
+	endStage(FLUID_STAGE_INJECT);
+	ApplyBuoyancy();
+	StoreAtPrecision({ VELOCITY_X, VELOCITY_Y, VELOCITY_Z });
+	endStage(FLUID_STAGE_BUOYANCY);
+	ComputeDivergence();
+	endStage(FLUID_STAGE_DIVERGENCE);
+	SolvePressure();
+	//the solvers iterate in full float, only the result they leave gets stored
+	StoreAtPrecision({ PRESSURE });
+	endStage(FLUID_STAGE_PRESSURE);
+	ProjectPressure();
+	StoreAtPrecision({ VELOCITY_X, VELOCITY_Y, VELOCITY_Z });
+	endStage(FLUID_STAGE_PROJECT);
+}
+
+void FluidSolverCPU::Advect()
+{
+	//every field moves along the velocity from before advection
+	AdvectChannels({
+		VELOCITY_X, VELOCITY_Y, VELOCITY_Z,
+		COLOR_R, COLOR_G, COLOR_B, DENSITY,
+		TEMPERATURE
+	});
+}
+
+//cells of a row advected together, small enough to keep their positions and samples in l1
+#define ADVECTION_BATCH_SIZE 64
+
+void FluidSolverCPU::AdvectChannels(std::initializer_list<FluidChannel> channels)
+{
+	const float* velX = fields[VELOCITY_X].data();
+	const float* velY = fields[VELOCITY_Y].data();
+	const float* velZ = fields[VELOCITY_Z].data();
+	const float dt = settings.fixedTimeStep;
+	const bool maccormack = settings.advectionScheme == ADVECTION_MACCORMACK;
+
+	//flatten the channels so the per cell loop is just an index
+	const int count = (int)channels.size();
+	std::vector<const float*> inputs;
+	std::vector<float*> outputs;
+	std::vector<float*> forwards;
+	std::vector<float> solidValues;
+	for (FluidChannel channel : channels) {
+		//inactive bricks are never written, so they start out holding nothing
+		if (maccormack && (int)advectionForward[channel].size() != cellCount) {
+			advectionForward[channel].assign(cellCount, channel == TEMPERATURE ? settings.ambientTemperature : 0.0f);
+		}
+
+		inputs.push_back(fields[channel].data());
+		outputs.push_back(scratch[channel].data());
+		forwards.push_back(maccormack ? advectionForward[channel].data() : scratch[channel].data());
+		//solid cells hold nothing, buoyancy gives them the obstacle's velocity
+		solidValues.push_back(channel == TEMPERATURE ? settings.ambientTemperature : 0.0f);
+	}
+
+	//runs of a row are sampled together so the batch sampler can fill its vectors
+	ForEachRow([&](int y, int z, int xBegin, int xEnd) {
+		float posX[ADVECTION_BATCH_SIZE];
+		float posY[ADVECTION_BATCH_SIZE];
+		float posZ[ADVECTION_BATCH_SIZE];
+		float* runOutputs[CHANNEL_COUNT];
+
+		for (int runBegin = xBegin; runBegin < xEnd; runBegin += ADVECTION_BATCH_SIZE) {
+			const int run = std::min(xEnd - runBegin, ADVECTION_BATCH_SIZE);
+			const int first = Index(runBegin, y, z);
+
+			//move 'backwards' along the velocity to find what ends up here,
+			//once for every channel since they all sample the same texels
+			for (int k = 0; k < run; k++) {
+				int i = first + k;
+				posX[k] = (runBegin + k) - dt * velX[i];
+				posY[k] = y - dt * velY[i];
+				posZ[k] = z - dt * velZ[i];
+			}
+			for (int c = 0; c < count; c++) {
+				runOutputs[c] = forwards[c] + first;
+			}
+			SampleTrilinearBatch(inputs.data(), runOutputs, count, resX, resY, resZ, posX, posY, posZ, run);
+
+			for (int k = 0; k < run; k++) {
+				if (IsSolid(first + k)) {
+					for (int c = 0; c < count; c++) {
+						forwards[c][first + k] = solidValues[c];
+					}
+				}
+			}
+		}
+	});
+
+	//same as MacCormackCS
+	if (maccormack) {
+		std::vector<const float*> forwardInputs(forwards.begin(), forwards.end());
+		ForEachRow([&](int y, int z, int xBegin, int xEnd) {
+			float forwardX[ADVECTION_BATCH_SIZE];
+			float forwardY[ADVECTION_BATCH_SIZE];
+			float forwardZ[ADVECTION_BATCH_SIZE];
+			float backwardX[ADVECTION_BATCH_SIZE];
+			float backwardY[ADVECTION_BATCH_SIZE];
+			float backwardZ[ADVECTION_BATCH_SIZE];
+			float backward[CHANNEL_COUNT][ADVECTION_BATCH_SIZE];
+			float minValue[CHANNEL_COUNT][ADVECTION_BATCH_SIZE];
+			float maxValue[CHANNEL_COUNT][ADVECTION_BATCH_SIZE];
+			float* backwardOut[CHANNEL_COUNT];
+			float* minOut[CHANNEL_COUNT];
+			float* maxOut[CHANNEL_COUNT];
+			for (int c = 0; c < count; c++) {
+				backwardOut[c] = backward[c];
+				minOut[c] = minValue[c];
+				maxOut[c] = maxValue[c];
+			}
+
+			for (int runBegin = xBegin; runBegin < xEnd; runBegin += ADVECTION_BATCH_SIZE) {
+				const int run = std::min(xEnd - runBegin, ADVECTION_BATCH_SIZE);
+				const int first = Index(runBegin, y, z);
+
+				//advect the forward result back the other way, perfect advection would land on the input again
+				for (int k = 0; k < run; k++) {
+					int i = first + k;
+					forwardX[k] = (runBegin + k) + dt * velX[i];
+					forwardY[k] = y + dt * velY[i];
+					forwardZ[k] = z + dt * velZ[i];
+					backwardX[k] = (runBegin + k) - dt * velX[i];
+					backwardY[k] = y - dt * velY[i];
+					backwardZ[k] = z - dt * velZ[i];
+				}
+				SampleTrilinearBatch(forwardInputs.data(), backwardOut, count, resX, resY, resZ, forwardX, forwardY, forwardZ, run);
+				GetTrilinearRangeBatch(inputs.data(), minOut, maxOut, count, resX, resY, resZ, backwardX, backwardY, backwardZ, run);
+
+				for (int c = 0; c < count; c++) {
+					for (int k = 0; k < run; k++) {
+						int i = first + k;
+						float corrected = forwards[c][i] + 0.5f * (inputs[c][i] - backward[c][k]);
+						outputs[c][i] = IsSolid(i) ? solidValues[c] : std::min(std::max(corrected, minValue[c][k]), maxValue[c][k]);
+					}
+				}
+			}
+		});
+	}
+
+	for (FluidChannel channel : channels) {
+		SwapChannel(channel);
+	}
+}
+
+void FluidSolverCPU::InjectSmoke()
+{
+	const FluidSimSettings& s = settings;
+	//the radius is measured against the longest axis, so the emitter stays round on any grid
+	const float invLargestRes = 1.0f / std::max(resX, std::max(resY, resZ));
+	const float center[3] = {
+		s.injectPosition[0] * resX,
+		s.injectPosition[1] * resY,
+		s.injectPosition[2] * resZ
+	};
+
+	float* colorR = fields[COLOR_R].data();
+	float* colorG = fields[COLOR_G].data();
+	float* colorB = fields[COLOR_B].data();
+	float* density = fields[DENSITY].data();
+	float* temperature = fields[TEMPERATURE].data();
+	float* velX = fields[VELOCITY_X].data();
+	float* velY = fields[VELOCITY_Y].data();
+	float* velZ = fields[VELOCITY_Z].data();
+
+	//each cell only touches itself, so this can safely update in place
+	ForEachCell([&](int x, int y, int z) {
+		int i = Index(x, y, z);
+		if (IsSolid(i)) {
+			return;
+		}
+
+		//offset of the cell center in cells
+		float dx = x + 0.5f - center[0];
+		float dy = y + 0.5f - center[1];
+		float dz = z + 0.5f - center[2];
+		float dist = std::sqrt(dx * dx + dy * dy + dz * dz) * invLargestRes;
+
+		float injFalloff = s.injectRadius == 0.0f ? 0.0f :
+			std::max(0.0f, s.injectRadius - dist) / s.injectRadius;
+		if (injFalloff <= 0.0f) {
+			return;
+		}
+
+		//color is a replacement, density is an add
+		colorR[i] = s.injectColor[0];
+		colorG[i] = s.injectColor[1];
+		colorB[i] = s.injectColor[2];
+		density[i] = std::min(std::max(density[i] + s.injectDensity * injFalloff, 0.0f), 1.0f);
+
+		temperature[i] += s.injectTemperature * injFalloff;
+		velX[i] += s.injectVelocity[0];
+		velY[i] += s.injectVelocity[1];
+		velZ[i] += s.injectVelocity[2];
+	});
+}
+
+void FluidSolverCPU::ApplyBuoyancy()
+{
+	const FluidSimSettings& s = settings;
+	const float* density = fields[DENSITY].data();
+	const float* temperature = fields[TEMPERATURE].data();
+	float* velX = fields[VELOCITY_X].data();
+	float* velY = fields[VELOCITY_Y].data();
+	float* velZ = fields[VELOCITY_Z].data();
+
+	//without confinement every cell only touches itself, so update in place
+	if (s.vorticityEpsilon <= 0.0f) {
+		// From: http://web.stanford.edu/class/cs237d/smoke.pdf
+		ForEachCell([&](int x, int y, int z) {
+			int i = Index(x, y, z);
+
+			//solid cells move with their obstacle
+			if (IsSolid(i)) {
+				velX[i] = obstacles->GetVelocity(0)[i];
+				velY[i] = obstacles->GetVelocity(1)[i];
+				velZ[i] = obstacles->GetVelocity(2)[i];
+				return;
+			}
+
+			velY[i] += -s.densityWeight * density[i] +
+				s.temperatureBuoyancy * (temperature[i] - s.ambientTemperature);
+		});
+		return;
+	}
+
+	ApplyVorticityConfinement();
+}
+
+void FluidSolverCPU::ApplyVorticityConfinement()
+{
+	const FluidSimSettings& s = settings;
+	const float* density = fields[DENSITY].data();
+	const float* temperature = fields[TEMPERATURE].data();
+	const float* velocity[3] = { fields[VELOCITY_X].data(), fields[VELOCITY_Y].data(), fields[VELOCITY_Z].data() };
+	float* velocityOut[3] = { scratch[VELOCITY_X].data(), scratch[VELOCITY_Y].data(), scratch[VELOCITY_Z].data() };
+
+	//velocity with a 2 cell border covers the curl of the brick and its 1 cell border
+	const int tileSize = BRICK_SIZE + 4;
+	const int curlSize = BRICK_SIZE + 2;
+
+	const bool sparse = settings.sparseBricks;
+	const std::vector<int>& active = bricks->GetActiveBricks();
+	int brickCount = sparse ? (int)active.size() : bricks->GetBrickCount();
+
+	pool->ParallelFor(0, brickCount, [&](int listBegin, int listEnd) {
+		std::vector<float> tile[3];
+		for (int axis = 0; axis < 3; axis++) {
+			tile[axis].resize(tileSize * tileSize * tileSize);
+		}
+		std::vector<float> curlLength(curlSize * curlSize * curlSize);
+
+		for (int b = listBegin; b < listEnd; b++) {
+			int begin[3];
+			int end[3];
+			bricks->GetBrickBounds(sparse ? active[b] : b, begin, end);
+			const int tileOrigin[3] = { begin[0] - 2, begin[1] - 2, begin[2] - 2 };
+			const int curlOrigin[3] = { begin[0] - 1, begin[1] - 1, begin[2] - 1 };
+
+			//gather once, clamped to the grid like the neighbour lookups
+			for (int tz = 0; tz < tileSize; tz++) {
+				int z = std::min(std::max(tileOrigin[2] + tz, 0), resZ - 1);
+				for (int ty = 0; ty < tileSize; ty++) {
+					int y = std::min(std::max(tileOrigin[1] + ty, 0), resY - 1);
+					for (int tx = 0; tx < tileSize; tx++) {
+						int x = std::min(std::max(tileOrigin[0] + tx, 0), resX - 1);
+						int t = (tz * tileSize + ty) * tileSize + tx;
+						int i = Index(x, y, z);
+						tile[0][t] = velocity[0][i];
+						tile[1][t] = velocity[1][i];
+						tile[2][t] = velocity[2][i];
+					}
+				}
+			}
+
+			//central difference curl at a grid cell, neighbours clamped at the walls
+			auto curlAt = [&](int x, int y, int z, float curl[3]) {
+				auto at = [&](int axis, int cx, int cy, int cz) {
+					return tile[axis][((cz - tileOrigin[2]) * tileSize + (cy - tileOrigin[1])) * tileSize + (cx - tileOrigin[0])];
+				};
+				int left = GetLowerIndex(x);
+				int right = GetUpperIndex(x, resX);
+				int bottom = GetLowerIndex(y);
+				int top = GetUpperIndex(y, resY);
+				int back = GetLowerIndex(z);
+				int front = GetUpperIndex(z, resZ);
+
+				curl[0] = 0.5f * ((at(2, x, top, z) - at(2, x, bottom, z)) - (at(1, x, y, front) - at(1, x, y, back)));
+				curl[1] = 0.5f * ((at(0, x, y, front) - at(0, x, y, back)) - (at(2, right, y, z) - at(2, left, y, z)));
+				curl[2] = 0.5f * ((at(1, right, y, z) - at(1, left, y, z)) - (at(0, x, top, z) - at(0, x, bottom, z)));
+			};
+
+			for (int cz = 0; cz < curlSize; cz++) {
+				int z = std::min(std::max(curlOrigin[2] + cz, 0), resZ - 1);
+				for (int cy = 0; cy < curlSize; cy++) {
+					int y = std::min(std::max(curlOrigin[1] + cy, 0), resY - 1);
+					for (int cx = 0; cx < curlSize; cx++) {
+						int x = std::min(std::max(curlOrigin[0] + cx, 0), resX - 1);
+						float curl[3];
+						curlAt(x, y, z, curl);
+						curlLength[(cz * curlSize + cy) * curlSize + cx] =
+							std::sqrt(curl[0] * curl[0] + curl[1] * curl[1] + curl[2] * curl[2]);
+					}
+				}
+			}
+
+			auto lengthAt = [&](int x, int y, int z) {
+				return curlLength[((z - curlOrigin[2]) * curlSize + (y - curlOrigin[1])) * curlSize + (x - curlOrigin[0])];
+			};
+
+			for (int z = begin[2]; z < end[2]; z++) {
+				for (int y = begin[1]; y < end[1]; y++) {
+					for (int x = begin[0]; x < end[0]; x++) {
+						int i = Index(x, y, z);
+
+						//solid cells move with their obstacle
+						if (IsSolid(i)) {
+							for (int axis = 0; axis < 3; axis++) {
+								velocityOut[axis][i] = obstacles->GetVelocity(axis)[i];
+							}
+							continue;
+						}
+
+						//the curl length grows towards a vortex's center
+						float gradient[3] = {
+							0.5f * (lengthAt(GetUpperIndex(x, resX), y, z) - lengthAt(GetLowerIndex(x), y, z)),
+							0.5f * (lengthAt(x, GetUpperIndex(y, resY), z) - lengthAt(x, GetLowerIndex(y), z)),
+							0.5f * (lengthAt(x, y, GetUpperIndex(z, resZ)) - lengthAt(x, y, GetLowerIndex(z)))
+						};
+						float gradientLength = std::sqrt(gradient[0] * gradient[0] + gradient[1] * gradient[1] + gradient[2] * gradient[2]);
+
+						float force[3] = { 0.0f, 0.0f, 0.0f };
+						if (gradientLength > 1e-6f) {
+							float n[3] = { gradient[0] / gradientLength, gradient[1] / gradientLength, gradient[2] / gradientLength };
+							float curl[3];
+							curlAt(x, y, z, curl);
+
+							//push along n x curl, spinning the vortex back up
+							force[0] = s.vorticityEpsilon * (n[1] * curl[2] - n[2] * curl[1]);
+							force[1] = s.vorticityEpsilon * (n[2] * curl[0] - n[0] * curl[2]);
+							force[2] = s.vorticityEpsilon * (n[0] * curl[1] - n[1] * curl[0]);
+						}
+
+						// From: http://web.stanford.edu/class/cs237d/smoke.pdf
+						force[1] += -s.densityWeight * density[i] +
+							s.temperatureBuoyancy * (temperature[i] - s.ambientTemperature);
+
+						velocityOut[0][i] = velocity[0][i] + force[0];
+						velocityOut[1][i] = velocity[1][i] + force[1];
+						velocityOut[2][i] = velocity[2][i] + force[2];
+					}
+				}
+			}
+		}
+	});
+
+	SwapChannel(VELOCITY_X);
+	SwapChannel(VELOCITY_Y);
+	SwapChannel(VELOCITY_Z);
+}
+
+void FluidSolverCPU::ComputeDivergence()
+{
+	const float* velX = fields[VELOCITY_X].data();
+	const float* velY = fields[VELOCITY_Y].data();
+	const float* velZ = fields[VELOCITY_Z].data();
+	float* divergence = fields[DIVERGENCE].data();
+
+	if (!solidCells.empty()) {
+		const float* solidX = obstacles->GetVelocity(0);
+		const float* solidY = obstacles->GetVelocity(1);
+		const float* solidZ = obstacles->GetVelocity(2);
+
+		//solid neighbours count with their obstacle's velocity, nothing flows through them
+		auto at = [&](const float* field, const float* solidField, int j) {
+			return IsSolid(j) ? solidField[j] : field[j];
+		};
+
+		ForEachCell([&](int x, int y, int z) {
+			int i = Index(x, y, z);
+			if (IsSolid(i)) {
+				divergence[i] = 0.0f;
+				return;
+			}
+
+			divergence[i] = 0.5f * (
+				(at(velX, solidX, Index(GetUpperIndex(x, resX), y, z)) - at(velX, solidX, Index(GetLowerIndex(x), y, z))) +
+				(at(velY, solidY, Index(x, GetUpperIndex(y, resY), z)) - at(velY, solidY, Index(x, GetLowerIndex(y), z))) +
+				(at(velZ, solidZ, Index(x, y, GetUpperIndex(z, resZ))) - at(velZ, solidZ, Index(x, y, GetLowerIndex(z)))));
+		});
+		return;
+	}
+
+	ForEachCell([&](int x, int y, int z) {
+		divergence[Index(x, y, z)] = 0.5f * (
+			(velX[Index(GetUpperIndex(x, resX), y, z)] - velX[Index(GetLowerIndex(x), y, z)]) +
+			(velY[Index(x, GetUpperIndex(y, resY), z)] - velY[Index(x, GetLowerIndex(y), z)]) +
+			(velZ[Index(x, y, GetUpperIndex(z, resZ))] - velZ[Index(x, y, GetLowerIndex(z))]));
+	});
+}
+
+void FluidSolverCPU::SolvePressure()
+{
+	//last step's pressure is usually close, otherwise start from zero like clearing pressureMap[0]
+	if (!settings.warmStartPressure) {
+		std::fill(fields[PRESSURE].begin(), fields[PRESSURE].end(), 0.0f);
+	}
+
+	//the dct can't see obstacles, multigrid handles them instead
+	PressureSolverType solver = settings.pressureSolver;
+	if (solver == PRESSURE_SOLVER_SPECTRAL && !solidCells.empty()) {
+		solver = PRESSURE_SOLVER_MULTIGRID;
+	}
+
+	if (solver == PRESSURE_SOLVER_MULTIGRID) {
+		pressureIterations = multigrid->Solve(fields[PRESSURE].data(), fields[DIVERGENCE].data(),
+			settings.multigridCycle, settings.multigridMaxCycles, settings.pressureTolerance);
+		pressureResidual = multigrid->GetLastResidual();
+		return;
+	}
+
+	if (solver == PRESSURE_SOLVER_SPECTRAL) {
+		//no iterations, the transforms solve it outright
+		spectral->Solve(fields[PRESSURE].data(), fields[DIVERGENCE].data());
+		pressureIterations = 1;
+		pressureResidual = spectral->GetLastResidual();
+		return;
+	}
+
+	if (solver == PRESSURE_SOLVER_CONJUGATE_GRADIENT) {
+		pressureIterations = conjugateGradient->Solve(fields[PRESSURE].data(), fields[DIVERGENCE].data(),
+			settings.pcgPreconditioner, settings.pcgMaxIterations, settings.pressureTolerance);
+		pressureResidual = conjugateGradient->GetLastResidual();
+		return;
+	}
+
+	const float* divergence = fields[DIVERGENCE].data();
+
+	int iteration = 0;
+	pressureResidual = MeasurePressureResidual();
+	while (iteration < settings.pressureIterations && pressureResidual > settings.pressureTolerance) {
+		const float* pressure = fields[PRESSURE].data();
+		float* pressureOut = scratch[PRESSURE].data();
+
+		pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+			for (int z = zBegin; z < zEnd; z++) {
+				for (int y = 0; y < resY; y++) {
+					for (int x = 0; x < resX; x++) {
+						int i = Index(x, y, z);
+						if (!faces[i]) {
+							pressureOut[i] = 0.0f;
+							continue;
+						}
+						pressureOut[i] = (NeighbourPressureSum(pressure, faces[i], i, resX, resY) - divergence[i]) / 6.0f;
+					}
+				}
+			}
+		});
+
+		SwapChannel(PRESSURE);
+		iteration++;
+
+		//stop early once it's converged far enough
+		if (iteration % settings.jacobiCheckInterval == 0 || iteration == settings.pressureIterations) {
+			pressureResidual = MeasurePressureResidual();
+		}
+	}
+	pressureIterations = iteration;
+
+	//the other solvers already center their result
+	if (settings.warmStartPressure) {
+		RemovePressureMean();
+	}
+}
+
+float FluidSolverCPU::MeasurePressureResidual()
+{
+	const float* pressure = fields[PRESSURE].data();
+	const float* divergence = fields[DIVERGENCE].data();
+
+	//per slice sums of r, r^2, divergence, divergence^2 and the cells counted, added in order
+	std::vector<double> partials(resZ * 5, 0.0);
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			double sums[5] = {};
+			for (int y = 0; y < resY; y++) {
+				for (int x = 0; x < resX; x++) {
+					//solid cells aren't part of the system
+					int i = Index(x, y, z);
+					if (!faces[i]) {
+						continue;
+					}
+					float neighbours = NeighbourPressureSum(pressure, faces[i], i, resX, resY);
+
+					double r = (double)divergence[i] - (neighbours - 6.0f * pressure[i]);
+					sums[0] += r;
+					sums[1] += r * r;
+					sums[2] += divergence[i];
+					sums[3] += (double)divergence[i] * divergence[i];
+					sums[4] += 1.0;
+				}
+			}
+			for (int s = 0; s < 5; s++) {
+				partials[z * 5 + s] = sums[s];
+			}
+		}
+	});
+
+	double sums[5] = {};
+	for (int z = 0; z < resZ; z++) {
+		for (int s = 0; s < 5; s++) {
+			sums[s] += partials[z * 5 + s];
+		}
+	}
+	if (sums[4] <= 0.0) {
+		return 0.0f;
+	}
+
+	double residualNorm = sums[1] - sums[0] * sums[0] / sums[4];
+	double divergenceNorm = sums[3] - sums[2] * sums[2] / sums[4];
+	if (divergenceNorm <= 0.0) {
+		return 0.0f;
+	}
+	return (float)std::sqrt(std::max(residualNorm, 0.0) / divergenceNorm);
+}
+
+void FluidSolverCPU::RemovePressureMean()
+{
+	float* pressure = fields[PRESSURE].data();
+
+	std::vector<double> partials(resZ, 0.0);
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			double sum = 0.0;
+			for (int i = Index(0, 0, z); i < Index(0, 0, z + 1); i++) {
+				sum += pressure[i];
+			}
+			partials[z] = sum;
+		}
+	});
+
+	double total = 0.0;
+	for (double partial : partials) {
+		total += partial;
+	}
+	float mean = (float)(total / cellCount);
+
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		for (int i = Index(0, 0, zBegin); i < Index(0, 0, zEnd); i++) {
+			pressure[i] -= mean;
+		}
+	});
+}
+
+void FluidSolverCPU::ProjectPressure()
+{
+	const float* pressure = fields[PRESSURE].data();
+	float* velX = fields[VELOCITY_X].data();
+	float* velY = fields[VELOCITY_Y].data();
+	float* velZ = fields[VELOCITY_Z].data();
+
+	if (!solidCells.empty()) {
+		const float* solidVelocity[3] = { obstacles->GetVelocity(0), obstacles->GetVelocity(1), obstacles->GetVelocity(2) };
+		float* velocity[3] = { velX, velY, velZ };
+		const int strides[3] = { 1, resX, resX * resY };
+
+		//same as PressureProjectionCS, solid neighbours read as this cell's pressure and
+		//the velocity into a solid neighbour is whatever the solid is doing
+		ForEachCell([&](int x, int y, int z) {
+			int i = Index(x, y, z);
+			if (IsSolid(i)) {
+				for (int axis = 0; axis < 3; axis++) {
+					velocity[axis][i] = solidVelocity[axis][i];
+				}
+				return;
+			}
+
+			const int coords[3] = { x, y, z };
+			const int res[3] = { resX, resY, resZ };
+			for (int axis = 0; axis < 3; axis++) {
+				int lower = i - (coords[axis] > 0 ? strides[axis] : 0);
+				int upper = i + (coords[axis] < res[axis] - 1 ? strides[axis] : 0);
+				bool lowerSolid = IsSolid(lower);
+				bool upperSolid = IsSolid(upper);
+
+				float pLower = lowerSolid ? pressure[i] : pressure[lower];
+				float pUpper = upperSolid ? pressure[i] : pressure[upper];
+				velocity[axis][i] -= 0.5f * (pUpper - pLower);
+
+				if (upperSolid) {
+					velocity[axis][i] = solidVelocity[axis][upper];
+				}
+				else if (lowerSolid) {
+					velocity[axis][i] = solidVelocity[axis][lower];
+				}
+			}
+		});
+		return;
+	}
+
+	//only pressure is read from neighbours, so velocity updates in place
+	ForEachCell([&](int x, int y, int z) {
+		int i = Index(x, y, z);
+		velX[i] -= 0.5f * (pressure[Index(GetUpperIndex(x, resX), y, z)] - pressure[Index(GetLowerIndex(x), y, z)]);
+		velY[i] -= 0.5f * (pressure[Index(x, GetUpperIndex(y, resY), z)] - pressure[Index(x, GetLowerIndex(y), z)]);
+		velZ[i] -= 0.5f * (pressure[Index(x, y, GetUpperIndex(z, resZ))] - pressure[Index(x, y, GetLowerIndex(z))]);
+	});
+}
+
+void FluidSolverCPU::CopyDensityRGBA(float* out)
+{
+	const float* colorR = fields[COLOR_R].data();
+	const float* colorG = fields[COLOR_G].data();
+	const float* colorB = fields[COLOR_B].data();
+	const float* density = fields[DENSITY].data();
+
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		int begin = Index(0, 0, zBegin);
+		int end = Index(0, 0, zEnd);
+		for (int i = begin; i < end; i++) {
+			out[i * 4 + 0] = colorR[i];
+			out[i * 4 + 1] = colorG[i];
+			out[i * 4 + 2] = colorB[i];
+			out[i * 4 + 3] = density[i];
+		}
+	});
+}
+
+void FluidSolverCPU::CopyDensityRGBAHalf(uint16_t* out)
+{
+	const float* colorR = fields[COLOR_R].data();
+	const float* colorG = fields[COLOR_G].data();
+	const float* colorB = fields[COLOR_B].data();
+	const float* density = fields[DENSITY].data();
+	const int sliceSize = resX * resY;
+
+	//interleave a slice at a time, then convert the whole slice at once
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		std::vector<float> texels(sliceSize * 4);
+		for (int z = zBegin; z < zEnd; z++) {
+			int begin = Index(0, 0, z);
+			for (int i = 0; i < sliceSize; i++) {
+				texels[i * 4 + 0] = colorR[begin + i];
+				texels[i * 4 + 1] = colorG[begin + i];
+				texels[i * 4 + 2] = colorB[begin + i];
+				texels[i * 4 + 3] = density[begin + i];
+			}
+			FloatToHalf(texels.data(), out + begin * 4, sliceSize * 4);
+		}
+	});
+}
+
+void FluidSolverCPU::UpdateBricks()
+{
+	const FluidSimSettings& s = settings;
+
+	//coming from dense, anything left in an empty brick gets cleared
+	if (!bricksWereSparse) {
+		bricks->Reset();
+	}
+
+	const float* density = fields[DENSITY].data();
+	const float* temperature = fields[TEMPERATURE].data();
+	const float* velX = fields[VELOCITY_X].data();
+	const float* velY = fields[VELOCITY_Y].data();
+	const float* velZ = fields[VELOCITY_Z].data();
+	const float velocityThresholdSquared = s.brickVelocityThreshold * s.brickVelocityThreshold;
+	//moving obstacles push the air around them even where it's still
+	const float* solidVelocity[3] = {};
+	if (obstacles && !solidCells.empty()) {
+		for (int axis = 0; axis < 3; axis++) {
+			solidVelocity[axis] = obstacles->GetVelocity(axis);
+		}
+	}
+
+	//emitter sphere in texel space, cell centers sit on whole numbers
+	const float emitterCenter[3] = {
+		s.injectPosition[0] * resX - 0.5f,
+		s.injectPosition[1] * resY - 0.5f,
+		s.injectPosition[2] * resZ - 0.5f
+	};
+	const float emitterRadius = s.injectRadius * std::max(resX, std::max(resY, resZ));
+
+	pool->ParallelFor(0, bricks->GetBrickCount(), [&](int brickBegin, int brickEnd) {
+		for (int brick = brickBegin; brick < brickEnd; brick++) {
+			int begin[3];
+			int end[3];
+			bricks->GetBrickBounds(brick, begin, end);
+
+			//closest point of the brick to the emitter
+			float distanceSquared = 0.0f;
+			for (int axis = 0; axis < 3; axis++) {
+				float closest = std::min(std::max(emitterCenter[axis], (float)begin[axis]), (float)(end[axis] - 1));
+				float d = closest - emitterCenter[axis];
+				distanceSquared += d * d;
+			}
+			bool content = s.injectRadius > 0.0f && distanceSquared < emitterRadius * emitterRadius;
+
+			for (int z = begin[2]; z < end[2] && !content; z++) {
+				for (int y = begin[1]; y < end[1] && !content; y++) {
+					for (int x = begin[0]; x < end[0]; x++) {
+						int i = Index(x, y, z);
+						float speedSquared = velX[i] * velX[i] + velY[i] * velY[i] + velZ[i] * velZ[i];
+						bool movingSolid = IsSolid(i) &&
+							(solidVelocity[0][i] != 0.0f || solidVelocity[1][i] != 0.0f || solidVelocity[2][i] != 0.0f);
+						if (density[i] > s.brickDensityThreshold ||
+							speedSquared > velocityThresholdSquared ||
+							std::abs(temperature[i] - s.ambientTemperature) > s.brickTemperatureThreshold ||
+							movingSolid) {
+							content = true;
+							break;
+						}
+					}
+				}
+			}
+
+			brickContent[brick] = content;
+		}
+	});
+
+	bricks->Update(brickContent);
+
+	//skipped bricks are never written, so they have to start out empty in both buffers
+	const std::vector<int>& deactivated = bricks->GetDeactivatedBricks();
+	pool->ParallelFor(0, (int)deactivated.size(), [&](int listBegin, int listEnd) {
+		for (int b = listBegin; b < listEnd; b++) {
+			int begin[3];
+			int end[3];
+			bricks->GetBrickBounds(deactivated[b], begin, end);
+
+			for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+				//pressure is still solved over the whole grid
+				if (channel == PRESSURE) {
+					continue;
+				}
+				float value = channel == TEMPERATURE ? s.ambientTemperature : 0.0f;
+
+				for (int z = begin[2]; z < end[2]; z++) {
+					for (int y = begin[1]; y < end[1]; y++) {
+						int rowBegin = Index(begin[0], y, z);
+						int rowEnd = Index(end[0], y, z);
+						std::fill(fields[channel].begin() + rowBegin, fields[channel].begin() + rowEnd, value);
+						std::fill(scratch[channel].begin() + rowBegin, scratch[channel].begin() + rowEnd, value);
+						//maccormack's backward trace samples its forward results across brick edges
+						if (!advectionForward[channel].empty()) {
+							std::fill(advectionForward[channel].begin() + rowBegin, advectionForward[channel].begin() + rowEnd, value);
+						}
+					}
+				}
+			}
+		}
+	});
+}
+
+void FluidSolverCPU::SwapChannel(FluidChannel channel)
+{
+	std::swap(fields[channel], scratch[channel]);
+}
+
+FieldPrecision FluidSolverCPU::GetChannelPrecision(FluidChannel channel)
+{
+	const FieldPrecisionPolicy& p = settings.precision;
+	switch (channel) {
+	case VELOCITY_X:
+	case VELOCITY_Y:
+	case VELOCITY_Z:
+		return p.velocity;
+	case COLOR_R:
+	case COLOR_G:
+	case COLOR_B:
+	case DENSITY:
+		return p.density;
+	case TEMPERATURE:
+		return p.temperature;
+	case PRESSURE:
+		return p.pressure;
+	default:
+		return FIELD_PRECISION_FLOAT32;
+	}
+}
+
+void FluidSolverCPU::StoreAtPrecision(std::initializer_list<FluidChannel> channels)
+{
+	const int sliceSize = resX * resY;
+
+	for (FluidChannel channel : channels) {
+		if (GetChannelPrecision(channel) != FIELD_PRECISION_FLOAT16) {
+			continue;
+		}
+
+		float* values = fields[channel].data();
+		pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+			RoundToHalf(values + zBegin * sliceSize, (zEnd - zBegin) * sliceSize);
+		});
+	}
+}
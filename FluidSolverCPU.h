@@ -0,0 +1,348 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "MultigridSolver.h"
+#include "ConjugateGradientSolver.h"
+#include "SpectralPoissonSolver.h"
+#include "BrickMask.h"
+#include "ObstacleVoxelizer.h"
+
+//channels the cpu solver stores, each one is its own float grid (SoA)
+enum FluidChannel {
+	VELOCITY_X,
+	VELOCITY_Y,
+	VELOCITY_Z,
+	COLOR_R,
+	COLOR_G,
+	COLOR_B,
+	DENSITY,
+	TEMPERATURE,
+	PRESSURE,
+	DIVERGENCE,
+
+	//this will allways equal count since enums start at 0
+	CHANNEL_COUNT
+};
+
+//how the pressure equation gets solved each step
+enum PressureSolverType {
+	PRESSURE_SOLVER_JACOBI,
+	PRESSURE_SOLVER_MULTIGRID,
+	PRESSURE_SOLVER_CONJUGATE_GRADIENT,
+	//direct dct solve, only valid while the domain has no obstacles
+	//so it falls back to multigrid when there are any
+	PRESSURE_SOLVER_SPECTRAL
+};
+
+//how fields get moved along the velocity
+enum AdvectionScheme {
+	//first order backward trace, cheap but smears detail out
+	ADVECTION_SEMI_LAGRANGIAN,
+	//second order, corrects the trace with a forward + backward round trip,
+	//clamped to the texels the trace sampled
+	ADVECTION_MACCORMACK
+};
+
+//storage precision of a field, FLOAT16 matches a 16 bit float texture
+enum FieldPrecision {
+	FIELD_PRECISION_FLOAT32,
+	FIELD_PRECISION_FLOAT16
+};
+
+//per field storage precision, density covers the color stored alongside it
+struct FieldPrecisionPolicy {
+	FieldPrecision velocity = FIELD_PRECISION_FLOAT32;
+	FieldPrecision density = FIELD_PRECISION_FLOAT32;
+	FieldPrecision temperature = FIELD_PRECISION_FLOAT32;
+	FieldPrecision pressure = FIELD_PRECISION_FLOAT32;
+};
+
+//the stages of a step, in the order Simulate runs them
+enum FluidStage {
+	FLUID_STAGE_ADVECT,
+	FLUID_STAGE_INJECT,
+	FLUID_STAGE_BUOYANCY,
+	FLUID_STAGE_DIVERGENCE,
+	FLUID_STAGE_PRESSURE,
+	FLUID_STAGE_PROJECT,
+
+	//this will allways equal count since enums start at 0
+	FLUID_STAGE_COUNT
+};
+
+//sim parameters, FluidField copies its values in before each step
+struct FluidSimSettings {
+	float fixedTimeStep = 0.016f;
+	AdvectionScheme advectionScheme = ADVECTION_SEMI_LAGRANGIAN;
+
+	//jacobi runs a fixed number of sweeps, multigrid and conjugate
+	//gradient run until the relative residual is under tolerance
+	PressureSolverType pressureSolver = PRESSURE_SOLVER_MULTIGRID;
+	//keep the last step's pressure as the starting guess instead of zero
+	bool warmStartPressure = true;
+	//max jacobi sweeps, the residual is checked every jacobiCheckInterval of them
+	int pressureIterations = 20;
+	int jacobiCheckInterval = 5;
+	MultigridCycle multigridCycle = MULTIGRID_V_CYCLE;
+	int multigridMaxCycles = 10;
+	PcgPreconditioner pcgPreconditioner = PCG_PRECONDITIONER_MIC0;
+	int pcgMaxIterations = 200;
+	float pressureTolerance = 0.001f;
+
+	//only simulate bricks near smoke, velocity or the emitter
+	bool sparseBricks = false;
+	float brickDensityThreshold = 0.001f;
+	float brickVelocityThreshold = 0.001f;
+	float brickTemperatureThreshold = 0.001f;
+
+	//fields stored at half get rounded after every stage that writes them,
+	//the same as the gpu writing into 16 bit textures
+	FieldPrecisionPolicy precision;
+
+	float ambientTemperature = 0.0f;
+	float injectTemperature = 0.5f;
+	float injectDensity = 0.05f;
+	float injectRadius = 0.15f;
+	float temperatureBuoyancy = 0.5f;
+	float densityWeight = 0.1f;
+	//strength of the vorticity confinement force, 0 turns it off
+	float vorticityEpsilon = 0.3f;
+	float injectPosition[3] = { 0.5f, 0.2f, 0.5f };
+	float injectVelocity[3] = { 0, 0, 0 };
+	float injectColor[3] = { 1.0f, 1.0f, 1.0f };
+};
+
+// Portable CPU version of the compute shader chain in FluidField::Simulate.
+// Every stage matches its shader, including the neighbour clamping from
+// FluidSimHelpers.hlsli, so it can run headless and be used as ground
+// truth for the GPU kernels. Work is split over z slices on a thread pool.
+class FluidSolverCPU
+{
+public:
+	FluidSolverCPU(int resX, int resY, int resZ, unsigned int threadCount = 0);
+
+	FluidSimSettings* GetSettings() { return &settings; }
+	int GetResX() { return resX; }
+	int GetResY() { return resY; }
+	int GetResZ() { return resZ; }
+
+	/// <summary>
+	/// Changes the grid size, trilinearly resampling every field onto the new
+	/// grid. Velocity is rescaled per axis since it's measured in cells.
+	/// </summary>
+	void Resize(int resX, int resY, int resZ);
+	unsigned int GetThreadCount() { return pool->GetThreadCount(); }
+
+	// Moves the work onto a new pool, 0 uses every hardware thread. Each
+	// step comes out the same whatever the count, sums are always added up
+	// slice by slice in z order rather than per chunk.
+	void SetThreadCount(unsigned int threadCount);
+
+	// Zero every field
+	void Reset();
+
+	/// <summary>
+	/// Solid cells every stage should respect, owned by the caller and at
+	/// this solver's resolution. Changes are picked up at the start of the
+	/// next step. Resizing drops them, so hand over one at the new size.
+	/// null removes them.
+	/// </summary>
+	void SetObstacles(const ObstacleVoxelizer* obstacles);
+
+	// Runs a single fixed time step through every stage
+	void Simulate();
+
+	//individual stages, in the order Simulate runs them
+	void Advect();
+	void InjectSmoke();
+	void ApplyBuoyancy();
+	void ComputeDivergence();
+	void SolvePressure();
+	void ProjectPressure();
+
+	// Wall time each stage of the last Simulate took, picking up obstacle
+	// changes and sparse bricks count towards advection
+	float GetStageMs(FluidStage stage) { return stageMs[stage]; }
+
+	// Bricks the last step simulated, and the total in the grid
+	int GetActiveBrickCount() { return settings.sparseBricks ? bricks->GetActiveBrickCount() : bricks->GetBrickCount(); }
+	int GetBrickCount() { return bricks->GetBrickCount(); }
+
+	// Iterations (or multigrid cycles) the last pressure solve ran, and the
+	// relative residual it reached.
+	int GetPressureIterations() { return pressureIterations; }
+	float GetPressureResidual() { return pressureResidual; }
+
+	const std::vector<float>& GetChannel(FluidChannel channel) { return fields[channel]; }
+	std::vector<float>& GetChannelForWrite(FluidChannel channel) { return fields[channel]; }
+
+	/// <summary>
+	/// Interleaves color and density into float4 rgba texels,
+	/// the same layout as FluidField's density texture
+	/// </summary>
+	void CopyDensityRGBA(float* out);
+
+	// Same as CopyDensityRGBA but as half4 texels, for a 16 bit density texture
+	void CopyDensityRGBAHalf(uint16_t* out);
+
+private:
+	int Index(int x, int y, int z) { return (z * resY + y) * resX + x; }
+	bool IsSolid(int i) { return !solidCells.empty() && solidCells[i]; }
+
+	// Refreshes the solid cells and face masks if the obstacles changed
+	void SyncObstacles();
+
+	// Sets the size and rebuilds everything that depends on it except the fields
+	void SetResolution(int resX, int resY, int resZ);
+
+	/// <summary>
+	/// Buoyancy plus vorticity confinement in one pass. Each brick gathers
+	/// its velocity with a 2 cell border once, works out the curl length
+	/// over a 1 cell border from that, then takes the gradient and the
+	/// confinement force without going back to the full grid.
+	/// </summary>
+	void ApplyVorticityConfinement();
+
+	/// <summary>
+	/// Advects any set of channels along the current velocity in one pass.
+	/// Each cell is backtraced once and the trilinear stencil is shared by
+	/// every channel, MacCormack adds one more shared pass for the correction.
+	/// </summary>
+	void AdvectChannels(std::initializer_list<FluidChannel> channels);
+
+	// Swap the current and scratch grids of a channel
+	void SwapChannel(FluidChannel channel);
+
+	// Precision the policy stores a channel at, divergence is always full float
+	FieldPrecision GetChannelPrecision(FluidChannel channel);
+
+	// Rounds each channel stored at half to the nearest half, what writing
+	// it to its texture would keep. Full precision channels are untouched.
+	void StoreAtPrecision(std::initializer_list<FluidChannel> channels);
+
+	/// <summary>
+	/// Flags bricks with density, velocity or temperature above the thresholds,
+	/// or that touch the emitter, then rebuilds the active list. Bricks that
+	/// fall out of it are zeroed so they read as empty while skipped.
+	/// </summary>
+	void UpdateBricks();
+
+	/// <summary>
+	/// Calls func(x, y, z) for every cell a stage should update, split over
+	/// the pool. That's every active brick in sparse mode, else the whole grid.
+	/// </summary>
+	template<typename Func>
+	void ForEachCell(Func func);
+
+	// Same cells as ForEachCell, a run along x at a time as func(y, z, xBegin, xEnd)
+	template<typename Func>
+	void ForEachRow(Func func);
+
+	// Relative residual of the current pressure, with the mean of the
+	// divergence left out since the walls make it unsolvable
+	float MeasurePressureResidual();
+
+	// Shift pressure to average zero so warm starts don't drift
+	void RemovePressureMean();
+
+	int resX;
+	int resY;
+	int resZ;
+	int cellCount;
+	FluidSimSettings settings;
+
+	//current state and scratch targets for each stage to write into
+	std::vector<float> fields[CHANNEL_COUNT];
+	std::vector<float> scratch[CHANNEL_COUNT];
+	//the plain semi-lagrangian result of each channel, kept for MacCormack's correction pass
+	std::vector<float> advectionForward[CHANNEL_COUNT];
+
+	const ObstacleVoxelizer* obstacles = nullptr;
+	unsigned int obstacleVersion = 0;
+	//a byte per cell, empty while nothing is solid
+	std::vector<unsigned char> solidCells;
+	//open faces of every cell, the walls alone without obstacles
+	std::vector<unsigned char> faces;
+
+	std::unique_ptr<ThreadPool> pool;
+	std::unique_ptr<MultigridSolver> multigrid;
+	std::unique_ptr<ConjugateGradientSolver> conjugateGradient;
+	std::unique_ptr<SpectralPoissonSolver> spectral;
+
+	std::unique_ptr<BrickMask> bricks;
+	std::vector<unsigned char> brickContent;
+	bool bricksWereSparse = false;
+
+	int pressureIterations = 0;
+	float pressureResidual = -1.0f;
+	float stageMs[FLUID_STAGE_COUNT] = {};
+};
+
+template<typename Func>
+void FluidSolverCPU::ForEachCell(Func func)
+{
+	if (!settings.sparseBricks) {
+		pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+			for (int z = zBegin; z < zEnd; z++) {
+				for (int y = 0; y < resY; y++) {
+					for (int x = 0; x < resX; x++) {
+						func(x, y, z);
+					}
+				}
+			}
+		});
+		return;
+	}
+
+	const std::vector<int>& active = bricks->GetActiveBricks();
+	pool->ParallelFor(0, (int)active.size(), [&](int listBegin, int listEnd) {
+		for (int b = listBegin; b < listEnd; b++) {
+			int begin[3];
+			int end[3];
+			bricks->GetBrickBounds(active[b], begin, end);
+
+			for (int z = begin[2]; z < end[2]; z++) {
+				for (int y = begin[1]; y < end[1]; y++) {
+					for (int x = begin[0]; x < end[0]; x++) {
+						func(x, y, z);
+					}
+				}
+			}
+		}
+	});
+}
+
+template<typename Func>
+void FluidSolverCPU::ForEachRow(Func func)
+{
+	if (!settings.sparseBricks) {
+		pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+			for (int z = zBegin; z < zEnd; z++) {
+				for (int y = 0; y < resY; y++) {
+					func(y, z, 0, resX);
+				}
+			}
+		});
+		return;
+	}
+
+	const std::vector<int>& active = bricks->GetActiveBricks();
+	pool->ParallelFor(0, (int)active.size(), [&](int listBegin, int listEnd) {
+		for (int b = listBegin; b < listEnd; b++) {
+			int begin[3];
+			int end[3];
+			bricks->GetBrickBounds(active[b], begin, end);
+
+			for (int z = begin[2]; z < end[2]; z++) {
+				for (int y = begin[1]; y < end[1]; y++) {
+					func(y, z, begin[0], end[0]);
+				}
+			}
+		}
+	});
+}
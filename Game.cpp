@@ -1,11 +1,11 @@
 
-#include <stdlib.h>     // For seeding random and rand()
 #include <time.h>       // For grabbing time (to seed random)
 
 #include "Game.h"
 #include "Vertex.h"
 #include "Input.h"
 #include "Helpers.h"
+#include "TrilinearSampler.h"
 
 #include "WICTextureLoader.h"
 #include "ImGui/imgui.h"
@@ -21,7 +21,7 @@
 using namespace DirectX;
 
 // Helper macro for getting a float between min and max
-#define RandomRange(min, max) (float)rand() / RAND_MAX * (max - min) + min
+#define RandomRange(min, max) sceneRandom.Range(min, max)
 
 // Helper macros for making texture and shader loading code more succinct
 #define LoadTexture(file, srv) CreateWICTextureFromFile(device.Get(), context.Get(), FixPath(file).c_str(), 0, srv.GetAddressOf())
@@ -51,7 +51,7 @@ Game::Game(HINSTANCE hInstance)
 	showPointLights(false)
 {
 	// Seed random
-	srand((unsigned int)time(0));
+	sceneRandom.SetSeed((unsigned int)time(0));
 
 #if defined(DEBUG) || defined(_DEBUG)
 	// Do we want a console window?  Probably only in debug mode
@@ -140,6 +140,10 @@ void Game::LoadAssetsAndCreateEntities()
 {
 	//fluild field object
 	fluidField = std::make_shared<FluidField>(device, context);
+	DirectX::XMINT3 gridRes = fluidField->GetGridResolution();
+	fluidGridRes[0] = gridRes.x;
+	fluidGridRes[1] = gridRes.y;
+	fluidGridRes[2] = gridRes.z;
 
 	// Load shaders using our succinct LoadShader() macro
 	std::shared_ptr<SimpleVertexShader> vertexShader	= LoadShader(SimpleVertexShader, L"VertexShader.cso");
@@ -537,6 +541,7 @@ void Game::Update(float deltaTime, float totalTime)
 
 	// Update the camera
 	camera->Update(deltaTime);
+	fluidField->UpdateObstacles(entities, deltaTime);
 	fluidField->UpdateFluid(deltaTime);
 
 	// Check individual input
@@ -781,6 +786,15 @@ void Game::BuildUI()
 			ImGui::TreePop();
 		}
 
+		// === Fluid ===
+		if (ImGui::TreeNode("Fluid"))
+		{
+			FluidUI(fluidField);
+
+			// Finalize the tree node
+			ImGui::TreePop();
+		}
+
 		//add node to see extra render targets
 		if (ImGui::TreeNode("MRTs")) 
 		{
@@ -877,6 +891,249 @@ void Game::EntityUI(std::shared_ptr<GameEntity> entity)
 }
 
 
+// --------------------------------------------------------
+// Builds the UI for the fluid sim settings
+// --------------------------------------------------------
+void Game::FluidUI(std::shared_ptr<FluidField> fluid)
+{
+	ImGui::Spacing();
+
+	// Grid size, axes can differ
+	ImGui::SliderInt3("Grid Resolution", fluidGridRes, 16, 256);
+	DirectX::XMINT3 currentRes = fluid->GetGridResolution();
+	ImGui::Text("Current: %d x %d x %d", currentRes.x, currentRes.y, currentRes.z);
+	if (ImGui::Button("Apply Resolution"))
+		fluid->SetGridResolution(fluidGridRes[0], fluidGridRes[1], fluidGridRes[2]);
+
+	// Fixed step catch up, owed steps past the max are dropped
+	ImGui::SliderInt("Max Substeps", fluid->GetMaxSubsteps(), 1, 8);
+	ImGui::Checkbox("Interpolate Rendering", fluid->GetInterpolateRendering());
+	ImGui::Text("Substeps: %d, Dropped: %d", fluid->GetLastSubsteps(), fluid->GetLastDroppedSteps());
+
+	// Raymarching leaps over bricks with less density than this
+	ImGui::Checkbox("Empty Space Skipping", fluid->GetEmptySpaceSkipping());
+	ImGui::DragFloat("Empty Threshold", fluid->GetEmptySpaceThreshold(), 0.00001f, 0.0f, 0.01f, "%.5f");
+
+	// Raymarch budget, quality is steps per pixel (or voxel) across the volume
+	ImGui::SliderInt("Max Raymarch Samples", fluid->GetRaymarchSamples(), 16, 512);
+	ImGui::Checkbox("Adaptive Raymarch", fluid->GetAdaptiveRaymarch());
+	ImGui::SliderFloat("Raymarch Quality", fluid->GetRaymarchQuality(), 0.1f, 2.0f);
+	ImGui::Checkbox("Jitter Raymarch", fluid->GetRaymarchJitter());
+	ImGui::Text("Raymarch Samples: %d", fluid->GetLastRaymarchSamples());
+
+	// Smaller volume passes get upsampled against scene depth
+	int resolution = fluid->GetVolumeResolution() == VOLUME_RESOLUTION_FULL ? 0 : fluid->GetVolumeResolution() == VOLUME_RESOLUTION_HALF ? 1 : 2;
+	if (ImGui::Combo("Volume Resolution", &resolution, "Full\0Half\0Quarter"))
+		fluid->SetVolumeResolution(resolution == 0 ? VOLUME_RESOLUTION_FULL : resolution == 1 ? VOLUME_RESOLUTION_HALF : VOLUME_RESOLUTION_QUARTER);
+
+	// Which device runs the sim
+	int backend = (int)fluid->GetSimBackend();
+	if (ImGui::Combo("Sim Backend", &backend, "GPU (Compute)\0CPU (Threaded)"))
+		fluid->SetSimBackend((FluidSimBackend)backend);
+	if (fluid->GetSimBackend() == FLUID_BACKEND_CPU)
+	{
+		ImGui::Checkbox("Async CPU Sim", fluid->GetAsyncCpuSim());
+		int threads = (int)fluid->GetCpuThreadCount();
+		if (ImGui::InputInt("CPU Threads", &threads) && threads > 0)
+			fluid->SetCpuThreadCount(threads);
+		// Anything wider than the cpu supports falls back to the widest it has
+		int isa = (int)GetSamplerIsa();
+		if (ImGui::Combo("CPU Sampler", &isa, "Scalar\0SSE\0AVX2\0AVX-512"))
+			SetSamplerIsa((SamplerIsa)isa);
+	}
+
+	// Advection order
+	int scheme = (int)fluid->GetAdvectionScheme();
+	if (ImGui::Combo("Advection", &scheme, "Semi-Lagrangian\0MacCormack"))
+		fluid->SetAdvectionScheme((AdvectionScheme)scheme);
+	ImGui::SliderFloat("Vorticity Confinement", fluid->GetVorticityEpsilon(), 0.0f, 1.0f);
+
+	// Pressure solve
+	int solver = (int)fluid->GetPressureSolver();
+	if (ImGui::Combo("Pressure Solver", &solver, "Jacobi\0Multigrid\0Conjugate Gradient\0Spectral (DCT)"))
+		fluid->SetPressureSolver((PressureSolverType)solver);
+	ImGui::Checkbox("Warm Start Pressure", fluid->GetWarmStartPressure());
+
+	if (solver == PRESSURE_SOLVER_SPECTRAL && fluid->GetSimBackend() == FLUID_BACKEND_GPU)
+		ImGui::Text("Spectral is CPU only, the GPU uses multigrid");
+
+	if (solver == PRESSURE_SOLVER_MULTIGRID || (solver == PRESSURE_SOLVER_SPECTRAL && fluid->GetSimBackend() == FLUID_BACKEND_GPU))
+	{
+		int cycle = (int)fluid->GetMultigridCycle();
+		if (ImGui::Combo("Cycle", &cycle, "V-Cycle\0F-Cycle"))
+			fluid->SetMultigridCycle((MultigridCycle)cycle);
+
+		ImGui::SliderInt("Max Cycles", fluid->GetMultigridMaxCycles(), 1, 20);
+		ImGui::DragFloat("Tolerance", fluid->GetPressureTolerance(), 0.0001f, 0.00001f, 0.1f, "%.5f");
+	}
+	else if (solver == PRESSURE_SOLVER_JACOBI)
+	{
+		ImGui::SliderInt("Max Sweeps", fluid->GetJacobiMaxIterations(), 1, 500);
+		ImGui::DragFloat("Tolerance", fluid->GetPressureTolerance(), 0.0001f, 0.00001f, 0.1f, "%.5f");
+	}
+	else if (solver == PRESSURE_SOLVER_CONJUGATE_GRADIENT)
+	{
+		// MIC(0) is sequential per row, so only the cpu backend offers it
+		if (fluid->GetSimBackend() == FLUID_BACKEND_CPU)
+		{
+			int preconditioner = (int)fluid->GetPcgPreconditioner();
+			if (ImGui::Combo("Preconditioner", &preconditioner, "Jacobi\0MIC(0)"))
+				fluid->SetPcgPreconditioner((PcgPreconditioner)preconditioner);
+		}
+
+		ImGui::SliderInt("Max Iterations", fluid->GetPcgMaxIterations(), 1, 1000);
+		ImGui::DragFloat("Tolerance", fluid->GetPressureTolerance(), 0.0001f, 0.00001f, 0.1f, "%.5f");
+	}
+
+	ImGui::Text("Pressure Iterations: %d", fluid->GetPressureIterations());
+	float residual = fluid->GetPressureResidual();
+	if (residual >= 0.0f)
+		ImGui::Text("Pressure Residual: %.6f", residual);
+	else
+		ImGui::Text("Pressure Residual: not measured");
+
+	// Skip empty parts of the grid
+	ImGui::Checkbox("Sparse Bricks", fluid->GetSparseBricks());
+	ImGui::Text("Active Bricks: %d / %d", fluid->GetActiveBrickCount(), fluid->GetBrickCount());
+
+	// Entities inside the volume block the smoke
+	ImGui::Checkbox("Obstacles", fluid->GetObstaclesEnabled());
+	ImGui::Text("Solid Cells: %d", fluid->GetObstacleCellCount());
+
+	// Storage precision per field, color is stored with density
+	FieldPrecisionPolicy precision = fluid->GetFieldPrecision();
+	int velocityPrecision = (int)precision.velocity;
+	int densityPrecision = (int)precision.density;
+	int temperaturePrecision = (int)precision.temperature;
+	int pressurePrecision = (int)precision.pressure;
+	bool precisionChanged = false;
+	precisionChanged |= ImGui::Combo("Velocity Precision", &velocityPrecision, "FP32\0FP16");
+	precisionChanged |= ImGui::Combo("Density Precision", &densityPrecision, "FP32\0FP16");
+	precisionChanged |= ImGui::Combo("Temperature Precision", &temperaturePrecision, "FP32\0FP16");
+	precisionChanged |= ImGui::Combo("Pressure Precision", &pressurePrecision, "FP32\0FP16");
+	if (precisionChanged)
+	{
+		precision.velocity = (FieldPrecision)velocityPrecision;
+		precision.density = (FieldPrecision)densityPrecision;
+		precision.temperature = (FieldPrecision)temperaturePrecision;
+		precision.pressure = (FieldPrecision)pressurePrecision;
+		fluid->SetFieldPrecision(precision);
+	}
+	if (!fluid->IsHalfPressureSupported())
+		ImGui::Text("No R16 typed UAV loads, pressure stays FP32");
+
+	// Record a run once, then replay it without simulating
+	const char* recordingPath = "FluidRecording.flrc";
+	if (fluid->IsRecording())
+	{
+		ImGui::Text("Recorded Frames: %d, Compression: %.1fx", fluid->GetRecordedFrameCount(), fluid->GetRecordingCompression());
+		if (ImGui::Button("Stop Recording"))
+			fluid->StopRecording();
+	}
+	else if (ImGui::Button("Start Recording"))
+		fluid->StartRecording(recordingPath);
+
+	if (fluid->IsPlayingBack())
+	{
+		int frame = fluid->GetPlaybackFrame();
+		if (ImGui::SliderInt("Playback Frame", &frame, 0, fluid->GetPlaybackFrameCount() - 1))
+			fluid->SeekPlayback(frame);
+		if (ImGui::Button("Stop Playback"))
+			fluid->StopPlayback();
+	}
+	else if (!fluid->IsRecording() && ImGui::Button("Play Recording"))
+		fluid->StartPlayback(recordingPath);
+
+	// Save the warmed up state and start from it again later
+	const char* checkpointPath = "FluidCheckpoint.flck";
+	if (ImGui::Button("Save Checkpoint"))
+		fluid->SaveCheckpoint(checkpointPath);
+	ImGui::SameLine();
+	if (ImGui::Button("Load Checkpoint"))
+		fluid->LoadCheckpoint(checkpointPath);
+
+	// Hash every step, then rerun (e.g. on another thread count) against it
+	const char* hashLogPath = "FluidHashes.txt";
+	const char* hashCompareLogPath = "FluidHashesCompare.txt";
+	if (fluid->IsDeterministicRun())
+	{
+		ImGui::Text("Hashed Steps: %d", fluid->GetHashedStepCount());
+		ImGui::Text("Velocity: %016llx", (unsigned long long)fluid->GetStepHash(CHECKPOINT_VELOCITY));
+		ImGui::Text("Density: %016llx", (unsigned long long)fluid->GetStepHash(CHECKPOINT_DENSITY));
+		ImGui::Text("Temperature: %016llx", (unsigned long long)fluid->GetStepHash(CHECKPOINT_TEMPERATURE));
+		ImGui::Text("Pressure: %016llx", (unsigned long long)fluid->GetStepHash(CHECKPOINT_PRESSURE));
+		if (fluid->GetDivergedStep() >= 0)
+		{
+			const char* volumeNames[] = { "velocity", "density", "temperature", "pressure" };
+			ImGui::Text("Diverged at step %d in %s", fluid->GetDivergedStep(), volumeNames[fluid->GetDivergedVolume()]);
+		}
+		else if (fluid->GetReferenceStepCount() > 0)
+			ImGui::Text("Matches the last run so far (%d steps)", fluid->GetReferenceStepCount());
+		if (ImGui::Button("Stop Deterministic Run"))
+			fluid->StopDeterministicRun();
+	}
+	else
+	{
+		if (ImGui::Button("Start Deterministic Run"))
+			fluid->StartDeterministicRun(hashLogPath);
+		ImGui::SameLine();
+		if (ImGui::Button("Compare With Last Run"))
+			fluid->StartDeterministicRun(hashCompareLogPath, hashLogPath);
+	}
+
+	// The same render done on the cpu, for checking it against the shader
+	if (ImGui::Button("Render CPU Preview"))
+		fluid->RenderFluidCPU(camera, 320, 180);
+	if (fluid->GetCpuRaymarcher())
+	{
+		VolumeRaymarcherCPU* raymarcher = fluid->GetCpuRaymarcher();
+		ImGui::Text("CPU Raymarch: %.2f ms, %.2f Mrays/s", raymarcher->GetLastRenderMs(), raymarcher->GetRaysPerSecond() / 1000000.0);
+		ImGui::Image(fluid->GetCpuRenderPreview().Get(), ImVec2(320, 180));
+	}
+
+	ImGui::Text("Field Memory: %.1f MB", fluid->GetFieldMemoryMB());
+	ImGui::Text("Sim Time: %.3f ms", fluid->GetSimTimeMs());
+
+	// Error of each preset against full precision, run on the cpu solver
+	if (fluid->IsPrecisionReportRunning())
+		ImGui::Text("Running precision report...");
+	else if (ImGui::Button("Run Precision Report"))
+		fluid->StartPrecisionReport(60);
+
+	const std::vector<PrecisionReportRow>& report = fluid->GetPrecisionReport();
+	if (!report.empty() && ImGui::BeginTable("Precision Report", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+	{
+		ImGui::TableSetupColumn("Preset");
+		ImGui::TableSetupColumn("Bytes/Cell");
+		ImGui::TableSetupColumn("CPU ms");
+		ImGui::TableSetupColumn("Density RMS");
+		ImGui::TableSetupColumn("Density Max");
+		ImGui::TableSetupColumn("Velocity RMS");
+		ImGui::TableHeadersRow();
+
+		for (const PrecisionReportRow& row : report)
+		{
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::Text("%s%s", row.name, row.finite ? "" : " (NaN)");
+			ImGui::TableNextColumn();
+			ImGui::Text("%d", row.bytesPerCell);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", row.cpuMsPerStep);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.5f", row.densityRmsError);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.5f", row.densityMaxError);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.5f", row.velocityRmsError);
+		}
+		ImGui::EndTable();
+	}
+
+	ImGui::Spacing();
+}
+
+
 // --------------------------------------------------------
 // Builds the UI for a single light
 // --------------------------------------------------------
@@ -9,6 +9,7 @@
 #include "Sky.h"
 #include "Renderer.h"
 #include "FluidField.h"
+#include "CounterRandom.h"
 
 #include <DirectXMath.h>
 #include <wrl/client.h>
@@ -40,6 +41,9 @@ private:
 	int lightCount;
 	bool showPointLights;
 
+	// Where the point lights get placed from
+	CounterRandom sceneRandom;
+
 	// These will be loaded along with other assets and
 	// saved to these variables for ease of access
 	std::shared_ptr<Mesh> lightMesh;
@@ -64,6 +68,7 @@ private:
 	void CameraUI(std::shared_ptr<Camera> cam);
 	void EntityUI(std::shared_ptr<GameEntity> entity);	
 	void LightUI(Light& light);
+	void FluidUI(std::shared_ptr<FluidField> fluid);
 	
 	// Should the ImGui demo window be shown?
 	bool showUIDemoWindow;
@@ -71,5 +76,9 @@ private:
 	std::shared_ptr<Renderer> renderer;
 
 	std::shared_ptr<FluidField> fluidField;
+
+	// Grid size being edited in the UI, only applied on request
+	// since it rebuilds every sim volume
+	int fluidGridRes[3];
 };
 
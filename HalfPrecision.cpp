@@ -0,0 +1,205 @@
+#include "HalfPrecision.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HALF_PRECISION_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+//msvc lets intrinsics through without /arch, the cpuid check guards them
+#define F16C_TARGET
+#else
+#include <cpuid.h>
+#define F16C_TARGET __attribute__((target("avx,f16c")))
+#endif
+#endif
+
+static uint16_t FloatToHalfScalar(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t exponent = (bits >> 23) & 0xff;
+	uint32_t mantissa = bits & 0x7fffff;
+
+	//inf stays inf, nan stays a (quiet) nan
+	if (exponent == 0xff) {
+		return (uint16_t)(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+	}
+
+	int halfExponent = (int)exponent - 127 + 15;
+	if (halfExponent >= 31) {
+		return (uint16_t)(sign | 0x7c00);
+	}
+
+	if (halfExponent <= 0) {
+		//too small even for a denormal
+		if (halfExponent < -10) {
+			return (uint16_t)sign;
+		}
+
+		//denormal, shift the mantissa (with its implicit 1) down and round
+		mantissa |= 0x800000;
+		int shift = 14 - halfExponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t remainder = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1))) {
+			half++;
+		}
+		return (uint16_t)(sign | half);
+	}
+
+	//a carry out of the mantissa correctly bumps the exponent, up to inf
+	uint32_t half = ((uint32_t)halfExponent << 10) | (mantissa >> 13);
+	uint32_t remainder = mantissa & 0x1fff;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+		half++;
+	}
+	return (uint16_t)(sign | half);
+}
+
+static float HalfToFloatScalar(uint16_t half)
+{
+	uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+
+	if (exponent == 0) {
+		//zero or denormal, mantissa * 2^-24
+		float value = mantissa * (1.0f / 16777216.0f);
+		return sign ? -value : value;
+	}
+
+	uint32_t bits;
+	if (exponent == 31) {
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	}
+	else {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+#ifdef HALF_PRECISION_X86
+static bool DetectF16C()
+{
+	unsigned int ecx = 0;
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	ecx = (unsigned int)info[2];
+#else
+	unsigned int eax, ebx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return false;
+	}
+#endif
+
+	//f16c is vex encoded, so the os also has to save the avx registers
+	bool f16c = (ecx & (1u << 29)) != 0;
+	bool osxsave = (ecx & (1u << 27)) != 0;
+	if (!f16c || !osxsave) {
+		return false;
+	}
+
+#if defined(_MSC_VER)
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int xcr0Low, xcr0High;
+	__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)xcr0High << 32) | xcr0Low;
+#endif
+	return (xcr0 & 0x6) == 0x6;
+}
+
+F16C_TARGET static void FloatToHalfF16C(const float* in, uint16_t* out, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i*)(out + i), halves);
+	}
+	for (; i < count; i++) {
+		out[i] = FloatToHalfScalar(in[i]);
+	}
+}
+
+F16C_TARGET static void HalfToFloatF16C(const uint16_t* in, float* out, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i halves = _mm_loadu_si128((const __m128i*)(in + i));
+		_mm256_storeu_ps(out + i, _mm256_cvtph_ps(halves));
+	}
+	for (; i < count; i++) {
+		out[i] = HalfToFloatScalar(in[i]);
+	}
+}
+
+F16C_TARGET static void RoundToHalfF16C(float* values, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm256_storeu_ps(values + i, _mm256_cvtph_ps(halves));
+	}
+	for (; i < count; i++) {
+		values[i] = HalfToFloatScalar(FloatToHalfScalar(values[i]));
+	}
+}
+#endif
+
+bool HasF16C()
+{
+#ifdef HALF_PRECISION_X86
+	static const bool supported = DetectF16C();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+void FloatToHalf(const float* in, uint16_t* out, int count)
+{
+#ifdef HALF_PRECISION_X86
+	if (HasF16C()) {
+		FloatToHalfF16C(in, out, count);
+		return;
+	}
+#endif
+	for (int i = 0; i < count; i++) {
+		out[i] = FloatToHalfScalar(in[i]);
+	}
+}
+
+void HalfToFloat(const uint16_t* in, float* out, int count)
+{
+#ifdef HALF_PRECISION_X86
+	if (HasF16C()) {
+		HalfToFloatF16C(in, out, count);
+		return;
+	}
+#endif
+	for (int i = 0; i < count; i++) {
+		out[i] = HalfToFloatScalar(in[i]);
+	}
+}
+
+void RoundToHalf(float* values, int count)
+{
+#ifdef HALF_PRECISION_X86
+	if (HasF16C()) {
+		RoundToHalfF16C(values, count);
+		return;
+	}
+#endif
+	for (int i = 0; i < count; i++) {
+		values[i] = HalfToFloatScalar(FloatToHalfScalar(values[i]));
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+// Float <-> IEEE 754 half conversion for reduced precision fields.
+// Uses F16C to convert 8 values at a time when the cpu supports it,
+// otherwise an exact scalar fallback. Both round to nearest even,
+// the same as a 16 bit float texture store.
+
+// True if conversions go through F16C
+bool HasF16C();
+
+void FloatToHalf(const float* in, uint16_t* out, int count);
+void HalfToFloat(const uint16_t* in, float* out, int count);
+
+// Rounds every value in place to the nearest half,
+// i.e. what writing it to a 16 bit float texture would keep
+void RoundToHalf(float* values, int count);
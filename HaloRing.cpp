@@ -0,0 +1,61 @@
+#include "HaloRing.h"
+
+#include <new>
+
+//slots start on a cache line, so messages are padded up to 16 floats
+static size_t PaddedFloats(size_t floats)
+{
+	return (floats + 15) / 16 * 16;
+}
+
+size_t HaloRing::GetSize(int slotCount, size_t slotFloats)
+{
+	return 128 + (size_t)slotCount * PaddedFloats(slotFloats) * sizeof(float);
+}
+
+void HaloRing::Create(unsigned char* memory, int slotCount, size_t slotFloats)
+{
+	static_assert(sizeof(Counters) == 128, "counters are two cache lines");
+	Counters* created = new (memory) Counters();
+	created->written.store(0, std::memory_order_relaxed);
+	created->read.store(0, std::memory_order_relaxed);
+	Attach(memory, slotCount, slotFloats);
+}
+
+void HaloRing::Attach(unsigned char* memory, int slotCount, size_t slotFloats)
+{
+	counters = (Counters*)memory;
+	slots = (float*)(memory + 128);
+	this->slotCount = slotCount;
+	this->slotFloats = PaddedFloats(slotFloats);
+}
+
+float* HaloRing::BeginWrite(const std::function<bool()>& giveUp)
+{
+	//only this side moves written, so a relaxed load of it is current
+	uint32_t written = counters->written.load(std::memory_order_relaxed);
+	if (!SpinWait([&]() { return written - counters->read.load(std::memory_order_acquire) < (uint32_t)slotCount; }, giveUp)) {
+		return nullptr;
+	}
+	return slots + (written % slotCount) * slotFloats;
+}
+
+void HaloRing::EndWrite()
+{
+	//release so the reader sees the message before the count
+	counters->written.fetch_add(1, std::memory_order_release);
+}
+
+const float* HaloRing::BeginRead(const std::function<bool()>& giveUp)
+{
+	uint32_t read = counters->read.load(std::memory_order_relaxed);
+	if (!SpinWait([&]() { return counters->written.load(std::memory_order_acquire) != read; }, giveUp)) {
+		return nullptr;
+	}
+	return slots + (read % slotCount) * slotFloats;
+}
+
+void HaloRing::EndRead()
+{
+	counters->read.fetch_add(1, std::memory_order_release);
+}
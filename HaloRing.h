@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+//shared memory only works across processes with atomics that don't fall back to a lock
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "cross process atomics need lock free ints");
+
+/// <summary>
+/// Waits until ready() returns true. Spins briefly since the other side
+/// is usually close behind, then yields so waiting processes don't starve
+/// busy ones when there are more processes than cores, asking giveUp()
+/// before each yield whether the other side is ever coming. False if it
+/// gave up.
+/// </summary>
+template<typename Ready, typename GiveUp>
+bool SpinWait(Ready ready, GiveUp giveUp)
+{
+	for (int spin = 0; !ready(); spin++) {
+		if (spin >= 64) {
+			if (giveUp()) {
+				return false;
+			}
+			std::this_thread::yield();
+		}
+	}
+	return true;
+}
+
+// A single producer, single consumer queue of fixed size messages living
+// in shared memory, how a slab hands its edge planes to a neighbour.
+// Messages are written and read in place, so a halo is copied once on
+// each side. Both counters only grow and each side writes just its own.
+class HaloRing
+{
+public:
+	// Bytes a ring takes, a multiple of 64
+	static size_t GetSize(int slotCount, size_t slotFloats);
+
+	// Sets a ring up in memory (64 byte aligned), only one process should
+	void Create(unsigned char* memory, int slotCount, size_t slotFloats);
+	// Uses a ring another process set up, with the same sizes
+	void Attach(unsigned char* memory, int slotCount, size_t slotFloats);
+
+	size_t GetSlotFloats() { return slotFloats; }
+
+	// Waits for a free slot and returns it to be filled, null if giveUp said to stop waiting
+	float* BeginWrite(const std::function<bool()>& giveUp);
+	// Publishes the slot BeginWrite returned
+	void EndWrite();
+
+	// Waits for the oldest unread message, null if giveUp said to stop waiting
+	const float* BeginRead(const std::function<bool()>& giveUp);
+	// Frees the slot BeginRead returned
+	void EndRead();
+
+private:
+	//each counter gets its own cache line so the two sides don't fight over one
+	struct Counters {
+		std::atomic<uint32_t> written;
+		char writtenPad[60];
+		std::atomic<uint32_t> read;
+		char readPad[60];
+	};
+
+	Counters* counters = nullptr;
+	float* slots = nullptr;
+	int slotCount = 0;
+	size_t slotFloats = 0;
+};
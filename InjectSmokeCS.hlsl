@@ -1,4 +1,5 @@
-#include "FluidSimHelpers.hlsli"
+#include "BrickHelpers.hlsli"
+#include "ObstacleHelpers.hlsli"
 cbuffer ExternalData : register(b0) {
 	float injectRadius;//in UV coords
 	float3 injectPosition; //also in uv coords
@@ -9,7 +10,9 @@ cbuffer ExternalData : register(b0) {
 	float3 injectVelocity;
 	float injectTemperature;
 
-	int gridSize;
+	int3 gridSize;
+	int sparseBricks;
+	int3 bricksPerAxis;
 }
 
 Texture3D DensityMap : register(t0);
@@ -20,18 +23,23 @@ RWTexture3D<float4> TemperatureOut : register(u1);
 RWTexture3D<float4> VelocityOut : register(u2);
 
 [numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
-void main( uint3 DTid : SV_DispatchThreadID )
+void main(uint3 dispatchID : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
-	//here'd be where we'd check for obstacles
+	uint3 DTid = GetSimCellIndex(dispatchID, groupID, groupThreadID, sparseBricks, bricksPerAxis);
 
 	// Pixel position in [0-gridSize] range and UV coords [0-1] range
 	float3 posInGrid = float3(DTid);
 	float3 posUVW = PixelIndexToUVW(posInGrid, gridSize);
 
 	// How much to inject based on distance?
-	float dist = length(posUVW - injectPosition);
+	float dist = length((posUVW - injectPosition) * gridSize) / GetLargestAxis(gridSize);
 	float injFalloff = injectRadius == 0.0f ? 0.0f : max(0, injectRadius - dist) / injectRadius;
 
+	//nothing gets injected inside obstacles
+	if (IsSolid(DTid, gridSize)) {
+		injFalloff = 0;
+	}
+
 	// Grab the old values
 	float4 oldColorAndDensity = DensityMap[DTid];
 
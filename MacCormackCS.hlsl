@@ -0,0 +1,79 @@
+#include "BrickHelpers.hlsli"
+#include "ObstacleHelpers.hlsli"
+
+// Second half of MacCormack advection, AdvectionCS has already written
+// the semi-lagrangian step of every field to its ForwardMap
+cbuffer ExternalData : register(b0) {
+	float deltaTime;
+	int3 gridRes;
+	int sparseBricks;
+	int3 bricksPerAxis;
+	int fieldCount;
+	float4 solidValues[MAX_ADVECTED_FIELDS];
+};
+
+Texture3D<float4> VelocityMap : register (t0);
+Texture3D<float4> InputMap0 : register (t1);
+Texture3D<float4> InputMap1 : register (t2);
+Texture3D<float4> InputMap2 : register (t3);
+Texture3D<float4> InputMap3 : register (t4);
+//t8 - t10 are taken by the brick and obstacle helpers
+Texture3D<float4> ForwardMap0 : register (t11);
+Texture3D<float4> ForwardMap1 : register (t12);
+Texture3D<float4> ForwardMap2 : register (t13);
+Texture3D<float4> ForwardMap3 : register (t14);
+RWTexture3D<float4> UavOutputMap0 : register (u0);
+RWTexture3D<float4> UavOutputMap1 : register (u1);
+RWTexture3D<float4> UavOutputMap2 : register (u2);
+RWTexture3D<float4> UavOutputMap3 : register (u3);
+
+SamplerState LinearClampSampler : register(s0);
+
+void CorrectField(Texture3D<float4> inputMap, Texture3D<float4> forwardMap, RWTexture3D<float4> outputMap,
+	uint3 cell, float3 forwardUVW, int3 base, float4 solidValue, bool solid) {
+	//advect the forward result back the other way, perfect advection would land on the input again
+	float4 backward = forwardMap.SampleLevel(LinearClampSampler, forwardUVW, 0.0f);
+
+	//and take out half of that round trip error
+	float4 result = forwardMap[cell] + 0.5f * (inputMap[cell] - backward);
+
+	//limiter, keep the result within the texels the forward step blended
+	//so the correction can't create new peaks or ringing
+	float4 minValue = inputMap[clamp(base, 0, gridRes - 1)];
+	float4 maxValue = minValue;
+	[unroll]
+	for (int i = 1; i < 8; i++) {
+		int3 corner = clamp(base + int3(i & 1, (i >> 1) & 1, i >> 2), 0, gridRes - 1);
+		float4 value = inputMap[corner];
+		minValue = min(minValue, value);
+		maxValue = max(maxValue, value);
+	}
+
+	outputMap[cell] = solid ? solidValue : clamp(result, minValue, maxValue);
+}
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 dispatchID : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
+{
+	uint3 DTid = GetSimCellIndex(dispatchID, groupID, groupThreadID, sparseBricks, bricksPerAxis);
+	float3 velocity = VelocityMap[DTid].xyz;
+
+	//both positions are shared by every field
+	float3 forwardUVW = PixelIndexToUVW(float3(DTid) + deltaTime * velocity, gridRes);
+	int3 base = (int3)floor(float3(DTid) - deltaTime * velocity);
+	bool solid = IsSolid(DTid, gridRes);
+
+	CorrectField(InputMap0, ForwardMap0, UavOutputMap0, DTid, forwardUVW, base, solidValues[0], solid);
+	[branch]
+	if (fieldCount > 1) {
+		CorrectField(InputMap1, ForwardMap1, UavOutputMap1, DTid, forwardUVW, base, solidValues[1], solid);
+	}
+	[branch]
+	if (fieldCount > 2) {
+		CorrectField(InputMap2, ForwardMap2, UavOutputMap2, DTid, forwardUVW, base, solidValues[2], solid);
+	}
+	[branch]
+	if (fieldCount > 3) {
+		CorrectField(InputMap3, ForwardMap3, UavOutputMap3, DTid, forwardUVW, base, solidValues[3], solid);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read only memory mapping of a whole file. Opening costs nothing however
+// big the file is, the os pages data in as it's touched, so formats laid
+// out the way they're used can be read straight from GetData.
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// False if the file doesn't exist, is empty or can't be mapped
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() { return data != nullptr; }
+	const unsigned char* GetData() { return data; }
+	size_t GetSize() { return size; }
+
+private:
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+};
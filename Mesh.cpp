@@ -250,6 +250,12 @@ void Mesh::CreateBuffers(Vertex* vertArray, size_t numVerts, unsigned int* index
 
 	// Save the indices
 	this->numIndices = (unsigned int)numIndices;
+
+	// Keep the positions and indices around on the CPU
+	positions.resize(numVerts);
+	for (size_t i = 0; i < numVerts; i++)
+		positions[i] = vertArray[i].Position;
+	indices.assign(indexArray, indexArray + numIndices);
 }
 
 // --------------------------------------------------------
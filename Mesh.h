@@ -3,6 +3,7 @@
 #include <d3d11.h>
 #include <wrl/client.h>
 #include <string>
+#include <vector>
 
 #include "Vertex.h"
 
@@ -19,6 +20,10 @@ public:
 	Microsoft::WRL::ComPtr<ID3D11Buffer> GetIndexBuffer();
 	unsigned int GetIndexCount();
 
+	// CPU copies of the geometry, for things like voxelizing it
+	const std::vector<DirectX::XMFLOAT3>& GetPositions() { return positions; }
+	const std::vector<unsigned int>& GetIndices() { return indices; }
+
 	// Basic mesh drawing
 	void SetBuffersAndDraw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
 
@@ -30,6 +35,9 @@ private:
 	// Total indices in this mesh
 	unsigned int numIndices;
 
+	std::vector<DirectX::XMFLOAT3> positions;
+	std::vector<unsigned int> indices;
+
 	// Helper for creating buffers (in the event we add more constructor overloads)
 	void CreateBuffers(Vertex* vertArray, size_t numVerts, unsigned int* indexArray, size_t numIndices, Microsoft::WRL::ComPtr<ID3D11Device> device);
 	void CalculateTangents(Vertex* verts, size_t numVerts, unsigned int* indices, size_t numIndices);
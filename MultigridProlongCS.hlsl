@@ -0,0 +1,23 @@
+#include "FluidSimHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 coarseGridRes;
+};
+
+RWTexture3D<float> FineOut : register (u0);
+Texture3D<float4> CoarseMap : register (t0);
+Texture3D<float4> FineMap : register (t1);
+
+SamplerState LinearClampSampler : register(s0);
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	//sampling the coarse grid at fine cell centers gives the cell centered
+	//trilinear interpolation for free. Odd axes have one fine cell fewer
+	//than twice the coarse ones, so the spacing comes from the coarse grid.
+	float3 posUVW = (float3(DTid) + 0.5f) / (2.0f * coarseGridRes);
+	float correction = CoarseMap.SampleLevel(LinearClampSampler, posUVW, 0.0f).x;
+
+	FineOut[DTid] = FineMap[DTid].x + correction;
+}
@@ -0,0 +1,26 @@
+#include "FluidSimHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 coarseGridRes;
+};
+
+RWTexture3D<float> CoarseOut : register (u0);
+Texture3D<float4> FineMap : register (t0);
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	int3 fine = DTid * 2;
+
+	float sum =
+		FineMap[fine].x + FineMap[fine + int3(1, 0, 0)].x +
+		FineMap[fine + int3(0, 1, 0)].x + FineMap[fine + int3(1, 1, 0)].x +
+		FineMap[fine + int3(0, 0, 1)].x + FineMap[fine + int3(1, 0, 1)].x +
+		FineMap[fine + int3(0, 1, 1)].x + FineMap[fine + int3(1, 1, 1)].x;
+
+	//average of the 8 children, times 4 since the coarse
+	//operator is a quarter of the fine one per unit spacing.
+	//The last cell of an odd axis has no partner, whose out of
+	//bounds load reads 0 and keeps the sum what the fine grid had
+	CoarseOut[DTid] = sum * 0.5f;
+}
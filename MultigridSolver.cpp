@@ -0,0 +1,433 @@
+#include "MultigridSolver.h"
+#include "FluidSimHelpers.h"
+
+#include <algorithm>
+#include <cmath>
+
+MultigridSolver::MultigridSolver(int resX, int resY, int resZ, ThreadPool* pool)
+{
+	this->pool = pool;
+
+	//keep halving while every axis stays above 4 cells, odd axes round up
+	while (true) {
+		Level level = {};
+		level.resX = resX;
+		level.resY = resY;
+		level.resZ = resZ;
+
+		int cellCount = resX * resY * resZ;
+		level.rhs.assign(cellCount, 0.0f);
+		level.residual.assign(cellCount, 0.0f);
+		if (!levels.empty()) {
+			level.pressureStorage.assign(cellCount, 0.0f);
+		}
+		levels.push_back(level);
+
+		if (std::min(resX, std::min(resY, resZ)) <= 4) {
+			break;
+		}
+
+		resX = GetCoarseRes(resX);
+		resY = GetCoarseRes(resY);
+		resZ = GetCoarseRes(resZ);
+	}
+
+	//storage doesn't move once every level is in place
+	for (size_t i = 1; i < levels.size(); i++) {
+		levels[i].pressure = levels[i].pressureStorage.data();
+	}
+
+	SetSolidCells(nullptr);
+}
+
+void MultigridSolver::SetSolidCells(const unsigned char* solid)
+{
+	if (!solid) {
+		for (Level& level : levels) {
+			level.solid.clear();
+			BuildFaces(level);
+		}
+		return;
+	}
+
+	Level& finest = levels[0];
+	finest.solid.assign(solid, solid + finest.resX * finest.resY * finest.resZ);
+	BuildFaces(finest);
+
+	//a coarse cell stays open while any of its children are, so thin walls
+	//vanish further down and only the finer levels see them
+	for (size_t l = 1; l < levels.size(); l++) {
+		const Level& fine = levels[l - 1];
+		Level& coarse = levels[l];
+		coarse.solid.assign(coarse.resX * coarse.resY * coarse.resZ, 0);
+
+		pool->ParallelFor(0, coarse.resZ, [&](int zBegin, int zEnd) {
+			for (int z = zBegin; z < zEnd; z++) {
+				for (int y = 0; y < coarse.resY; y++) {
+					for (int x = 0; x < coarse.resX; x++) {
+						bool allSolid = true;
+						for (int child = 0; child < 8 && allSolid; child++) {
+							int fx = x * 2 + (child & 1);
+							int fy = y * 2 + ((child >> 1) & 1);
+							int fz = z * 2 + (child >> 2);
+							//the last cell of an odd axis has one child along it
+							if (fx < fine.resX && fy < fine.resY && fz < fine.resZ) {
+								allSolid = fine.solid[GridIndex(fx, fy, fz, fine.resX, fine.resY)] != 0;
+							}
+						}
+						coarse.solid[GridIndex(x, y, z, coarse.resX, coarse.resY)] = allSolid;
+					}
+				}
+			}
+		});
+		BuildFaces(coarse);
+	}
+}
+
+void MultigridSolver::BuildFaces(Level& level)
+{
+	const int resX = level.resX;
+	const int resY = level.resY;
+	const int resZ = level.resZ;
+	const unsigned char* solid = level.solid.empty() ? nullptr : level.solid.data();
+	level.faces.resize(resX * resY * resZ);
+
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			for (int y = 0; y < resY; y++) {
+				for (int x = 0; x < resX; x++) {
+					level.faces[GridIndex(x, y, z, resX, resY)] = GetOpenFaces(solid, x, y, z, resX, resY, resZ);
+				}
+			}
+		}
+	});
+}
+
+int MultigridSolver::Solve(float* pressure, const float* divergence, MultigridCycle cycle, int maxCycles, float tolerance)
+{
+	Level& finest = levels[0];
+	finest.pressure = pressure;
+
+	//with walls on every side the system only has a solution when the
+	//divergence sums to zero, so take out the mean before solving.
+	//cells with no open faces aren't part of the system
+	const unsigned char* faces = finest.faces.data();
+	int cellCount = finest.resX * finest.resY * finest.resZ;
+	int fluidCount = cellCount;
+	double divergenceSum = 0.0;
+	if (finest.solid.empty()) {
+		divergenceSum = Sum(divergence, finest);
+	}
+	else {
+		fluidCount = 0;
+		for (int i = 0; i < cellCount; i++) {
+			if (faces[i]) {
+				divergenceSum += divergence[i];
+				fluidCount++;
+			}
+		}
+	}
+	float mean = fluidCount > 0 ? (float)(divergenceSum / fluidCount) : 0.0f;
+	float* rhs = finest.rhs.data();
+	pool->ParallelFor(0, finest.resZ, [&](int zBegin, int zEnd) {
+		int begin = zBegin * finest.resX * finest.resY;
+		int end = zEnd * finest.resX * finest.resY;
+		for (int i = begin; i < end; i++) {
+			rhs[i] = faces[i] ? divergence[i] - mean : 0.0f;
+		}
+	});
+
+	double rhsNorm = std::sqrt(SumSquares(rhs, finest));
+	if (rhsNorm <= 0.0) {
+		lastResidual = 0.0f;
+		return 0;
+	}
+
+	//the starting guess may already be good enough
+	lastResidual = (float)(std::sqrt(ComputeResidual(finest)) / rhsNorm);
+
+	int cycles = 0;
+	while (cycles < maxCycles && lastResidual > tolerance) {
+		//a full multigrid pass first, then v-cycles to clean up
+		if (cycle == MULTIGRID_F_CYCLE && cycles == 0) {
+			FCycle();
+		}
+		else {
+			VCycle(0);
+		}
+		cycles++;
+
+		lastResidual = (float)(std::sqrt(ComputeResidual(finest)) / rhsNorm);
+	}
+
+	//solid cells pick up coarse corrections they never use, clear them out
+	if (!finest.solid.empty()) {
+		pool->ParallelFor(0, finest.resZ, [&](int zBegin, int zEnd) {
+			int begin = zBegin * finest.resX * finest.resY;
+			int end = zEnd * finest.resX * finest.resY;
+			for (int i = begin; i < end; i++) {
+				if (!faces[i]) {
+					pressure[i] = 0.0f;
+				}
+			}
+		});
+	}
+
+	//pressure is only defined up to a constant, keep it centered on zero
+	float pressureMean = fluidCount > 0 ? (float)(Sum(pressure, finest) / fluidCount) : 0.0f;
+	pool->ParallelFor(0, finest.resZ, [&](int zBegin, int zEnd) {
+		int begin = zBegin * finest.resX * finest.resY;
+		int end = zEnd * finest.resX * finest.resY;
+		for (int i = begin; i < end; i++) {
+			if (faces[i]) {
+				pressure[i] -= pressureMean;
+			}
+		}
+	});
+
+	return cycles;
+}
+
+void MultigridSolver::VCycle(int level)
+{
+	Level& current = levels[level];
+
+	//coarsest level is tiny, just relax it a lot
+	if (level == (int)levels.size() - 1) {
+		Smooth(current, coarsestSmoothSteps);
+		return;
+	}
+
+	Level& coarse = levels[level + 1];
+
+	Smooth(current, preSmoothSteps);
+	ComputeResidual(current);
+
+	//solve for the error on the coarser grid, starting from zero
+	Restrict(current, current.residual.data(), coarse, coarse.rhs.data());
+	std::fill(coarse.pressureStorage.begin(), coarse.pressureStorage.end(), 0.0f);
+	VCycle(level + 1);
+
+	ProlongAndAdd(coarse, current);
+	Smooth(current, postSmoothSteps);
+}
+
+void MultigridSolver::FCycle()
+{
+	//work on the error of the current guess so a warm start isn't thrown away
+	Level& finest = levels[0];
+	ComputeResidual(finest);
+
+	if (levels.size() == 1) {
+		Smooth(finest, coarsestSmoothSteps);
+		return;
+	}
+
+	//push the residual down through every level
+	Restrict(finest, finest.residual.data(), levels[1], levels[1].rhs.data());
+	for (size_t i = 1; i + 1 < levels.size(); i++) {
+		Restrict(levels[i], levels[i].rhs.data(), levels[i + 1], levels[i + 1].rhs.data());
+	}
+
+	//solve the coarsest, then interpolate up with a v-cycle at each level
+	Level& coarsest = levels.back();
+	std::fill(coarsest.pressureStorage.begin(), coarsest.pressureStorage.end(), 0.0f);
+	Smooth(coarsest, coarsestSmoothSteps);
+
+	for (int i = (int)levels.size() - 2; i >= 1; i--) {
+		std::fill(levels[i].pressureStorage.begin(), levels[i].pressureStorage.end(), 0.0f);
+		ProlongAndAdd(levels[i + 1], levels[i]);
+		VCycle(i);
+	}
+
+	ProlongAndAdd(levels[1], finest);
+	VCycle(0);
+}
+
+void MultigridSolver::Smooth(Level& level, int iterations)
+{
+	const int resX = level.resX;
+	const int resY = level.resY;
+	const int resZ = level.resZ;
+	const int strideZ = resX * resY;
+	float* pressure = level.pressure;
+	const float* rhs = level.rhs.data();
+	const unsigned char* faces = level.faces.data();
+
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		//cells of one color only read cells of the other, so each half updates in parallel
+		for (int color = 0; color < 2; color++) {
+			pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+				for (int z = zBegin; z < zEnd; z++) {
+					for (int y = 0; y < resY; y++) {
+						for (int x = (y + z + color) & 1; x < resX; x += 2) {
+							int i = GridIndex(x, y, z, resX, resY);
+							unsigned char open = faces[i];
+
+							//clamped and solid neighbours cancel out, so only count the open ones
+							float sum = 0.0f;
+							int count = 0;
+							if (open & FACE_NEG_X) { sum += pressure[i - 1]; count++; }
+							if (open & FACE_POS_X) { sum += pressure[i + 1]; count++; }
+							if (open & FACE_NEG_Y) { sum += pressure[i - resX]; count++; }
+							if (open & FACE_POS_Y) { sum += pressure[i + resX]; count++; }
+							if (open & FACE_NEG_Z) { sum += pressure[i - strideZ]; count++; }
+							if (open & FACE_POS_Z) { sum += pressure[i + strideZ]; count++; }
+
+							if (count > 0) {
+								pressure[i] = (sum - rhs[i]) / count;
+							}
+						}
+					}
+				}
+			});
+		}
+	}
+}
+
+double MultigridSolver::ComputeResidual(Level& level)
+{
+	const int resX = level.resX;
+	const int resY = level.resY;
+	const int resZ = level.resZ;
+	const int strideZ = resX * resY;
+	const float* pressure = level.pressure;
+	const float* rhs = level.rhs.data();
+	float* residual = level.residual.data();
+	const unsigned char* faces = level.faces.data();
+
+	//per slice partial sums, added in order so the result doesn't depend on threading
+	std::vector<double> partials(resZ, 0.0);
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			double sliceSum = 0.0;
+			for (int y = 0; y < resY; y++) {
+				for (int x = 0; x < resX; x++) {
+					int i = GridIndex(x, y, z, resX, resY);
+					unsigned char open = faces[i];
+					float center = pressure[i];
+
+					float laplacian = 0.0f;
+					if (open & FACE_NEG_X) laplacian += pressure[i - 1] - center;
+					if (open & FACE_POS_X) laplacian += pressure[i + 1] - center;
+					if (open & FACE_NEG_Y) laplacian += pressure[i - resX] - center;
+					if (open & FACE_POS_Y) laplacian += pressure[i + resX] - center;
+					if (open & FACE_NEG_Z) laplacian += pressure[i - strideZ] - center;
+					if (open & FACE_POS_Z) laplacian += pressure[i + strideZ] - center;
+
+					//cells with nothing open aren't solved for
+					float r = open ? rhs[i] - laplacian : 0.0f;
+					residual[i] = r;
+					sliceSum += (double)r * r;
+				}
+			}
+			partials[z] = sliceSum;
+		}
+	});
+
+	double total = 0.0;
+	for (double partial : partials) {
+		total += partial;
+	}
+	return total;
+}
+
+void MultigridSolver::Restrict(const Level& fine, const float* fineValues, Level& coarse, float* coarseValues)
+{
+	const int fineX = fine.resX;
+	const int fineY = fine.resY;
+
+	pool->ParallelFor(0, coarse.resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			for (int y = 0; y < coarse.resY; y++) {
+				for (int x = 0; x < coarse.resX; x++) {
+					int f = GridIndex(x * 2, y * 2, z * 2, fineX, fineY);
+					coarseValues[GridIndex(x, y, z, coarse.resX, coarse.resY)] =
+						RestrictBlock(fineValues + f, x * 2, y * 2, z * 2, fineX, fineY, fine.resZ);
+				}
+			}
+		}
+	});
+}
+
+void MultigridSolver::ProlongAndAdd(const Level& coarse, Level& fine)
+{
+	const float* coarsePressure = coarse.pressure;
+	float* finePressure = fine.pressure;
+
+	//a fine cell center sits a quarter of a coarse cell from its parent's center,
+	//so along each axis it blends 3/4 of the parent with 1/4 of the nearest neighbour
+	auto axisTaps = [](int fine, int coarseRes, int& near, int& far) {
+		int parent = fine / 2;
+		near = parent;
+		far = (fine & 1) ? GetUpperIndex(parent, coarseRes) : GetLowerIndex(parent);
+	};
+
+	pool->ParallelFor(0, fine.resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			int z0, z1;
+			axisTaps(z, coarse.resZ, z0, z1);
+			for (int y = 0; y < fine.resY; y++) {
+				int y0, y1;
+				axisTaps(y, coarse.resY, y0, y1);
+
+				const float* row00 = coarsePressure + GridIndex(0, y0, z0, coarse.resX, coarse.resY);
+				const float* row10 = coarsePressure + GridIndex(0, y1, z0, coarse.resX, coarse.resY);
+				const float* row01 = coarsePressure + GridIndex(0, y0, z1, coarse.resX, coarse.resY);
+				const float* row11 = coarsePressure + GridIndex(0, y1, z1, coarse.resX, coarse.resY);
+				float* out = finePressure + GridIndex(0, y, z, fine.resX, fine.resY);
+
+				for (int x = 0; x < fine.resX; x++) {
+					int x0, x1;
+					axisTaps(x, coarse.resX, x0, x1);
+
+					float near = 0.75f * (0.75f * row00[x0] + 0.25f * row10[x0]) + 0.25f * (0.75f * row01[x0] + 0.25f * row11[x0]);
+					float far = 0.75f * (0.75f * row00[x1] + 0.25f * row10[x1]) + 0.25f * (0.75f * row01[x1] + 0.25f * row11[x1]);
+					out[x] += 0.75f * near + 0.25f * far;
+				}
+			}
+		}
+	});
+}
+
+double MultigridSolver::SumSquares(const float* values, const Level& level)
+{
+	std::vector<double> partials(level.resZ, 0.0);
+	const int sliceSize = level.resX * level.resY;
+	pool->ParallelFor(0, level.resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			double sliceSum = 0.0;
+			for (int i = z * sliceSize; i < (z + 1) * sliceSize; i++) {
+				sliceSum += (double)values[i] * values[i];
+			}
+			partials[z] = sliceSum;
+		}
+	});
+
+	double total = 0.0;
+	for (double partial : partials) {
+		total += partial;
+	}
+	return total;
+}
+
+double MultigridSolver::Sum(const float* values, const Level& level)
+{
+	std::vector<double> partials(level.resZ, 0.0);
+	const int sliceSize = level.resX * level.resY;
+	pool->ParallelFor(0, level.resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			double sliceSum = 0.0;
+			for (int i = z * sliceSize; i < (z + 1) * sliceSize; i++) {
+				sliceSum += values[i];
+			}
+			partials[z] = sliceSum;
+		}
+	});
+
+	double total = 0.0;
+	for (double partial : partials) {
+		total += partial;
+	}
+	return total;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+
+#include "ThreadPool.h"
+
+//cycle shapes the multigrid solver can run
+enum MultigridCycle {
+	MULTIGRID_V_CYCLE,
+	MULTIGRID_F_CYCLE
+};
+
+// Geometric multigrid solver for the pressure equation the
+// fluid sim uses. Levels halve the grid (rounding up, the last
+// cell of an odd axis gets no partner) until it is 4 cells
+// across, smoothing with red-black Gauss-Seidel. Cost per cycle
+// is O(N) and the number of cycles needed stays flat as the grid
+// grows.
+class MultigridSolver
+{
+public:
+	MultigridSolver(int resX, int resY, int resZ, ThreadPool* pool);
+
+	/// <summary>
+	/// Solves sum(neighbours) - 6 * pressure = divergence, the same system
+	/// PressureSolverCS relaxes, with neighbours clamped at the walls.
+	/// pressure holds the starting guess and receives the result. Runs
+	/// cycles until the relative residual drops below tolerance or
+	/// maxCycles is hit, returning the number of cycles used.
+	/// </summary>
+	int Solve(float* pressure, const float* divergence, MultigridCycle cycle, int maxCycles, float tolerance);
+
+	/// <summary>
+	/// Marks cells (a byte per cell, non zero for solid) that are walls inside
+	/// the grid, or clears them with null. Solid neighbours are closed like the
+	/// outer walls, solid cells are left out of the solve and come back as zero.
+	/// A coarse cell is only solid when all 8 of its children are.
+	/// </summary>
+	void SetSolidCells(const unsigned char* solid);
+
+	// Relative residual (|r| / |divergence|) after the last Solve
+	float GetLastResidual() { return lastResidual; }
+	int GetLevelCount() { return (int)levels.size(); }
+
+	int preSmoothSteps = 2;
+	int postSmoothSteps = 2;
+	int coarsestSmoothSteps = 32;
+
+private:
+	struct Level {
+		int resX;
+		int resY;
+		int resZ;
+
+		//level 0 points pressure at the caller's grid
+		float* pressure;
+		std::vector<float> pressureStorage;
+		std::vector<float> rhs;
+		std::vector<float> residual;
+		//non zero for solid cells, empty when the level has none
+		std::vector<unsigned char> solid;
+		//open faces of each cell, see GetOpenFaces
+		std::vector<unsigned char> faces;
+	};
+
+	// Rebuilds a level's face masks from its solid cells
+	void BuildFaces(Level& level);
+
+	void VCycle(int level);
+	void FCycle();
+
+	// Red-black Gauss-Seidel sweeps on a level's pressure
+	void Smooth(Level& level, int iterations);
+
+	// Writes rhs - A * pressure into the level's residual
+	// and returns its sum of squares
+	double ComputeResidual(Level& level);
+
+	// Averages 2x2x2 blocks of a fine grid into the next level,
+	// scaled to account for the coarser cell spacing. Children past
+	// the end of an odd axis count as zero, see RestrictBlock
+	void Restrict(const Level& fine, const float* fineValues, Level& coarse, float* coarseValues);
+
+	// Adds the trilinear interpolation of a coarse level's pressure to the finer level
+	void ProlongAndAdd(const Level& coarse, Level& fine);
+
+	double SumSquares(const float* values, const Level& level);
+	double Sum(const float* values, const Level& level);
+
+	std::vector<Level> levels;
+	ThreadPool* pool;
+	float lastResidual = 0.0f;
+};
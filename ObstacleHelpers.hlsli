@@ -0,0 +1,50 @@
+#ifndef OBSTACLE_HELPER
+#define OBSTACLE_HELPER
+
+#include "FluidSimHelpers.hlsli"
+
+//one bit per cell, packed brick by brick like ObstacleVoxelizer.h,
+//an unbound buffer reads back as zero so nothing is solid
+StructuredBuffer<uint> ObstacleBits : register(t9);
+//velocity of the solid in the cells it covers, in cells per second
+Texture3D<float4> ObstacleVelocityMap : register(t10);
+
+#define OBSTACLE_WORDS_PER_BRICK (GROUP_SIZE * GROUP_SIZE * GROUP_SIZE / 32)
+
+bool IsSolid(int3 cell, int3 gridRes) {
+	if (any(cell < 0) || any(cell >= gridRes)) {
+		return false;
+	}
+
+	int3 bricksPerAxis = (gridRes + GROUP_SIZE - 1) / GROUP_SIZE;
+	int3 brickCoords = cell / GROUP_SIZE;
+	int3 local = cell % GROUP_SIZE;
+	uint brick = (brickCoords.z * bricksPerAxis.y + brickCoords.y) * bricksPerAxis.x + brickCoords.x;
+	uint bit = (local.z * GROUP_SIZE + local.y) * GROUP_SIZE + local.x;
+
+	return (ObstacleBits[brick * OBSTACLE_WORDS_PER_BRICK + (bit >> 5)] >> (bit & 31)) & 1;
+}
+
+//solid neighbours act like the clamped walls and read as the cell itself
+float OpenOrCenter(float value, float center, int3 neighbour, int3 gridRes) {
+	return IsSolid(neighbour, gridRes) ? center : value;
+}
+
+//neighbours that are neither clamped nor solid
+int GetOpenNeighbourCount(int3 cell, int3 gridRes) {
+	int count = 0;
+	[unroll]
+	for (int axis = 0; axis < 3; axis++) {
+		int3 step = int3(axis == 0, axis == 1, axis == 2);
+		count += (cell[axis] > 0 && !IsSolid(cell - step, gridRes)) ? 1 : 0;
+		count += (cell[axis] < gridRes[axis] - 1 && !IsSolid(cell + step, gridRes)) ? 1 : 0;
+	}
+	return count;
+}
+
+//fluid velocity, or the obstacle's if the cell is inside one
+float3 GetCellVelocity(Texture3D<float4> velocityMap, int3 cell, int3 gridRes) {
+	return IsSolid(cell, gridRes) ? ObstacleVelocityMap[cell].xyz : velocityMap[cell].xyz;
+}
+
+#endif
\ No newline at end of file
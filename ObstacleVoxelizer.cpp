@@ -0,0 +1,376 @@
+#include "ObstacleVoxelizer.h"
+#include "FluidSimHelpers.h"
+
+#include <algorithm>
+#include <cmath>
+
+//bits for one brick, (z * BRICK_SIZE + y) * BRICK_SIZE + x
+static int BrickBit(int x, int y, int z)
+{
+	return ((z % BRICK_SIZE) * BRICK_SIZE + y % BRICK_SIZE) * BRICK_SIZE + x % BRICK_SIZE;
+}
+
+//separating axis test between a triangle and a cube, after Akenine-Moller
+static bool TriangleBoxOverlap(const float center[3], float halfSize, const float* a, const float* b, const float* c)
+{
+	//move everything so the box sits at the origin
+	float v[3][3];
+	for (int i = 0; i < 3; i++) {
+		v[0][i] = a[i] - center[i];
+		v[1][i] = b[i] - center[i];
+		v[2][i] = c[i] - center[i];
+	}
+
+	float edges[3][3];
+	for (int i = 0; i < 3; i++) {
+		edges[0][i] = v[1][i] - v[0][i];
+		edges[1][i] = v[2][i] - v[1][i];
+		edges[2][i] = v[0][i] - v[2][i];
+	}
+
+	//box faces, the triangle's bounds against the box
+	for (int axis = 0; axis < 3; axis++) {
+		float low = std::min(v[0][axis], std::min(v[1][axis], v[2][axis]));
+		float high = std::max(v[0][axis], std::max(v[1][axis], v[2][axis]));
+		if (low > halfSize || high < -halfSize) {
+			return false;
+		}
+	}
+
+	//the nine box axis x triangle edge directions
+	for (int e = 0; e < 3; e++) {
+		for (int axis = 0; axis < 3; axis++) {
+			float n[3] = { 0.0f, 0.0f, 0.0f };
+			int a1 = (axis + 1) % 3;
+			int a2 = (axis + 2) % 3;
+			n[a1] = -edges[e][a2];
+			n[a2] = edges[e][a1];
+
+			float low = 0.0f;
+			float high = 0.0f;
+			for (int k = 0; k < 3; k++) {
+				float p = n[0] * v[k][0] + n[1] * v[k][1] + n[2] * v[k][2];
+				low = k == 0 ? p : std::min(low, p);
+				high = k == 0 ? p : std::max(high, p);
+			}
+			float radius = halfSize * (std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]));
+			if (low > radius || high < -radius) {
+				return false;
+			}
+		}
+	}
+
+	//the triangle's plane against the box
+	float normal[3] = {
+		edges[0][1] * edges[1][2] - edges[0][2] * edges[1][1],
+		edges[0][2] * edges[1][0] - edges[0][0] * edges[1][2],
+		edges[0][0] * edges[1][1] - edges[0][1] * edges[1][0]
+	};
+	float distance = normal[0] * v[0][0] + normal[1] * v[0][1] + normal[2] * v[0][2];
+	float radius = halfSize * (std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]));
+	return std::fabs(distance) <= radius;
+}
+
+//where the line along x through (y, z) crosses a triangle. points on a shared
+//edge are given to exactly one of the two triangles so parity stays right
+static bool RowCrossing(const float* a, const float* b, const float* c, double y, double z, double& x)
+{
+	const float* v[3] = { a, b, c };
+	double area = ((double)b[1] - a[1]) * ((double)c[2] - a[2]) - ((double)b[2] - a[2]) * ((double)c[1] - a[1]);
+	if (area == 0.0) {
+		return false;
+	}
+	if (area < 0.0) {
+		std::swap(v[1], v[2]);
+	}
+
+	double weights[3];
+	for (int k = 0; k < 3; k++) {
+		const float* p = v[(k + 1) % 3];
+		const float* q = v[(k + 2) % 3];
+		double dy = (double)q[1] - p[1];
+		double dz = (double)q[2] - p[2];
+		weights[k] = dy * (z - p[2]) - dz * (y - p[1]);
+		if (weights[k] < 0.0) {
+			return false;
+		}
+		if (weights[k] == 0.0 && !(dz < 0.0 || (dz == 0.0 && dy > 0.0))) {
+			return false;
+		}
+	}
+
+	double sum = weights[0] + weights[1] + weights[2];
+	x = (weights[0] * v[0][0] + weights[1] * v[1][0] + weights[2] * v[2][0]) / sum;
+	return true;
+}
+
+ObstacleVoxelizer::ObstacleVoxelizer(int resX, int resY, int resZ, ThreadPool* pool)
+{
+	this->pool = pool;
+	res[0] = resX;
+	res[1] = resY;
+	res[2] = resZ;
+	for (int axis = 0; axis < 3; axis++) {
+		bricks[axis] = (res[axis] + BRICK_SIZE - 1) / BRICK_SIZE;
+	}
+	brickCount = bricks[0] * bricks[1] * bricks[2];
+	cellCount = resX * resY * resZ;
+
+	solidBits.assign(brickCount * OBSTACLE_WORDS_PER_BRICK, 0);
+	for (int axis = 0; axis < 3; axis++) {
+		velocity[axis].assign(cellCount, 0.0f);
+	}
+	brickSolidCount.assign(brickCount, 0);
+	dirtyBricks.assign(brickCount, 0);
+}
+
+void ObstacleVoxelizer::SetObstacle(int id, const float* positions, int vertexCount, const unsigned int* indices, int indexCount, const float velocityAffine[12])
+{
+	auto existing = std::find_if(obstacles.begin(), obstacles.end(), [id](const Obstacle& o) { return o.id == id; });
+	if (existing == obstacles.end()) {
+		obstacles.push_back(Obstacle());
+		existing = obstacles.end() - 1;
+		existing->id = id;
+	}
+	else {
+		MarkBricks(*existing);
+	}
+
+	Obstacle& obstacle = *existing;
+	obstacle.positions.assign(positions, positions + vertexCount * 3);
+	obstacle.indices.assign(indices, indices + indexCount);
+	std::copy(velocityAffine, velocityAffine + 12, obstacle.velocityAffine);
+
+	for (int axis = 0; axis < 3; axis++) {
+		obstacle.boundsMin[axis] = vertexCount > 0 ? positions[axis] : 0.0f;
+		obstacle.boundsMax[axis] = vertexCount > 0 ? positions[axis] : -1.0f;
+	}
+	for (int v = 1; v < vertexCount; v++) {
+		for (int axis = 0; axis < 3; axis++) {
+			obstacle.boundsMin[axis] = std::min(obstacle.boundsMin[axis], positions[v * 3 + axis]);
+			obstacle.boundsMax[axis] = std::max(obstacle.boundsMax[axis], positions[v * 3 + axis]);
+		}
+	}
+
+	MarkBricks(obstacle);
+}
+
+void ObstacleVoxelizer::RemoveObstacle(int id)
+{
+	auto existing = std::find_if(obstacles.begin(), obstacles.end(), [id](const Obstacle& o) { return o.id == id; });
+	if (existing == obstacles.end()) {
+		return;
+	}
+
+	MarkBricks(*existing);
+	obstacles.erase(existing);
+}
+
+void ObstacleVoxelizer::MarkBricks(const Obstacle& obstacle)
+{
+	int low[3];
+	int high[3];
+	for (int axis = 0; axis < 3; axis++) {
+		//cells the bounds touch, then the bricks holding them
+		int first = std::max(0, (int)std::floor(obstacle.boundsMin[axis]));
+		int last = std::min(res[axis] - 1, (int)std::floor(obstacle.boundsMax[axis]));
+		if (obstacle.boundsMax[axis] < 0.0f || first > last) {
+			return;
+		}
+		low[axis] = first / BRICK_SIZE;
+		high[axis] = last / BRICK_SIZE;
+	}
+
+	for (int bz = low[2]; bz <= high[2]; bz++) {
+		for (int by = low[1]; by <= high[1]; by++) {
+			for (int bx = low[0]; bx <= high[0]; bx++) {
+				dirtyBricks[(bz * bricks[1] + by) * bricks[0] + bx] = 1;
+			}
+		}
+	}
+	pendingUpdate = true;
+}
+
+bool ObstacleVoxelizer::Update()
+{
+	pendingUpdate = false;
+	updatedBricks.clear();
+	for (int brick = 0; brick < brickCount; brick++) {
+		if (dirtyBricks[brick]) {
+			updatedBricks.push_back(brick);
+			dirtyBricks[brick] = 0;
+		}
+	}
+	if (updatedBricks.empty()) {
+		return false;
+	}
+
+	pool->ParallelFor(0, (int)updatedBricks.size(), [&](int begin, int end) {
+		std::vector<double> crossings;
+		for (int i = begin; i < end; i++) {
+			VoxelizeBrick(updatedBricks[i], crossings);
+		}
+	});
+
+	solidCellCount = 0;
+	for (int count : brickSolidCount) {
+		solidCellCount += count;
+	}
+	version++;
+	return true;
+}
+
+void ObstacleVoxelizer::VoxelizeBrick(int brick, std::vector<double>& crossings)
+{
+	int begin[3];
+	int end[3];
+	GetBrickBounds(brick, begin, end);
+
+	uint32_t* bits = &solidBits[brick * OBSTACLE_WORDS_PER_BRICK];
+	std::fill(bits, bits + OBSTACLE_WORDS_PER_BRICK, 0u);
+	for (int z = begin[2]; z < end[2]; z++) {
+		for (int y = begin[1]; y < end[1]; y++) {
+			int row = GridIndex(0, y, z, res[0], res[1]);
+			for (int axis = 0; axis < 3; axis++) {
+				std::fill(&velocity[axis][row + begin[0]], &velocity[axis][row + end[0]], 0.0f);
+			}
+		}
+	}
+
+	int solidCount = 0;
+	auto markSolid = [&](const Obstacle& obstacle, int x, int y, int z) {
+		int bit = BrickBit(x, y, z);
+		uint32_t flag = 1u << (bit & 31);
+		if (bits[bit >> 5] & flag) {
+			return;
+		}
+		bits[bit >> 5] |= flag;
+		solidCount++;
+
+		float p[3] = { x + 0.5f, y + 0.5f, z + 0.5f };
+		const float* m = obstacle.velocityAffine;
+		int i = GridIndex(x, y, z, res[0], res[1]);
+		for (int axis = 0; axis < 3; axis++) {
+			velocity[axis][i] = p[0] * m[axis] + p[1] * m[3 + axis] + p[2] * m[6 + axis] + m[9 + axis];
+		}
+	};
+
+	for (const Obstacle& obstacle : obstacles) {
+		bool overlaps = true;
+		for (int axis = 0; axis < 3; axis++) {
+			overlaps = overlaps && obstacle.boundsMax[axis] >= begin[axis] && obstacle.boundsMin[axis] < end[axis];
+		}
+		if (!overlaps) {
+			continue;
+		}
+
+		const float* positions = obstacle.positions.data();
+		const int triangleCount = (int)obstacle.indices.size() / 3;
+
+		//shell, every cell a triangle passes through
+		for (int t = 0; t < triangleCount; t++) {
+			const float* a = positions + obstacle.indices[t * 3] * 3;
+			const float* b = positions + obstacle.indices[t * 3 + 1] * 3;
+			const float* c = positions + obstacle.indices[t * 3 + 2] * 3;
+
+			int low[3];
+			int high[3];
+			bool inside = true;
+			for (int axis = 0; axis < 3; axis++) {
+				float triLow = std::min(a[axis], std::min(b[axis], c[axis]));
+				float triHigh = std::max(a[axis], std::max(b[axis], c[axis]));
+				low[axis] = std::max(begin[axis], (int)std::floor(triLow));
+				high[axis] = std::min(end[axis] - 1, (int)std::floor(triHigh));
+				inside = inside && low[axis] <= high[axis];
+			}
+			if (!inside) {
+				continue;
+			}
+
+			for (int z = low[2]; z <= high[2]; z++) {
+				for (int y = low[1]; y <= high[1]; y++) {
+					for (int x = low[0]; x <= high[0]; x++) {
+						float center[3] = { x + 0.5f, y + 0.5f, z + 0.5f };
+						if (TriangleBoxOverlap(center, 0.5f, a, b, c)) {
+							markSolid(obstacle, x, y, z);
+						}
+					}
+				}
+			}
+		}
+
+		//inside, count crossings along each x row and fill where the count is odd
+		for (int z = begin[2]; z < end[2]; z++) {
+			for (int y = begin[1]; y < end[1]; y++) {
+				double rowY = y + 0.5;
+				double rowZ = z + 0.5;
+				if (rowY < obstacle.boundsMin[1] || rowY > obstacle.boundsMax[1] || rowZ < obstacle.boundsMin[2] || rowZ > obstacle.boundsMax[2]) {
+					continue;
+				}
+
+				crossings.clear();
+				for (int t = 0; t < triangleCount; t++) {
+					double crossing;
+					if (RowCrossing(positions + obstacle.indices[t * 3] * 3, positions + obstacle.indices[t * 3 + 1] * 3,
+						positions + obstacle.indices[t * 3 + 2] * 3, rowY, rowZ, crossing)) {
+						crossings.push_back(crossing);
+					}
+				}
+				if (crossings.size() < 2) {
+					continue;
+				}
+				std::sort(crossings.begin(), crossings.end());
+
+				size_t passed = 0;
+				for (int x = begin[0]; x < end[0]; x++) {
+					double cellX = x + 0.5;
+					while (passed < crossings.size() && crossings[passed] < cellX) {
+						passed++;
+					}
+					if (passed & 1) {
+						markSolid(obstacle, x, y, z);
+					}
+				}
+			}
+		}
+	}
+
+	brickSolidCount[brick] = solidCount;
+}
+
+bool ObstacleVoxelizer::IsSolid(int x, int y, int z) const
+{
+	int brick = ((z / BRICK_SIZE) * bricks[1] + y / BRICK_SIZE) * bricks[0] + x / BRICK_SIZE;
+	int bit = BrickBit(x, y, z);
+	return (solidBits[brick * OBSTACLE_WORDS_PER_BRICK + (bit >> 5)] >> (bit & 31)) & 1;
+}
+
+void ObstacleVoxelizer::CopySolidCells(unsigned char* solid) const
+{
+	const int resX = res[0];
+	const int resY = res[1];
+
+	pool->ParallelFor(0, res[2], [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			for (int y = 0; y < resY; y++) {
+				for (int x = 0; x < resX; x++) {
+					solid[GridIndex(x, y, z, resX, resY)] = IsSolid(x, y, z);
+				}
+			}
+		}
+	});
+}
+
+void ObstacleVoxelizer::GetBrickBounds(int brick, int begin[3], int end[3]) const
+{
+	int coords[3] = {
+		brick % bricks[0],
+		(brick / bricks[0]) % bricks[1],
+		brick / (bricks[0] * bricks[1])
+	};
+
+	for (int axis = 0; axis < 3; axis++) {
+		begin[axis] = coords[axis] * BRICK_SIZE;
+		end[axis] = std::min(begin[axis] + BRICK_SIZE, res[axis]);
+	}
+}
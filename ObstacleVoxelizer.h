@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BrickMask.h"
+#include "ThreadPool.h"
+
+//32 bit words of solid flags per brick
+#define OBSTACLE_WORDS_PER_BRICK (BRICK_SIZE * BRICK_SIZE * BRICK_SIZE / 32)
+
+// Turns triangle meshes into a 1 bit per cell solid grid for the fluid
+// sim, plus the velocity of the solid in every cell it covers. Bits are
+// kept brick by brick (OBSTACLE_WORDS_PER_BRICK words per BRICK_SIZE^3
+// cells, bit (z * 8 + y) * 8 + x inside the brick) so a changed brick is
+// one contiguous range to upload. Moving an obstacle marks the bricks
+// under its old and new bounds and Update only revoxelizes those, spread
+// over the thread pool.
+class ObstacleVoxelizer
+{
+public:
+	ObstacleVoxelizer(int resX, int resY, int resZ, ThreadPool* pool);
+
+	/// <summary>
+	/// Adds an obstacle or replaces the one with the same id. positions are
+	/// xyz triples in grid space (cell x covers [x, x + 1)) and every three
+	/// indices make a triangle. Meshes should be closed so the inside can be
+	/// filled. The solid moves at p * velocityAffine[0..8] + velocityAffine[9..11]
+	/// cells per second for a grid space point p, as a row vector like DirectXMath.
+	/// </summary>
+	void SetObstacle(int id, const float* positions, int vertexCount, const unsigned int* indices, int indexCount, const float velocityAffine[12]);
+	void RemoveObstacle(int id);
+
+	/// <summary>
+	/// Revoxelizes every brick touched since the last call. Returns true
+	/// if anything was redone, those bricks are listed in GetUpdatedBricks.
+	/// </summary>
+	bool Update();
+
+	// True if Update has bricks to redo, nothing it reads back changes until then
+	bool HasPendingUpdate() const { return pendingUpdate; }
+
+	bool IsSolid(int x, int y, int z) const;
+	bool HasObstacles() const { return solidCellCount > 0; }
+	int GetSolidCellCount() const { return solidCellCount; }
+
+	// Expands the bits to a byte per cell in x-fastest order, 1 for solid
+	void CopySolidCells(unsigned char* solid) const;
+
+	const std::vector<uint32_t>& GetSolidBits() const { return solidBits; }
+	const std::vector<int>& GetUpdatedBricks() const { return updatedBricks; }
+	int GetBrickCount() const { return brickCount; }
+	void GetBrickBounds(int brick, int begin[3], int end[3]) const;
+
+	// Solid velocity along one axis for every cell, zero outside obstacles
+	const float* GetVelocity(int axis) const { return velocity[axis].data(); }
+
+	// Bumped every time Update changes the grid
+	unsigned int GetVersion() const { return version; }
+
+private:
+	struct Obstacle {
+		int id;
+		std::vector<float> positions;
+		std::vector<unsigned int> indices;
+		float velocityAffine[12];
+		float boundsMin[3];
+		float boundsMax[3];
+	};
+
+	// Flags the bricks an obstacle's bounds overlap
+	void MarkBricks(const Obstacle& obstacle);
+	void VoxelizeBrick(int brick, std::vector<double>& crossings);
+
+	int res[3];
+	int bricks[3];
+	int brickCount;
+	int cellCount;
+
+	std::vector<Obstacle> obstacles;
+
+	std::vector<uint32_t> solidBits;
+	std::vector<float> velocity[3];
+	std::vector<int> brickSolidCount;
+	std::vector<unsigned char> dirtyBricks;
+	std::vector<int> updatedBricks;
+	bool pendingUpdate = false;
+	int solidCellCount = 0;
+	unsigned int version = 0;
+
+	ThreadPool* pool;
+};
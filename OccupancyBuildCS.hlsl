@@ -0,0 +1,40 @@
+#include "BrickHelpers.hlsli"
+#include "ReductionHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 gridRes;
+	int usePrevious;
+};
+
+RWTexture3D<float2> OccupancyOut : register (u0);
+Texture3D<float4> DensityMap : register (t0);
+Texture3D<float4> PreviousDensityMap : register (t1);
+
+//one group per brick, the brick plus the cell around it that trilinear samples inside reach
+#define HALO_SIZE (BRICK_SIZE + 2)
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 groupID : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+	int3 haloMin = int3(groupID) * BRICK_SIZE - 1;
+	float2 range = float2(1e30f, -1e30f);
+
+	for (uint i = groupIndex; i < HALO_SIZE * HALO_SIZE * HALO_SIZE; i += REDUCTION_THREADS) {
+		int3 cell = haloMin + int3(i % HALO_SIZE, (i / HALO_SIZE) % HALO_SIZE, i / (HALO_SIZE * HALO_SIZE));
+		if (any(cell < 0) || any(cell >= gridRes)) {
+			continue;
+		}
+
+		float density = DensityMap[cell].a;
+		range = float2(min(range.x, density), max(range.y, density));
+		if (usePrevious != 0) {
+			float previous = PreviousDensityMap[cell].a;
+			range = float2(min(range.x, previous), max(range.y, previous));
+		}
+	}
+
+	range = GroupMinMax(range, groupIndex);
+	if (groupIndex == 0) {
+		OccupancyOut[groupID] = range;
+	}
+}
\ No newline at end of file
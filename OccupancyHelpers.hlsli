@@ -0,0 +1,36 @@
+#ifndef OCCUPANCY_HELPER
+#define OCCUPANCY_HELPER
+
+#include "BrickHelpers.hlsli"
+
+//distance along dir from uvw to where the biggest cell around it with max density
+//under threshold ends, 0 if uvw's brick has more than that, see OccupancyPyramid.h
+float GetEmptySpaceDistance(Texture3D<float2> occupancy, float3 uvw, float3 dir, int3 gridRes, int3 bricksPerAxis, int levels, float threshold) {
+	int3 brick = clamp(int3(floor(uvw * gridRes / BRICK_SIZE)), 0, bricksPerAxis - 1);
+
+	//mips line up, so a brick's cell on any level is its coordinates shifted down
+	int emptyLevel = -1;
+	[loop]
+	for (int level = 0; level < levels; level++) {
+		int3 size = max(bricksPerAxis >> level, 1);
+		int3 cell = min(brick >> level, size - 1);
+		if (occupancy.Load(int4(cell, level)).y > threshold) {
+			break;
+		}
+		emptyLevel = level;
+	}
+	if (emptyLevel < 0) {
+		return 0.0f;
+	}
+
+	int3 size = max(bricksPerAxis >> emptyLevel, 1);
+	int3 cell = min(brick >> emptyLevel, size - 1);
+	float3 cellMin = float3((cell << emptyLevel) * BRICK_SIZE) / gridRes;
+	float3 cellMax = (cell == size - 1) ? 1.0f : min(float3(((cell + 1) << emptyLevel) * BRICK_SIZE) / gridRes, 1.0f);
+
+	float3 exits = ((dir > 0.0f ? cellMax : cellMin) - uvw) / dir;
+	exits = (dir == 0.0f) ? 1e30f : exits;
+	return max(min(exits.x, min(exits.y, exits.z)), 0.0f);
+}
+
+#endif
\ No newline at end of file
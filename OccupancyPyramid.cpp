@@ -0,0 +1,152 @@
+#include "OccupancyPyramid.h"
+#include "BrickMask.h"
+#include "FluidSimHelpers.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+void OccupancyPyramid::Build(const float* texels, const float* previousTexels, int resX, int resY, int resZ, ThreadPool* pool)
+{
+	res[0] = resX;
+	res[1] = resY;
+	res[2] = resZ;
+	for (int axis = 0; axis < 3; axis++) {
+		bricks[axis] = (res[axis] + BRICK_SIZE - 1) / BRICK_SIZE;
+	}
+
+	//a full mip chain, down to a single cell
+	int levelCount = 1;
+	while ((std::max(bricks[0], std::max(bricks[1], bricks[2])) >> levelCount) > 0) {
+		levelCount++;
+	}
+	levels.resize(levelCount);
+
+	//each brick plus the cells around it that samples inside it blend with
+	std::vector<float>& brickLevel = levels[0];
+	brickLevel.resize((size_t)bricks[0] * bricks[1] * bricks[2] * 2);
+	pool->ParallelFor(0, bricks[2], [&](int zBegin, int zEnd) {
+		for (int bz = zBegin; bz < zEnd; bz++) {
+			for (int by = 0; by < bricks[1]; by++) {
+				for (int bx = 0; bx < bricks[0]; bx++) {
+					int brick[3] = { bx, by, bz };
+					int begin[3];
+					int end[3];
+					for (int axis = 0; axis < 3; axis++) {
+						begin[axis] = std::max(brick[axis] * BRICK_SIZE - 1, 0);
+						end[axis] = std::min((brick[axis] + 1) * BRICK_SIZE + 1, res[axis]);
+					}
+
+					float minValue = FLT_MAX;
+					float maxValue = -FLT_MAX;
+					for (int z = begin[2]; z < end[2]; z++) {
+						for (int y = begin[1]; y < end[1]; y++) {
+							for (int x = begin[0]; x < end[0]; x++) {
+								size_t i = (size_t)GridIndex(x, y, z, resX, resY) * 4 + 3;
+								minValue = std::min(minValue, texels[i]);
+								maxValue = std::max(maxValue, texels[i]);
+								if (previousTexels) {
+									minValue = std::min(minValue, previousTexels[i]);
+									maxValue = std::max(maxValue, previousTexels[i]);
+								}
+							}
+						}
+					}
+
+					size_t cell = (size_t)GridIndex(bx, by, bz, bricks[0], bricks[1]) * 2;
+					brickLevel[cell] = minValue;
+					brickLevel[cell + 1] = maxValue;
+				}
+			}
+		}
+	});
+
+	//every coarser level from the one below, small enough to not need the pool
+	for (int level = 1; level < levelCount; level++) {
+		int fine[3];
+		int coarse[3];
+		GetLevelSize(level - 1, fine);
+		GetLevelSize(level, coarse);
+		const std::vector<float>& fineLevel = levels[level - 1];
+		std::vector<float>& coarseLevel = levels[level];
+		coarseLevel.resize((size_t)coarse[0] * coarse[1] * coarse[2] * 2);
+
+		for (int cz = 0; cz < coarse[2]; cz++) {
+			for (int cy = 0; cy < coarse[1]; cy++) {
+				for (int cx = 0; cx < coarse[0]; cx++) {
+					//children 2c and 2c + 1, the last cell on an axis also takes the odd one out
+					int cell[3] = { cx, cy, cz };
+					int first[3];
+					int last[3];
+					for (int axis = 0; axis < 3; axis++) {
+						first[axis] = cell[axis] * 2;
+						last[axis] = cell[axis] == coarse[axis] - 1 ? fine[axis] - 1 : first[axis] + 1;
+					}
+
+					float minValue = FLT_MAX;
+					float maxValue = -FLT_MAX;
+					for (int z = first[2]; z <= last[2]; z++) {
+						for (int y = first[1]; y <= last[1]; y++) {
+							for (int x = first[0]; x <= last[0]; x++) {
+								size_t child = (size_t)GridIndex(x, y, z, fine[0], fine[1]) * 2;
+								minValue = std::min(minValue, fineLevel[child]);
+								maxValue = std::max(maxValue, fineLevel[child + 1]);
+							}
+						}
+					}
+
+					size_t index = (size_t)GridIndex(cx, cy, cz, coarse[0], coarse[1]) * 2;
+					coarseLevel[index] = minValue;
+					coarseLevel[index + 1] = maxValue;
+				}
+			}
+		}
+	}
+}
+
+void OccupancyPyramid::GetLevelSize(int level, int size[3])
+{
+	for (int axis = 0; axis < 3; axis++) {
+		size[axis] = std::max(bricks[axis] >> level, 1);
+	}
+}
+
+float OccupancyPyramid::GetEmptyDistance(const float uvw[3], const float dir[3], float threshold)
+{
+	int brick[3];
+	for (int axis = 0; axis < 3; axis++) {
+		brick[axis] = std::min(std::max((int)std::floor(uvw[axis] * res[axis] / BRICK_SIZE), 0), bricks[axis] - 1);
+	}
+
+	//climb while the cell around uvw is still empty, the mips line up so a
+	//brick's cell on any level is just its coordinates shifted down
+	int emptyLevel = -1;
+	int size[3];
+	int cell[3];
+	for (int level = 0; level < (int)levels.size(); level++) {
+		GetLevelSize(level, size);
+		for (int axis = 0; axis < 3; axis++) {
+			cell[axis] = std::min(brick[axis] >> level, size[axis] - 1);
+		}
+		if (levels[level][(size_t)GridIndex(cell[0], cell[1], cell[2], size[0], size[1]) * 2 + 1] > threshold) {
+			break;
+		}
+		emptyLevel = level;
+	}
+	if (emptyLevel < 0) {
+		return 0.0f;
+	}
+
+	GetLevelSize(emptyLevel, size);
+	float exit = FLT_MAX;
+	for (int axis = 0; axis < 3; axis++) {
+		if (dir[axis] == 0.0f) {
+			continue;
+		}
+		int c = std::min(brick[axis] >> emptyLevel, size[axis] - 1);
+		float cellMin = (float)((c << emptyLevel) * BRICK_SIZE) / res[axis];
+		float cellMax = c == size[axis] - 1 ? 1.0f : std::min((float)(((c + 1) << emptyLevel) * BRICK_SIZE) / res[axis], 1.0f);
+		exit = std::min(exit, ((dir[axis] > 0.0f ? cellMax : cellMin) - uvw[axis]) / dir[axis]);
+	}
+	return std::max(exit, 0.0f);
+}
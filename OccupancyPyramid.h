@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Min and max density over every brick of a volume and over blocks of
+// bricks twice as big per level, for raymarchers to leap over empty space.
+// A brick's range takes in the one cell border trilinear filtering reads
+// across, so nothing a sample inside it can see is missed. Level sizes
+// halve rounding down like texture mips, with the last cell along an axis
+// also covering the child that rounding left out. OccupancyBuildCS and
+// OccupancyReduceCS build the same thing on the gpu.
+class OccupancyPyramid
+{
+public:
+	/// <summary>
+	/// Rebuilds from the alpha of float4 texels (x fastest). With previous
+	/// texels the ranges cover both, for renders that blend between them.
+	/// </summary>
+	void Build(const float* texels, const float* previousTexels, int resX, int resY, int resZ, ThreadPool* pool);
+
+	int GetLevelCount() { return (int)levels.size(); }
+	// Cells per axis of a level
+	void GetLevelSize(int level, int size[3]);
+	// min and max pairs, x fastest
+	const std::vector<float>& GetLevel(int level) { return levels[level]; }
+
+	/// <summary>
+	/// Distance along dir from uvw (both in the volume's 0 to 1 texture space)
+	/// to where the biggest cell around uvw with max density under threshold
+	/// ends, 0 if the brick at uvw has more than that in it
+	/// </summary>
+	float GetEmptyDistance(const float uvw[3], const float dir[3], float threshold);
+
+private:
+	int res[3] = { 0, 0, 0 };
+	int bricks[3] = { 0, 0, 0 };
+	std::vector<std::vector<float>> levels;
+};
@@ -0,0 +1,35 @@
+#include "FluidSimHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 fineSize;
+	int3 coarseSize;
+};
+
+RWTexture3D<float2> CoarseOut : register (u0);
+Texture3D<float2> FineOccupancy : register (t0);
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	int3 cell = DTid;
+	if (any(cell >= coarseSize)) {
+		return;
+	}
+
+	//children 2c and 2c + 1, the last cell on an axis also takes the
+	//odd one out that rounding the mip size down left behind
+	int3 first = cell * 2;
+	int3 last = (cell == coarseSize - 1) ? fineSize - 1 : first + 1;
+
+	float2 range = float2(1e30f, -1e30f);
+	for (int z = first.z; z <= last.z; z++) {
+		for (int y = first.y; y <= last.y; y++) {
+			for (int x = first.x; x <= last.x; x++) {
+				float2 child = FineOccupancy[int3(x, y, z)];
+				range = float2(min(range.x, child.x), max(range.y, child.y));
+			}
+		}
+	}
+
+	CoarseOut[cell] = range;
+}
\ No newline at end of file
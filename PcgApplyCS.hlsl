@@ -0,0 +1,45 @@
+#include "ObstacleHelpers.hlsli"
+#include "ReductionHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 gridRes;
+};
+
+RWTexture3D<float> ProductOut : register (u0);
+RWStructuredBuffer<float4> GroupSums : register (u1);
+Texture3D<float4> DirectionMap : register (t0);
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+	int3 coords = DTid;
+
+	float left = DirectionMap[GetLeftIndex(coords)].x;
+	float right = DirectionMap[GetRightIndex(coords, gridRes)].x;
+	float bottom = DirectionMap[GetBottomIndex(coords)].x;
+	float top = DirectionMap[GetTopIndex(coords, gridRes)].x;
+	float back = DirectionMap[GetBackIndex(coords)].x;
+	float front = DirectionMap[GetFrontIndex(coords, gridRes)].x;
+	float center = DirectionMap[coords].x;
+
+	left = OpenOrCenter(left, center, coords - int3(1, 0, 0), gridRes);
+	right = OpenOrCenter(right, center, coords + int3(1, 0, 0), gridRes);
+	bottom = OpenOrCenter(bottom, center, coords - int3(0, 1, 0), gridRes);
+	top = OpenOrCenter(top, center, coords + int3(0, 1, 0), gridRes);
+	back = OpenOrCenter(back, center, coords - int3(0, 0, 1), gridRes);
+	front = OpenOrCenter(front, center, coords + int3(0, 0, 1), gridRes);
+
+	//q = A * d with the negated pressure matrix
+	float product = 6.0f * center - (left + right + bottom + top + back + front);
+
+	if (any(DTid >= (uint3)gridRes) || IsSolid(coords, gridRes)) {
+		product = 0;
+	}
+
+	ProductOut[DTid] = product;
+
+	float4 sums = GroupSum(float4(center * product, 0, 0, 0), groupIndex);
+	if (groupIndex == 0) {
+		GroupSums[GroupSumIndex(groupID, gridRes)] = sums;
+	}
+}
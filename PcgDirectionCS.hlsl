@@ -0,0 +1,22 @@
+#include "ObstacleHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 gridRes;
+	int rzSlot; //dot(r, z) before the update
+	int rzNewSlot; //dot(r, z) after the update
+};
+
+RWTexture3D<float> Direction : register (u0);
+RWStructuredBuffer<float4> Scalars : register (u1);
+Texture3D<float4> ResidualMap : register (t0);
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	float rz = Scalars[rzSlot].x;
+	float beta = rz > 0 ? Scalars[rzNewSlot].x / rz : 0;
+
+	//d = z + beta * d, z is recomputed from the residual
+	float preconditioned = ResidualMap[DTid].x / max(GetOpenNeighbourCount(DTid, gridRes), 1);
+	Direction[DTid] = preconditioned + beta * Direction[DTid];
+}
@@ -0,0 +1,50 @@
+#include "ObstacleHelpers.hlsli"
+#include "ReductionHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 gridRes;
+};
+
+RWTexture3D<float> ResidualOut : register (u0);
+RWStructuredBuffer<float4> GroupSums : register (u1);
+Texture3D<float4> VelocityDivergenceMap : register (t0);
+Texture3D<float4> PressureMap : register (t1);
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+	int3 coords = DTid;
+
+	float left = PressureMap[GetLeftIndex(coords)].x;
+	float right = PressureMap[GetRightIndex(coords, gridRes)].x;
+	float bottom = PressureMap[GetBottomIndex(coords)].x;
+	float top = PressureMap[GetTopIndex(coords, gridRes)].x;
+	float back = PressureMap[GetBackIndex(coords)].x;
+	float front = PressureMap[GetFrontIndex(coords, gridRes)].x;
+	float center = PressureMap[coords].x;
+
+	left = OpenOrCenter(left, center, coords - int3(1, 0, 0), gridRes);
+	right = OpenOrCenter(right, center, coords + int3(1, 0, 0), gridRes);
+	bottom = OpenOrCenter(bottom, center, coords - int3(0, 1, 0), gridRes);
+	top = OpenOrCenter(top, center, coords + int3(0, 1, 0), gridRes);
+	back = OpenOrCenter(back, center, coords - int3(0, 0, 1), gridRes);
+	front = OpenOrCenter(front, center, coords + int3(0, 0, 1), gridRes);
+
+	//cg solves the negated system so the matrix is positive definite,
+	//r = -divergence - (6 * center - neighbours)
+	float divergence = VelocityDivergenceMap[coords].x;
+	float residual = (left + right + bottom + top + back + front - 6.0f * center) - divergence;
+
+	if (any(DTid >= (uint3)gridRes) || IsSolid(coords, gridRes)) {
+		residual = 0;
+		divergence = 0;
+	}
+
+	ResidualOut[DTid] = residual;
+
+	//residual sum to take out its mean, divergence sums for the relative residual
+	float4 sums = GroupSum(float4(residual, divergence, divergence * divergence, 0), groupIndex);
+	if (groupIndex == 0) {
+		GroupSums[GroupSumIndex(groupID, gridRes)] = sums;
+	}
+}
@@ -0,0 +1,38 @@
+#include "ObstacleHelpers.hlsli"
+#include "ReductionHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 gridRes;
+	float fluidCellCount; //cells outside obstacles
+};
+
+RWTexture3D<float> Residual : register (u0);
+RWTexture3D<float> DirectionOut : register (u1);
+RWStructuredBuffer<float4> GroupSums : register (u2);
+RWStructuredBuffer<float4> Scalars : register (u3);
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+	bool inside = all(DTid < (uint3)gridRes) && !IsSolid(DTid, gridRes);
+
+	//walls on every side mean only a zero sum residual can be solved
+	float residual = Residual[DTid] - Scalars[0].x / fluidCellCount;
+
+	//jacobi preconditioner, divide by the diagonal
+	float preconditioned = residual / max(GetOpenNeighbourCount(DTid, gridRes), 1);
+
+	if (inside) {
+		Residual[DTid] = residual;
+		DirectionOut[DTid] = preconditioned;
+	}
+	else {
+		residual = 0;
+		preconditioned = 0;
+	}
+
+	float4 sums = GroupSum(float4(residual * preconditioned, residual * residual, 0, 0), groupIndex);
+	if (groupIndex == 0) {
+		GroupSums[GroupSumIndex(groupID, gridRes)] = sums;
+	}
+}
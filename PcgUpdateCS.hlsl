@@ -0,0 +1,39 @@
+#include "ObstacleHelpers.hlsli"
+#include "ReductionHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 gridRes;
+	int rzSlot; //scalar slot holding dot(r, z) from the last iteration
+};
+
+RWTexture3D<float> Pressure : register (u0);
+RWTexture3D<float> Residual : register (u1);
+RWStructuredBuffer<float4> GroupSums : register (u2);
+RWStructuredBuffer<float4> Scalars : register (u3);
+Texture3D<float4> DirectionMap : register (t0);
+Texture3D<float4> ProductMap : register (t1);
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+	//slot 2 holds dot(d, A * d)
+	float dq = Scalars[2].x;
+	float alpha = dq > 0 ? Scalars[rzSlot].x / dq : 0;
+
+	float residual = Residual[DTid] - alpha * ProductMap[DTid].x;
+	float preconditioned = residual / max(GetOpenNeighbourCount(DTid, gridRes), 1);
+
+	if (all(DTid < (uint3)gridRes)) {
+		Pressure[DTid] = Pressure[DTid] + alpha * DirectionMap[DTid].x;
+		Residual[DTid] = residual;
+	}
+	else {
+		residual = 0;
+		preconditioned = 0;
+	}
+
+	float4 sums = GroupSum(float4(residual * preconditioned, residual * residual, 0, 0), groupIndex);
+	if (groupIndex == 0) {
+		GroupSums[GroupSumIndex(groupID, gridRes)] = sums;
+	}
+}
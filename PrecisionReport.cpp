@@ -0,0 +1,111 @@
+#include "PrecisionReport.h"
+
+#include <chrono>
+#include <cmath>
+
+struct PrecisionPreset {
+	const char* name;
+	FieldPrecision velocity;
+	FieldPrecision density;
+	FieldPrecision temperature;
+	FieldPrecision pressure;
+};
+
+//the reference has to come first, everything else is compared against it
+static const PrecisionPreset PRESETS[] = {
+	{ "All FP32", FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT32 },
+	{ "FP16 Velocity", FIELD_PRECISION_FLOAT16, FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT32 },
+	{ "FP16 Density", FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT16, FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT32 },
+	{ "FP16 Temperature", FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT16, FIELD_PRECISION_FLOAT32 },
+	{ "FP16 Pressure", FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT32, FIELD_PRECISION_FLOAT16 },
+	{ "All FP16", FIELD_PRECISION_FLOAT16, FIELD_PRECISION_FLOAT16, FIELD_PRECISION_FLOAT16, FIELD_PRECISION_FLOAT16 }
+};
+
+int GetFieldBytesPerCell(const FieldPrecisionPolicy& policy)
+{
+	//4 channel velocity and density, 1 channel temperature and pressure, 2 copies of each
+	int velocity = policy.velocity == FIELD_PRECISION_FLOAT16 ? 8 : 16;
+	int density = policy.density == FIELD_PRECISION_FLOAT16 ? 8 : 16;
+	int temperature = policy.temperature == FIELD_PRECISION_FLOAT16 ? 2 : 4;
+	int pressure = policy.pressure == FIELD_PRECISION_FLOAT16 ? 2 : 4;
+	return 2 * (velocity + density + temperature + pressure);
+}
+
+std::vector<PrecisionReportRow> RunPrecisionReport(int resX, int resY, int resZ, int steps, const FluidSimSettings& settings)
+{
+	std::vector<PrecisionReportRow> rows;
+	std::vector<float> referenceDensity;
+	std::vector<float> referenceVelocity[3];
+	double referenceDensityRms = 0.0;
+	double referenceVelocityRms = 0.0;
+
+	for (const PrecisionPreset& preset : PRESETS) {
+		PrecisionReportRow row = {};
+		row.name = preset.name;
+		row.policy.velocity = preset.velocity;
+		row.policy.density = preset.density;
+		row.policy.temperature = preset.temperature;
+		row.policy.pressure = preset.pressure;
+		row.bytesPerCell = GetFieldBytesPerCell(row.policy);
+
+		FluidSolverCPU solver(resX, resY, resZ);
+		*solver.GetSettings() = settings;
+		solver.GetSettings()->precision = row.policy;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int step = 0; step < steps; step++) {
+			solver.Simulate();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		row.cpuMsPerStep = std::chrono::duration<float, std::milli>(end - start).count() / (steps > 0 ? steps : 1);
+
+		const std::vector<float>& density = solver.GetChannel(DENSITY);
+		const std::vector<float>* velocity[3] = {
+			&solver.GetChannel(VELOCITY_X),
+			&solver.GetChannel(VELOCITY_Y),
+			&solver.GetChannel(VELOCITY_Z)
+		};
+		const size_t cellCount = density.size();
+
+		if (rows.empty()) {
+			referenceDensity = density;
+			for (int axis = 0; axis < 3; axis++) {
+				referenceVelocity[axis] = *velocity[axis];
+			}
+
+			for (size_t i = 0; i < cellCount; i++) {
+				referenceDensityRms += (double)density[i] * density[i];
+				for (int axis = 0; axis < 3; axis++) {
+					referenceVelocityRms += (double)(*velocity[axis])[i] * (*velocity[axis])[i];
+				}
+			}
+			referenceDensityRms = std::sqrt(referenceDensityRms / cellCount);
+			referenceVelocityRms = std::sqrt(referenceVelocityRms / cellCount);
+		}
+
+		double densityError = 0.0;
+		double velocityError = 0.0;
+		float densityMax = 0.0f;
+		bool finite = true;
+		for (size_t i = 0; i < cellCount; i++) {
+			float d = density[i] - referenceDensity[i];
+			densityError += (double)d * d;
+			densityMax = std::fmax(densityMax, std::fabs(d));
+			finite = finite && std::isfinite(density[i]);
+
+			for (int axis = 0; axis < 3; axis++) {
+				float v = (*velocity[axis])[i] - referenceVelocity[axis][i];
+				velocityError += (double)v * v;
+				finite = finite && std::isfinite((*velocity[axis])[i]);
+			}
+		}
+
+		row.densityRmsError = referenceDensityRms > 0.0 ? (float)(std::sqrt(densityError / cellCount) / referenceDensityRms) : 0.0f;
+		row.densityMaxError = densityMax;
+		row.velocityRmsError = referenceVelocityRms > 0.0 ? (float)(std::sqrt(velocityError / cellCount) / referenceVelocityRms) : 0.0f;
+		row.finite = finite;
+		rows.push_back(row);
+	}
+
+	return rows;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+
+#include "FluidSolverCPU.h"
+
+//one precision setup measured against the full float reference
+struct PrecisionReportRow {
+	const char* name;
+	FieldPrecisionPolicy policy;
+	//gpu storage of the ping-ponged velocity, density, temperature and pressure textures
+	int bytesPerCell;
+	//cpu backend step time, includes the cost of rounding to half
+	float cpuMsPerStep;
+	//rms errors are relative to the reference field's rms, max is absolute
+	float densityRmsError;
+	float densityMaxError;
+	float velocityRmsError;
+	//nothing blew up to nan or inf
+	bool finite;
+};
+
+// GPU bytes per cell the policy needs for the simulated fields
+int GetFieldBytesPerCell(const FieldPrecisionPolicy& policy);
+
+/// <summary>
+/// Runs the same scene once per precision preset on the CPU backend, full
+/// float first as the reference, and reports the error each preset builds
+/// up over the steps alongside its step time and memory footprint.
+/// </summary>
+std::vector<PrecisionReportRow> RunPrecisionReport(int resX, int resY, int resZ, int steps, const FluidSimSettings& settings);
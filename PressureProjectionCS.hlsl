@@ -1,9 +1,12 @@
-#include "FluidSimHelpers.hlsli"
+#include "BrickHelpers.hlsli"
+#include "ObstacleHelpers.hlsli"
 
 cbuffer ExternalData : register(b0) {
 	float deltaTime;
-	float invFluidSimGridRes; //(1/windowWidth, 1/windowHeigh)
-	int gridRes;
+	float3 invFluidSimGridRes; //(1/windowWidth, 1/windowHeigh)
+	int3 gridRes;
+	int sparseBricks;
+	int3 bricksPerAxis;
 };
 
 RWTexture3D<float4> UavOutputMap : register (u0);
@@ -13,8 +16,10 @@ Texture3D<float4> PressureMap : register(t1);
 //SamplerState PointSampler : register(s0);
 
 [numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
-void main( uint3 DTid : SV_DispatchThreadID )
+void main(uint3 dispatchID : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
+	uint3 DTid = GetSimCellIndex(dispatchID, groupID, groupThreadID, sparseBricks, bricksPerAxis);
+
 	//float3 coords = (float3(DTid)+0.5f) * invFluidSimGridRes;
 
 	int3 coords = DTid;
@@ -28,10 +33,40 @@ void main( uint3 DTid : SV_DispatchThreadID )
 	float pBack = PressureMap[GetBackIndex(coords)].r;
 	float pFront = PressureMap[GetFrontIndex(coords, gridRes)].r;
 
+	float pCenter = PressureMap[coords].r;
+
+	//solid neighbours read as this cell's pressure
+	int3 lower = int3(GetLeftIndex(coords).x, GetBottomIndex(coords).y, GetBackIndex(coords).z);
+	int3 upper = int3(GetRightIndex(coords, gridRes).x, GetTopIndex(coords, gridRes).y, GetFrontIndex(coords, gridRes).z);
+	bool3 lowerSolid = bool3(IsSolid(int3(lower.x, coords.yz), gridRes), IsSolid(int3(coords.x, lower.y, coords.z), gridRes), IsSolid(int3(coords.xy, lower.z), gridRes));
+	bool3 upperSolid = bool3(IsSolid(int3(upper.x, coords.yz), gridRes), IsSolid(int3(coords.x, upper.y, coords.z), gridRes), IsSolid(int3(coords.xy, upper.z), gridRes));
+	pLeft = lowerSolid.x ? pCenter : pLeft;
+	pBottom = lowerSolid.y ? pCenter : pBottom;
+	pBack = lowerSolid.z ? pCenter : pBack;
+	pRight = upperSolid.x ? pCenter : pRight;
+	pTop = upperSolid.y ? pCenter : pTop;
+	pFront = upperSolid.z ? pCenter : pFront;
+
 	float3 gradP = 0.5 * float3(pRight - pLeft, pTop - pBottom, pFront - pBack);
 	// Project the velocity onto its divergence-free component by    
 	// subtracting the gradient of pressure.    
 	float3 vOld = VelocityMap[DTid];// VelocityMap.SampleLevel(PointSampler, coords, 0.0f);
 	float3 vNew = vOld - gradP;
+
+	//the velocity into a solid neighbour is whatever the solid is doing, same as FluidSolverCPU
+	[unroll]
+	for (int axis = 0; axis < 3; axis++) {
+		int3 step = int3(axis == 0, axis == 1, axis == 2);
+		if (upperSolid[axis]) {
+			vNew[axis] = ObstacleVelocityMap[coords + step * (upper[axis] - coords[axis])][axis];
+		}
+		else if (lowerSolid[axis]) {
+			vNew[axis] = ObstacleVelocityMap[coords - step * (coords[axis] - lower[axis])][axis];
+		}
+	}
+
+	if (IsSolid(coords, gridRes)) {
+		vNew = ObstacleVelocityMap[coords].xyz;
+	}
 	UavOutputMap[DTid] = float4(vNew, 1);
 }
@@ -1,11 +1,13 @@
-#include "FluidSimHelpers.hlsli"
+#include "ObstacleHelpers.hlsli"
 
 // Defines the input to this compute shader
 // used to handle globabl variables
 cbuffer ExternalData : register(b0) {
 	float deltaTime;
-	float invFluidSimGridRes; //(1/windowWidth, 1/windowHeigh)
-	int gridRes;
+	float3 invFluidSimGridRes; //(1/windowWidth, 1/windowHeigh)
+	int3 gridRes;
+	float jacobiWeight; //1 for plain jacobi, lower to damp it as a multigrid smoother
+	int useObstacles; //only the finest level matches the obstacle grid
 };
 
 RWTexture3D<float4> UavOutputMap : register (u0);
@@ -67,12 +69,23 @@ void main(uint3 DTid : SV_DispatchThreadID, uint3 GRTid : SV_GroupThreadID)
 	float front = PressureMap[GetFrontIndex(coords, gridRes)].x;
 	float center = PressureMap[coords].x;
 
-	//repeat for obstacle
-	//then if adjacent cells are obstacles
-	//set that value to be center
+	//adjacent obstacles act like the walls and read as the center
+	if (useObstacles != 0) {
+		left = OpenOrCenter(left, center, coords - int3(1, 0, 0), gridRes);
+		right = OpenOrCenter(right, center, coords + int3(1, 0, 0), gridRes);
+		bottom = OpenOrCenter(bottom, center, coords - int3(0, 1, 0), gridRes);
+		top = OpenOrCenter(top, center, coords + int3(0, 1, 0), gridRes);
+		back = OpenOrCenter(back, center, coords - int3(0, 0, 1), gridRes);
+		front = OpenOrCenter(front, center, coords + int3(0, 0, 1), gridRes);
+	}
 
 	float velocityDivergence = VelocityDivergenceMap[coords].x;
 
-	UavOutputMap[DTid] = (left + right + bottom + top + back + front - velocityDivergence) / 6.0f;
+	float newPressure = (left + right + bottom + top + back + front - velocityDivergence) / 6.0f;
+	newPressure = lerp(center, newPressure, jacobiWeight);
+	if (useObstacles != 0 && IsSolid(coords, gridRes)) {
+		newPressure = 0;
+	}
+	UavOutputMap[DTid] = newPressure;
 	//UavOutputMap[DTid] = velocityDivergence;
 }
\ No newline at end of file
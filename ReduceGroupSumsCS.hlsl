@@ -0,0 +1,25 @@
+#include "ReductionHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int partialCount;
+	int outputSlot;
+};
+
+RWStructuredBuffer<float4> GroupSums : register (u0);
+RWStructuredBuffer<float4> Scalars : register (u1);
+
+//a single group adds up every partial sum so the scalars
+//never have to leave the gpu between iterations
+[numthreads(REDUCTION_THREADS, 1, 1)]
+void main(uint groupIndex : SV_GroupIndex)
+{
+	float4 value = 0;
+	for (int i = groupIndex; i < partialCount; i += REDUCTION_THREADS) {
+		value += GroupSums[i];
+	}
+
+	float4 total = GroupSum(value, groupIndex);
+	if (groupIndex == 0) {
+		Scalars[outputSlot] = total;
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef REDUCTION_HELPER
+#define REDUCTION_HELPER
+
+#include "FluidSimHelpers.hlsli"
+
+#define REDUCTION_THREADS (GROUP_SIZE * GROUP_SIZE * GROUP_SIZE)
+
+groupshared float4 reductionLDS[REDUCTION_THREADS];
+
+//adds value up over the whole thread group, every thread gets the total
+//has to be reached by every thread in the group
+float4 GroupSum(float4 value, uint groupIndex) {
+	reductionLDS[groupIndex] = value;
+	GroupMemoryBarrierWithGroupSync();
+
+	[unroll]
+	for (uint stride = REDUCTION_THREADS / 2; stride > 0; stride >>= 1) {
+		if (groupIndex < stride) {
+			reductionLDS[groupIndex] += reductionLDS[groupIndex + stride];
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	return reductionLDS[0];
+}
+
+//min of x and max of y over the whole thread group, every thread gets both
+//has to be reached by every thread in the group
+float2 GroupMinMax(float2 value, uint groupIndex) {
+	reductionLDS[groupIndex] = float4(value, 0, 0);
+	GroupMemoryBarrierWithGroupSync();
+
+	[unroll]
+	for (uint stride = REDUCTION_THREADS / 2; stride > 0; stride >>= 1) {
+		if (groupIndex < stride) {
+			reductionLDS[groupIndex].x = min(reductionLDS[groupIndex].x, reductionLDS[groupIndex + stride].x);
+			reductionLDS[groupIndex].y = max(reductionLDS[groupIndex].y, reductionLDS[groupIndex + stride].y);
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	return reductionLDS[0].xy;
+}
+
+//where a group stores its partial sum, one slot per group of the grid
+uint GroupSumIndex(uint3 groupID, int3 gridSize) {
+	uint3 groupsPerAxis = (gridSize + GROUP_SIZE - 1) / GROUP_SIZE;
+	return (groupID.z * groupsPerAxis.y + groupID.y) * groupsPerAxis.x + groupID.x;
+}
+
+#endif
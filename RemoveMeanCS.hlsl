@@ -0,0 +1,16 @@
+#include "FluidSimHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 gridRes;
+	int sumSlot; //scalar slot holding the volume's sum in x
+};
+
+RWTexture3D<float> Volume : register (u0);
+RWStructuredBuffer<float4> Scalars : register (u1);
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	float cellCount = GetCellCount(gridRes);
+	Volume[DTid] = Volume[DTid] - Scalars[sumSlot].x / cellCount;
+}
@@ -1,5 +1,6 @@
 #include "Renderer.h"
 #include "Helpers.h"
+#include "CounterRandom.h"
 
 #include "ImGui/imgui.h"
 #include "ImGui/imgui_impl_dx11.h"
@@ -8,7 +9,7 @@
 using namespace DirectX;
 
 // Helper macro for getting a float between min and max
-#define RandomRange(min, max) (float)rand() / RAND_MAX * (max - min) + min
+#define RandomRange(min, max) random.Range(min, max)
 
 //currently just sets up needed variables.
 //in the future it could setup shadow mapping or similar things
@@ -33,6 +34,9 @@ Renderer::Renderer(
 	//call post resize since it recreates render targets
 	this->PostResize(backBufferRTV, depthBufferDSV, windowWidth, windowHeight);
 
+	//the kernel only has to be spread out, so it's the same every run
+	CounterRandom random;
+
 	//create random 4x4 texture
 	const int textureSize = 4;
 	const int totalPixels = textureSize * textureSize;
@@ -71,9 +75,9 @@ Renderer::Renderer(
 	//create array of offsets ssao will use
 	for (int i = 0; i < numOffsets; i++) {
 		ssaoOffsets[i] = XMFLOAT4(
-			(float)rand() / RAND_MAX * 2 - 1, //gets range -1 to 1
-			(float)rand() / RAND_MAX * 2 - 1,
-			(float)rand() / RAND_MAX, //range 0 to 1
+			RandomRange(-1, 1),
+			RandomRange(-1, 1),
+			RandomRange(0, 1),
 			0);
 
 		XMVECTOR offset = XMVector3Normalize(XMLoadFloat4(&ssaoOffsets[i]));
@@ -271,7 +275,7 @@ void Renderer::RenderScene(
 
 	//render the fluid field
 	//after skybox but before post processes
-	fluid->RenderFluid(camera);
+	fluid->RenderFluid(camera, mSRVs[RenderTargetType::SCENE_DEPTH]);
 
 	//ID3D11RenderTargetView* nullViews[4] = {};
 
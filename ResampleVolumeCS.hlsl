@@ -0,0 +1,19 @@
+#include "FluidSimHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	float4 valueScale; //per channel, velocity is in cells so it stretches with its axis
+	int3 gridRes; //size of the new grid
+};
+
+RWTexture3D<float4> UavOutputMap : register (u0);
+Texture3D<float4> InputMap : register (t0);
+
+SamplerState LinearClampSampler : register(s0);
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	//uvw is the same point in both grids, so the sampler does the trilinear resample
+	float3 posUVW = PixelIndexToUVW(float3(DTid), gridRes);
+	UavOutputMap[DTid] = valueScale * InputMap.SampleLevel(LinearClampSampler, posUVW, 0.0f);
+}
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "SharedMemory.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SharedMemory::~SharedMemory()
+{
+	Close();
+}
+
+bool SharedMemory::Create(const std::string& name, size_t size)
+{
+	Close();
+	if (size == 0) {
+		return false;
+	}
+
+#ifdef _WIN32
+	//backed by the page file, the os zeroes it
+	HANDLE handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		(DWORD)((unsigned long long)size >> 32), (DWORD)(size & 0xffffffffu), name.c_str());
+	if (!handle) {
+		return false;
+	}
+	if (GetLastError() == ERROR_ALREADY_EXISTS) {
+		CloseHandle(handle);
+		return false;
+	}
+	void* view = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!view) {
+		CloseHandle(handle);
+		return false;
+	}
+
+	//the block lives as long as any process holds the mapping, so keep it open
+	mapping = handle;
+#else
+	//posix names need a leading slash
+	std::string path = "/" + name;
+	int file = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (file < 0) {
+		return false;
+	}
+	//a fresh object grows with zeroes
+	if (ftruncate(file, (off_t)size) != 0) {
+		close(file);
+		shm_unlink(path.c_str());
+		return false;
+	}
+	void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	close(file);
+	if (view == MAP_FAILED) {
+		shm_unlink(path.c_str());
+		return false;
+	}
+#endif
+
+	data = (unsigned char*)view;
+	this->size = size;
+	this->name = name;
+	owner = true;
+	return true;
+}
+
+bool SharedMemory::Open(const std::string& name)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+	if (!handle) {
+		return false;
+	}
+	void* view = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (!view) {
+		CloseHandle(handle);
+		return false;
+	}
+
+	//the view covers whole pages, the creator's size is at most that
+	MEMORY_BASIC_INFORMATION info;
+	VirtualQuery(view, &info, sizeof(info));
+	size = info.RegionSize;
+	mapping = handle;
+#else
+	std::string path = "/" + name;
+	int file = shm_open(path.c_str(), O_RDWR, 0600);
+	if (file < 0) {
+		return false;
+	}
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0) {
+		close(file);
+		return false;
+	}
+	void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	close(file);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+	size = (size_t)info.st_size;
+#endif
+
+	data = (unsigned char*)view;
+	this->name = name;
+	owner = false;
+	return true;
+}
+
+void SharedMemory::Close()
+{
+	if (!data) {
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mapping);
+	mapping = nullptr;
+#else
+	munmap(data, size);
+	//anyone still mapping it keeps their view, the name just goes away
+	if (owner) {
+		shm_unlink(("/" + name).c_str());
+	}
+#endif
+	data = nullptr;
+	size = 0;
+	owner = false;
+	name.clear();
+}
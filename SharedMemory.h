@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A named block of memory other processes on the machine can map. The
+// creator sizes and names it, others open it by name and see the same
+// bytes, so anything placed in it has to be position independent.
+class SharedMemory
+{
+public:
+	SharedMemory() {}
+	~SharedMemory();
+
+	SharedMemory(const SharedMemory&) = delete;
+	SharedMemory& operator=(const SharedMemory&) = delete;
+
+	// Makes a new zeroed block, false if the name is taken or it can't be mapped
+	bool Create(const std::string& name, size_t size);
+	// Maps a block another process created
+	bool Open(const std::string& name);
+	// Unmaps it, the creator also takes the name away
+	void Close();
+
+	bool IsOpen() { return data != nullptr; }
+	unsigned char* GetData() { return data; }
+	size_t GetSize() { return size; }
+
+private:
+	unsigned char* data = nullptr;
+	size_t size = 0;
+	bool owner = false;
+	std::string name;
+#ifdef _WIN32
+	void* mapping = nullptr;
+#endif
+};
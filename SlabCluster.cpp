@@ -0,0 +1,309 @@
+#include "SlabCluster.h"
+#include "FluidSimHelpers.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+//how long workers get to attach, and to exit once told to
+#define SLAB_START_TIMEOUT_MS 30000
+#define SLAB_STOP_TIMEOUT_MS 5000
+
+//sections of the shared block start on their own cache line
+static size_t AlignUp(size_t bytes)
+{
+	return (bytes + 63) / 64 * 64;
+}
+
+static std::string GetExecutablePath()
+{
+#ifdef _WIN32
+	char path[MAX_PATH];
+	DWORD length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+	return std::string(path, length);
+#else
+	char path[4096];
+	ssize_t length = readlink("/proc/self/exe", path, sizeof(path));
+	return length > 0 ? std::string(path, (size_t)length) : std::string();
+#endif
+}
+
+SlabCluster::~SlabCluster()
+{
+	Stop();
+}
+
+bool SlabCluster::Start(int resX, int resY, int resZ, int rankCount, unsigned int threadsPerRank,
+	int jacobiHaloDepth, const std::string& executable)
+{
+	Stop();
+
+	//every slab needs two planes for the vorticity halo
+	if (rankCount < 1 || rankCount > SLAB_MAX_RANKS || resZ < rankCount * 2) {
+		return false;
+	}
+
+	//levels MultigridSolver would build for this grid
+	int levelCount = 1;
+	int levelRes[3] = { resX, resY, resZ };
+	for (; std::min(levelRes[0], std::min(levelRes[1], levelRes[2])) > 4; levelCount++) {
+		for (int axis = 0; axis < 3; axis++) {
+			levelRes[axis] = GetCoarseRes(levelRes[axis]);
+		}
+	}
+
+	//slab edges on multiples of 2^split planes let split levels restrict without
+	//crossing a slab. Go as coarse as still leaves the ranks similar shares, the
+	//last slab also takes the planes left over when resZ isn't a multiple.
+	int split = 0;
+	for (int s = levelCount - 1; s > 0; s--) {
+		int units = resZ >> s;
+		bool balanced = units % rankCount == 0 || units >= rankCount * 4;
+		if (units >= rankCount && balanced && (units / rankCount << s) >= 2) {
+			split = s;
+			break;
+		}
+	}
+	int units = resZ >> split;
+	int slabBegin[SLAB_MAX_RANKS + 1];
+	int thinnest = resZ;
+	for (int r = 0; r <= rankCount; r++) {
+		slabBegin[r] = r == rankCount ? resZ : (int)((long long)units * r / rankCount) << split;
+		if (r > 0) {
+			thinnest = std::min(thinnest, slabBegin[r] - slabBegin[r - 1]);
+		}
+	}
+	const int distributedLevels = split + 1;
+	const int halo = std::min(SLAB_HALO_PLANES, thinnest);
+
+	//lay the block out, rings last since they're the biggest
+	size_t sliceSize = (size_t)resX * resY;
+	size_t offset = AlignUp(sizeof(SlabSharedHeader));
+	size_t reductionOffset = offset;
+	offset += AlignUp((size_t)resZ * 5 * sizeof(double));
+	size_t gatherOffset = offset;
+	offset += AlignUp(sliceSize * resZ * sizeof(float));
+	size_t coarseOffset = offset;
+	if (distributedLevels < levelCount) {
+		//the first level rank 0 runs alone
+		size_t coarseCells = 1;
+		for (int axis = 0; axis < 3; axis++) {
+			int res = axis == 0 ? resX : axis == 1 ? resY : resZ;
+			for (int l = 0; l < distributedLevels; l++) {
+				res = GetCoarseRes(res);
+			}
+			coarseCells *= res;
+		}
+		offset += AlignUp(coarseCells * sizeof(float));
+	}
+	//advection is the widest exchange, 8 channels of a full halo
+	size_t ringSlotFloats = 8 * (size_t)halo * sliceSize;
+	size_t ringSize = HaloRing::GetSize(SLAB_RING_SLOTS, ringSlotFloats);
+	size_t ringOffset = offset;
+	offset += ringSize * 2 * (rankCount - 1);
+
+	static std::atomic<int> clusterCount(0);
+#ifdef _WIN32
+	unsigned long processId = GetCurrentProcessId();
+#else
+	unsigned long processId = (unsigned long)getpid();
+#endif
+	name = "FluidSlabs_" + std::to_string(processId) + "_" + std::to_string(clusterCount++);
+	if (!shared.Create(name, offset)) {
+		return false;
+	}
+
+	unsigned char* data = shared.GetData();
+	header = new (data) SlabSharedHeader();
+	header->resX = resX;
+	header->resY = resY;
+	header->resZ = resZ;
+	header->rankCount = rankCount;
+	header->threadsPerRank = threadsPerRank;
+	std::copy(slabBegin, slabBegin + rankCount + 1, header->slabBegin);
+	header->haloPlanes = halo;
+	header->jacobiHaloDepth = std::min(std::max(jacobiHaloDepth, 1), halo);
+	header->distributedLevels = distributedLevels;
+	header->ringSlotFloats = ringSlotFloats;
+	header->reductionOffset = reductionOffset;
+	header->gatherOffset = gatherOffset;
+	header->coarseOffset = coarseOffset;
+	header->ringOffset = ringOffset;
+	header->ringSize = ringSize;
+	header->settings = settings;
+	header->commandSerial.store(0);
+	header->command.store(SLAB_COMMAND_NONE);
+	header->barrierArrived.store(0);
+	header->barrierGeneration.store(0);
+	header->readyCount.store(0);
+	header->failed.store(0);
+	header->clampedTraces.store(0);
+	for (int ring = 0; ring < 2 * (rankCount - 1); ring++) {
+		HaloRing created;
+		created.Create(data + ringOffset + ring * ringSize, SLAB_RING_SLOTS, ringSlotFloats);
+	}
+
+	std::string workerPath = executable.empty() ? GetExecutablePath() : executable;
+	for (int rank = 1; rank < rankCount; rank++) {
+		if (!LaunchWorker(workerPath, rank)) {
+			Stop();
+			return false;
+		}
+	}
+	local = std::make_unique<SlabSolver>(data, 0);
+	local->SetWorkerCheck([this]() { return WorkersRunning(); });
+
+	//workers build their slabs in parallel with rank 0
+	auto start = std::chrono::steady_clock::now();
+	while (header->readyCount.load(std::memory_order_acquire) < rankCount - 1) {
+		if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(SLAB_START_TIMEOUT_MS) || !WorkersRunning()) {
+			Stop();
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+bool SlabCluster::LaunchWorker(const std::string& executable, int rank)
+{
+#ifdef _WIN32
+	std::string commandLine = "\"" + executable + "\" --slab-worker " + name + " " + std::to_string(rank);
+	STARTUPINFOA startup = {};
+	startup.cb = sizeof(startup);
+	PROCESS_INFORMATION info = {};
+	if (!CreateProcessA(executable.c_str(), &commandLine[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &info)) {
+		return false;
+	}
+	CloseHandle(info.hThread);
+	workers.push_back(info.hProcess);
+#else
+	std::string rankText = std::to_string(rank);
+	char* argv[] = { (char*)executable.c_str(), (char*)"--slab-worker", (char*)name.c_str(), (char*)rankText.c_str(), nullptr };
+	pid_t pid;
+	if (posix_spawn(&pid, executable.c_str(), nullptr, nullptr, argv, environ) != 0) {
+		return false;
+	}
+	workers.push_back(pid);
+#endif
+	return true;
+}
+
+bool SlabCluster::WorkersRunning()
+{
+#ifdef _WIN32
+	for (void* process : workers) {
+		if (WaitForSingleObject((HANDLE)process, 0) == WAIT_OBJECT_0) {
+			return false;
+		}
+	}
+#else
+	//an exited worker gets reaped here, Stop's waitpid then just fails for it
+	for (int pid : workers) {
+		int status;
+		if (waitpid(pid, &status, WNOHANG) != 0) {
+			return false;
+		}
+	}
+#endif
+	return true;
+}
+
+void SlabCluster::Stop()
+{
+	if (!shared.IsOpen()) {
+		return;
+	}
+
+	//workers that never got going see the stop as soon as they attach
+	PostCommand(SLAB_COMMAND_STOP);
+#ifdef _WIN32
+	for (void* process : workers) {
+		if (WaitForSingleObject((HANDLE)process, SLAB_STOP_TIMEOUT_MS) != WAIT_OBJECT_0) {
+			TerminateProcess((HANDLE)process, 1);
+		}
+		CloseHandle((HANDLE)process);
+	}
+#else
+	for (int pid : workers) {
+		int status;
+		auto start = std::chrono::steady_clock::now();
+		while (waitpid(pid, &status, WNOHANG) == 0) {
+			if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(SLAB_STOP_TIMEOUT_MS)) {
+				kill(pid, SIGKILL);
+				waitpid(pid, &status, 0);
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+#endif
+	workers.clear();
+
+	local.reset();
+	header = nullptr;
+	shared.Close();
+}
+
+void SlabCluster::PostCommand(SlabCommand command)
+{
+	header->command.store(command, std::memory_order_relaxed);
+	header->commandSerial.fetch_add(1, std::memory_order_release);
+}
+
+bool SlabCluster::Simulate()
+{
+	header->settings = settings;
+	PostCommand(SLAB_COMMAND_STEP);
+	return local->RunCommand(SLAB_COMMAND_STEP);
+}
+
+bool SlabCluster::Reset()
+{
+	PostCommand(SLAB_COMMAND_RESET);
+	return local->RunCommand(SLAB_COMMAND_RESET);
+}
+
+bool SlabCluster::GatherChannel(FluidChannel channel, float* out)
+{
+	header->gatherChannel = channel;
+	PostCommand(SLAB_COMMAND_GATHER);
+	if (!local->RunCommand(SLAB_COMMAND_GATHER)) {
+		return false;
+	}
+
+	const float* gathered = (const float*)(shared.GetData() + header->gatherOffset);
+	std::copy(gathered, gathered + (size_t)header->resX * header->resY * header->resZ, out);
+	return true;
+}
+
+int SlabCluster::RunWorker(const std::string& name, int rank)
+{
+	SharedMemory memory;
+	if (!memory.Open(name)) {
+		return 1;
+	}
+	const SlabSharedHeader* header = (const SlabSharedHeader*)memory.GetData();
+	if (rank < 1 || rank >= header->rankCount) {
+		return 1;
+	}
+
+	SlabSolver solver(memory.GetData(), rank);
+	return solver.RunWorker() ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "SharedMemory.h"
+#include "SlabSolver.h"
+
+// Runs one fluid grid as z slabs over several processes on this machine,
+// for grids too big for one process to step quickly. This process is
+// rank 0 and the others are copies of a worker executable, all sharing a
+// block of memory that holds the commands, the halo rings between
+// neighbouring slabs and the buffers for sums and gathers. Steps come out
+// exactly as FluidSolverCPU's would for the settings SlabSolver supports.
+class SlabCluster
+{
+public:
+	SlabCluster() {}
+	~SlabCluster();
+
+	SlabCluster(const SlabCluster&) = delete;
+	SlabCluster& operator=(const SlabCluster&) = delete;
+
+	/// <summary>
+	/// Splits the grid into rankCount slabs and launches rankCount - 1
+	/// workers, each running executable --slab-worker name rank (this
+	/// executable when empty). threadsPerRank sizes every process' pool,
+	/// 0 uses every hardware thread in each. jacobiHaloDepth is how many
+	/// planes Jacobi exchanges at a time. False if the grid is too thin for
+	/// that many slabs or a process doesn't come up.
+	/// </summary>
+	bool Start(int resX, int resY, int resZ, int rankCount, unsigned int threadsPerRank,
+		int jacobiHaloDepth = SLAB_HALO_PLANES, const std::string& executable = "");
+	// Tells the workers to exit and waits for them
+	void Stop();
+
+	bool IsRunning() { return local != nullptr; }
+	FluidSimSettings* GetSettings() { return &settings; }
+
+	// Runs a single fixed time step on every slab. False (for this and every
+	// later command) if a worker exited or stopped answering partway, the
+	// cluster then needs a Stop and Start
+	bool Simulate();
+	// Zero every field
+	bool Reset();
+	// Copies a channel of the whole grid out, x fastest
+	bool GatherChannel(FluidChannel channel, float* out);
+
+	int GetRankCount() { return header ? header->rankCount : 0; }
+	int GetSlabBegin(int rank) { return header->slabBegin[rank]; }
+	int GetDistributedLevels() { return header->distributedLevels; }
+
+	// Rank 0's wall time per stage, which includes waiting for the slowest slab
+	float GetStageMs(FluidStage stage) { return local->GetStageMs(stage); }
+	int GetPressureIterations() { return local->GetPressureIterations(); }
+	float GetPressureResidual() { return local->GetPressureResidual(); }
+	// Advection traces that ran past a halo since Start, these cells won't match a single process
+	unsigned int GetClampedTraces() { return header->clampedTraces.load(); }
+
+	/// <summary>
+	/// Main of a worker process, attaches to the named block as rank and
+	/// runs until rank 0 stops it. Returns the process' exit code.
+	/// </summary>
+	static int RunWorker(const std::string& name, int rank);
+
+private:
+	void PostCommand(SlabCommand command);
+	bool LaunchWorker(const std::string& executable, int rank);
+	// False once any worker process has exited
+	bool WorkersRunning();
+
+	SharedMemory shared;
+	SlabSharedHeader* header = nullptr;
+	std::unique_ptr<SlabSolver> local;
+	FluidSimSettings settings;
+	std::string name;
+#ifdef _WIN32
+	std::vector<void*> workers;
+#else
+	std::vector<int> workers;
+#endif
+};
@@ -0,0 +1,1023 @@
+#include "SlabSolver.h"
+#include "FluidSimHelpers.h"
+#include "HalfPrecision.h"
+#include "TrilinearSampler.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+//the same run length FluidSolverCPU advects in
+#define ADVECTION_BATCH_SIZE 64
+
+SlabSolver::SlabSolver(unsigned char* shared, int rank)
+	: header((SlabSharedHeader*)shared), shared(shared), rank(rank)
+{
+	rankCount = header->rankCount;
+	resX = header->resX;
+	resY = header->resY;
+	resZ = header->resZ;
+	sliceSize = resX * resY;
+	zBegin = header->slabBegin[rank];
+	zEnd = header->slabBegin[rank + 1];
+	halo = header->haloPlanes;
+	firstPlane = zBegin - halo;
+	planeCount = zEnd - zBegin + 2 * halo;
+
+	pool = std::make_unique<ThreadPool>(header->threadsPerRank);
+	for (int i = 0; i < CHANNEL_COUNT; i++) {
+		fields[i].assign((size_t)planeCount * sliceSize, 0.0f);
+		scratch[i].assign((size_t)planeCount * sliceSize, 0.0f);
+	}
+	pressureHaloValid = halo;
+
+	//the rings between rank p and p + 1 carry planes up then down
+	auto ringAt = [&](int pair, int direction) {
+		return shared + header->ringOffset + (size_t)(pair * 2 + direction) * header->ringSize;
+	};
+	if (rank > 0) {
+		fromLower.Attach(ringAt(rank - 1, 0), SLAB_RING_SLOTS, header->ringSlotFloats);
+		toLower.Attach(ringAt(rank - 1, 1), SLAB_RING_SLOTS, header->ringSlotFloats);
+	}
+	if (rank < rankCount - 1) {
+		toUpper.Attach(ringAt(rank, 0), SLAB_RING_SLOTS, header->ringSlotFloats);
+		fromUpper.Attach(ringAt(rank, 1), SLAB_RING_SLOTS, header->ringSlotFloats);
+	}
+
+	BuildLevels();
+}
+
+FluidSimSettings SlabSolver::GetSupportedSettings(const FluidSimSettings& settings)
+{
+	FluidSimSettings supported = settings;
+	supported.advectionScheme = ADVECTION_SEMI_LAGRANGIAN;
+	if (supported.pressureSolver != PRESSURE_SOLVER_JACOBI) {
+		supported.pressureSolver = PRESSURE_SOLVER_MULTIGRID;
+	}
+	supported.multigridCycle = MULTIGRID_V_CYCLE;
+	supported.sparseBricks = false;
+	return supported;
+}
+
+bool SlabSolver::RunWorker()
+{
+	header->readyCount.fetch_add(1, std::memory_order_release);
+
+	//every command ends in a barrier, so rank 0 can't post the next one before this rank has read the last
+	uint32_t seen = 0;
+	while (true) {
+		for (int spin = 0; header->commandSerial.load(std::memory_order_acquire) == seen; spin++) {
+			//nobody is waiting on this rank between runs, so stop taking a core
+			if (spin > 100000) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			else if (spin >= 64) {
+				std::this_thread::yield();
+			}
+		}
+		seen++;
+
+		SlabCommand command = (SlabCommand)header->command.load(std::memory_order_acquire);
+		if (command == SLAB_COMMAND_STOP) {
+			return true;
+		}
+		//the others have given up on this cluster too, or will once they wait on this rank
+		if (!RunCommand(command)) {
+			return false;
+		}
+	}
+}
+
+bool SlabSolver::RunCommand(SlabCommand command)
+{
+	if (failed) {
+		return false;
+	}
+	switch (command) {
+	case SLAB_COMMAND_STEP: Step(); break;
+	case SLAB_COMMAND_GATHER: Gather(header->gatherChannel); break;
+	case SLAB_COMMAND_RESET: Reset(); break;
+	default: break;
+	}
+	return !failed;
+}
+
+void SlabSolver::Barrier()
+{
+	//once failed the ranks are out of step, every wait left in the command returns at once
+	if (failed) {
+		return;
+	}
+
+	//the last to arrive starts the next generation, everyone else waits for it
+	uint32_t generation = header->barrierGeneration.load(std::memory_order_acquire);
+	if (header->barrierArrived.fetch_add(1, std::memory_order_acq_rel) + 1 == (uint32_t)rankCount) {
+		header->barrierArrived.store(0, std::memory_order_relaxed);
+		header->barrierGeneration.fetch_add(1, std::memory_order_release);
+		return;
+	}
+	SpinWait([&]() { return header->barrierGeneration.load(std::memory_order_acquire) != generation; }, StartWait());
+}
+
+std::function<bool()> SlabSolver::StartWait()
+{
+	auto start = std::chrono::steady_clock::now();
+	return [this, start]() {
+		failed = failed || header->failed.load(std::memory_order_acquire) != 0 ||
+			std::chrono::steady_clock::now() - start > std::chrono::milliseconds(SLAB_WAIT_TIMEOUT_MS) ||
+			(workersRunning && !workersRunning());
+		if (failed) {
+			header->failed.store(1, std::memory_order_release);
+		}
+		return failed;
+	};
+}
+
+void SlabSolver::ExchangeHalos(float* const* arrays, int arrayCount, const SlabLevel& level, int depth)
+{
+	if (!level.distributed || depth <= 0 || failed) {
+		return;
+	}
+
+	const size_t block = (size_t)level.resX * level.resY * depth;
+
+	//both sends go out before either receive, so neighbours never wait on each other
+	if (rank > 0) {
+		float* message = toLower.BeginWrite(StartWait());
+		if (!message) {
+			return;
+		}
+		for (int a = 0; a < arrayCount; a++) {
+			const float* planes = arrays[a] + level.Index(0, 0, level.zBegin);
+			std::copy(planes, planes + block, message + a * block);
+		}
+		toLower.EndWrite();
+	}
+	if (rank < rankCount - 1) {
+		float* message = toUpper.BeginWrite(StartWait());
+		if (!message) {
+			return;
+		}
+		for (int a = 0; a < arrayCount; a++) {
+			const float* planes = arrays[a] + level.Index(0, 0, level.zEnd - depth);
+			std::copy(planes, planes + block, message + a * block);
+		}
+		toUpper.EndWrite();
+	}
+
+	if (rank > 0) {
+		const float* message = fromLower.BeginRead(StartWait());
+		if (!message) {
+			return;
+		}
+		for (int a = 0; a < arrayCount; a++) {
+			std::copy(message + a * block, message + (a + 1) * block, arrays[a] + level.Index(0, 0, level.zBegin - depth));
+		}
+		fromLower.EndRead();
+	}
+	if (rank < rankCount - 1) {
+		const float* message = fromUpper.BeginRead(StartWait());
+		if (!message) {
+			return;
+		}
+		for (int a = 0; a < arrayCount; a++) {
+			std::copy(message + a * block, message + (a + 1) * block, arrays[a] + level.Index(0, 0, level.zEnd));
+		}
+		fromUpper.EndRead();
+	}
+}
+
+void SlabSolver::SumPlanes(const std::vector<double>& partials, const SlabLevel& level, int count, double* totals)
+{
+	for (int s = 0; s < count; s++) {
+		totals[s] = 0.0;
+	}
+
+	//rank 0 alone holds every plane
+	if (!level.distributed) {
+		for (int z = 0; z < level.zEnd - level.zBegin; z++) {
+			for (int s = 0; s < count; s++) {
+				totals[s] += partials[z * count + s];
+			}
+		}
+		return;
+	}
+
+	double* planeSums = (double*)(shared + header->reductionOffset);
+	std::copy(partials.begin(), partials.end(), planeSums + level.zBegin * count);
+	Barrier();
+	for (int z = 0; z < level.resZ; z++) {
+		for (int s = 0; s < count; s++) {
+			totals[s] += planeSums[z * count + s];
+		}
+	}
+	//nobody writes the next sums until everyone has read these
+	Barrier();
+}
+
+void SlabSolver::Step()
+{
+	settings = GetSupportedSettings(header->settings);
+
+	auto stageStart = std::chrono::high_resolution_clock::now();
+	auto endStage = [&](FluidStage stage) {
+		auto now = std::chrono::high_resolution_clock::now();
+		stageMs[stage] = std::chrono::duration<float, std::milli>(now - stageStart).count();
+		stageStart = now;
+	};
+
+	//the same stages and rounding as FluidSolverCPU::Simulate
+	Advect();
+	StoreAtPrecision({ VELOCITY_X, VELOCITY_Y, VELOCITY_Z, COLOR_R, COLOR_G, COLOR_B, DENSITY, TEMPERATURE });
+	endStage(FLUID_STAGE_ADVECT);
+	InjectSmoke();
+	StoreAtPrecision({ VELOCITY_X, VELOCITY_Y, VELOCITY_Z, COLOR_R, COLOR_G, COLOR_B, DENSITY, TEMPERATURE });
+	endStage(FLUID_STAGE_INJECT);
+	ApplyBuoyancy();
+	StoreAtPrecision({ VELOCITY_X, VELOCITY_Y, VELOCITY_Z });
+	endStage(FLUID_STAGE_BUOYANCY);
+	ComputeDivergence();
+	endStage(FLUID_STAGE_DIVERGENCE);
+	SolvePressure();
+	StoreAtPrecision({ PRESSURE });
+	endStage(FLUID_STAGE_PRESSURE);
+	ProjectPressure();
+	StoreAtPrecision({ VELOCITY_X, VELOCITY_Y, VELOCITY_Z });
+	endStage(FLUID_STAGE_PROJECT);
+}
+
+void SlabSolver::Reset()
+{
+	for (int i = 0; i < CHANNEL_COUNT; i++) {
+		std::fill(fields[i].begin(), fields[i].end(), 0.0f);
+		std::fill(scratch[i].begin(), scratch[i].end(), 0.0f);
+	}
+	pressureHaloValid = halo;
+	Barrier();
+}
+
+void SlabSolver::Gather(FluidChannel channel)
+{
+	float* gathered = (float*)(shared + header->gatherOffset);
+	const float* values = fields[channel].data();
+	ForEachPlane(zBegin, zEnd, [&](int z) {
+		std::copy(values + Index(0, 0, z), values + Index(0, 0, z + 1), gathered + (size_t)z * sliceSize);
+	});
+	Barrier();
+}
+
+void SlabSolver::Advect()
+{
+	static const FluidChannel channels[] = {
+		VELOCITY_X, VELOCITY_Y, VELOCITY_Z,
+		COLOR_R, COLOR_G, COLOR_B, DENSITY,
+		TEMPERATURE
+	};
+	const int count = sizeof(channels) / sizeof(channels[0]);
+	const float dt = settings.fixedTimeStep;
+
+	//how far the fastest trace reaches along z sets how many planes to send,
+	//plus one for the far corner of its stencil
+	const float* velZ = fields[VELOCITY_Z].data();
+	float maxSpeed = 0.0f;
+	for (int i = Index(0, 0, zBegin); i < Index(0, 0, zEnd); i++) {
+		maxSpeed = std::max(maxSpeed, std::abs(velZ[i]));
+	}
+	header->rankMaxSpeed[rank] = maxSpeed;
+	Barrier();
+	for (int r = 0; r < rankCount; r++) {
+		maxSpeed = std::max(maxSpeed, header->rankMaxSpeed[r]);
+	}
+	Barrier();
+	float reach = std::min(maxSpeed * std::abs(dt), (float)halo);
+	int depth = std::min((int)std::ceil(reach) + 1, halo);
+
+	const float* inputs[count];
+	float* exchanged[count];
+	for (int c = 0; c < count; c++) {
+		exchanged[c] = fields[channels[c]].data();
+		inputs[c] = exchanged[c];
+	}
+	ExchangeHalos(exchanged, count, levels[0], depth);
+
+	//a trace past the ghost planes, faster than the halo allows, gets pulled back
+	//to the last one. at the grid's own walls the sampler's clamping takes over
+	const float lowest = rank > 0 ? (float)(zBegin - depth) : -FLT_MAX;
+	const float highest = rank < rankCount - 1 ? (float)(zEnd + depth - 2) : FLT_MAX;
+	const float* velX = fields[VELOCITY_X].data();
+	const float* velY = fields[VELOCITY_Y].data();
+
+	std::atomic<uint32_t> clamped(0);
+	ForEachPlane(zBegin, zEnd, [&](int z) {
+		float posX[ADVECTION_BATCH_SIZE];
+		float posY[ADVECTION_BATCH_SIZE];
+		float posZ[ADVECTION_BATCH_SIZE];
+		float* runOutputs[count];
+		uint32_t planeClamped = 0;
+
+		for (int y = 0; y < resY; y++) {
+			for (int runBegin = 0; runBegin < resX; runBegin += ADVECTION_BATCH_SIZE) {
+				const int run = std::min(resX - runBegin, ADVECTION_BATCH_SIZE);
+				const int first = Index(runBegin, y, z);
+
+				for (int k = 0; k < run; k++) {
+					int i = first + k;
+					posX[k] = (runBegin + k) - dt * velX[i];
+					posY[k] = y - dt * velY[i];
+					float p = z - dt * velZ[i];
+					//a nan would clamp to plane 0, which only the first rank holds
+					if (p < lowest || (rank > 0 && p != p)) {
+						p = lowest;
+						planeClamped++;
+					}
+					else if (p > highest) {
+						p = highest;
+						planeClamped++;
+					}
+					posZ[k] = p;
+				}
+				for (int c = 0; c < count; c++) {
+					runOutputs[c] = scratch[channels[c]].data() + first;
+				}
+				SampleTrilinearBatch(inputs, runOutputs, count, resX, resY, resZ, posX, posY, posZ, run, firstPlane);
+			}
+		}
+		clamped.fetch_add(planeClamped, std::memory_order_relaxed);
+	});
+	if (clamped.load() > 0) {
+		header->clampedTraces.fetch_add(clamped.load(), std::memory_order_relaxed);
+	}
+
+	for (FluidChannel channel : channels) {
+		std::swap(fields[channel], scratch[channel]);
+	}
+}
+
+void SlabSolver::InjectSmoke()
+{
+	const FluidSimSettings& s = settings;
+	const float invLargestRes = 1.0f / std::max(resX, std::max(resY, resZ));
+	const float center[3] = {
+		s.injectPosition[0] * resX,
+		s.injectPosition[1] * resY,
+		s.injectPosition[2] * resZ
+	};
+
+	float* colorR = fields[COLOR_R].data();
+	float* colorG = fields[COLOR_G].data();
+	float* colorB = fields[COLOR_B].data();
+	float* density = fields[DENSITY].data();
+	float* temperature = fields[TEMPERATURE].data();
+	float* velX = fields[VELOCITY_X].data();
+	float* velY = fields[VELOCITY_Y].data();
+	float* velZ = fields[VELOCITY_Z].data();
+
+	ForEachPlane(zBegin, zEnd, [&](int z) {
+		for (int y = 0; y < resY; y++) {
+			for (int x = 0; x < resX; x++) {
+				int i = Index(x, y, z);
+				float dx = x + 0.5f - center[0];
+				float dy = y + 0.5f - center[1];
+				float dz = z + 0.5f - center[2];
+				float dist = std::sqrt(dx * dx + dy * dy + dz * dz) * invLargestRes;
+
+				float injFalloff = s.injectRadius == 0.0f ? 0.0f :
+					std::max(0.0f, s.injectRadius - dist) / s.injectRadius;
+				if (injFalloff <= 0.0f) {
+					continue;
+				}
+
+				colorR[i] = s.injectColor[0];
+				colorG[i] = s.injectColor[1];
+				colorB[i] = s.injectColor[2];
+				density[i] = std::min(std::max(density[i] + s.injectDensity * injFalloff, 0.0f), 1.0f);
+
+				temperature[i] += s.injectTemperature * injFalloff;
+				velX[i] += s.injectVelocity[0];
+				velY[i] += s.injectVelocity[1];
+				velZ[i] += s.injectVelocity[2];
+			}
+		}
+	});
+}
+
+void SlabSolver::ApplyBuoyancy()
+{
+	const FluidSimSettings& s = settings;
+	if (s.vorticityEpsilon > 0.0f) {
+		ApplyVorticityConfinement();
+		return;
+	}
+
+	const float* density = fields[DENSITY].data();
+	const float* temperature = fields[TEMPERATURE].data();
+	float* velY = fields[VELOCITY_Y].data();
+	ForEachPlane(zBegin, zEnd, [&](int z) {
+		for (int i = Index(0, 0, z); i < Index(0, 0, z + 1); i++) {
+			velY[i] += -s.densityWeight * density[i] +
+				s.temperatureBuoyancy * (temperature[i] - s.ambientTemperature);
+		}
+	});
+}
+
+void SlabSolver::ApplyVorticityConfinement()
+{
+	const FluidSimSettings& s = settings;
+	const float* density = fields[DENSITY].data();
+	const float* temperature = fields[TEMPERATURE].data();
+	float* velocityIn[3] = { fields[VELOCITY_X].data(), fields[VELOCITY_Y].data(), fields[VELOCITY_Z].data() };
+	const float* const* velocity = velocityIn;
+	float* velocityOut[3] = { scratch[VELOCITY_X].data(), scratch[VELOCITY_Y].data(), scratch[VELOCITY_Z].data() };
+
+	//the curl length one plane past the slab reads velocity two planes past it
+	ExchangeHalos(velocityIn, 3, levels[0], 2);
+
+	auto curlAt = [&](int x, int y, int z, float curl[3]) {
+		auto at = [&](int axis, int cx, int cy, int cz) {
+			return velocity[axis][Index(cx, cy, cz)];
+		};
+		int left = GetLowerIndex(x);
+		int right = GetUpperIndex(x, resX);
+		int bottom = GetLowerIndex(y);
+		int top = GetUpperIndex(y, resY);
+		int back = GetLowerIndex(z);
+		int front = GetUpperIndex(z, resZ);
+
+		curl[0] = 0.5f * ((at(2, x, top, z) - at(2, x, bottom, z)) - (at(1, x, y, front) - at(1, x, y, back)));
+		curl[1] = 0.5f * ((at(0, x, y, front) - at(0, x, y, back)) - (at(2, right, y, z) - at(2, left, y, z)));
+		curl[2] = 0.5f * ((at(1, right, y, z) - at(1, left, y, z)) - (at(0, x, top, z) - at(0, x, bottom, z)));
+	};
+
+	//curl length over the slab and a plane either side, as far as the grid goes
+	const int curlFirst = zBegin - 1;
+	std::vector<float> curlLength((size_t)(zEnd - zBegin + 2) * sliceSize);
+	ForEachPlane(std::max(curlFirst, 0), std::min(zEnd + 1, resZ), [&](int z) {
+		for (int y = 0; y < resY; y++) {
+			for (int x = 0; x < resX; x++) {
+				float curl[3];
+				curlAt(x, y, z, curl);
+				curlLength[((z - curlFirst) * resY + y) * resX + x] =
+					std::sqrt(curl[0] * curl[0] + curl[1] * curl[1] + curl[2] * curl[2]);
+			}
+		}
+	});
+	auto lengthAt = [&](int x, int y, int z) {
+		return curlLength[((z - curlFirst) * resY + y) * resX + x];
+	};
+
+	ForEachPlane(zBegin, zEnd, [&](int z) {
+		for (int y = 0; y < resY; y++) {
+			for (int x = 0; x < resX; x++) {
+				int i = Index(x, y, z);
+
+				float gradient[3] = {
+					0.5f * (lengthAt(GetUpperIndex(x, resX), y, z) - lengthAt(GetLowerIndex(x), y, z)),
+					0.5f * (lengthAt(x, GetUpperIndex(y, resY), z) - lengthAt(x, GetLowerIndex(y), z)),
+					0.5f * (lengthAt(x, y, GetUpperIndex(z, resZ)) - lengthAt(x, y, GetLowerIndex(z)))
+				};
+				float gradientLength = std::sqrt(gradient[0] * gradient[0] + gradient[1] * gradient[1] + gradient[2] * gradient[2]);
+
+				float force[3] = { 0.0f, 0.0f, 0.0f };
+				if (gradientLength > 1e-6f) {
+					float n[3] = { gradient[0] / gradientLength, gradient[1] / gradientLength, gradient[2] / gradientLength };
+					float curl[3];
+					curlAt(x, y, z, curl);
+
+					force[0] = s.vorticityEpsilon * (n[1] * curl[2] - n[2] * curl[1]);
+					force[1] = s.vorticityEpsilon * (n[2] * curl[0] - n[0] * curl[2]);
+					force[2] = s.vorticityEpsilon * (n[0] * curl[1] - n[1] * curl[0]);
+				}
+
+				force[1] += -s.densityWeight * density[i] +
+					s.temperatureBuoyancy * (temperature[i] - s.ambientTemperature);
+
+				velocityOut[0][i] = velocity[0][i] + force[0];
+				velocityOut[1][i] = velocity[1][i] + force[1];
+				velocityOut[2][i] = velocity[2][i] + force[2];
+			}
+		}
+	});
+
+	std::swap(fields[VELOCITY_X], scratch[VELOCITY_X]);
+	std::swap(fields[VELOCITY_Y], scratch[VELOCITY_Y]);
+	std::swap(fields[VELOCITY_Z], scratch[VELOCITY_Z]);
+}
+
+void SlabSolver::ComputeDivergence()
+{
+	//only z velocity is read across a slab edge
+	float* velZ = fields[VELOCITY_Z].data();
+	ExchangeHalos(&velZ, 1, levels[0], 1);
+
+	const float* velX = fields[VELOCITY_X].data();
+	const float* velY = fields[VELOCITY_Y].data();
+	float* divergence = fields[DIVERGENCE].data();
+	ForEachPlane(zBegin, zEnd, [&](int z) {
+		for (int y = 0; y < resY; y++) {
+			for (int x = 0; x < resX; x++) {
+				divergence[Index(x, y, z)] = 0.5f * (
+					(velX[Index(GetUpperIndex(x, resX), y, z)] - velX[Index(GetLowerIndex(x), y, z)]) +
+					(velY[Index(x, GetUpperIndex(y, resY), z)] - velY[Index(x, GetLowerIndex(y), z)]) +
+					(velZ[Index(x, y, GetUpperIndex(z, resZ))] - velZ[Index(x, y, GetLowerIndex(z))]));
+			}
+		}
+	});
+}
+
+void SlabSolver::SolvePressure()
+{
+	if (!settings.warmStartPressure) {
+		std::fill(fields[PRESSURE].begin(), fields[PRESSURE].end(), 0.0f);
+		pressureHaloValid = halo;
+	}
+
+	if (settings.pressureSolver == PRESSURE_SOLVER_JACOBI) {
+		SolveJacobi();
+		return;
+	}
+
+	pressureIterations = SolveMultigrid();
+	//smoothing leaves the ghost planes behind
+	pressureHaloValid = 0;
+}
+
+void SlabSolver::SolveJacobi()
+{
+	//k planes of halo buy k sweeps before the next exchange, each one
+	//redoing the ghost planes it can still get right
+	const int depth = header->jacobiHaloDepth;
+	pressureHaloValid = std::min(pressureHaloValid, depth);
+	float* divergence = fields[DIVERGENCE].data();
+	ExchangeHalos(&divergence, 1, levels[0], depth - 1);
+
+	const unsigned char* faces = levels[0].faces.data();
+	int iteration = 0;
+	pressureResidual = MeasurePressureResidual();
+	while (iteration < settings.pressureIterations && pressureResidual > settings.pressureTolerance && !failed) {
+		if (pressureHaloValid < 1) {
+			float* pressure = fields[PRESSURE].data();
+			ExchangeHalos(&pressure, 1, levels[0], depth);
+			pressureHaloValid = depth;
+		}
+
+		const int ghosts = pressureHaloValid - 1;
+		const float* pressure = fields[PRESSURE].data();
+		float* pressureOut = scratch[PRESSURE].data();
+		ForEachPlane(std::max(zBegin - ghosts, 0), std::min(zEnd + ghosts, resZ), [&](int z) {
+			for (int y = 0; y < resY; y++) {
+				for (int x = 0; x < resX; x++) {
+					int i = Index(x, y, z);
+					if (!faces[i]) {
+						pressureOut[i] = 0.0f;
+						continue;
+					}
+					pressureOut[i] = (NeighbourPressureSum(pressure, faces[i], i, resX, resY) - divergence[i]) / 6.0f;
+				}
+			}
+		});
+
+		std::swap(fields[PRESSURE], scratch[PRESSURE]);
+		pressureHaloValid = ghosts;
+		iteration++;
+
+		if (iteration % settings.jacobiCheckInterval == 0 || iteration == settings.pressureIterations) {
+			pressureResidual = MeasurePressureResidual();
+		}
+	}
+	pressureIterations = iteration;
+
+	if (!settings.warmStartPressure) {
+		return;
+	}
+
+	//the same shift on the ghost planes keeps them matching the neighbours
+	float* pressure = fields[PRESSURE].data();
+	std::vector<double> partials(zEnd - zBegin, 0.0);
+	ForEachPlane(zBegin, zEnd, [&](int z) {
+		double sum = 0.0;
+		for (int i = Index(0, 0, z); i < Index(0, 0, z + 1); i++) {
+			sum += pressure[i];
+		}
+		partials[z - zBegin] = sum;
+	});
+	double total;
+	SumPlanes(partials, levels[0], 1, &total);
+	float mean = (float)(total / (resX * resY * resZ));
+
+	ForEachPlane(0, planeCount, [&](int plane) {
+		for (int i = plane * sliceSize; i < (plane + 1) * sliceSize; i++) {
+			pressure[i] -= mean;
+		}
+	});
+}
+
+float SlabSolver::MeasurePressureResidual()
+{
+	if (pressureHaloValid < 1) {
+		float* pressure = fields[PRESSURE].data();
+		ExchangeHalos(&pressure, 1, levels[0], header->jacobiHaloDepth);
+		pressureHaloValid = header->jacobiHaloDepth;
+	}
+
+	const float* pressure = fields[PRESSURE].data();
+	const float* divergence = fields[DIVERGENCE].data();
+	const unsigned char* faces = levels[0].faces.data();
+
+	std::vector<double> partials((zEnd - zBegin) * 5, 0.0);
+	ForEachPlane(zBegin, zEnd, [&](int z) {
+		double sums[5] = {};
+		for (int y = 0; y < resY; y++) {
+			for (int x = 0; x < resX; x++) {
+				int i = Index(x, y, z);
+				if (!faces[i]) {
+					continue;
+				}
+				float neighbours = NeighbourPressureSum(pressure, faces[i], i, resX, resY);
+
+				double r = (double)divergence[i] - (neighbours - 6.0f * pressure[i]);
+				sums[0] += r;
+				sums[1] += r * r;
+				sums[2] += divergence[i];
+				sums[3] += (double)divergence[i] * divergence[i];
+				sums[4] += 1.0;
+			}
+		}
+		for (int s = 0; s < 5; s++) {
+			partials[(z - zBegin) * 5 + s] = sums[s];
+		}
+	});
+
+	double sums[5];
+	SumPlanes(partials, levels[0], 5, sums);
+	if (sums[4] <= 0.0) {
+		return 0.0f;
+	}
+
+	double residualNorm = sums[1] - sums[0] * sums[0] / sums[4];
+	double divergenceNorm = sums[3] - sums[2] * sums[2] / sums[4];
+	if (divergenceNorm <= 0.0) {
+		return 0.0f;
+	}
+	return (float)std::sqrt(std::max(residualNorm, 0.0) / divergenceNorm);
+}
+
+void SlabSolver::ProjectPressure()
+{
+	if (pressureHaloValid < 1) {
+		float* pressure = fields[PRESSURE].data();
+		ExchangeHalos(&pressure, 1, levels[0], 1);
+		pressureHaloValid = 1;
+	}
+
+	const float* pressure = fields[PRESSURE].data();
+	float* velX = fields[VELOCITY_X].data();
+	float* velY = fields[VELOCITY_Y].data();
+	float* velZ = fields[VELOCITY_Z].data();
+	ForEachPlane(zBegin, zEnd, [&](int z) {
+		for (int y = 0; y < resY; y++) {
+			for (int x = 0; x < resX; x++) {
+				int i = Index(x, y, z);
+				velX[i] -= 0.5f * (pressure[Index(GetUpperIndex(x, resX), y, z)] - pressure[Index(GetLowerIndex(x), y, z)]);
+				velY[i] -= 0.5f * (pressure[Index(x, GetUpperIndex(y, resY), z)] - pressure[Index(x, GetLowerIndex(y), z)]);
+				velZ[i] -= 0.5f * (pressure[Index(x, y, GetUpperIndex(z, resZ))] - pressure[Index(x, y, GetLowerIndex(z))]);
+			}
+		}
+	});
+}
+
+void SlabSolver::StoreAtPrecision(std::initializer_list<FluidChannel> channels)
+{
+	const FieldPrecisionPolicy& p = settings.precision;
+	for (FluidChannel channel : channels) {
+		FieldPrecision precision =
+			channel <= VELOCITY_Z ? p.velocity :
+			channel <= DENSITY ? p.density :
+			channel == TEMPERATURE ? p.temperature :
+			channel == PRESSURE ? p.pressure : FIELD_PRECISION_FLOAT32;
+		if (precision != FIELD_PRECISION_FLOAT16) {
+			continue;
+		}
+
+		//ghost planes too, so ones still current stay that way
+		float* values = fields[channel].data();
+		ForEachPlane(0, planeCount, [&](int plane) {
+			RoundToHalf(values + plane * sliceSize, sliceSize);
+		});
+	}
+}
+
+void SlabSolver::BuildLevels()
+{
+	int levelRes[3] = { resX, resY, resZ };
+	for (int l = 0; ; l++) {
+		//only rank 0 holds the levels it runs alone
+		bool distributed = l < header->distributedLevels;
+		if (distributed || rank == 0) {
+			SlabLevel level = GetWholeLevel(l);
+			level.resX = levelRes[0];
+			level.resY = levelRes[1];
+			level.resZ = levelRes[2];
+			if (distributed) {
+				//level 0 keeps the channels' halo, coarser ones need a plane
+				int ghosts = l == 0 ? halo : 1;
+				//rounded up so the last slab keeps the unpaired plane of an odd axis
+				level.zBegin = (header->slabBegin[rank] + (1 << l) - 1) >> l;
+				level.zEnd = (header->slabBegin[rank + 1] + (1 << l) - 1) >> l;
+				level.firstPlane = level.zBegin - ghosts;
+				level.planeCount = level.zEnd - level.zBegin + 2 * ghosts;
+				level.distributed = true;
+			}
+
+			size_t cells = (size_t)level.planeCount * level.resX * level.resY;
+			level.rhs.assign(cells, 0.0f);
+			level.residual.assign(cells, 0.0f);
+			if (l > 0) {
+				level.pressureStorage.assign(cells, 0.0f);
+			}
+			level.faces.assign(cells, 0);
+			for (int z = std::max(level.firstPlane, 0); z < std::min(level.firstPlane + level.planeCount, level.resZ); z++) {
+				for (int y = 0; y < level.resY; y++) {
+					for (int x = 0; x < level.resX; x++) {
+						level.faces[level.Index(x, y, z)] = GetOpenFaces(nullptr, x, y, z, level.resX, level.resY, level.resZ);
+					}
+				}
+			}
+			levels.push_back(std::move(level));
+		}
+		levelCount = l + 1;
+
+		//the same halving MultigridSolver does
+		if (std::min(levelRes[0], std::min(levelRes[1], levelRes[2])) <= 4) {
+			break;
+		}
+		for (int axis = 0; axis < 3; axis++) {
+			levelRes[axis] = GetCoarseRes(levelRes[axis]);
+		}
+	}
+
+	for (size_t l = 1; l < levels.size(); l++) {
+		levels[l].pressure = levels[l].pressureStorage.data();
+	}
+}
+
+SlabSolver::SlabLevel SlabSolver::GetWholeLevel(int level)
+{
+	SlabLevel whole = {};
+	whole.resX = resX;
+	whole.resY = resY;
+	whole.resZ = resZ;
+	for (int l = 0; l < level; l++) {
+		whole.resX = GetCoarseRes(whole.resX);
+		whole.resY = GetCoarseRes(whole.resY);
+		whole.resZ = GetCoarseRes(whole.resZ);
+	}
+	whole.zBegin = 0;
+	whole.zEnd = whole.resZ;
+	whole.firstPlane = 0;
+	whole.planeCount = whole.resZ;
+	whole.distributed = false;
+	whole.pressure = nullptr;
+	return whole;
+}
+
+int SlabSolver::SolveMultigrid()
+{
+	//MultigridSolver::Solve for a grid without solids
+	SlabLevel& finest = levels[0];
+	finest.pressure = fields[PRESSURE].data();
+	const float* divergence = fields[DIVERGENCE].data();
+	const unsigned char* faces = finest.faces.data();
+	const int cellCount = resX * resY * resZ;
+
+	float mean = (float)(Sum(divergence, finest, false) / cellCount);
+	float* rhs = finest.rhs.data();
+	ForEachPlane(zBegin, zEnd, [&](int z) {
+		for (int i = Index(0, 0, z); i < Index(0, 0, z + 1); i++) {
+			rhs[i] = faces[i] ? divergence[i] - mean : 0.0f;
+		}
+	});
+
+	double rhsNorm = std::sqrt(Sum(rhs, finest, true));
+	if (rhsNorm <= 0.0) {
+		pressureResidual = 0.0f;
+		return 0;
+	}
+
+	pressureResidual = (float)(std::sqrt(ComputeResidual(finest, true)) / rhsNorm);
+	int cycles = 0;
+	while (cycles < settings.multigridMaxCycles && pressureResidual > settings.pressureTolerance && !failed) {
+		VCycle(0);
+		cycles++;
+		pressureResidual = (float)(std::sqrt(ComputeResidual(finest, true)) / rhsNorm);
+	}
+
+	float* pressure = finest.pressure;
+	float pressureMean = (float)(Sum(pressure, finest, false) / cellCount);
+	ForEachPlane(zBegin, zEnd, [&](int z) {
+		for (int i = Index(0, 0, z); i < Index(0, 0, z + 1); i++) {
+			if (faces[i]) {
+				pressure[i] -= pressureMean;
+			}
+		}
+	});
+	return cycles;
+}
+
+void SlabSolver::VCycle(int level)
+{
+	SlabLevel& current = levels[level];
+
+	if (level == levelCount - 1) {
+		Smooth(current, 32);
+		return;
+	}
+
+	Smooth(current, 2);
+	ComputeResidual(current, false);
+
+	if (level + 1 < header->distributedLevels || !current.distributed) {
+		//the coarse level is split the same way, or rank 0 already has it all
+		SlabLevel& coarse = levels[level + 1];
+		Restrict(current, current.residual.data(), coarse, coarse.rhs.data());
+		std::fill(coarse.pressureStorage.begin(), coarse.pressureStorage.end(), 0.0f);
+		VCycle(level + 1);
+
+		ExchangeHalos(&coarse.pressure, 1, coarse, 1);
+		ProlongAndAdd(coarse, coarse.pressure, current);
+	}
+	else {
+		//too thin to split again, rank 0 takes the residual and runs the coarser levels alone
+		SlabLevel whole = GetWholeLevel(level);
+		float* gathered = (float*)(shared + header->gatherOffset);
+		const int planeSize = current.resX * current.resY;
+		ForEachPlane(current.zBegin, current.zEnd, [&](int z) {
+			const float* residual = current.residual.data() + current.Index(0, 0, z);
+			std::copy(residual, residual + planeSize, gathered + whole.Index(0, 0, z));
+		});
+		Barrier();
+
+		float* coarsePressure = (float*)(shared + header->coarseOffset);
+		if (rank == 0) {
+			SlabLevel& coarse = levels[level + 1];
+			Restrict(whole, gathered, coarse, coarse.rhs.data());
+			std::fill(coarse.pressureStorage.begin(), coarse.pressureStorage.end(), 0.0f);
+			VCycle(level + 1);
+			std::copy(coarse.pressureStorage.begin(), coarse.pressureStorage.end(), coarsePressure);
+		}
+		Barrier();
+		ProlongAndAdd(GetWholeLevel(level + 1), coarsePressure, current);
+	}
+
+	Smooth(current, 2);
+}
+
+void SlabSolver::Smooth(SlabLevel& level, int iterations)
+{
+	const int levelX = level.resX;
+	const int levelY = level.resY;
+	const int strideZ = levelX * levelY;
+	float* pressure = level.pressure;
+	const float* rhs = level.rhs.data();
+	const unsigned char* faces = level.faces.data();
+
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		//each half reads the other color, including the neighbours' edge planes of it
+		for (int color = 0; color < 2; color++) {
+			ExchangeHalos(&pressure, 1, level, 1);
+			ForEachPlane(level.zBegin, level.zEnd, [&](int z) {
+				for (int y = 0; y < levelY; y++) {
+					for (int x = (y + z + color) & 1; x < levelX; x += 2) {
+						int i = level.Index(x, y, z);
+						unsigned char open = faces[i];
+
+						float sum = 0.0f;
+						int count = 0;
+						if (open & FACE_NEG_X) { sum += pressure[i - 1]; count++; }
+						if (open & FACE_POS_X) { sum += pressure[i + 1]; count++; }
+						if (open & FACE_NEG_Y) { sum += pressure[i - levelX]; count++; }
+						if (open & FACE_POS_Y) { sum += pressure[i + levelX]; count++; }
+						if (open & FACE_NEG_Z) { sum += pressure[i - strideZ]; count++; }
+						if (open & FACE_POS_Z) { sum += pressure[i + strideZ]; count++; }
+
+						if (count > 0) {
+							pressure[i] = (sum - rhs[i]) / count;
+						}
+					}
+				}
+			});
+		}
+	}
+}
+
+double SlabSolver::ComputeResidual(SlabLevel& level, bool sum)
+{
+	ExchangeHalos(&level.pressure, 1, level, 1);
+
+	const int levelX = level.resX;
+	const int levelY = level.resY;
+	const int strideZ = levelX * levelY;
+	const float* pressure = level.pressure;
+	const float* rhs = level.rhs.data();
+	float* residual = level.residual.data();
+	const unsigned char* faces = level.faces.data();
+
+	std::vector<double> partials(level.zEnd - level.zBegin, 0.0);
+	ForEachPlane(level.zBegin, level.zEnd, [&](int z) {
+		double sliceSum = 0.0;
+		for (int y = 0; y < levelY; y++) {
+			for (int x = 0; x < levelX; x++) {
+				int i = level.Index(x, y, z);
+				unsigned char open = faces[i];
+				float center = pressure[i];
+
+				float laplacian = 0.0f;
+				if (open & FACE_NEG_X) laplacian += pressure[i - 1] - center;
+				if (open & FACE_POS_X) laplacian += pressure[i + 1] - center;
+				if (open & FACE_NEG_Y) laplacian += pressure[i - levelX] - center;
+				if (open & FACE_POS_Y) laplacian += pressure[i + levelX] - center;
+				if (open & FACE_NEG_Z) laplacian += pressure[i - strideZ] - center;
+				if (open & FACE_POS_Z) laplacian += pressure[i + strideZ] - center;
+
+				float r = open ? rhs[i] - laplacian : 0.0f;
+				residual[i] = r;
+				sliceSum += (double)r * r;
+			}
+		}
+		partials[z - level.zBegin] = sliceSum;
+	});
+
+	//inside a v-cycle only the residual itself is needed, which saves the ranks a sync
+	if (!sum) {
+		return 0.0;
+	}
+	double total;
+	SumPlanes(partials, level, 1, &total);
+	return total;
+}
+
+void SlabSolver::Restrict(const SlabLevel& fine, const float* fineValues, SlabLevel& coarse, float* coarseValues)
+{
+	//slab edges fall on even fine planes, so every child is this rank's own
+	ForEachPlane(coarse.zBegin, coarse.zEnd, [&](int z) {
+		for (int y = 0; y < coarse.resY; y++) {
+			for (int x = 0; x < coarse.resX; x++) {
+				coarseValues[coarse.Index(x, y, z)] = RestrictBlock(fineValues + fine.Index(x * 2, y * 2, z * 2),
+					x * 2, y * 2, z * 2, fine.resX, fine.resY, fine.resZ);
+			}
+		}
+	});
+}
+
+void SlabSolver::ProlongAndAdd(const SlabLevel& coarse, const float* coarsePressure, SlabLevel& fine)
+{
+	float* finePressure = fine.pressure;
+
+	auto axisTaps = [](int fine, int coarseRes, int& near, int& far) {
+		int parent = fine / 2;
+		near = parent;
+		far = (fine & 1) ? GetUpperIndex(parent, coarseRes) : GetLowerIndex(parent);
+	};
+
+	//the far taps of the edge planes are the coarse ghost planes
+	ForEachPlane(fine.zBegin, fine.zEnd, [&](int z) {
+		int z0, z1;
+		axisTaps(z, coarse.resZ, z0, z1);
+		for (int y = 0; y < fine.resY; y++) {
+			int y0, y1;
+			axisTaps(y, coarse.resY, y0, y1);
+
+			const float* row00 = coarsePressure + coarse.Index(0, y0, z0);
+			const float* row10 = coarsePressure + coarse.Index(0, y1, z0);
+			const float* row01 = coarsePressure + coarse.Index(0, y0, z1);
+			const float* row11 = coarsePressure + coarse.Index(0, y1, z1);
+			float* out = finePressure + fine.Index(0, y, z);
+
+			for (int x = 0; x < fine.resX; x++) {
+				int x0, x1;
+				axisTaps(x, coarse.resX, x0, x1);
+
+				float near = 0.75f * (0.75f * row00[x0] + 0.25f * row10[x0]) + 0.25f * (0.75f * row01[x0] + 0.25f * row11[x0]);
+				float far = 0.75f * (0.75f * row00[x1] + 0.25f * row10[x1]) + 0.25f * (0.75f * row01[x1] + 0.25f * row11[x1]);
+				out[x] += 0.75f * near + 0.25f * far;
+			}
+		}
+	});
+}
+
+double SlabSolver::Sum(const float* values, const SlabLevel& level, bool squares)
+{
+	std::vector<double> partials(level.zEnd - level.zBegin, 0.0);
+	ForEachPlane(level.zBegin, level.zEnd, [&](int z) {
+		double sliceSum = 0.0;
+		for (int i = level.Index(0, 0, z); i < level.Index(0, 0, z + 1); i++) {
+			sliceSum += squares ? (double)values[i] * values[i] : values[i];
+		}
+		partials[z - level.zBegin] = sliceSum;
+	});
+
+	double total;
+	SumPlanes(partials, level, 1, &total);
+	return total;
+}
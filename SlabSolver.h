@@ -0,0 +1,259 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "FluidSolverCPU.h"
+#include "HaloRing.h"
+#include "ThreadPool.h"
+
+//most processes a grid can be split over
+#define SLAB_MAX_RANKS 64
+//ghost planes a slab keeps past each side, the deepest halo an exchange can send
+#define SLAB_HALO_PLANES 4
+//messages a halo ring holds, so a rank can run one exchange ahead of its neighbour
+#define SLAB_RING_SLOTS 2
+//longest a rank waits on the others before giving up on a command
+#define SLAB_WAIT_TIMEOUT_MS 30000
+
+//what rank 0 has every rank do next
+enum SlabCommand {
+	SLAB_COMMAND_NONE,
+	SLAB_COMMAND_STEP,
+	SLAB_COMMAND_GATHER,
+	SLAB_COMMAND_RESET,
+	SLAB_COMMAND_STOP
+};
+
+// Start of the shared memory every rank maps. Rank 0 lays it out before
+// any worker starts, after that only the command and sync fields change.
+// Offsets are from the start of the block since each process maps it at
+// its own address.
+struct SlabSharedHeader {
+	int resX;
+	int resY;
+	int resZ;
+	int rankCount;
+	unsigned int threadsPerRank;
+	//first plane of each rank's slab, slabBegin[rankCount] is resZ
+	int slabBegin[SLAB_MAX_RANKS + 1];
+	//ghost planes each slab keeps per side, at most the thinnest slab
+	int haloPlanes;
+	//planes a jacobi exchange sends, sweeps between exchanges
+	int jacobiHaloDepth;
+	//multigrid levels split over the ranks, coarser ones run on rank 0 alone
+	int distributedLevels;
+
+	size_t ringSlotFloats;
+	//5 doubles per plane of per plane partial sums
+	size_t reductionOffset;
+	//a whole grid of floats, for gathering channels and multigrid residuals
+	size_t gatherOffset;
+	//pressure of the first level rank 0 runs alone
+	size_t coarseOffset;
+	//two rings per pair of neighbours, towards the higher rank first
+	size_t ringOffset;
+	size_t ringSize;
+
+	//what the next step runs with, written before each step command
+	FluidSimSettings settings;
+	FluidChannel gatherChannel;
+
+	std::atomic<uint32_t> commandSerial;
+	std::atomic<int> command;
+	std::atomic<uint32_t> barrierArrived;
+	std::atomic<uint32_t> barrierGeneration;
+	std::atomic<int> readyCount;
+	//set by the first rank to give up waiting on the others, so the rest stop waiting too
+	std::atomic<int> failed;
+	//advection traces that reached past the halo and got pulled back, over every step
+	std::atomic<uint32_t> clampedTraces;
+	//each rank's largest |velocity z|, for sizing the advection halo
+	float rankMaxSpeed[SLAB_MAX_RANKS];
+};
+
+// One rank of a grid split into z slabs across processes, the stages of
+// FluidSolverCPU run on its own planes plus ghost planes copied in from
+// the neighbouring slabs. Each stage exchanges only the channels and depth
+// it reads across a slab edge, and every sum goes through per plane
+// partials added in plane order, so the ranks together produce exactly
+// what one FluidSolverCPU would.
+//
+// Pressure uses Jacobi with deep halos, k planes per exchange then k
+// sweeps that redo the shrinking ghost region, or multigrid with a one
+// plane exchange before every smoothing half sweep, residual and
+// prolongation. Multigrid levels are split while every slab keeps a whole
+// plane, the coarser ones are gathered onto rank 0 and solved there.
+//
+// Covers dense grids without obstacles. MacCormack runs as
+// semi-Lagrangian, conjugate gradient and spectral as multigrid, and an
+// F-cycle as V-cycles.
+class SlabSolver
+{
+public:
+	// Attaches to the block a SlabCluster laid out, as one of its ranks
+	SlabSolver(unsigned char* shared, int rank);
+
+	/// <summary>
+	/// A worker process' main loop, runs whatever rank 0 posts until
+	/// it says stop. False if it left because a command failed.
+	/// </summary>
+	bool RunWorker();
+
+	/// <summary>
+	/// Runs one command as this rank, every rank has to run each one.
+	/// False if a wait on the other ranks gave up partway, after
+	/// SLAB_WAIT_TIMEOUT_MS or once another rank had, and every command
+	/// after that fails straight away.
+	/// </summary>
+	bool RunCommand(SlabCommand command);
+
+	// Rank 0 asks this while it waits, false once a worker has exited
+	void SetWorkerCheck(std::function<bool()> workersRunning) { this->workersRunning = workersRunning; }
+
+	int GetZBegin() { return zBegin; }
+	int GetZEnd() { return zEnd; }
+
+	// Wall time each stage of the last step took on this rank, including waiting on the others
+	float GetStageMs(FluidStage stage) { return stageMs[stage]; }
+	int GetPressureIterations() { return pressureIterations; }
+	float GetPressureResidual() { return pressureResidual; }
+
+	// Settings the slabs can't run swapped for the nearest ones they can
+	static FluidSimSettings GetSupportedSettings(const FluidSimSettings& settings);
+
+private:
+	// Planes of a grid a rank holds, for level 0 of the pressure solve and
+	// every multigrid level
+	struct SlabLevel {
+		int resX;
+		int resY;
+		int resZ;
+		//planes this rank updates
+		int zBegin;
+		int zEnd;
+		//plane the arrays start at and how many they hold, ghosts included
+		int firstPlane;
+		int planeCount;
+		//false when rank 0 has the whole level to itself
+		bool distributed;
+
+		float* pressure;
+		std::vector<float> pressureStorage;
+		std::vector<float> rhs;
+		std::vector<float> residual;
+		//open faces of every plane held, see GetOpenFaces
+		std::vector<unsigned char> faces;
+
+		int Index(int x, int y, int z) const { return ((z - firstPlane) * resY + y) * resX + x; }
+	};
+
+	int Index(int x, int y, int z) { return ((z - firstPlane) * resY + y) * resX + x; }
+
+	void Step();
+	void Reset();
+	// Copies this rank's planes of a channel into the shared gather buffer
+	void Gather(FluidChannel channel);
+
+	// Blocks until every rank has called it, or a wait gives up
+	void Barrier();
+
+	// When a wait on the other ranks starting now should give up, see RunCommand
+	std::function<bool()> StartWait();
+
+	/// <summary>
+	/// Sends this rank's depth edge planes of each array to its neighbours
+	/// and fills its ghost planes with theirs, for arrays laid out like level.
+	/// </summary>
+	void ExchangeHalos(float* const* arrays, int arrayCount, const SlabLevel& level, int depth);
+
+	/// <summary>
+	/// Adds up count sums per plane over the whole level, partials holding
+	/// this rank's planes. Planes go in order whatever the split, the order
+	/// a single process adds its slices in, so every rank gets the same bits.
+	/// </summary>
+	void SumPlanes(const std::vector<double>& partials, const SlabLevel& level, int count, double* totals);
+
+	// Calls func(z) for every plane of [begin, end), split over the pool
+	template<typename Func>
+	void ForEachPlane(int begin, int end, Func func);
+
+	void Advect();
+	void InjectSmoke();
+	void ApplyBuoyancy();
+	void ApplyVorticityConfinement();
+	void ComputeDivergence();
+	void SolvePressure();
+	void SolveJacobi();
+	void ProjectPressure();
+	void StoreAtPrecision(std::initializer_list<FluidChannel> channels);
+
+	// Same as FluidSolverCPU's, summed over every rank
+	float MeasurePressureResidual();
+
+	//multigrid over the slabs, the same steps as MultigridSolver
+	void BuildLevels();
+	int SolveMultigrid();
+	void VCycle(int level);
+	void Smooth(SlabLevel& level, int iterations);
+	double ComputeResidual(SlabLevel& level, bool sum);
+	void Restrict(const SlabLevel& fine, const float* fineValues, SlabLevel& coarse, float* coarseValues);
+	void ProlongAndAdd(const SlabLevel& coarse, const float* coarsePressure, SlabLevel& fine);
+	double Sum(const float* values, const SlabLevel& level, bool squares);
+	// A level's layout with the whole grid and no ghosts, as rank 0 holds the coarse ones
+	SlabLevel GetWholeLevel(int level);
+
+	SlabSharedHeader* header;
+	unsigned char* shared;
+	int rank;
+	int rankCount;
+	int resX;
+	int resY;
+	int resZ;
+	int sliceSize;
+	int zBegin;
+	int zEnd;
+	int halo;
+	int firstPlane;
+	int planeCount;
+	FluidSimSettings settings;
+
+	//this rank's planes of each channel with halo ghost planes either side
+	std::vector<float> fields[CHANNEL_COUNT];
+	std::vector<float> scratch[CHANNEL_COUNT];
+
+	//rings to and from the rank below and above, unused at the ends
+	HaloRing toLower;
+	HaloRing fromLower;
+	HaloRing toUpper;
+	HaloRing fromUpper;
+
+	//levels this rank holds, rank 0 also has the ones it runs alone
+	std::vector<SlabLevel> levels;
+	//levels in the whole hierarchy, the same count MultigridSolver builds
+	int levelCount = 0;
+	//ghost planes of pressure either side that match the neighbours' current values
+	int pressureHaloValid = 0;
+
+	//rank 0 only, see SetWorkerCheck
+	std::function<bool()> workersRunning;
+	//a wait gave up, what the ranks hold no longer adds up
+	bool failed = false;
+
+	std::unique_ptr<ThreadPool> pool;
+	int pressureIterations = 0;
+	float pressureResidual = -1.0f;
+	float stageMs[FLUID_STAGE_COUNT] = {};
+};
+
+template<typename Func>
+void SlabSolver::ForEachPlane(int begin, int end, Func func)
+{
+	pool->ParallelFor(begin, end, [&](int zFirst, int zLast) {
+		for (int z = zFirst; z < zLast; z++) {
+			func(z);
+		}
+	});
+}
@@ -0,0 +1,100 @@
+#include "SpectralPoissonSolver.h"
+#include "FluidSimHelpers.h"
+
+#include <algorithm>
+#include <cmath>
+
+SpectralPoissonSolver::SpectralPoissonSolver(int resX, int resY, int resZ, ThreadPool* pool)
+	: transform(resX, resY, resZ, pool)
+{
+	this->resX = resX;
+	this->resY = resY;
+	this->resZ = resZ;
+	this->pool = pool;
+	cellCount = resX * resY * resZ;
+
+	const double pi = 3.14159265358979323846;
+	auto buildEigenvalues = [pi](std::vector<float>& eigen, int length) {
+		eigen.resize(length);
+		for (int k = 0; k < length; k++) {
+			eigen[k] = (float)(2.0 * std::cos(pi * k / length) - 2.0);
+		}
+	};
+	buildEigenvalues(eigenX, resX);
+	buildEigenvalues(eigenY, resY);
+	buildEigenvalues(eigenZ, resZ);
+}
+
+void SpectralPoissonSolver::Solve(float* pressure, const float* divergence)
+{
+	std::copy(divergence, divergence + cellCount, pressure);
+	transform.Forward(pressure);
+
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			for (int y = 0; y < resY; y++) {
+				float eigenYZ = eigenY[y] + eigenZ[z];
+				float* row = pressure + GridIndex(0, y, z, resX, resY);
+				for (int x = 0; x < resX; x++) {
+					//the constant mode has no solution, dropping it removes the mean
+					float eigen = eigenX[x] + eigenYZ;
+					row[x] = eigen < 0.0f ? row[x] / eigen : 0.0f;
+				}
+			}
+		}
+	});
+
+	transform.Inverse(pressure);
+
+	double residualSquared = 0.0;
+	double rhsSquared = 0.0;
+	MeasureResidual(pressure, divergence, residualSquared, rhsSquared);
+	lastResidual = rhsSquared > 0.0 ? (float)std::sqrt(residualSquared / rhsSquared) : 0.0f;
+}
+
+void SpectralPoissonSolver::MeasureResidual(const float* pressure, const float* divergence, double& residualSquared, double& rhsSquared)
+{
+	const int strideZ = resX * resY;
+
+	//per slice sums, added in order: r, r^2, rhs, rhs^2
+	std::vector<double> partials(resZ * 4, 0.0);
+	pool->ParallelFor(0, resZ, [&](int zBegin, int zEnd) {
+		for (int z = zBegin; z < zEnd; z++) {
+			double sums[4] = {};
+			for (int y = 0; y < resY; y++) {
+				for (int x = 0; x < resX; x++) {
+					int i = GridIndex(x, y, z, resX, resY);
+					float center = pressure[i];
+
+					float laplacian = 0.0f;
+					if (x > 0) laplacian += pressure[i - 1] - center;
+					if (x < resX - 1) laplacian += pressure[i + 1] - center;
+					if (y > 0) laplacian += pressure[i - resX] - center;
+					if (y < resY - 1) laplacian += pressure[i + resX] - center;
+					if (z > 0) laplacian += pressure[i - strideZ] - center;
+					if (z < resZ - 1) laplacian += pressure[i + strideZ] - center;
+
+					double r = (double)divergence[i] - laplacian;
+					sums[0] += r;
+					sums[1] += r * r;
+					sums[2] += divergence[i];
+					sums[3] += (double)divergence[i] * divergence[i];
+				}
+			}
+			for (int s = 0; s < 4; s++) {
+				partials[z * 4 + s] = sums[s];
+			}
+		}
+	});
+
+	double sums[4] = {};
+	for (int z = 0; z < resZ; z++) {
+		for (int s = 0; s < 4; s++) {
+			sums[s] += partials[z * 4 + s];
+		}
+	}
+
+	//only the mean free parts of both count, the mean is never solved for
+	residualSquared = std::max(sums[1] - sums[0] * sums[0] / cellCount, 0.0);
+	rhsSquared = std::max(sums[3] - sums[2] * sums[2] / cellCount, 0.0);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+#include "ThreadPool.h"
+#include "DctTransform3D.h"
+
+// Direct pressure solve for a closed box with no obstacles. The clamped
+// neighbour lookups make the pressure matrix a Neumann Laplacian, which
+// the DCT-II diagonalizes, so one forward transform, a divide by the
+// eigenvalues and an inverse transform solve it exactly in O(N log N).
+class SpectralPoissonSolver
+{
+public:
+	SpectralPoissonSolver(int resX, int resY, int resZ, ThreadPool* pool);
+
+	/// <summary>
+	/// Solves sum(neighbours) - 6 * pressure = divergence with neighbours
+	/// clamped at the walls. The divergence's mean can't be solved for and
+	/// is dropped, and the result averages to zero.
+	/// </summary>
+	void Solve(float* pressure, const float* divergence);
+
+	// Relative residual (|r| / |divergence|) after the last Solve,
+	// only float round off since the solve is exact
+	float GetLastResidual() { return lastResidual; }
+
+private:
+	// Sum of squares of rhs - A * pressure, and of the mean free rhs
+	void MeasureResidual(const float* pressure, const float* divergence, double& residualSquared, double& rhsSquared);
+
+	int resX;
+	int resY;
+	int resZ;
+	int cellCount;
+
+	//1D eigenvalues 2cos(pi k / N) - 2 along each axis
+	std::vector<float> eigenX;
+	std::vector<float> eigenY;
+	std::vector<float> eigenZ;
+
+	DctTransform3D transform;
+	ThreadPool* pool;
+	float lastResidual = 0.0f;
+};
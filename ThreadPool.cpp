@@ -0,0 +1,100 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	//the calling thread also runs chunks, so spawn one less
+	nextChunk = 0;
+	for (unsigned int i = 1; i < threadCount; i++) {
+		workers.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::ParallelFor(int begin, int end, const std::function<void(int, int)>& func)
+{
+	int count = end - begin;
+	if (count <= 0) {
+		return;
+	}
+
+	//nothing to share, just run it here
+	if (workers.empty() || count == 1) {
+		func(begin, end);
+		return;
+	}
+
+	//a few chunks per thread so uneven work still balances out
+	int chunkCount = (int)GetThreadCount() * 4;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &func;
+		jobBegin = begin;
+		jobEnd = end;
+		jobChunkSize = std::max(1, (count + chunkCount - 1) / chunkCount);
+		nextChunk = 0;
+		activeWorkers = (unsigned int)workers.size();
+		generation++;
+	}
+	wakeCondition.notify_all();
+
+	RunChunks();
+
+	//wait for the workers to finish their last chunks
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this] { return activeWorkers == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::WorkerLoop()
+{
+	unsigned long long seenGeneration = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+			if (stopping) {
+				return;
+			}
+			seenGeneration = generation;
+		}
+
+		RunChunks();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--activeWorkers == 0) {
+			doneCondition.notify_one();
+		}
+	}
+}
+
+void ThreadPool::RunChunks()
+{
+	int count = jobEnd - jobBegin;
+	while (true) {
+		int start = nextChunk.fetch_add(jobChunkSize);
+		if (start >= count) {
+			return;
+		}
+
+		int stop = std::min(start + jobChunkSize, count);
+		(*job)(jobBegin + start, jobBegin + stop);
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small pool of persistent worker threads used to split
+// grid work across cores. Only one thread should hand work
+// to a pool at a time and jobs must not call back into it.
+class ThreadPool
+{
+public:
+	// threadCount of 0 uses every hardware thread
+	ThreadPool(unsigned int threadCount = 0);
+	~ThreadPool();
+
+	// Total threads that run work, including the calling thread
+	unsigned int GetThreadCount() { return (unsigned int)workers.size() + 1; }
+
+	/// <summary>
+	/// Splits [begin, end) into chunks and calls func(chunkBegin, chunkEnd)
+	/// for each one across the pool. Blocks until every chunk is done.
+	/// </summary>
+	void ParallelFor(int begin, int end, const std::function<void(int, int)>& func);
+
+private:
+	void WorkerLoop();
+	void RunChunks();
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+	unsigned long long generation = 0;
+	unsigned int activeWorkers = 0;
+	bool stopping = false;
+
+	//current job, only valid while ParallelFor is running
+	const std::function<void(int, int)>* job = nullptr;
+	int jobBegin = 0;
+	int jobEnd = 0;
+	int jobChunkSize = 1;
+	std::atomic<int> nextChunk;
+};
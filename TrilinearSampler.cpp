@@ -0,0 +1,522 @@
+#include "TrilinearSampler.h"
+#include "FluidSimHelpers.h"
+
+#include <atomic>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TRILINEAR_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+//msvc lets intrinsics through without /arch, the cpuid check guards them
+#define AVX2_TARGET
+#define AVX512_TARGET
+#else
+#include <cpuid.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+//avx512f brings fma along, keep gcc from fusing the lerps so they round like the scalar ones
+#define AVX512_TARGET __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#endif
+#endif
+
+static std::atomic<int> samplerIsaOverride(SAMPLER_ISA_COUNT);
+
+// The same blend as SampleStencil, over a float4 texel's channels
+static void SampleStencil4(const float* texels, const TrilinearStencil& stencil, float* out)
+{
+	const int* c = stencil.corners;
+	for (int channel = 0; channel < 4; channel++) {
+		float f[8];
+		for (int corner = 0; corner < 8; corner++) {
+			f[corner] = texels[c[corner] * 4 + channel];
+		}
+		float c00 = f[0] + (f[1] - f[0]) * stencil.tx;
+		float c10 = f[2] + (f[3] - f[2]) * stencil.tx;
+		float c01 = f[4] + (f[5] - f[4]) * stencil.tx;
+		float c11 = f[6] + (f[7] - f[6]) * stencil.tx;
+
+		float c0 = c00 + (c10 - c00) * stencil.ty;
+		float c1 = c01 + (c11 - c01) * stencil.ty;
+		out[channel] = c0 + (c1 - c0) * stencil.tz;
+	}
+}
+
+static void SampleBatchScalar(const float* const* fields, float* const* out, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int begin, int end, int firstTexel)
+{
+	for (int i = begin; i < end; i++) {
+		TrilinearStencil stencil;
+		GetTrilinearStencil(resX, resY, resZ, x[i], y[i], z[i], stencil);
+		for (int corner = 0; corner < 8; corner++) {
+			stencil.corners[corner] -= firstTexel;
+		}
+		for (int c = 0; c < channelCount; c++) {
+			out[c][i] = SampleStencil(fields[c], stencil);
+		}
+	}
+}
+
+static void RangeBatchScalar(const float* const* fields, float* const* minOut, float* const* maxOut, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int begin, int end)
+{
+	for (int i = begin; i < end; i++) {
+		TrilinearStencil stencil;
+		GetTrilinearStencil(resX, resY, resZ, x[i], y[i], z[i], stencil);
+		for (int c = 0; c < channelCount; c++) {
+			GetStencilRange(fields[c], stencil, minOut[c][i], maxOut[c][i]);
+		}
+	}
+}
+
+static void SampleBatch4Scalar(const float* texels, float* out,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int begin, int end)
+{
+	for (int i = begin; i < end; i++) {
+		TrilinearStencil stencil;
+		GetTrilinearStencil(resX, resY, resZ, x[i], y[i], z[i], stencil);
+		SampleStencil4(texels, stencil, out + i * 4);
+	}
+}
+
+#ifdef TRILINEAR_X86
+static SamplerIsa DetectSamplerIsa()
+{
+	unsigned int ecx1 = 0;
+	unsigned int ebx7 = 0;
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	ecx1 = (unsigned int)info[2];
+	if (maxLeaf >= 7) {
+		__cpuidex(info, 7, 0);
+		ebx7 = (unsigned int)info[1];
+	}
+#else
+	unsigned int eax, ebx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx1, &edx)) {
+		return SAMPLER_ISA_SSE;
+	}
+	unsigned int ecx7;
+	if (__get_cpuid_max(0, nullptr) < 7 || !__get_cpuid_count(7, 0, &eax, &ebx7, &ecx7, &edx)) {
+		ebx7 = 0;
+	}
+#endif
+
+	//the wider registers are only usable if the os saves them on a switch
+	bool osxsave = (ecx1 & (1u << 27)) != 0;
+	if (!osxsave) {
+		return SAMPLER_ISA_SSE;
+	}
+#if defined(_MSC_VER)
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int xcr0Low, xcr0High;
+	__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)xcr0High << 32) | xcr0Low;
+#endif
+
+	bool avx2 = (ebx7 & (1u << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+	bool avx512 = (ebx7 & (1u << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+	if (avx512) {
+		return SAMPLER_ISA_AVX512;
+	}
+	return avx2 ? SAMPLER_ISA_AVX2 : SAMPLER_ISA_SSE;
+}
+
+// SSE has no gather, so four scalar stencils are loaded lane by lane and blended together
+static void SampleBatchSSE(const float* const* fields, float* const* out, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count, int firstTexel)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		TrilinearStencil s[4];
+		for (int lane = 0; lane < 4; lane++) {
+			GetTrilinearStencil(resX, resY, resZ, x[i + lane], y[i + lane], z[i + lane], s[lane]);
+			for (int corner = 0; corner < 8; corner++) {
+				s[lane].corners[corner] -= firstTexel;
+			}
+		}
+		__m128 tx = _mm_setr_ps(s[0].tx, s[1].tx, s[2].tx, s[3].tx);
+		__m128 ty = _mm_setr_ps(s[0].ty, s[1].ty, s[2].ty, s[3].ty);
+		__m128 tz = _mm_setr_ps(s[0].tz, s[1].tz, s[2].tz, s[3].tz);
+
+		for (int c = 0; c < channelCount; c++) {
+			const float* field = fields[c];
+			__m128 f[8];
+			for (int corner = 0; corner < 8; corner++) {
+				f[corner] = _mm_setr_ps(field[s[0].corners[corner]], field[s[1].corners[corner]],
+					field[s[2].corners[corner]], field[s[3].corners[corner]]);
+			}
+			__m128 c00 = _mm_add_ps(f[0], _mm_mul_ps(_mm_sub_ps(f[1], f[0]), tx));
+			__m128 c10 = _mm_add_ps(f[2], _mm_mul_ps(_mm_sub_ps(f[3], f[2]), tx));
+			__m128 c01 = _mm_add_ps(f[4], _mm_mul_ps(_mm_sub_ps(f[5], f[4]), tx));
+			__m128 c11 = _mm_add_ps(f[6], _mm_mul_ps(_mm_sub_ps(f[7], f[6]), tx));
+			__m128 c0 = _mm_add_ps(c00, _mm_mul_ps(_mm_sub_ps(c10, c00), ty));
+			__m128 c1 = _mm_add_ps(c01, _mm_mul_ps(_mm_sub_ps(c11, c01), ty));
+			_mm_storeu_ps(out[c] + i, _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), tz)));
+		}
+	}
+	SampleBatchScalar(fields, out, channelCount, resX, resY, resZ, x, y, z, i, count, firstTexel);
+}
+
+static void RangeBatchSSE(const float* const* fields, float* const* minOut, float* const* maxOut, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		TrilinearStencil s[4];
+		for (int lane = 0; lane < 4; lane++) {
+			GetTrilinearStencil(resX, resY, resZ, x[i + lane], y[i + lane], z[i + lane], s[lane]);
+		}
+
+		for (int c = 0; c < channelCount; c++) {
+			const float* field = fields[c];
+			__m128 minValue = _mm_setr_ps(field[s[0].corners[0]], field[s[1].corners[0]], field[s[2].corners[0]], field[s[3].corners[0]]);
+			__m128 maxValue = minValue;
+			for (int corner = 1; corner < 8; corner++) {
+				__m128 value = _mm_setr_ps(field[s[0].corners[corner]], field[s[1].corners[corner]],
+					field[s[2].corners[corner]], field[s[3].corners[corner]]);
+				//operands in this order keep std::min and std::max's choice between equal values
+				minValue = _mm_min_ps(value, minValue);
+				maxValue = _mm_max_ps(value, maxValue);
+			}
+			_mm_storeu_ps(minOut[c] + i, minValue);
+			_mm_storeu_ps(maxOut[c] + i, maxValue);
+		}
+	}
+	RangeBatchScalar(fields, minOut, maxOut, channelCount, resX, resY, resZ, x, y, z, i, count);
+}
+
+static void SampleBatch4SSE(const float* texels, float* out,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count)
+{
+	for (int i = 0; i < count; i++) {
+		TrilinearStencil s;
+		GetTrilinearStencil(resX, resY, resZ, x[i], y[i], z[i], s);
+		__m128 tx = _mm_set1_ps(s.tx);
+		__m128 ty = _mm_set1_ps(s.ty);
+		__m128 tz = _mm_set1_ps(s.tz);
+
+		__m128 f[8];
+		for (int corner = 0; corner < 8; corner++) {
+			f[corner] = _mm_loadu_ps(texels + s.corners[corner] * 4);
+		}
+		__m128 c00 = _mm_add_ps(f[0], _mm_mul_ps(_mm_sub_ps(f[1], f[0]), tx));
+		__m128 c10 = _mm_add_ps(f[2], _mm_mul_ps(_mm_sub_ps(f[3], f[2]), tx));
+		__m128 c01 = _mm_add_ps(f[4], _mm_mul_ps(_mm_sub_ps(f[5], f[4]), tx));
+		__m128 c11 = _mm_add_ps(f[6], _mm_mul_ps(_mm_sub_ps(f[7], f[6]), tx));
+		__m128 c0 = _mm_add_ps(c00, _mm_mul_ps(_mm_sub_ps(c10, c00), ty));
+		__m128 c1 = _mm_add_ps(c01, _mm_mul_ps(_mm_sub_ps(c11, c01), ty));
+		_mm_storeu_ps(out + i * 4, _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), tz)));
+	}
+}
+
+// Corner indices and weights of 8 positions, the vector form of GetTrilinearStencil.
+// Nans and positions too big for an int convert to INT_MIN the same as the scalar
+// cast does on x86, so they clamp to the same texel.
+AVX2_TARGET static void GetStencilAVX2(const float* x, const float* y, const float* z, const __m256i last[3], const __m256i strides[2],
+	__m256i first, __m256i corners[8], __m256 weights[3])
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	const float* positions[3] = { x, y, z };
+	__m256i low[3];
+	__m256i high[3];
+	for (int axis = 0; axis < 3; axis++) {
+		__m256 p = _mm256_loadu_ps(positions[axis]);
+		__m256 f = _mm256_floor_ps(p);
+		weights[axis] = _mm256_sub_ps(p, f);
+		__m256i cell = _mm256_cvttps_epi32(f);
+		low[axis] = _mm256_min_epi32(_mm256_max_epi32(cell, zero), last[axis]);
+		high[axis] = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(cell, one), zero), last[axis]);
+	}
+	for (int axis = 1; axis < 3; axis++) {
+		low[axis] = _mm256_mullo_epi32(low[axis], strides[axis - 1]);
+		high[axis] = _mm256_mullo_epi32(high[axis], strides[axis - 1]);
+	}
+	for (int corner = 0; corner < 8; corner++) {
+		corners[corner] = _mm256_sub_epi32(_mm256_add_epi32(_mm256_add_epi32(corner & 1 ? high[0] : low[0], corner & 2 ? high[1] : low[1]), corner & 4 ? high[2] : low[2]), first);
+	}
+}
+
+AVX2_TARGET static void SampleBatchAVX2(const float* const* fields, float* const* out, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count, int firstTexel)
+{
+	const __m256i last[3] = { _mm256_set1_epi32(resX - 1), _mm256_set1_epi32(resY - 1), _mm256_set1_epi32(resZ - 1) };
+	const __m256i strides[2] = { _mm256_set1_epi32(resX), _mm256_set1_epi32(resX * resY) };
+
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i corners[8];
+		__m256 t[3];
+		GetStencilAVX2(x + i, y + i, z + i, last, strides, _mm256_set1_epi32(firstTexel), corners, t);
+
+		for (int c = 0; c < channelCount; c++) {
+			const float* field = fields[c];
+			__m256 f[8];
+			for (int corner = 0; corner < 8; corner++) {
+				f[corner] = _mm256_i32gather_ps(field, corners[corner], 4);
+			}
+			__m256 c00 = _mm256_add_ps(f[0], _mm256_mul_ps(_mm256_sub_ps(f[1], f[0]), t[0]));
+			__m256 c10 = _mm256_add_ps(f[2], _mm256_mul_ps(_mm256_sub_ps(f[3], f[2]), t[0]));
+			__m256 c01 = _mm256_add_ps(f[4], _mm256_mul_ps(_mm256_sub_ps(f[5], f[4]), t[0]));
+			__m256 c11 = _mm256_add_ps(f[6], _mm256_mul_ps(_mm256_sub_ps(f[7], f[6]), t[0]));
+			__m256 c0 = _mm256_add_ps(c00, _mm256_mul_ps(_mm256_sub_ps(c10, c00), t[1]));
+			__m256 c1 = _mm256_add_ps(c01, _mm256_mul_ps(_mm256_sub_ps(c11, c01), t[1]));
+			_mm256_storeu_ps(out[c] + i, _mm256_add_ps(c0, _mm256_mul_ps(_mm256_sub_ps(c1, c0), t[2])));
+		}
+	}
+	SampleBatchScalar(fields, out, channelCount, resX, resY, resZ, x, y, z, i, count, firstTexel);
+}
+
+AVX2_TARGET static void RangeBatchAVX2(const float* const* fields, float* const* minOut, float* const* maxOut, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count)
+{
+	const __m256i last[3] = { _mm256_set1_epi32(resX - 1), _mm256_set1_epi32(resY - 1), _mm256_set1_epi32(resZ - 1) };
+	const __m256i strides[2] = { _mm256_set1_epi32(resX), _mm256_set1_epi32(resX * resY) };
+
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i corners[8];
+		__m256 t[3];
+		GetStencilAVX2(x + i, y + i, z + i, last, strides, _mm256_setzero_si256(), corners, t);
+
+		for (int c = 0; c < channelCount; c++) {
+			const float* field = fields[c];
+			__m256 minValue = _mm256_i32gather_ps(field, corners[0], 4);
+			__m256 maxValue = minValue;
+			for (int corner = 1; corner < 8; corner++) {
+				__m256 value = _mm256_i32gather_ps(field, corners[corner], 4);
+				minValue = _mm256_min_ps(value, minValue);
+				maxValue = _mm256_max_ps(value, maxValue);
+			}
+			_mm256_storeu_ps(minOut[c] + i, minValue);
+			_mm256_storeu_ps(maxOut[c] + i, maxValue);
+		}
+	}
+	RangeBatchScalar(fields, minOut, maxOut, channelCount, resX, resY, resZ, x, y, z, i, count);
+}
+
+// Two positions per register, each half blending one texel's 4 channels
+AVX2_TARGET static void SampleBatch4AVX2(const float* texels, float* out,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count)
+{
+	int i = 0;
+	for (; i + 2 <= count; i += 2) {
+		TrilinearStencil s[2];
+		GetTrilinearStencil(resX, resY, resZ, x[i], y[i], z[i], s[0]);
+		GetTrilinearStencil(resX, resY, resZ, x[i + 1], y[i + 1], z[i + 1], s[1]);
+		__m256 tx = _mm256_setr_ps(s[0].tx, s[0].tx, s[0].tx, s[0].tx, s[1].tx, s[1].tx, s[1].tx, s[1].tx);
+		__m256 ty = _mm256_setr_ps(s[0].ty, s[0].ty, s[0].ty, s[0].ty, s[1].ty, s[1].ty, s[1].ty, s[1].ty);
+		__m256 tz = _mm256_setr_ps(s[0].tz, s[0].tz, s[0].tz, s[0].tz, s[1].tz, s[1].tz, s[1].tz, s[1].tz);
+
+		__m256 f[8];
+		for (int corner = 0; corner < 8; corner++) {
+			f[corner] = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(texels + s[0].corners[corner] * 4)),
+				_mm_loadu_ps(texels + s[1].corners[corner] * 4), 1);
+		}
+		__m256 c00 = _mm256_add_ps(f[0], _mm256_mul_ps(_mm256_sub_ps(f[1], f[0]), tx));
+		__m256 c10 = _mm256_add_ps(f[2], _mm256_mul_ps(_mm256_sub_ps(f[3], f[2]), tx));
+		__m256 c01 = _mm256_add_ps(f[4], _mm256_mul_ps(_mm256_sub_ps(f[5], f[4]), tx));
+		__m256 c11 = _mm256_add_ps(f[6], _mm256_mul_ps(_mm256_sub_ps(f[7], f[6]), tx));
+		__m256 c0 = _mm256_add_ps(c00, _mm256_mul_ps(_mm256_sub_ps(c10, c00), ty));
+		__m256 c1 = _mm256_add_ps(c01, _mm256_mul_ps(_mm256_sub_ps(c11, c01), ty));
+		_mm256_storeu_ps(out + i * 4, _mm256_add_ps(c0, _mm256_mul_ps(_mm256_sub_ps(c1, c0), tz)));
+	}
+	SampleBatch4Scalar(texels, out, resX, resY, resZ, x, y, z, i, count);
+}
+
+AVX512_TARGET static void GetStencilAVX512(const float* x, const float* y, const float* z, const __m512i last[3], const __m512i strides[2],
+	__m512i first, __m512i corners[8], __m512 weights[3])
+{
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i one = _mm512_set1_epi32(1);
+	const float* positions[3] = { x, y, z };
+	__m512i low[3];
+	__m512i high[3];
+	for (int axis = 0; axis < 3; axis++) {
+		__m512 p = _mm512_loadu_ps(positions[axis]);
+		__m512 f = _mm512_roundscale_ps(p, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+		weights[axis] = _mm512_sub_ps(p, f);
+		__m512i cell = _mm512_cvttps_epi32(f);
+		low[axis] = _mm512_min_epi32(_mm512_max_epi32(cell, zero), last[axis]);
+		high[axis] = _mm512_min_epi32(_mm512_max_epi32(_mm512_add_epi32(cell, one), zero), last[axis]);
+	}
+	for (int axis = 1; axis < 3; axis++) {
+		low[axis] = _mm512_mullo_epi32(low[axis], strides[axis - 1]);
+		high[axis] = _mm512_mullo_epi32(high[axis], strides[axis - 1]);
+	}
+	for (int corner = 0; corner < 8; corner++) {
+		corners[corner] = _mm512_sub_epi32(_mm512_add_epi32(_mm512_add_epi32(corner & 1 ? high[0] : low[0], corner & 2 ? high[1] : low[1]), corner & 4 ? high[2] : low[2]), first);
+	}
+}
+
+AVX512_TARGET static void SampleBatchAVX512(const float* const* fields, float* const* out, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count, int firstTexel)
+{
+	const __m512i last[3] = { _mm512_set1_epi32(resX - 1), _mm512_set1_epi32(resY - 1), _mm512_set1_epi32(resZ - 1) };
+	const __m512i strides[2] = { _mm512_set1_epi32(resX), _mm512_set1_epi32(resX * resY) };
+
+	int i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m512i corners[8];
+		__m512 t[3];
+		GetStencilAVX512(x + i, y + i, z + i, last, strides, _mm512_set1_epi32(firstTexel), corners, t);
+
+		for (int c = 0; c < channelCount; c++) {
+			const float* field = fields[c];
+			__m512 f[8];
+			for (int corner = 0; corner < 8; corner++) {
+				f[corner] = _mm512_i32gather_ps(corners[corner], field, 4);
+			}
+			__m512 c00 = _mm512_add_ps(f[0], _mm512_mul_ps(_mm512_sub_ps(f[1], f[0]), t[0]));
+			__m512 c10 = _mm512_add_ps(f[2], _mm512_mul_ps(_mm512_sub_ps(f[3], f[2]), t[0]));
+			__m512 c01 = _mm512_add_ps(f[4], _mm512_mul_ps(_mm512_sub_ps(f[5], f[4]), t[0]));
+			__m512 c11 = _mm512_add_ps(f[6], _mm512_mul_ps(_mm512_sub_ps(f[7], f[6]), t[0]));
+			__m512 c0 = _mm512_add_ps(c00, _mm512_mul_ps(_mm512_sub_ps(c10, c00), t[1]));
+			__m512 c1 = _mm512_add_ps(c01, _mm512_mul_ps(_mm512_sub_ps(c11, c01), t[1]));
+			_mm512_storeu_ps(out[c] + i, _mm512_add_ps(c0, _mm512_mul_ps(_mm512_sub_ps(c1, c0), t[2])));
+		}
+	}
+	SampleBatchScalar(fields, out, channelCount, resX, resY, resZ, x, y, z, i, count, firstTexel);
+}
+
+AVX512_TARGET static void RangeBatchAVX512(const float* const* fields, float* const* minOut, float* const* maxOut, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count)
+{
+	const __m512i last[3] = { _mm512_set1_epi32(resX - 1), _mm512_set1_epi32(resY - 1), _mm512_set1_epi32(resZ - 1) };
+	const __m512i strides[2] = { _mm512_set1_epi32(resX), _mm512_set1_epi32(resX * resY) };
+
+	int i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m512i corners[8];
+		__m512 t[3];
+		GetStencilAVX512(x + i, y + i, z + i, last, strides, _mm512_setzero_si512(), corners, t);
+
+		for (int c = 0; c < channelCount; c++) {
+			const float* field = fields[c];
+			__m512 minValue = _mm512_i32gather_ps(corners[0], field, 4);
+			__m512 maxValue = minValue;
+			for (int corner = 1; corner < 8; corner++) {
+				__m512 value = _mm512_i32gather_ps(corners[corner], field, 4);
+				minValue = _mm512_min_ps(value, minValue);
+				maxValue = _mm512_max_ps(value, maxValue);
+			}
+			_mm512_storeu_ps(minOut[c] + i, minValue);
+			_mm512_storeu_ps(maxOut[c] + i, maxValue);
+		}
+	}
+	RangeBatchScalar(fields, minOut, maxOut, channelCount, resX, resY, resZ, x, y, z, i, count);
+}
+
+// Four positions per register, a quarter each
+AVX512_TARGET static void SampleBatch4AVX512(const float* texels, float* out,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		TrilinearStencil s[4];
+		for (int lane = 0; lane < 4; lane++) {
+			GetTrilinearStencil(resX, resY, resZ, x[i + lane], y[i + lane], z[i + lane], s[lane]);
+		}
+		__m512 t[3];
+		for (int axis = 0; axis < 3; axis++) {
+			float w[4];
+			for (int lane = 0; lane < 4; lane++) {
+				w[lane] = axis == 0 ? s[lane].tx : axis == 1 ? s[lane].ty : s[lane].tz;
+			}
+			t[axis] = _mm512_setr_ps(w[0], w[0], w[0], w[0], w[1], w[1], w[1], w[1], w[2], w[2], w[2], w[2], w[3], w[3], w[3], w[3]);
+		}
+
+		__m512 f[8];
+		for (int corner = 0; corner < 8; corner++) {
+			__m512 v = _mm512_castps128_ps512(_mm_loadu_ps(texels + s[0].corners[corner] * 4));
+			v = _mm512_insertf32x4(v, _mm_loadu_ps(texels + s[1].corners[corner] * 4), 1);
+			v = _mm512_insertf32x4(v, _mm_loadu_ps(texels + s[2].corners[corner] * 4), 2);
+			f[corner] = _mm512_insertf32x4(v, _mm_loadu_ps(texels + s[3].corners[corner] * 4), 3);
+		}
+		__m512 c00 = _mm512_add_ps(f[0], _mm512_mul_ps(_mm512_sub_ps(f[1], f[0]), t[0]));
+		__m512 c10 = _mm512_add_ps(f[2], _mm512_mul_ps(_mm512_sub_ps(f[3], f[2]), t[0]));
+		__m512 c01 = _mm512_add_ps(f[4], _mm512_mul_ps(_mm512_sub_ps(f[5], f[4]), t[0]));
+		__m512 c11 = _mm512_add_ps(f[6], _mm512_mul_ps(_mm512_sub_ps(f[7], f[6]), t[0]));
+		__m512 c0 = _mm512_add_ps(c00, _mm512_mul_ps(_mm512_sub_ps(c10, c00), t[1]));
+		__m512 c1 = _mm512_add_ps(c01, _mm512_mul_ps(_mm512_sub_ps(c11, c01), t[1]));
+		_mm512_storeu_ps(out + i * 4, _mm512_add_ps(c0, _mm512_mul_ps(_mm512_sub_ps(c1, c0), t[2])));
+	}
+	SampleBatch4Scalar(texels, out, resX, resY, resZ, x, y, z, i, count);
+}
+#endif
+
+SamplerIsa GetSupportedSamplerIsa()
+{
+#ifdef TRILINEAR_X86
+	static const SamplerIsa supported = DetectSamplerIsa();
+	return supported;
+#else
+	return SAMPLER_ISA_SCALAR;
+#endif
+}
+
+SamplerIsa GetSamplerIsa()
+{
+	SamplerIsa supported = GetSupportedSamplerIsa();
+	int forced = samplerIsaOverride.load(std::memory_order_relaxed);
+	return forced < supported ? (SamplerIsa)forced : supported;
+}
+
+void SetSamplerIsa(SamplerIsa isa)
+{
+	samplerIsaOverride.store(isa, std::memory_order_relaxed);
+}
+
+const char* GetSamplerIsaName(SamplerIsa isa)
+{
+	switch (isa) {
+	case SAMPLER_ISA_SSE: return "SSE";
+	case SAMPLER_ISA_AVX2: return "AVX2";
+	case SAMPLER_ISA_AVX512: return "AVX-512";
+	default: return "Scalar";
+	}
+}
+
+void SampleTrilinearBatch(const float* const* fields, float* const* out, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count, int firstPlane)
+{
+	int firstTexel = firstPlane * resX * resY;
+	switch (GetSamplerIsa()) {
+#ifdef TRILINEAR_X86
+	case SAMPLER_ISA_AVX512: SampleBatchAVX512(fields, out, channelCount, resX, resY, resZ, x, y, z, count, firstTexel); return;
+	case SAMPLER_ISA_AVX2: SampleBatchAVX2(fields, out, channelCount, resX, resY, resZ, x, y, z, count, firstTexel); return;
+	case SAMPLER_ISA_SSE: SampleBatchSSE(fields, out, channelCount, resX, resY, resZ, x, y, z, count, firstTexel); return;
+#endif
+	default: SampleBatchScalar(fields, out, channelCount, resX, resY, resZ, x, y, z, 0, count, firstTexel); return;
+	}
+}
+
+void GetTrilinearRangeBatch(const float* const* fields, float* const* minOut, float* const* maxOut, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count)
+{
+	switch (GetSamplerIsa()) {
+#ifdef TRILINEAR_X86
+	case SAMPLER_ISA_AVX512: RangeBatchAVX512(fields, minOut, maxOut, channelCount, resX, resY, resZ, x, y, z, count); return;
+	case SAMPLER_ISA_AVX2: RangeBatchAVX2(fields, minOut, maxOut, channelCount, resX, resY, resZ, x, y, z, count); return;
+	case SAMPLER_ISA_SSE: RangeBatchSSE(fields, minOut, maxOut, channelCount, resX, resY, resZ, x, y, z, count); return;
+#endif
+	default: RangeBatchScalar(fields, minOut, maxOut, channelCount, resX, resY, resZ, x, y, z, 0, count); return;
+	}
+}
+
+void SampleTrilinearBatch4(const float* texels, float* out,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count)
+{
+	switch (GetSamplerIsa()) {
+#ifdef TRILINEAR_X86
+	case SAMPLER_ISA_AVX512: SampleBatch4AVX512(texels, out, resX, resY, resZ, x, y, z, count); return;
+	case SAMPLER_ISA_AVX2: SampleBatch4AVX2(texels, out, resX, resY, resZ, x, y, z, count); return;
+	case SAMPLER_ISA_SSE: SampleBatch4SSE(texels, out, resX, resY, resZ, x, y, z, count); return;
+#endif
+	default: SampleBatch4Scalar(texels, out, resX, resY, resZ, x, y, z, 0, count); return;
+	}
+}
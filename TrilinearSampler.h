@@ -0,0 +1,53 @@
+#pragma once
+
+// Trilinear sampling of many positions at once for the cpu solver, the
+// batched form of SampleStencil in FluidSimHelpers.h. Positions are in
+// texel space with clamp addressing, matching LinearClampSampler. The
+// widest instruction set the cpu has is picked at runtime: AVX-512 and
+// AVX2 work out 16 or 8 positions at a time with gathers, SSE 4 with
+// plain loads. Every path does the same float operations in the same
+// order as the scalar helpers, so results don't depend on the cpu.
+
+enum SamplerIsa {
+	SAMPLER_ISA_SCALAR,
+	SAMPLER_ISA_SSE,
+	SAMPLER_ISA_AVX2,
+	SAMPLER_ISA_AVX512,
+	SAMPLER_ISA_COUNT
+};
+
+// The widest instruction set this cpu and os support
+SamplerIsa GetSupportedSamplerIsa();
+
+// What the batch functions use, the supported one unless overridden
+SamplerIsa GetSamplerIsa();
+// Forces a narrower path, for benchmarks. Wider than supported is clamped.
+void SetSamplerIsa(SamplerIsa isa);
+
+const char* GetSamplerIsaName(SamplerIsa isa);
+
+/// <summary>
+/// Samples channelCount scalar fields (x fastest, resX * resY * resZ
+/// each) at count positions, out[c][i] is fields[c] at (x[i], y[i], z[i]).
+/// The corners and weights are shared by every channel. Fields that only
+/// hold the planes from firstPlane up, a slab of the grid, are sampled with
+/// positions and clamping of the whole grid; the caller keeps every position
+/// inside the planes it has.
+/// </summary>
+void SampleTrilinearBatch(const float* const* fields, float* const* out, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count, int firstPlane = 0);
+
+/// <summary>
+/// Smallest and largest of the 8 texels each position would blend, per
+/// channel, the batched GetStencilRange for the MacCormack limiter.
+/// </summary>
+void GetTrilinearRangeBatch(const float* const* fields, float* const* minOut, float* const* maxOut, int channelCount,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count);
+
+/// <summary>
+/// Samples a float4 field (4 floats per texel, x fastest) at count
+/// positions into 4 floats each. Each position's texels are single loads,
+/// so the wider paths blend 2 or 4 positions per register.
+/// </summary>
+void SampleTrilinearBatch4(const float* texels, float* out,
+	int resX, int resY, int resZ, const float* x, const float* y, const float* z, int count);
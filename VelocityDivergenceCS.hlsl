@@ -1,9 +1,12 @@
-#include "FluidSimHelpers.hlsli"
+#include "BrickHelpers.hlsli"
+#include "ObstacleHelpers.hlsli"
 
 cbuffer ExternalData : register(b0) {
 	float deltaTime;
-	float invFluidSimGridRes; //(1/windowWidth, 1/windowHeigh)
-	int gridRes;
+	float3 invFluidSimGridRes; //(1/windowWidth, 1/windowHeigh)
+	int3 gridRes;
+	int sparseBricks;
+	int3 bricksPerAxis;
 };
 
 RWTexture3D<float4> UavOutputMap : register (u0);
@@ -13,17 +16,20 @@ Texture3D<float4> VelocityMap : register (t0);
 //SamplerState PointSampler : register(s0); 
 
 [numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
-void main( uint3 DTid : SV_DispatchThreadID )
+void main(uint3 dispatchID : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
+	uint3 DTid = GetSimCellIndex(dispatchID, groupID, groupThreadID, sparseBricks, bricksPerAxis);
+
 	float3 coords = (float3(DTid)+0.5f) * invFluidSimGridRes;
 
 					//VelocityMap.SampleLevel(PointSampler, coords, 0.0f);
-	float3 velLeft = VelocityMap[GetLeftIndex(DTid)];
-	float3 velRight = VelocityMap[GetRightIndex(DTid, gridRes)];
-	float3 velBottom = VelocityMap[GetBottomIndex(DTid)];
-	float3 velTop = VelocityMap[GetTopIndex(DTid, gridRes)];
-	float3 velBack = VelocityMap[GetBackIndex(DTid)];
-	float3 velFront = VelocityMap[GetFrontIndex(DTid, gridRes)];
+	//solid neighbours count with their obstacle's velocity
+	float3 velLeft = GetCellVelocity(VelocityMap, GetLeftIndex(DTid), gridRes);
+	float3 velRight = GetCellVelocity(VelocityMap, GetRightIndex(DTid, gridRes), gridRes);
+	float3 velBottom = GetCellVelocity(VelocityMap, GetBottomIndex(DTid), gridRes);
+	float3 velTop = GetCellVelocity(VelocityMap, GetTopIndex(DTid, gridRes), gridRes);
+	float3 velBack = GetCellVelocity(VelocityMap, GetBackIndex(DTid), gridRes);
+	float3 velFront = GetCellVelocity(VelocityMap, GetFrontIndex(DTid, gridRes), gridRes);
 
 	//float3 velLeft = VelocityMap.SampleLevel(PointSampler, GetLeftIndex(coords), 0.0f).xyz;
 	//float3 velRight = VelocityMap.SampleLevel(PointSampler, GetRightIndex(coords, gridRes), 0.0f).xyz;
@@ -37,5 +43,9 @@ void main( uint3 DTid : SV_DispatchThreadID )
 		(velTop.y - velBottom.y) +
 		(velFront.z - velBack.z));
 
+	if (IsSolid(DTid, gridRes)) {
+		velocityDivergence = 0;
+	}
+
 	UavOutputMap[DTid] = float4(velocityDivergence.r, 0, 0, 0);
 }
\ No newline at end of file
@@ -0,0 +1,28 @@
+//nearest scene depth in each block of the reduced resolution volume pass, see BilateralUpsample.h
+
+cbuffer ExternalData : register(b0) {
+	int scale;
+	int2 depthSize;
+};
+
+struct VertexToPixel
+{
+	float4 position : SV_POSITION;
+	float2 uv : TEXCOORD0;
+};
+
+Texture2D<float> SceneDepth : register(t0);
+
+float main(VertexToPixel input) : SV_TARGET
+{
+	int2 blockMin = int2(input.position.xy) * scale;
+	int2 blockMax = min(blockMin + scale, depthSize);
+
+	float nearest = 1.0f;
+	for (int y = blockMin.y; y < blockMax.y; y++) {
+		for (int x = blockMin.x; x < blockMax.x; x++) {
+			nearest = min(nearest, SceneDepth.Load(int3(x, y, 0)));
+		}
+	}
+	return nearest;
+}
\ No newline at end of file
@@ -1,7 +1,8 @@
 #include "FluidSimHelpers.hlsli"
+#include "OccupancyHelpers.hlsli"
 #define NUM_SAMPLES 256
 
-//needs to match fluid field render types
+//needs to match VolumeRenderMode in VolumeRaymarcherCPU.h
 #define RENDER_MODE_DEBUG -1
 #define RENDER_MODE_BLEND 0
 #define RENDER_MODE_ADD 1
@@ -11,6 +12,16 @@ cbuffer externalData : register(b0) {
 	float3 cameraPosition;
 	int renderMode;
 	int raymarchSamples;
+	float interpolation; //0 shows the previous step, 1 the latest
+	int referenceSamples; //density is tuned for steps this many to the diagonal
+	int jitterSamples; //0 starts every ray right on the volume
+	matrix invViewProjection;
+	float2 targetSize;
+	int limitToSceneDepth; //rays stop at SceneDepth when there's no depth buffer to test against
+	int3 gridRes;
+	int occupancyLevels; //0 marches every step
+	int3 bricksPerAxis;
+	float emptySpaceThreshold;
 }
 
 struct VertexToPixel {
@@ -20,6 +31,10 @@ struct VertexToPixel {
 };
 
 Texture3D VolumeTexture : register(t0);
+Texture3D PreviousVolumeTexture : register(t1);
+Texture3D<float2> OccupancyTexture : register(t2);
+Texture2D<float> BlueNoiseTexture : register(t3);
+Texture2D<float> SceneDepth : register(t4);
 SamplerState SamplerLinearClamp : register(s0);
 
 bool RayAABBIntersection(float3 pos, float3 dir, float3 boxMin, float3 boxMax, out float t0, out float t1) {
@@ -33,7 +48,7 @@ bool RayAABBIntersection(float3 pos, float3 dir, float3 boxMin, float3 boxMax, o
 
 	//get max of tmin's xyz
 	float2 t = max(tmin.xx, tmin.yz);
-	t0 = min(t.x, t.y);
+	t0 = max(t.x, t.y);
 
 	t = min(tmax.xx, tmax.yz);
 	t1 = min(t.x, t.y);
@@ -52,7 +67,7 @@ float4 main(VertexToPixel input) : SV_TARGET
 	float3 dir = normalize(input.worldPos - pos);
 
 	float3 posLocal = mul(invWorld, float4(pos, 1)).xyz;
-	float3 dirLocal = normalize(mul(invWorld, float4(dir, 1)).xyz);
+	float3 dirLocal = normalize(mul(invWorld, float4(dir, 0)).xyz);
 
 	float nearHit;
 	float farHit;
@@ -62,6 +77,18 @@ float4 main(VertexToPixel input) : SV_TARGET
 		nearHit = 0.0f;
 	}
 
+	//end the ray at the scene surface in this pixel, if there is one
+	[branch]
+	if (limitToSceneDepth != 0) {
+		float depth = SceneDepth.Load(int3(input.screenPosition.xy, 0));
+		if (depth < 1.0f) {
+			float2 ndc = input.screenPosition.xy / targetSize * float2(2, -2) + float2(-1, 1);
+			float4 scenePos = mul(invViewProjection, float4(ndc, depth, 1));
+			float3 sceneLocal = mul(invWorld, float4(scenePos.xyz / scenePos.w, 1)).xyz;
+			farHit = min(farHit, dot(sceneLocal - posLocal, dirLocal));
+		}
+	}
+
 	//beginning and end ray positions
 	float3 rayStart = posLocal + dirLocal * nearHit;
 	float3 rayEnd = posLocal + dirLocal * farHit;
@@ -69,15 +96,48 @@ float4 main(VertexToPixel input) : SV_TARGET
 	float maxDist = farHit - nearHit;
 	float3 currentPos = rayStart;
 	float step = 1.73205f / raymarchSamples; //longest diagonal in cube
-	float3 stepDir = step * dir;
+	float3 stepDir = step * dirLocal;
+
+	//start each ray a blue noise fraction of a step in, so the banding from fewer samples turns into fine grain
+	float jitter = 0.0f;
+	if (jitterSamples != 0) {
+		uint2 noiseSize;
+		BlueNoiseTexture.GetDimensions(noiseSize.x, noiseSize.y);
+		jitter = BlueNoiseTexture[uint2(input.screenPosition.xy) % noiseSize];
+	}
+	currentPos += stepDir * jitter;
+
+	//longer steps each have to block as much light as the shorter ones they stand in for
+	float stepScale = (float)referenceSamples / raymarchSamples;
 
 	float4 finalColor = float4(0, 0, 0, 0);
-	float totalDist = 0.0f;
+	float totalDist = step * jitter;
 
 	[loop]
 	for (int i = 0; i < raymarchSamples && totalDist < maxDist; i++) {
-		float uvw = currentPos + float3(0.5f, 0.5f, 0.5f);
+		float3 uvw = currentPos + float3(0.5f, 0.5f, 0.5f);
+
+		//hop over empty cells a whole number of steps at a time so samples land where they would have
+		[branch]
+		if (occupancyLevels > 0) {
+			float emptyDist = GetEmptySpaceDistance(OccupancyTexture, uvw, dirLocal, gridRes, bricksPerAxis, occupancyLevels, emptySpaceThreshold);
+			if (emptyDist > 0.0f) {
+				int skipped = max((int)ceil(emptyDist / step), 1);
+				i += skipped - 1;
+				currentPos += stepDir * skipped;
+				totalDist += step * skipped;
+				continue;
+			}
+		}
+
 		float4 color = VolumeTexture.SampleLevel(SamplerLinearClamp, uvw, 0);
+		[branch]
+		if (interpolation < 1.0f) {
+			color = lerp(PreviousVolumeTexture.SampleLevel(SamplerLinearClamp, uvw, 0), color, interpolation);
+		}
+		if (stepScale != 1.0f) {
+			color.a = 1.0f - pow(saturate(1.0f - color.a), stepScale);
+		}
 
 		if (renderMode == RENDER_MODE_DEBUG) {
 			finalColor += color * step;
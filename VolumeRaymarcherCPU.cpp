@@ -0,0 +1,284 @@
+#include "VolumeRaymarcherCPU.h"
+#include "FluidSimHelpers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <xmmintrin.h>
+
+//pixels along each side of a tile, the unit of work handed to the pool
+#define TILE_SIZE 16
+
+// A point (w = 1) or direction (w = 0) times a row major matrix, divided through by w for points
+static void TransformRow(const float m[16], const float in[3], float w, float out[3])
+{
+	float result[4];
+	for (int c = 0; c < 4; c++) {
+		result[c] = in[0] * m[c] + in[1] * m[4 + c] + in[2] * m[8 + c] + w * m[12 + c];
+	}
+	float invW = w != 0.0f && result[3] != 0.0f ? 1.0f / result[3] : 1.0f;
+	for (int c = 0; c < 3; c++) {
+		out[c] = result[c] * invW;
+	}
+}
+
+static void Normalize(float v[3])
+{
+	float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	if (length > 0.0f) {
+		v[0] /= length;
+		v[1] /= length;
+		v[2] /= length;
+	}
+}
+
+// Slab test against the cube, same as VolumePS's RayAABBIntersection
+static bool RayAABBIntersection(const float pos[3], const float dir[3], float& t0, float& t1)
+{
+	t0 = -INFINITY;
+	t1 = INFINITY;
+	for (int axis = 0; axis < 3; axis++) {
+		float invDir = 1.0f / dir[axis];
+		float testMin = (-0.5f - pos[axis]) * invDir;
+		float testMax = (0.5f - pos[axis]) * invDir;
+		t0 = std::max(t0, std::min(testMin, testMax));
+		t1 = std::min(t1, std::max(testMin, testMax));
+	}
+	return t0 <= t1;
+}
+
+// Trilinear sample of float4 texels at a texel space position, the
+// corners are blended as whole rgba vectors instead of per channel
+static __m128 SampleTexels(const float* texels, const int res[3], float x, float y, float z)
+{
+	TrilinearStencil stencil;
+	GetTrilinearStencil(res[0], res[1], res[2], x, y, z, stencil);
+	const int* c = stencil.corners;
+
+	__m128 tx = _mm_set1_ps(stencil.tx);
+	__m128 ty = _mm_set1_ps(stencil.ty);
+	__m128 tz = _mm_set1_ps(stencil.tz);
+	auto lerp = [](__m128 a, __m128 b, __m128 t) { return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t)); };
+
+	__m128 c00 = lerp(_mm_loadu_ps(texels + c[0] * 4), _mm_loadu_ps(texels + c[1] * 4), tx);
+	__m128 c10 = lerp(_mm_loadu_ps(texels + c[2] * 4), _mm_loadu_ps(texels + c[3] * 4), tx);
+	__m128 c01 = lerp(_mm_loadu_ps(texels + c[4] * 4), _mm_loadu_ps(texels + c[5] * 4), tx);
+	__m128 c11 = lerp(_mm_loadu_ps(texels + c[6] * 4), _mm_loadu_ps(texels + c[7] * 4), tx);
+	return lerp(lerp(c00, c10, ty), lerp(c01, c11, ty), tz);
+}
+
+VolumeRaymarcherCPU::VolumeRaymarcherCPU(unsigned int threadCount)
+{
+	pool = std::make_unique<ThreadPool>(threadCount);
+}
+
+void VolumeRaymarcherCPU::SetVolume(const float* texels, const float* previousTexels, int resX, int resY, int resZ)
+{
+	this->texels = texels;
+	this->previousTexels = previousTexels;
+	res[0] = resX;
+	res[1] = resY;
+	res[2] = resZ;
+
+	occupancyValid = emptySpaceSkipping && texels;
+	if (occupancyValid) {
+		occupancy.Build(texels, previousTexels, resX, resY, resZ, pool.get());
+	}
+}
+
+void VolumeRaymarcherCPU::SetSampling(int referenceSamples, const float* jitter, int jitterSize)
+{
+	this->referenceSamples = referenceSamples;
+	this->jitter = jitter;
+	this->jitterSize = jitterSize;
+}
+
+void VolumeRaymarcherCPU::Render(const VolumeRenderView& view, VolumeRenderMode mode, int raymarchSamples, float interpolation)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	width = view.width;
+	height = view.height;
+	image.assign((size_t)width * height * 4, 0.0f);
+
+	int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	int tileCount = tilesX * tilesY;
+
+	//counted per tile and added up in order, so the totals don't depend on the split
+	std::vector<long long> tileRays(tileCount, 0);
+	std::vector<long long> tileSamples(tileCount, 0);
+	if (texels) {
+		pool->ParallelFor(0, tileCount, [&](int tileBegin, int tileEnd) {
+			for (int tile = tileBegin; tile < tileEnd; tile++) {
+				int x0 = (tile % tilesX) * TILE_SIZE;
+				int y0 = (tile / tilesX) * TILE_SIZE;
+				int x1 = std::min(x0 + TILE_SIZE, width);
+				int y1 = std::min(y0 + TILE_SIZE, height);
+
+				for (int y = y0; y < y1; y++) {
+					for (int x = x0; x < x1; x++) {
+						int samples = 0;
+						if (MarchRay(view, x, y, mode, raymarchSamples, interpolation, &image[((size_t)y * width + x) * 4], samples)) {
+							tileRays[tile]++;
+							tileSamples[tile] += samples;
+						}
+					}
+				}
+			}
+		});
+	}
+
+	lastRayCount = 0;
+	lastSampleCount = 0;
+	for (int tile = 0; tile < tileCount; tile++) {
+		lastRayCount += tileRays[tile];
+		lastSampleCount += tileSamples[tile];
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	lastRenderMs = std::chrono::duration<float, std::milli>(end - start).count();
+}
+
+bool VolumeRaymarcherCPU::MarchRay(const VolumeRenderView& view, int x, int y, VolumeRenderMode mode, int raymarchSamples, float interpolation, float color[4], int& samples)
+{
+	//the pixel center on the far plane, the gpu only shades pixels the cube's back faces cover
+	float ndc[3] = {
+		(x + 0.5f) / width * 2.0f - 1.0f,
+		1.0f - (y + 0.5f) / height * 2.0f,
+		1.0f
+	};
+	float farPoint[3];
+	TransformRow(view.invViewProjection, ndc, 1.0f, farPoint);
+
+	float dir[3] = {
+		farPoint[0] - view.cameraPosition[0],
+		farPoint[1] - view.cameraPosition[1],
+		farPoint[2] - view.cameraPosition[2]
+	};
+	Normalize(dir);
+
+	float posLocal[3];
+	float dirLocal[3];
+	TransformRow(view.invWorld, view.cameraPosition, 1.0f, posLocal);
+	TransformRow(view.invWorld, dir, 0.0f, dirLocal);
+	Normalize(dirLocal);
+
+	float nearHit;
+	float farHit;
+	if (!RayAABBIntersection(posLocal, dirLocal, nearHit, farHit) || farHit < 0.0f) {
+		return false;
+	}
+	nearHit = std::max(nearHit, 0.0f);
+
+	//end the ray at the scene surface in this pixel, if there is one
+	float depth = sceneDepth ? sceneDepth[(size_t)y * width + x] : 1.0f;
+	if (depth < 1.0f) {
+		float scenePoint[3] = { ndc[0], ndc[1], depth };
+		float sceneWorld[3];
+		float sceneLocal[3];
+		TransformRow(view.invViewProjection, scenePoint, 1.0f, sceneWorld);
+		TransformRow(view.invWorld, sceneWorld, 1.0f, sceneLocal);
+		float sceneHit = 0.0f;
+		for (int axis = 0; axis < 3; axis++) {
+			sceneHit += (sceneLocal[axis] - posLocal[axis]) * dirLocal[axis];
+		}
+		farHit = std::min(farHit, sceneHit);
+	}
+
+	float maxDist = farHit - nearHit;
+	float step = 1.73205f / raymarchSamples; //longest diagonal in cube
+
+	//blue noise start offset and the opacity correction for longer steps, as in VolumePS
+	float offset = jitter ? jitter[(y % jitterSize) * jitterSize + x % jitterSize] : 0.0f;
+	float stepScale = referenceSamples > 0 ? (float)referenceSamples / raymarchSamples : 1.0f;
+
+	//texel space, uvw = local + 0.5 and texel centers sit on whole numbers
+	float texelPos[3];
+	float texelStep[3];
+	for (int axis = 0; axis < 3; axis++) {
+		texelStep[axis] = dirLocal[axis] * step * res[axis];
+		texelPos[axis] = (posLocal[axis] + dirLocal[axis] * nearHit + 0.5f) * res[axis] - 0.5f + texelStep[axis] * offset;
+	}
+
+	__m128 blend = _mm_set1_ps(interpolation);
+	bool interpolate = previousTexels && interpolation < 1.0f;
+
+	__m128 finalColor = _mm_setzero_ps();
+	float totalDist = step * offset;
+	for (int i = 0; i < raymarchSamples && totalDist < maxDist; i++) {
+		//hop over empty cells a whole number of steps at a time so samples land where they would have
+		if (occupancyValid) {
+			float uvw[3];
+			for (int axis = 0; axis < 3; axis++) {
+				uvw[axis] = (texelPos[axis] + 0.5f) / res[axis];
+			}
+			float emptyDist = occupancy.GetEmptyDistance(uvw, dirLocal, emptySpaceThreshold);
+			if (emptyDist > 0.0f) {
+				int skipped = std::max((int)std::ceil(emptyDist / step), 1);
+				i += skipped - 1;
+				for (int axis = 0; axis < 3; axis++) {
+					texelPos[axis] += texelStep[axis] * skipped;
+				}
+				totalDist += step * skipped;
+				continue;
+			}
+		}
+
+		__m128 sample = SampleTexels(texels, res, texelPos[0], texelPos[1], texelPos[2]);
+		if (interpolate) {
+			__m128 previous = SampleTexels(previousTexels, res, texelPos[0], texelPos[1], texelPos[2]);
+			sample = _mm_add_ps(previous, _mm_mul_ps(_mm_sub_ps(sample, previous), blend));
+		}
+		samples++;
+
+		//color times density with density itself in alpha, what every mode but debug adds up
+		float density = _mm_cvtss_f32(_mm_shuffle_ps(sample, sample, _MM_SHUFFLE(3, 3, 3, 3)));
+		if (stepScale != 1.0f) {
+			density = 1.0f - std::pow(std::min(std::max(1.0f - density, 0.0f), 1.0f), stepScale);
+			alignas(16) float channels[4];
+			_mm_store_ps(channels, sample);
+			channels[3] = density;
+			sample = _mm_load_ps(channels);
+		}
+		__m128 weighted = _mm_mul_ps(sample, _mm_set_ps(1.0f, density, density, density));
+
+		if (mode == RENDER_MODE_DEBUG) {
+			finalColor = _mm_add_ps(finalColor, _mm_mul_ps(sample, _mm_set1_ps(step)));
+		}
+		else if (mode == RENDER_MODE_ADD) {
+			finalColor = _mm_add_ps(finalColor, weighted);
+		}
+		else {
+			float alpha = _mm_cvtss_f32(_mm_shuffle_ps(finalColor, finalColor, _MM_SHUFFLE(3, 3, 3, 3)));
+			finalColor = _mm_add_ps(finalColor, _mm_mul_ps(weighted, _mm_set1_ps(1.0f - alpha)));
+			if (_mm_cvtss_f32(_mm_shuffle_ps(finalColor, finalColor, _MM_SHUFFLE(3, 3, 3, 3))) > 0.99f) {
+				break;
+			}
+		}
+
+		for (int axis = 0; axis < 3; axis++) {
+			texelPos[axis] += texelStep[axis];
+		}
+		totalDist += step;
+	}
+
+	_mm_storeu_ps(color, finalColor);
+	if (mode == RENDER_MODE_DEBUG) {
+		color[3] = 1.0f;
+	}
+	return true;
+}
+
+void VolumeRaymarcherCPU::CompositeRGBA8(const float background[3], unsigned char* out)
+{
+	for (size_t pixel = 0; pixel < (size_t)width * height; pixel++) {
+		const float* color = &image[pixel * 4];
+		float alpha = std::min(std::max(color[3], 0.0f), 1.0f);
+		for (int c = 0; c < 3; c++) {
+			float value = color[c] * alpha + background[c] * (1.0f - alpha);
+			out[pixel * 4 + c] = (unsigned char)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+		}
+		out[pixel * 4 + 3] = 255;
+	}
+}
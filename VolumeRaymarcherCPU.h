@@ -0,0 +1,116 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "OccupancyPyramid.h"
+#include "ThreadPool.h"
+
+//how samples along a ray are composited, needs to match the RENDER_MODE defines in VolumePS
+enum VolumeRenderMode {
+	RENDER_MODE_DEBUG = -1,
+	RENDER_MODE_BLEND,
+	RENDER_MODE_ADD
+};
+
+// Where a volume render looks from. Matrices are row major with row
+// vectors, the same as DirectXMath's XMFLOAT4X4, and invWorld takes world
+// space into the -0.5 to 0.5 cube the volume fills.
+struct VolumeRenderView {
+	float invViewProjection[16];
+	float invWorld[16];
+	float cameraPosition[3];
+	int width;
+	int height;
+};
+
+// Renders a density volume on the cpu the same way VolumePS does, for
+// thumbnails and headless images. Each pixel's ray is clipped to the
+// volume's cube and marched front to back, blend mode stops once the ray
+// is nearly opaque. The image is split into tiles spread over a thread
+// pool and each sample blends all four channels at once with SSE. Empty
+// space is leapt over with an OccupancyPyramid, the same as the shader.
+class VolumeRaymarcherCPU
+{
+public:
+	VolumeRaymarcherCPU(unsigned int threadCount = 0);
+
+	/// <summary>
+	/// The float4 texels (color rgb, density a, x fastest) to march through,
+	/// owned by the caller and read during Render. previousTexels is what
+	/// interpolation blends from, null if there's nothing to blend.
+	/// </summary>
+	void SetVolume(const float* texels, const float* previousTexels, int resX, int resY, int resZ);
+
+	/// <summary>
+	/// How samples are spaced, like VolumePS's. Density is treated as tuned for
+	/// referenceSamples steps, so fewer steps in Render block as much light in
+	/// total. jitter is size * size values in [0, 1) tiled over the image, each
+	/// ray starts that fraction of a step in, null starts right on the volume.
+	/// </summary>
+	void SetSampling(int referenceSamples, const float* jitter, int jitterSize);
+
+	/// <summary>
+	/// Post projection depth of the scene for every pixel of the next Render
+	/// (1 where there's nothing), rays stop at it like VolumePS's do in the
+	/// reduced resolution pass. Null marches the whole cube.
+	/// </summary>
+	void SetSceneDepth(const float* depth) { sceneDepth = depth; }
+
+	// Skip steps through bricks with no density over threshold, takes effect on the next SetVolume
+	void SetEmptySpaceSkipping(bool enabled, float threshold) { emptySpaceSkipping = enabled; emptySpaceThreshold = threshold; }
+
+	/// <summary>
+	/// Marches every pixel's ray with raymarchSamples steps across the cube's
+	/// diagonal. interpolation blends previousTexels towards texels like the
+	/// shader's, rays that miss the cube come out as zero.
+	/// </summary>
+	void Render(const VolumeRenderView& view, VolumeRenderMode mode, int raymarchSamples, float interpolation);
+
+	int GetWidth() { return width; }
+	int GetHeight() { return height; }
+
+	// rgba per pixel, straight from the compositing before any blending
+	const std::vector<float>& GetImage() { return image; }
+
+	/// <summary>
+	/// Blends the image over a background the way FluidField's blend state
+	/// does, color * alpha plus background * (1 - alpha), into rgba8 pixels.
+	/// </summary>
+	void CompositeRGBA8(const float background[3], unsigned char* out);
+
+	// Stats from the last Render, rays only count pixels that hit the cube
+	float GetLastRenderMs() { return lastRenderMs; }
+	long long GetLastRayCount() { return lastRayCount; }
+	long long GetLastSampleCount() { return lastSampleCount; }
+	double GetRaysPerSecond() { return lastRenderMs > 0.0f ? lastRayCount * 1000.0 / lastRenderMs : 0.0; }
+	double GetSamplesPerSecond() { return lastRenderMs > 0.0f ? lastSampleCount * 1000.0 / lastRenderMs : 0.0; }
+
+private:
+	// Marches one pixel's ray, returns false if it misses the cube
+	bool MarchRay(const VolumeRenderView& view, int x, int y, VolumeRenderMode mode, int raymarchSamples, float interpolation, float color[4], int& samples);
+
+	std::unique_ptr<ThreadPool> pool;
+
+	const float* texels = nullptr;
+	const float* previousTexels = nullptr;
+	int res[3] = { 0, 0, 0 };
+
+	const float* sceneDepth = nullptr;
+	int referenceSamples = 0;
+	const float* jitter = nullptr;
+	int jitterSize = 0;
+
+	bool emptySpaceSkipping = true;
+	float emptySpaceThreshold = 0.0001f;
+	bool occupancyValid = false;
+	OccupancyPyramid occupancy;
+
+	int width = 0;
+	int height = 0;
+	std::vector<float> image;
+
+	float lastRenderMs = 0.0f;
+	long long lastRayCount = 0;
+	long long lastSampleCount = 0;
+};
@@ -0,0 +1,21 @@
+#include "FluidSimHelpers.hlsli"
+#include "ReductionHelpers.hlsli"
+
+cbuffer ExternalData : register(b0) {
+	int3 gridRes;
+};
+
+RWStructuredBuffer<float4> GroupSums : register (u0);
+Texture3D<float4> InputMap : register (t0);
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, GROUP_SIZE)]
+void main(uint3 DTid : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+	//out of range loads come back as zero
+	float value = InputMap[DTid].x;
+
+	float4 sums = GroupSum(float4(value, 0, 0, 0), groupIndex);
+	if (groupIndex == 0) {
+		GroupSums[GroupSumIndex(groupID, gridRes)] = sums;
+	}
+}
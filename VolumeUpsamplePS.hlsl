@@ -0,0 +1,53 @@
+//joint bilateral upsample of the reduced resolution volume pass, see BilateralUpsample.h
+
+//needs to match BilateralUpsample.h
+#define UPSAMPLE_DEPTH_EPSILON 0.01f
+
+cbuffer ExternalData : register(b0) {
+	int scale;
+	int2 lowSize;
+	float depthA; //projection _33 and _43, view z = depthB / (depth - depthA)
+	float depthB;
+};
+
+struct VertexToPixel
+{
+	float4 position : SV_POSITION;
+	float2 uv : TEXCOORD0;
+};
+
+Texture2D LowResVolume : register(t0);
+Texture2D<float> LowResDepth : register(t1);
+Texture2D<float> SceneDepth : register(t2);
+
+float LinearDepth(float depth) {
+	return depthB / (depth - depthA);
+}
+
+float4 main(VertexToPixel input) : SV_TARGET
+{
+	//low resolution texel centers sit at scale * (i + 0.5)
+	float2 lowPos = input.position.xy / scale - 0.5f;
+	int2 base = (int2)floor(lowPos);
+	float2 t = lowPos - base;
+
+	float z = LinearDepth(SceneDepth.Load(int3(input.position.xy, 0)));
+	float4 color = float4(0, 0, 0, 0);
+	float totalWeight = 0.0f;
+
+	[unroll]
+	for (int tap = 0; tap < 4; tap++) {
+		int2 offset = int2(tap & 1, tap >> 1);
+		int3 low = int3(clamp(base + offset, 0, lowSize - 1), 0);
+
+		//bilinear, but texels at a different depth than this pixel barely count
+		float2 bilinear = offset ? t : 1.0f - t;
+		float difference = abs(LinearDepth(LowResDepth.Load(low)) - z) / z;
+		float weight = bilinear.x * bilinear.y / (UPSAMPLE_DEPTH_EPSILON + difference);
+
+		color += LowResVolume.Load(low) * weight;
+		totalWeight += weight;
+	}
+
+	return totalWeight > 0.0f ? color / totalWeight : float4(0, 0, 0, 0);
+}
\ No newline at end of file